@@ -6,11 +6,6 @@
 
 using namespace mhe;
 
-struct PerModelUniformData
-{
-    mat4x4 world;
-};
-
 struct PerCameraUniformData
 {
     mat4x4 vp;
@@ -30,9 +25,17 @@ struct LightUniformData
 
 using namespace mhe;
 
+// the cubes are placed on a grid_size x grid_size grid and drawn with one draw call
+const uint32_t grid_size = 100;
+const float grid_step = 0.15f;
+const float cube_scale = 0.1f;
+
+// every mesh is drawn once per instance
 struct Scene
 {
     std::vector<vk::Mesh> meshes;
+    vk::Buffer instances;
+    uint32_t instances_count;
 };
 
 class MeshRenderer
@@ -45,7 +48,7 @@ public:
         create_info.renderPass = context.render_passes.main_render_pass;
 
         VkPipelineVertexInputStateCreateInfo vi_create_info;
-        vk::GeometryLayout::vertex_input_info(vi_create_info);
+        vk::InstancedGeometryLayout::vertex_input_info(vi_create_info);
         // input assembly
         VkPipelineInputAssemblyStateCreateInfo ia_create_info = {};
         ia_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
@@ -144,15 +147,15 @@ public:
         VkShaderModuleCreateInfo shader_create_info = {};
         shader_create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
         std::vector<uint8_t> shader_data;
-        bool res = read_entire_file(shader_data, "../../shaders/00_cube.vert.spv", "rb");
-        ASSERT(res == true, "Can't read shader data from file cube_00.vert.spv");
+        bool res = read_entire_file(shader_data, "../../shaders/00_cube_instanced.vert.spv", "rb");
+        VERIFY(res == true, "Can't read shader data from file 00_cube_instanced.vert.spv", VK_ERROR_INITIALIZATION_FAILED);
         shader_create_info.pCode = reinterpret_cast<const uint32_t*>(&shader_data[0]);
         shader_create_info.codeSize = shader_data.size();
         VK_CHECK(vkCreateShaderModule(*context.main_device, &shader_create_info, context.allocation_callbacks, &vsm));
 
         VkShaderModule fsm;
         res = read_entire_file(shader_data, "../../shaders/00_cube.frag.spv", "rb");
-        ASSERT(res == true, "Can't read shader data from file cube_00.frag.spv");
+        VERIFY(res == true, "Can't read shader data from file 00_cube.frag.spv", VK_ERROR_INITIALIZATION_FAILED);
         shader_create_info.pCode = reinterpret_cast<const uint32_t*>(&shader_data[0]);
         shader_create_info.codeSize = shader_data.size();
         VK_CHECK(vkCreateShaderModule(*context.main_device, &shader_create_info, context.allocation_callbacks, &fsm));
@@ -216,11 +219,8 @@ public:
         command_buffer.bind_descriptor_set(VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout_, &light_descriptor_set_, 1, 3);
         for (const vk::Mesh& mesh : scene.meshes)
         {
-            VkDescriptorSet mesh_descriptor_sets[1] =
-            {
-                mesh.descriptor_set()
-            };
-            command_buffer.bind_descriptor_set(VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout_, mesh_descriptor_sets, array_size(mesh_descriptor_sets), 1);
+            // the world matrices come from the instance buffer
+            command_buffer.bind_mesh(mesh, &scene.instances);
             for (size_t i = 0, size = mesh.parts().size(); i < size; ++i)
             {
                 VkDescriptorSet part_descriptor_sets[1] =
@@ -228,7 +228,7 @@ public:
                     mesh.parts()[i].material->descriptor_set()
                 };
                 command_buffer.bind_descriptor_set(VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout_, part_descriptor_sets, array_size(part_descriptor_sets), 2);
-                command_buffer.draw(mesh, i);
+                command_buffer.draw_instanced(mesh, i, scene.instances_count);
             }
         }
     }
@@ -248,7 +248,7 @@ private:
 
         PerCameraUniformData per_camera_uniform_data;
         per_camera_uniform_data.vp = mat4x4::look_at(vec3(-2.0f, 4.0f, 10.0f), vec3(0.0f, 0.0f, 0.0f), vec3::up()) *
-            mat4x4::perspective(deg_to_rad(60.0f), 1.0f, 0.1f, 20.0f);
+            mat4x4::perspective(deg_to_rad(60.0f), 1.0f, 0.1f, 40.0f);
         VK_CHECK(per_camera_uniform_.init(context, gpu_iface, settings,
             reinterpret_cast<const uint8_t*>(&per_camera_uniform_data), sizeof(PerCameraUniformData)));
 
@@ -320,9 +320,9 @@ struct Renderers
     MeshRenderer mesh_renderer;
 };
 
-void create_renderers(Renderers& renderers, vk::VulkanContext& context)
+VkResult create_renderers(Renderers& renderers, vk::VulkanContext& context)
 {
-    renderers.mesh_renderer.init(context);
+    return renderers.mesh_renderer.init(context);
 }
 
 void destroy_renderers(Renderers& renderers, vk::VulkanContext& context)
@@ -330,6 +330,28 @@ void destroy_renderers(Renderers& renderers, vk::VulkanContext& context)
     renderers.mesh_renderer.destroy(context);
 }
 
+VkResult create_instances(Scene& scene, vk::VulkanContext& context)
+{
+    std::vector<vk::InstancedGeometryLayout::Instance> instances(grid_size * grid_size);
+    const float offset = -0.5f * grid_step * (grid_size - 1);
+    for (uint32_t z = 0; z < grid_size; ++z)
+    {
+        for (uint32_t x = 0; x < grid_size; ++x)
+        {
+            instances[z * grid_size + x].world = mat4x4::scaling(cube_scale) *
+                mat4x4::translation(vec3(offset + x * grid_step, 0.0f, offset + z * grid_step));
+        }
+    }
+
+    vk::Buffer::Settings settings;
+    settings.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    settings.memory_properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    VK_CHECK(scene.instances.init(context, context.default_gpu_interface, settings, reinterpret_cast<const uint8_t*>(&instances[0]),
+        static_cast<uint32_t>(instances.size() * vk::InstancedGeometryLayout::instance_stride())));
+    scene.instances_count = static_cast<uint32_t>(instances.size());
+    return VK_SUCCESS;
+}
+
 int main(int argc, char** argv)
 {
     vk::VulkanContext context;
@@ -337,12 +359,14 @@ int main(int argc, char** argv)
     VERIFY(res == VK_SUCCESS, "init_vulkan_context failed", -1);
 
     Renderers renderers;
-    create_renderers(renderers, context);
+    res = create_renderers(renderers, context);
+    VERIFY(res == VK_SUCCESS, "create_renderers failed", -1);
 
     Scene scene;
     vk::Mesh mesh;
     mesh.create_cube(context, context.default_gpu_interface);
     scene.meshes.push_back(mesh);
+    VK_CHECK(create_instances(scene, context));
 
     // load an image
     vk::ImageData image_data;
@@ -362,10 +386,10 @@ int main(int argc, char** argv)
     material.set_albedo(&texture);
     scene.meshes[0].set_material(0, &material);
 
-    vk::CommandBuffer command_buffer;
-    context.command_pools.main_graphics_command_pool.create_command_buffers(context, &command_buffer, 1);
+    vk::CommandBuffer layout_command_buffer;
+    context.command_pools.main_graphics_command_pool.create_command_buffers(context, &layout_command_buffer, 1);
 
-    command_buffer
+    layout_command_buffer
         .begin()
             .transfer_image_layout(context.main_swapchain.color_images()[0].image(),
                 VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT)
@@ -374,13 +398,20 @@ int main(int argc, char** argv)
             .transfer_image_layout(context.main_depth_stencil_image_view.image(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
                 VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT)
         .end();
-    context.main_device->graphics_queue().submit(&command_buffer, 1);
+    context.main_device->graphics_queue().submit(&layout_command_buffer, 1);
     context.main_device->graphics_queue().wait_idle();
 
+    context.command_pools.main_graphics_command_pool.destroy_command_buffers(context, &layout_command_buffer, 1);
+
+    vk::FrameContextRing frames;
+    VK_CHECK(frames.init(context, context.default_gpu_interface, vk::FrameContextRing::Settings()));
+
+    vk::Queue& graphics_queue = context.main_device->graphics_queue();
+    uint32_t frame_number = 0;
     while (app_message_loop(context))
     {
-        vk::Queue& graphics_queue = context.main_device->graphics_queue();
-        context.main_swapchain.acquire_next_image();
+        vk::FrameContext& frame = frames.begin_frame(context);
+        vk::CommandBuffer& command_buffer = frame.command_buffer(0);
 
         command_buffer
             .begin()
@@ -392,21 +423,24 @@ int main(int argc, char** argv)
             .end_render_pass_command()
             .end();
 
-        VkSemaphore submit_wait_semaphore = context.main_swapchain.next_image_semaphore();
-        VkSemaphore present_semaphore = graphics_queue.present_semaphore();
-        graphics_queue.submit(&command_buffer, 1, &submit_wait_semaphore, 1, &present_semaphore, 1);
-        graphics_queue.present(&context.main_swapchain);
-        graphics_queue.wait_idle();
+        vk::flush_uploads(context);
+        graphics_queue.submit(frame, &command_buffer, 1);
+        graphics_queue.present(&context.main_swapchain, frame);
+
+        if ((++frame_number & 255) == 0)
+            printf("frame time: %.3f ms\n", frames.frame_time());
     }
+    graphics_queue.wait_idle();
 
+    frames.destroy(context);
+
+    scene.instances.destroy(context);
     mesh.destroy(context);
     material.destroy(context);
     texture.destroy(context);
 
     destroy_renderers(renderers, context);
 
-    context.command_pools.main_graphics_command_pool.destroy_command_buffers(context, &command_buffer, 1);
-
     vk::destroy_vulkan_context(context);
     return 0;
 }
@@ -1,4 +1,5 @@
 #include "mhevk.hpp"
+#include "rendergraph.hpp"
 
 #include <limits>
 
@@ -271,10 +272,14 @@ private:
 
 struct GBuffer
 {
-    vk::ImageView layer0;
-    vk::ImageView layer1;
+    // transient images of the render graph
+    const vk::ImageView* layer0;
+    const vk::ImageView* layer1;
     vk::RenderPass render_pass;
     vk::Framebuffer framebuffer;
+    // the lighting into the swapchain images, the depth is sampled so it isn't an attachment
+    vk::RenderPass composition_render_pass;
+    std::vector<vk::Framebuffer> composition_framebuffers;
 };
 
 class GBufferRenderer
@@ -322,7 +327,7 @@ public:
         // pipeline
         VkGraphicsPipelineCreateInfo create_info = {};
         create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-        create_info.renderPass = context.render_passes.main_render_pass;
+        create_info.renderPass = gbuffer->composition_render_pass;
 
         VkPipelineVertexInputStateCreateInfo vi_create_info;
         vk::FullscreenLayout::vertex_input_info(vi_create_info);
@@ -400,14 +405,16 @@ public:
             VK_SAMPLER_MIPMAP_MODE_LINEAR, VK_SAMPLER_ADDRESS_MODE_REPEAT, VK_SAMPLER_ADDRESS_MODE_REPEAT, VK_SAMPLER_ADDRESS_MODE_REPEAT);
         VK_CHECK(vkCreateSampler(*context.main_device, &sampler_create_info, context.allocation_callbacks, &sampler_));
 
+        // the layouts the render graph transitions the images to for the composition
         VkDescriptorImageInfo image_info[3];
-        image_info[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-        image_info[0].imageView = gbuffer->layer0.image_view_id();
+        image_info[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        image_info[0].imageView = gbuffer->layer0->image_view_id();
         image_info[0].sampler = sampler_;
         image_info[1] = image_info[0];
         image_info[2] = image_info[0];
-        image_info[1].imageView = gbuffer->layer1.image_view_id();
+        image_info[1].imageView = gbuffer->layer1->image_view_id();
         image_info[2].imageView = context.main_depth_stencil_image_view.image_view_id();
+        image_info[2].imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
 
         write_descriptor_set.pImageInfo = image_info;
         write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
@@ -519,7 +526,7 @@ void destroy_renderers(Renderers& renderers, vk::VulkanContext& context)
     renderers.mesh_renderer.destroy(context);
 }
 
-VkResult create_gbuffer(GBuffer& gbuffer, vk::VulkanContext& context)
+vk::ImageView::Settings gbuffer_layer_settings(vk::VulkanContext& context)
 {
     vk::ImageView::Settings settings;
     settings.width = context.width;
@@ -527,48 +534,66 @@ VkResult create_gbuffer(GBuffer& gbuffer, vk::VulkanContext& context)
     settings.format = VK_FORMAT_R16G16B16A16_SFLOAT;
     settings.aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT;
     settings.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-    VK_CHECK(gbuffer.layer0.init(context, context.default_gpu_interface, settings, VK_NULL_HANDLE, nullptr, 0));
-    VK_CHECK(gbuffer.layer1.init(context, context.default_gpu_interface, settings, VK_NULL_HANDLE, nullptr, 0));
+    return settings;
+}
 
-    // create a render pass
+// the layers are allocated by the render graph
+VkResult create_gbuffer(GBuffer& gbuffer, vk::VulkanContext& context)
+{
+    // create a render pass, the render graph transitions the layers between the passes
     vk::RenderPass::Settings::AttachmentDesc attachment_desc[3];
     attachment_desc[0].format = VK_FORMAT_R16G16B16A16_SFLOAT;
     attachment_desc[0].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    attachment_desc[0].final_layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
     attachment_desc[1].format = VK_FORMAT_R16G16B16A16_SFLOAT;
     attachment_desc[1].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    attachment_desc[1].final_layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
     attachment_desc[2].format = context.main_depth_stencil_image_view.format();
     attachment_desc[2].layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
-    vk::RenderPass::Settings::DependencyDesc dependencies[1];
-    dependencies[0].render_pass = &context.render_passes.main_render_pass;
-    dependencies[0].src_access = VK_ACCESS_MEMORY_READ_BIT;
-    dependencies[0].dst_access = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
     vk::RenderPass::Settings render_pass_settings;
     render_pass_settings.count = 3;
     render_pass_settings.descs = attachment_desc;
-    render_pass_settings.dependencies = dependencies;
-    render_pass_settings.dependencies_count = array_size(dependencies);
     VK_CHECK(gbuffer.render_pass.init(context, context.default_gpu_interface, render_pass_settings));
 
+    // the composition ends in the presentable layout
+    vk::RenderPass::Settings::AttachmentDesc composition_attachment_desc[1];
+    composition_attachment_desc[0].format = VK_FORMAT_B8G8R8A8_UNORM;
+    composition_attachment_desc[0].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    render_pass_settings.count = 1;
+    render_pass_settings.descs = composition_attachment_desc;
+    VK_CHECK(gbuffer.composition_render_pass.init(context, context.default_gpu_interface, render_pass_settings));
+
     // create a framebuffer
     vk::Framebuffer::Settings framebuffer_settings;
-    const vk::ImageView* image_views[] = { &gbuffer.layer0, &gbuffer.layer1, &context.main_depth_stencil_image_view };
+    const vk::ImageView* image_views[] = { gbuffer.layer0, gbuffer.layer1, &context.main_depth_stencil_image_view };
     framebuffer_settings.attachments = image_views;
     framebuffer_settings.count = 3;
     framebuffer_settings.render_pass = &gbuffer.render_pass;
     framebuffer_settings.width = context.width;
     framebuffer_settings.height = context.height;
     VK_CHECK(gbuffer.framebuffer.init(context, context.default_gpu_interface, framebuffer_settings));
+
+    const std::vector<vk::ImageView>& swapchain_images = context.main_swapchain.color_images();
+    gbuffer.composition_framebuffers.resize(swapchain_images.size());
+    for (size_t i = 0, size = swapchain_images.size(); i < size; ++i)
+    {
+        const vk::ImageView* composition_image_views[] = { &swapchain_images[i] };
+        framebuffer_settings.attachments = composition_image_views;
+        framebuffer_settings.count = 1;
+        framebuffer_settings.render_pass = &gbuffer.composition_render_pass;
+        VK_CHECK(gbuffer.composition_framebuffers[i].init(context, context.default_gpu_interface, framebuffer_settings));
+    }
     return VK_SUCCESS;
 }
 
 void destroy_gbuffer(GBuffer& gbuffer, vk::VulkanContext& context)
 {
+    for (vk::Framebuffer& framebuffer : gbuffer.composition_framebuffers)
+        framebuffer.destroy(context);
+    gbuffer.composition_render_pass.destroy(context);
     gbuffer.framebuffer.destroy(context);
     gbuffer.render_pass.destroy(context);
-    gbuffer.layer0.destroy(context);
-    gbuffer.layer1.destroy(context);
 }
 
 int main(int argc, char** argv)
@@ -578,10 +603,7 @@ int main(int argc, char** argv)
     VERIFY(res == VK_SUCCESS, "init_vulkan_context failed", -1);
 
     GBuffer gbuffer;
-    VK_CHECK(create_gbuffer(gbuffer, context));
-
     Renderers renderers;
-    create_renderers(renderers, context, gbuffer);
 
     Scene scene;
     vk::Mesh mesh;
@@ -606,57 +628,86 @@ int main(int argc, char** argv)
     material.set_albedo(&texture);
     scene.meshes[0].set_material(0, &material);
 
-    vk::CommandBuffer command_buffers[2];
-    context.command_pools.main_graphics_command_pool.create_command_buffers(context, command_buffers, 2);
-
-    command_buffers[0]
-        .begin()
-            .transfer_image_layout(context.main_swapchain.color_images()[0].image(),
-                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT)
-            .transfer_image_layout(context.main_swapchain.color_images()[1].image(),
-                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT)
-            .transfer_image_layout(context.main_depth_stencil_image_view.image(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-                VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT)
-            .transfer_image_layout(gbuffer.layer0.image(),
-                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT)
-            .transfer_image_layout(gbuffer.layer1.image(),
-                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT)
-        .end();
-    context.main_device->graphics_queue().submit(command_buffers, 1);
-    context.main_device->graphics_queue().wait_idle();
-
-    while (app_message_loop(context))
+    // the images start in the undefined layout, the graph transitions them on the first use;
+    // both layers are alive from the gbuffer pass to the composition, so nothing is aliased here
+    vk::RenderGraph graph;
+    const VkImageAspectFlags depth_aspect = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+    const vk::RenderGraph::Resource layer0 = graph.create_image("gbuffer layer0", gbuffer_layer_settings(context));
+    const vk::RenderGraph::Resource layer1 = graph.create_image("gbuffer layer1", gbuffer_layer_settings(context));
+    const vk::RenderGraph::Resource depth = graph.import_image("depth", context.main_depth_stencil_image_view.image(), depth_aspect,
+        VK_IMAGE_LAYOUT_UNDEFINED, true);
+    const vk::RenderGraph::Resource backbuffer = graph.import_image("backbuffer", VK_NULL_HANDLE, VK_IMAGE_ASPECT_COLOR_BIT);
+    graph.set_output(backbuffer);
+
+    const vk::RenderGraph::Pass gbuffer_pass = graph.add_pass("gbuffer", [&](vk::CommandBuffer& command_buffer)
     {
-        vk::Queue& graphics_queue = context.main_device->graphics_queue();
-        context.main_swapchain.acquire_next_image();
-
-        VkSemaphore submit_wait_semaphore = context.main_swapchain.next_image_semaphore();
-
-        command_buffers[0]
-            .begin()
+        command_buffer
             .begin_render_pass_command(&gbuffer.framebuffer, vec4(0.0f, 0.0f, 0.0f, 1.0f), 1.0f, 0, 2, true, true)
             .set_viewport_command({ 0, 0, context.width, context.height })
             .set_scissor_command({ 0, 0, context.width, context.height });
-        renderers.mesh_renderer.render(command_buffers[0], context, scene);
-        command_buffers[0]
-            .end_render_pass_command()
-            .end();
-
-        command_buffers[1]
-            .begin()
-            .begin_render_pass_command(&context.main_swapchain.current_framebuffer(), vec4(0.0f, 1.0f, 0.0f, 1.0f), 1.0f, 0, 1, true, true)
+        renderers.mesh_renderer.render(command_buffer, context, scene);
+        command_buffer.end_render_pass_command();
+    });
+    graph.write(gbuffer_pass, layer0, vk::RenderGraph::usage_color_attachment);
+    graph.write(gbuffer_pass, layer1, vk::RenderGraph::usage_color_attachment);
+    graph.write(gbuffer_pass, depth, vk::RenderGraph::usage_depth_attachment);
+
+    const vk::RenderGraph::Pass composition_pass = graph.add_pass("composition", [&](vk::CommandBuffer& command_buffer)
+    {
+        command_buffer
+            .begin_render_pass_command(&gbuffer.composition_framebuffers[context.main_swapchain.current_buffer()],
+                vec4(0.0f, 1.0f, 0.0f, 1.0f), 1.0f, 0, 1, false, false)
             .set_viewport_command({ 0, 0, context.width, context.height })
             .set_scissor_command({ 0, 0, context.width, context.height });
-        renderers.gbuffer_renderer.render(command_buffers[1], context);
-        command_buffers[1]
-            .end_render_pass_command()
-            .end();
-
-        VkSemaphore present_semaphore = graphics_queue.present_semaphore();
-        graphics_queue.submit(command_buffers, 2, &submit_wait_semaphore, 1, &present_semaphore, 1);
-        graphics_queue.present(&context.main_swapchain);
-        graphics_queue.wait_idle();
+        renderers.gbuffer_renderer.render(command_buffer, context);
+        command_buffer.end_render_pass_command();
+    });
+    graph.read(composition_pass, layer0, vk::RenderGraph::usage_sampled);
+    graph.read(composition_pass, layer1, vk::RenderGraph::usage_sampled);
+    graph.read(composition_pass, depth, vk::RenderGraph::usage_depth_sampled);
+    graph.write(composition_pass, backbuffer, vk::RenderGraph::usage_color_attachment, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+    graph.compile();
+    VK_CHECK(graph.allocate(context, context.default_gpu_interface));
+    printf("transient memory: %.2f MB, %.2f MB without aliasing, %.2f MB lazily allocated\n",
+        graph.transient_memory_size() / (1024.0f * 1024.0f), graph.unaliased_memory_size() / (1024.0f * 1024.0f),
+        graph.lazy_memory_size() / (1024.0f * 1024.0f));
+
+    gbuffer.layer0 = &graph.image_view(layer0);
+    gbuffer.layer1 = &graph.image_view(layer1);
+    VK_CHECK(create_gbuffer(gbuffer, context));
+    create_renderers(renderers, context, gbuffer);
+
+    vk::FrameContextRing::Settings frames_settings;
+    frames_settings.command_buffers_count = 1;
+    vk::FrameContextRing frames;
+    VK_CHECK(frames.init(context, context.default_gpu_interface, frames_settings));
+
+    vk::Queue& graphics_queue = context.main_device->graphics_queue();
+    uint32_t frame_number = 0;
+    while (app_message_loop(context))
+    {
+        vk::FrameContext& frame = frames.begin_frame(context);
+        vk::CommandBuffer* command_buffers = frame.command_buffers();
+
+        // the contents of the acquired image are discarded, the submit waits for it in the color output stage
+        graph.set_image(backbuffer, context.main_swapchain.color_images()[context.main_swapchain.current_buffer()].image(),
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+
+        command_buffers[0].begin();
+        graph.execute(command_buffers[0]);
+        command_buffers[0].end();
+
+        vk::flush_uploads(context);
+        graphics_queue.submit(frame, command_buffers, 1);
+        graphics_queue.present(&context.main_swapchain, frame);
+
+        if ((++frame_number & 255) == 0)
+            printf("frame time: %.3f ms, barriers: %u with %u image barriers\n", frames.frame_time(),
+                graph.barriers_count(), graph.image_barriers_count());
     }
+    graphics_queue.wait_idle();
+
+    frames.destroy(context);
 
     mesh.destroy(context);
     material.destroy(context);
@@ -666,7 +717,7 @@ int main(int argc, char** argv)
 
     destroy_renderers(renderers, context);
 
-    context.command_pools.main_graphics_command_pool.destroy_command_buffers(context, command_buffers, 2);
+    graph.destroy(context);
 
     vk::destroy_vulkan_context(context);
     return 0;
@@ -1,14 +1,14 @@
 #include "mhevk.hpp"
+#include "jobs.hpp"
+#include "transforms.hpp"
+#include "culling.hpp"
 
 #include <limits>
+#include <algorithm>
+#include <atomic>
 
 using namespace mhe;
 
-struct PerModelUniformData
-{
-    mat4x4 world;
-};
-
 struct PerCameraUniformData
 {
     mat4x4 vp;
@@ -29,22 +29,64 @@ struct LightUniformData
 
 using namespace mhe;
 
+const uint32_t frames_in_flight = 2;
+const uint32_t max_objects = 4096;
+// objects per transform job
+const uint32_t transforms_grain_size = 1024;
+// parts per culling job
+const uint32_t culling_grain_size = 1024;
+// the simplification error of the selected level of detail stays below it
+const float lod_max_error_pixels = 1.0f;
+// the parts are culled by a compute shader, the CPU culls them and their meshlets otherwise
+const bool gpu_culling = true;
+// the compute shader also culls the parts hidden behind the depth of the previous frame
+const bool occlusion_culling = true;
+// the depth is laid down from the position stream first, the G-buffer pass then shades the visible fragments only
+const bool depth_prepass = true;
+
+// the camera in the space of the object's vertices, the meshlets are culled there
+struct ObjectView
+{
+    Frustum frustum;
+    vec3 camera;
+};
+
+// one object per mesh
 struct Scene
 {
     std::vector<vk::Mesh> meshes;
+    TransformArray transforms;
 };
 
 class MeshRenderer
 {
 public:
-    VkResult init(vk::VulkanContext& context, vk::RenderPass* render_pass)
+    VkResult init(vk::VulkanContext& context, vk::RenderPass* render_pass, vk::RenderPass* depth_render_pass, vk::VertexFormat vertex_format)
     {
+        vk::TransformBuffer::Settings transforms_settings;
+        transforms_settings.objects_count = max_objects;
+        transforms_settings.frames_count = frames_in_flight;
+        transforms_settings.object_size = sizeof(ObjectTransform);
+        VK_CHECK(transforms_.init(context, context.default_gpu_interface, transforms_settings));
+        frame_index_ = 0;
+        parts_tested_ = 0;
+        parts_frustum_visible_ = 0;
+        parts_visible_ = 0;
+
+        if (gpu_culling && occlusion_culling)
+        {
+            vk::DepthPyramid::Settings pyramid_settings;
+            pyramid_settings.depth = &context.main_depth_stencil_image_view;
+            pyramid_settings.frames_count = frames_in_flight;
+            VK_CHECK(depth_pyramid_.init(context, context.default_gpu_interface, pyramid_settings));
+        }
+
         VkGraphicsPipelineCreateInfo create_info = {};
         create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
         create_info.renderPass = *render_pass;
 
         VkPipelineVertexInputStateCreateInfo vi_create_info;
-        vk::GeometryLayout::vertex_input_info(vi_create_info);
+        vk::vertex_input_info(vertex_format, vi_create_info);
         // input assembly
         VkPipelineInputAssemblyStateCreateInfo ia_create_info = {};
         ia_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
@@ -60,8 +102,8 @@ public:
         ds_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
         ds_create_info.stencilTestEnable = VK_FALSE;
         ds_create_info.depthTestEnable = VK_TRUE;
-        ds_create_info.depthCompareOp = VK_COMPARE_OP_LESS;
-        ds_create_info.depthWriteEnable = VK_TRUE;
+        ds_create_info.depthCompareOp = depth_prepass ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_LESS;
+        ds_create_info.depthWriteEnable = depth_prepass ? VK_FALSE : VK_TRUE;
         ds_create_info.maxDepthBounds = 1.0f;
         // blend state
         VkPipelineColorBlendAttachmentState blend_attachment_state[2] = {{}, {}};
@@ -107,7 +149,7 @@ public:
 
         VkDescriptorSetLayout descriptor_set_layouts[3] =
         {
-            context.descriptor_set_layouts.camera_layout, context.descriptor_set_layouts.mesh_layout,
+            context.descriptor_set_layouts.camera_layout, context.descriptor_set_layouts.dynamic_mesh_layout,
             context.descriptor_set_layouts.material_layout
         };
 
@@ -161,6 +203,28 @@ public:
         vkDestroyShaderModule(*context.main_device, vsm, context.allocation_callbacks);
         vkDestroyShaderModule(*context.main_device, fsm, context.allocation_callbacks);
 
+        // the depth-only pipeline reads the positions alone and has no fragment shader
+        depth_pipeline_ = VK_NULL_HANDLE;
+        if (depth_prepass)
+        {
+            res = read_entire_file(shader_data, "../../shaders/depth_only.vert.spv", "rb");
+            VERIFY(res == true, "Can't read shader data from file depth_only.vert.spv", VK_ERROR_INITIALIZATION_FAILED);
+            shader_create_info.pCode = reinterpret_cast<const uint32_t*>(&shader_data[0]);
+            shader_create_info.codeSize = shader_data.size();
+            VK_CHECK(vkCreateShaderModule(*context.main_device, &shader_create_info, context.allocation_callbacks, &vsm));
+            shader_stage_create_info[0].module = vsm;
+
+            vk::position_input_info(vertex_format, vi_create_info);
+            ds_create_info.depthCompareOp = VK_COMPARE_OP_LESS;
+            ds_create_info.depthWriteEnable = VK_TRUE;
+            blend_create_info.attachmentCount = 0;
+            create_info.stageCount = 1;
+            create_info.renderPass = *depth_render_pass;
+            VK_CHECK(vkCreateGraphicsPipelines(*context.main_device, context.main_pipeline_cache, 1, &create_info, context.allocation_callbacks, &depth_pipeline_));
+
+            vkDestroyShaderModule(*context.main_device, vsm, context.allocation_callbacks);
+        }
+
         create_uniforms(context);
         create_descriptor_sets(context);
 
@@ -172,7 +236,14 @@ public:
         vkFreeDescriptorSets(*context.main_device, context.descriptor_pools.main_descriptor_pool, 1, &camera_descriptor_set_);
 
         per_camera_uniform_.destroy(context);
-
+        culled_draws_.destroy(context);
+        depth_pyramid_.destroy(context);
+        meshlet_draws_.destroy(context);
+        draws_.destroy(context);
+        transforms_.destroy(context);
+
+        if (depth_pipeline_ != VK_NULL_HANDLE)
+            vkDestroyPipeline(*context.main_device, depth_pipeline_, context.allocation_callbacks);
         vkDestroyPipeline(*context.main_device, pipeline_, context.allocation_callbacks);
         vkDestroyPipelineLayout(*context.main_device, pipeline_layout_, context.allocation_callbacks);
     }
@@ -182,29 +253,257 @@ public:
         return pipeline_;
     }
 
-    void render(vk::CommandBuffer& command_buffer, vk::VulkanContext& context, const Scene& scene)
+    // writes world and world-view-projection matrices of all the objects straight into the mapped buffer of the frame,
+    // picks the levels of detail of the objects, moves the camera into their space and culls their parts
+    void update_transforms(jobs::Scheduler& scheduler, const Scene& scene, uint32_t frame_index)
     {
-        command_buffer.bind_pipeline(pipeline_, VK_PIPELINE_BIND_POINT_GRAPHICS);
+        ASSERT(scene.transforms.size() <= max_objects, "Too many objects in the scene");
+        frame_index_ = frame_index;
+        uint8_t* dst = transforms_.frame_data(frame_index);
+        lods_.resize(scene.transforms.size());
+        views_.resize(scene.transforms.size());
+        scheduler.parallel_for(scene.transforms.size(), transforms_grain_size, [&](uint32_t begin, uint32_t end)
+        {
+            compute_transforms(dst, transforms_.stride(), scene.transforms, vp_, begin, end);
+            select_lods(scene, begin, end);
+            if (!gpu_culling)
+                update_views(scene, begin, end);
+        });
+
+        extract_frustum(frustum_, vp_);
+        if (gpu_culling)
+        {
+            // the frame's fence has been waited for, its counts are the ones of its previous use
+            parts_tested_ = culled_draws_.parts_count();
+            parts_frustum_visible_ = culled_draws_.frustum_visible_count(frame_index);
+            parts_visible_ = culled_draws_.visible_count(frame_index);
+            if (!lods_.empty())
+                std::copy(lods_.begin(), lods_.end(), culled_draws_.object_lods(frame_index));
+            return;
+        }
+
+        // the boxes of all the parts are written before the culling reads them 4 or 8 at once
+        parts_tested_ = 0;
+        parts_frustum_visible_ = 0;
+        parts_visible_ = 0;
+        scheduler.parallel_for(part_boxes_.size(), culling_grain_size, [&](uint32_t begin, uint32_t end)
+        {
+            const uint32_t visible_count = cull_boxes(&visible_parts_[begin], frustum_, part_boxes_, begin, end);
+            std::fill(parts_visibility_.begin() + begin, parts_visibility_.begin() + end, 0);
+            for (uint32_t i = 0; i < visible_count; ++i)
+                parts_visibility_[visible_parts_[begin + i]] = 1;
+            parts_tested_ += end - begin;
+            parts_frustum_visible_ += visible_count;
+            parts_visible_ += visible_count;
+        });
+    }
+
+    // records the culling of the parts by the compute shader, see vk::CulledDrawBuffer::cull()
+    void cull(vk::CommandBuffer& command_buffer)
+    {
+        culled_draws_.cull(command_buffer, frame_index_, frustum_);
+    }
+
+    bool async_culling() const
+    {
+        return culled_draws_.async_compute();
+    }
+
+    // records the reduction of the frame's depth for the occlusion culling of the next one after the G-buffer pass
+    void build_depth_pyramid(vk::CommandBuffer& command_buffer)
+    {
+        depth_pyramid_.build(command_buffer, vp_);
+    }
+
+    // the async culling of the next frame waits for the frame's build
+    VkSemaphore depth_pyramid_semaphore() const
+    {
+        return depth_pyramid_.async_compute() ? depth_pyramid_.built_semaphore(frame_index_) : VK_NULL_HANDLE;
+    }
+
+    uint32_t parts_tested() const
+    {
+        return parts_tested_;
+    }
+
+    uint32_t parts_frustum_visible() const
+    {
+        return parts_frustum_visible_;
+    }
+
+    uint32_t parts_visible() const
+    {
+        return parts_visible_;
+    }
+
+    // indirect draw commands of all the parts of the scene, call it again when the meshes change
+    VkResult build_draws(vk::VulkanContext& context, const Scene& scene)
+    {
+        uint32_t commands_count = 0;
+        for (size_t i = 0, size = scene.meshes.size(); i < size; ++i)
+            commands_count += static_cast<uint32_t>(scene.meshes[i].parts().size()) * scene.meshes[i].lods_count();
+
+        draws_.destroy(context);
+        vk::IndirectDrawBuffer::Settings settings;
+        settings.max_commands_count = std::max(commands_count, 1u);
+        VK_CHECK(draws_.init(context, context.default_gpu_interface, settings));
+        VK_VERIFY(draws_.build(context, &scene.meshes[0], static_cast<uint32_t>(scene.meshes.size())));
+
+        // the parts of all the objects follow each other
+        first_parts_.resize(scene.meshes.size());
+        uint32_t parts_count = 0;
+        for (size_t i = 0, size = scene.meshes.size(); i < size; ++i)
+        {
+            first_parts_[i] = parts_count;
+            parts_count += static_cast<uint32_t>(scene.meshes[i].parts().size());
+        }
+        part_boxes_.resize(parts_count);
+        visible_parts_.resize(parts_count);
+        parts_visibility_.assign(parts_count, 1);
+
+        meshlet_draws_.destroy(context);
+        vk::MeshletDrawBuffer::Settings meshlet_settings;
+        meshlet_settings.frames_count = frames_in_flight;
+        // the pipelines don't cull the back faces, the double-sided materials would lose their meshlets
+        meshlet_settings.backface_culling = false;
+        VK_CHECK(meshlet_draws_.init(context, context.default_gpu_interface, meshlet_settings));
+        VK_VERIFY(meshlet_draws_.build(context, context.default_gpu_interface, draws_));
+
+        culled_draws_.destroy(context);
+        vk::CulledDrawBuffer::Settings culled_settings;
+        culled_settings.frames_count = frames_in_flight;
+        VK_VERIFY(culled_draws_.init(context, context.default_gpu_interface, culled_settings));
+        return culled_draws_.build(context, context.default_gpu_interface, draws_, transforms_,
+            occlusion_culling ? &depth_pyramid_ : nullptr);
+    }
+
+    // the whole scene into the depth pre-pass, it culls the meshlets for the G-buffer pass of the frame
+    void render_depth(vk::CommandBuffer& command_buffer, vk::VulkanContext& context)
+    {
+        command_buffer
+            .set_viewport_command({ 0, 0, context.width, context.height })
+            .set_scissor_command({ 0, 0, context.width, context.height });
+        render_batches(command_buffer, 0, draws_.batches().size(), true);
+    }
+
+    // every task records a part of the scene into a secondary command buffer of the thread executing it,
+    // the buffers are returned in the scene order
+    void render_parallel(std::vector<vk::CommandBuffer>& secondary_command_buffers, vk::FrameContext& frame,
+        jobs::Scheduler& scheduler, vk::VulkanContext& context, const vk::Framebuffer* framebuffer)
+    {
+        const uint32_t tasks_count = frame.recording_threads_count();
+        const size_t batches_count = draws_.batches().size();
+        const size_t batches_per_task = (batches_count + tasks_count - 1) / tasks_count;
+        std::vector<uint32_t> used_command_buffers(tasks_count, 0);
+        secondary_command_buffers.resize(tasks_count);
+        scheduler.parallel_for(tasks_count, 1, [&](uint32_t task_index, uint32_t)
+        {
+            const uint32_t thread_index = jobs::Scheduler::thread_index();
+            vk::CommandBuffer& command_buffer = frame.secondary_command_buffer(thread_index, used_command_buffers[thread_index]++);
+            command_buffer
+                .begin_secondary(framebuffer)
+                .set_viewport_command({ 0, 0, context.width, context.height })
+                .set_scissor_command({ 0, 0, context.width, context.height });
+            const size_t begin = std::min(task_index * batches_per_task, batches_count);
+            const size_t end = std::min(begin + batches_per_task, batches_count);
+            render_batches(command_buffer, begin, end, false);
+            command_buffer.end();
+            secondary_command_buffers[task_index] = command_buffer;
+        });
+    }
+private:
+    // The distance is measured to the world space box of the mesh, the camera close to a part of a large object
+    // keeps its full detail. It's divided by the largest scale of the object to get to the units of the asset.
+    void select_lods(const Scene& scene, uint32_t begin, uint32_t end)
+    {
+        const TransformArray& transforms = scene.transforms;
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            const float scale = std::max(transforms.component(TransformArray::scale_x)[i],
+                std::max(transforms.component(TransformArray::scale_y)[i], transforms.component(TransformArray::scale_z)[i]));
+            const Aabb box = transform_box(scene.meshes[i].bounds(), transforms.world(i));
+            const float distance = box_distance(box, camera_position_) / scale;
+            lods_[i] = scene.meshes[i].select_lod(distance, screen_scale_, lod_max_error_pixels);
+        }
+    }
+
+    // the object space frustum and camera for the meshlets, the world space boxes of the parts
+    void update_views(const Scene& scene, uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            const mat4x4 world = scene.transforms.world(i);
+            extract_frustum(views_[i].frustum, world * vp_);
+            const vec4 camera = vec4(camera_position_.x, camera_position_.y, camera_position_.z, 1.0f) * inverse(world);
+            views_[i].camera = vec3(camera.x, camera.y, camera.z);
+
+            const std::vector<vk::MeshPart>& parts = scene.meshes[i].parts();
+            for (uint32_t j = 0, size = static_cast<uint32_t>(parts.size()); j < size; ++j)
+                part_boxes_.set(first_parts_[i] + j, transform_box(parts[j].bounds, world));
+        }
+    }
+
+    // One indirect draw per batch, the state changes only when the object or the material changes.
+    // Only the visible parts are drawn, the full detail is drawn by the visible meshlets when the CPU culls them.
+    // The depth-only draws read the position stream and don't change the materials.
+    void render_batches(vk::CommandBuffer& command_buffer, size_t begin, size_t end, bool depth_only)
+    {
+        command_buffer.bind_pipeline(depth_only ? depth_pipeline_ : pipeline_, VK_PIPELINE_BIND_POINT_GRAPHICS);
         command_buffer.bind_descriptor_set(VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout_, &camera_descriptor_set_, 1, 0);
-        for (const vk::Mesh& mesh : scene.meshes)
+        const std::vector<vk::IndirectDrawBuffer::Batch>& batches = draws_.batches();
+        const vk::GeometryPool* bound_geometry_pool = nullptr;
+        VkIndexType bound_index_type = VK_INDEX_TYPE_MAX_ENUM;
+        const vk::Mesh* bound_mesh = nullptr;
+        const vk::Material* bound_material = nullptr;
+        for (size_t batch_index = begin; batch_index < end; ++batch_index)
         {
-            VkDescriptorSet mesh_descriptor_sets[1] =
+            const vk::IndirectDrawBuffer::Batch& batch = batches[batch_index];
+            if (batch.mesh != bound_mesh)
             {
-                mesh.descriptor_set()
-            };
-            command_buffer.bind_descriptor_set(VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout_, mesh_descriptor_sets, array_size(mesh_descriptor_sets), 1);
-            for (size_t i = 0, size = mesh.parts().size(); i < size; ++i)
+                VkDescriptorSet mesh_descriptor_sets[1] =
+                {
+                    transforms_.descriptor_set()
+                };
+                const uint32_t dynamic_offset = transforms_.dynamic_offset(frame_index_, batch.object_index);
+                command_buffer.bind_descriptor_set(VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout_, mesh_descriptor_sets, array_size(mesh_descriptor_sets), 1,
+                    &dynamic_offset, 1);
+                bound_mesh = batch.mesh;
+            }
+            // all the meshes of a pool share its buffers, 16 and 32 bit meshes differ in the index type only
+            if (batch.mesh->geometry_pool() != bound_geometry_pool || batch.mesh->index_type() != bound_index_type)
+            {
+                bound_geometry_pool = batch.mesh->geometry_pool();
+                bound_index_type = batch.mesh->index_type();
+                if (depth_only)
+                    command_buffer.bind_positions(*bound_geometry_pool, bound_index_type);
+                else
+                    command_buffer.bind_geometry(*bound_geometry_pool, bound_index_type);
+            }
+            if (!depth_only && batch.material != bound_material)
             {
                 VkDescriptorSet part_descriptor_sets[1] =
                 {
-                    mesh.parts()[i].material->descriptor_set()
+                    batch.material->descriptor_set()
                 };
                 command_buffer.bind_descriptor_set(VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout_, part_descriptor_sets, array_size(part_descriptor_sets), 2);
-                command_buffer.draw(mesh, i);
+                bound_material = batch.material;
+            }
+            if (gpu_culling)
+            {
+                command_buffer.draw_culled(culled_draws_, frame_index_, batch_index);
+                continue;
+            }
+            // the G-buffer pass draws the meshlets culled for the depth pre-pass
+            if (depth_only || !depth_prepass)
+            {
+                const ObjectView& view = views_[batch.object_index];
+                meshlet_draws_.cull(frame_index_, batch_index, lods_[batch.object_index], &parts_visibility_[first_parts_[batch.object_index]],
+                    view.frustum, view.camera);
             }
+            command_buffer.draw_meshlets(meshlet_draws_, frame_index_, batch_index);
         }
     }
-private:
+
     VkResult create_uniforms(vk::VulkanContext& context)
     {
         uint32_t graphics_queue_family_index = context.main_device->physical_device()->graphics_queue_family_index();
@@ -219,8 +518,12 @@ private:
         settings.memory_properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
 
         PerCameraUniformData per_camera_uniform_data;
-        per_camera_uniform_data.vp = mat4x4::look_at(vec3(-2.0f, 4.0f, 10.0f), vec3(0.0f, 0.0f, 0.0f), vec3::up()) *
-            mat4x4::perspective(deg_to_rad(60.0f), 1.0f, 0.1f, 20.0f);
+        camera_position_ = vec3(-2.0f, 4.0f, 10.0f);
+        const mat4x4 projection = mat4x4::perspective(deg_to_rad(60.0f), 1.0f, 0.1f, 20.0f);
+        per_camera_uniform_data.vp = mat4x4::look_at(camera_position_, vec3(0.0f, 0.0f, 0.0f), vec3::up()) * projection;
+        vp_ = per_camera_uniform_data.vp;
+        // pixels per unit at the distance 1
+        screen_scale_ = 0.5f * context.height * std::fabs(projection(1, 1));
         per_camera_uniform_data.inv_vp = inverse(per_camera_uniform_data.vp);
         VK_CHECK(per_camera_uniform_.init(context, gpu_iface, settings,
             reinterpret_cast<const uint8_t*>(&per_camera_uniform_data), sizeof(PerCameraUniformData)));
@@ -255,11 +558,32 @@ private:
     }
 
     VkPipeline pipeline_;
+    VkPipeline depth_pipeline_;
     VkPipelineLayout pipeline_layout_;
 
     VkDescriptorSet camera_descriptor_set_;
 
     vk::Buffer per_camera_uniform_;
+    vk::TransformBuffer transforms_;
+    vk::IndirectDrawBuffer draws_;
+    vk::MeshletDrawBuffer meshlet_draws_;
+    vk::CulledDrawBuffer culled_draws_;
+    vk::DepthPyramid depth_pyramid_;
+    std::vector<uint32_t> lods_;
+    std::vector<ObjectView> views_;
+    // world space boxes of the parts of all the objects
+    BoxArray part_boxes_;
+    std::vector<uint32_t> first_parts_;
+    std::vector<uint32_t> visible_parts_;
+    std::vector<uint8_t> parts_visibility_;
+    Frustum frustum_;
+    std::atomic<uint32_t> parts_tested_;
+    std::atomic<uint32_t> parts_frustum_visible_;
+    std::atomic<uint32_t> parts_visible_;
+    mat4x4 vp_;
+    vec3 camera_position_;
+    float screen_scale_;
+    uint32_t frame_index_;
 };
 
 struct GBuffer
@@ -268,6 +592,9 @@ struct GBuffer
     vk::ImageView layer1;
     vk::RenderPass render_pass;
     vk::Framebuffer framebuffer;
+    // the main depth alone, render_pass loads it when depth_prepass
+    vk::RenderPass depth_render_pass;
+    vk::Framebuffer depth_framebuffer;
 };
 
 class GBufferRenderer
@@ -500,9 +827,9 @@ struct Renderers
     GBufferRenderer gbuffer_renderer;
 };
 
-void create_renderers(Renderers& renderers, vk::VulkanContext& context, GBuffer& gbuffer)
+void create_renderers(Renderers& renderers, vk::VulkanContext& context, GBuffer& gbuffer, vk::VertexFormat vertex_format)
 {
-    renderers.mesh_renderer.init(context, &gbuffer.render_pass);
+    renderers.mesh_renderer.init(context, &gbuffer.render_pass, &gbuffer.depth_render_pass, vertex_format);
     renderers.gbuffer_renderer.init(context, &gbuffer);
 }
 
@@ -531,6 +858,8 @@ VkResult create_gbuffer(GBuffer& gbuffer, vk::VulkanContext& context)
     attachment_desc[1].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
     attachment_desc[2].format = context.main_depth_stencil_image_view.format();
     attachment_desc[2].layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    if (depth_prepass)
+        attachment_desc[2].load_op = VK_ATTACHMENT_LOAD_OP_LOAD;
 
     vk::RenderPass::Settings::DependencyDesc dependencies[1];
     dependencies[0].render_pass = &context.render_passes.main_render_pass;
@@ -553,11 +882,29 @@ VkResult create_gbuffer(GBuffer& gbuffer, vk::VulkanContext& context)
     framebuffer_settings.width = context.width;
     framebuffer_settings.height = context.height;
     VK_CHECK(gbuffer.framebuffer.init(context, context.default_gpu_interface, framebuffer_settings));
+
+    if (!depth_prepass)
+        return VK_SUCCESS;
+    render_pass_settings.count = 1;
+    render_pass_settings.descs = &attachment_desc[2];
+    render_pass_settings.dependencies_count = 0;
+    attachment_desc[2].load_op = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    VK_CHECK(gbuffer.depth_render_pass.init(context, context.default_gpu_interface, render_pass_settings));
+
+    framebuffer_settings.attachments = &image_views[2];
+    framebuffer_settings.count = 1;
+    framebuffer_settings.render_pass = &gbuffer.depth_render_pass;
+    VK_CHECK(gbuffer.depth_framebuffer.init(context, context.default_gpu_interface, framebuffer_settings));
     return VK_SUCCESS;
 }
 
 void destroy_gbuffer(GBuffer& gbuffer, vk::VulkanContext& context)
 {
+    if (depth_prepass)
+    {
+        gbuffer.depth_framebuffer.destroy(context);
+        gbuffer.depth_render_pass.destroy(context);
+    }
     gbuffer.framebuffer.destroy(context);
     gbuffer.render_pass.destroy(context);
     gbuffer.layer0.destroy(context);
@@ -574,12 +921,15 @@ int main(int argc, char** argv)
     VK_CHECK(create_gbuffer(gbuffer, context));
 
     Renderers renderers;
-    create_renderers(renderers, context, gbuffer);
+    // the smallest vertices the device can fetch
+    const vk::VertexFormat vertex_format = vk::vertex_format_supported(*context.main_device->physical_device(), vk::vertex_format_quantized) ?
+        vk::vertex_format_quantized : vk::vertex_format_float;
+    create_renderers(renderers, context, gbuffer, vertex_format);
 
-    vk::CommandBuffer command_buffers[2];
-    context.command_pools.main_graphics_command_pool.create_command_buffers(context, command_buffers, 2);
+    vk::CommandBuffer layout_command_buffer;
+    context.command_pools.main_graphics_command_pool.create_command_buffers(context, &layout_command_buffer, 1);
 
-    command_buffers[0]
+    layout_command_buffer
         .begin()
             .transfer_image_layout(context.main_swapchain.color_images()[0].image(),
                 VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT)
@@ -592,31 +942,93 @@ int main(int argc, char** argv)
             .transfer_image_layout(gbuffer.layer1.image(),
                 VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT)
         .end();
-    context.main_device->graphics_queue().submit(command_buffers, 1);
+    context.main_device->graphics_queue().submit(&layout_command_buffer, 1);
     context.main_device->graphics_queue().wait_idle();
+    context.command_pools.main_graphics_command_pool.destroy_command_buffers(context, &layout_command_buffer, 1);
+
+    jobs::Scheduler scheduler;
+    scheduler.init(jobs::Scheduler::Settings());
 
+    // the first run imports the asset and cooks cube.fbx.mhemesh, the next runs map the cooked file
+    Timer load_timer;
     vk::Mesh mesh;
-    mesh.create("../../assets/cube.fbx", context, context.default_gpu_interface);
+    vk::Mesh::ImportSettings import_settings;
+    import_settings.vertex_format = vertex_format;
+    VK_CHECK(mesh.create("../../assets/cube.fbx", context, context.default_gpu_interface, &scheduler, import_settings));
+    printf("mesh loading time: %.3f ms\n", load_timer.elapsed());
 
     Scene scene;
     scene.meshes.push_back(mesh);
-
+    scene.transforms.resize(static_cast<uint32_t>(scene.meshes.size()));
+    for (uint32_t i = 0; i < scene.transforms.size(); ++i)
+        scene.transforms.set_local(i, scene.meshes[i].position_offset(), scene.meshes[i].position_scale());
+    VK_CHECK(renderers.mesh_renderer.build_draws(context, scene));
+
+    // a thread may execute all the recording tasks of the frame
+    vk::FrameContextRing::Settings frames_settings;
+    frames_settings.frames_count = frames_in_flight;
+    frames_settings.command_buffers_count = 2;
+    frames_settings.recording_threads_count = scheduler.threads_count();
+    frames_settings.secondary_command_buffers_count = scheduler.threads_count();
+    frames_settings.compute_command_buffers_count = 1;
+    vk::FrameContextRing frames;
+    VK_CHECK(frames.init(context, context.default_gpu_interface, frames_settings));
+
+    vk::Queue& graphics_queue = context.main_device->graphics_queue();
+    vk::Queue& compute_queue = context.main_device->compute_queue();
+    const bool async_culling = gpu_culling && renderers.mesh_renderer.async_culling();
+    const bool depth_pyramid = gpu_culling && occlusion_culling;
+    // signaled by the graphics submit of the previous frame after it has built the depth pyramid
+    VkSemaphore depth_pyramid_semaphore = VK_NULL_HANDLE;
+    std::vector<vk::CommandBuffer> secondary_command_buffers;
+    uint32_t frame_number = 0;
+    float angle = 0.0f;
     while (app_message_loop(context))
     {
-        vk::Queue& graphics_queue = context.main_device->graphics_queue();
-        context.main_swapchain.acquire_next_image();
-
-        VkSemaphore submit_wait_semaphore = context.main_swapchain.next_image_semaphore();
+        vk::FrameContext& frame = frames.begin_frame(context);
+        vk::CommandBuffer* command_buffers = frame.command_buffers();
+
+        // spin the objects around the y axis
+        angle += frames.frame_time() * 0.001f;
+        for (uint32_t i = 0; i < scene.transforms.size(); ++i)
+            scene.transforms.set_rotation(i, vec4(0.0f, sin(angle * 0.5f), 0.0f, cos(angle * 0.5f)));
+        renderers.mesh_renderer.update_transforms(scheduler, scene, frames.current_index());
+
+        // the compute queue culls the parts while the draws are recorded, or the frame's commands start with the culling
+        VkSemaphore compute_finished_semaphore = VK_NULL_HANDLE;
+        if (async_culling)
+        {
+            vk::CommandBuffer& compute_command_buffer = frame.compute_command_buffer(0);
+            compute_command_buffer.begin();
+            renderers.mesh_renderer.cull(compute_command_buffer);
+            compute_command_buffer.end();
+            compute_finished_semaphore = frame.compute_finished_semaphore();
+            compute_queue.submit(&compute_command_buffer, 1, &depth_pyramid_semaphore, depth_pyramid_semaphore != VK_NULL_HANDLE ? 1 : 0,
+                &compute_finished_semaphore, 1, VK_NULL_HANDLE, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+        }
 
+        // the depth pre-pass culls the meshlets before the G-buffer tasks draw them
+        command_buffers[0].begin();
+        if (gpu_culling && !async_culling)
+            renderers.mesh_renderer.cull(command_buffers[0]);
+        if (depth_prepass)
+        {
+            command_buffers[0].begin_render_pass_command(&gbuffer.depth_framebuffer, vec4(0.0f, 0.0f, 0.0f, 1.0f), 1.0f, 0, 0, true, true);
+            renderers.mesh_renderer.render_depth(command_buffers[0], context);
+            command_buffers[0]
+                .end_render_pass_command()
+                .memory_barrier(VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+                    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT);
+        }
+        renderers.mesh_renderer.render_parallel(secondary_command_buffers, frame, scheduler, context, &gbuffer.framebuffer);
         command_buffers[0]
-            .begin()
-            .begin_render_pass_command(&gbuffer.framebuffer, vec4(0.0f, 0.0f, 0.0f, 1.0f), 1.0f, 0, 2, true, true)
-            .set_viewport_command({ 0, 0, context.width, context.height })
-            .set_scissor_command({ 0, 0, context.width, context.height });
-        renderers.mesh_renderer.render(command_buffers[0], context, scene);
-        command_buffers[0]
-            .end_render_pass_command()
-            .end();
+            .begin_render_pass_command(&gbuffer.framebuffer, vec4(0.0f, 0.0f, 0.0f, 1.0f), 1.0f, 0, 2, true, true,
+                VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS)
+            .execute_commands(&secondary_command_buffers[0], static_cast<uint32_t>(secondary_command_buffers.size()))
+            .end_render_pass_command();
+        if (depth_pyramid)
+            renderers.mesh_renderer.build_depth_pyramid(command_buffers[0]);
+        command_buffers[0].end();
 
         command_buffers[1]
             .begin()
@@ -628,18 +1040,31 @@ int main(int argc, char** argv)
             .end_render_pass_command()
             .end();
 
-        VkSemaphore present_semaphore = graphics_queue.present_semaphore();
-        graphics_queue.submit(command_buffers, 2, &submit_wait_semaphore, 1, &present_semaphore, 1);
-        graphics_queue.present(&context.main_swapchain);
-        graphics_queue.wait_idle();
+        vk::flush_uploads(context);
+        depth_pyramid_semaphore = depth_pyramid ? renderers.mesh_renderer.depth_pyramid_semaphore() : VK_NULL_HANDLE;
+        graphics_queue.submit(frame, command_buffers, 2, compute_finished_semaphore, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+            depth_pyramid_semaphore);
+        graphics_queue.present(&context.main_swapchain, frame);
+
+        if ((++frame_number & 255) == 0)
+        {
+            printf("frame time: %.3f ms, visible parts: %u of %u, %u in the frustum\n", frames.frame_time(),
+                renderers.mesh_renderer.parts_visible(), renderers.mesh_renderer.parts_tested(),
+                renderers.mesh_renderer.parts_frustum_visible());
+        }
     }
+    graphics_queue.wait_idle();
+
+    frames.destroy(context);
+    scheduler.destroy();
+
+    for (size_t i = 0, size = scene.meshes.size(); i < size; ++i)
+        scene.meshes[i].destroy(context);
 
     destroy_gbuffer(gbuffer, context);
 
     destroy_renderers(renderers, context);
 
-    context.command_pools.main_graphics_command_pool.destroy_command_buffers(context, command_buffers, 2);
-
     vk::destroy_vulkan_context(context);
     return 0;
 }
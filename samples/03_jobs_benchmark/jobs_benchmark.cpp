@@ -0,0 +1,95 @@
+#include "jobs.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace mhe;
+
+namespace {
+
+const uint32_t empty_jobs_count = 100000;
+const uint32_t elements_count = 1000000;
+const uint32_t grain_size = 4096;
+const uint32_t repeats_count = 10;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+float elapsed_ms(const Clock::time_point& start)
+{
+    return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+void transform(std::vector<float>& data, uint32_t begin, uint32_t end)
+{
+    for (uint32_t i = begin; i < end; ++i)
+        data[i] = std::sqrt(data[i] * 1.0001f + 1.0f);
+}
+
+// best of several runs, the first ones warm up the threads
+template <class F>
+float measure(F f)
+{
+    float best = 1e30f;
+    for (uint32_t i = 0; i < repeats_count; ++i)
+    {
+        Clock::time_point start = Clock::now();
+        f();
+        float time = elapsed_ms(start);
+        if (time < best)
+            best = time;
+    }
+    return best;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t max_threads_count = std::thread::hardware_concurrency();
+    if (argc > 1)
+        max_threads_count = static_cast<uint32_t>(atoi(argv[1]));
+    if (max_threads_count == 0)
+        max_threads_count = 1;
+
+    std::vector<float> data(elements_count, 1.0f);
+    float serial_time = measure([&]() { transform(data, 0, elements_count); });
+    printf("parallel_for serial baseline: %.3f ms\n", serial_time);
+    printf("%8s %16s %14s %18s %9s\n", "threads", "empty jobs, ms", "ns per job", "parallel_for, ms", "speedup");
+
+    for (uint32_t threads_count = 1; threads_count <= max_threads_count; threads_count *= 2)
+    {
+        jobs::Scheduler::Settings settings;
+        settings.threads_count = threads_count;
+        jobs::Scheduler scheduler;
+        scheduler.init(settings);
+
+        float empty_jobs_time = measure([&]()
+        {
+            jobs::Counter counter;
+            for (uint32_t i = 0; i < empty_jobs_count; ++i)
+                scheduler.run([]() {}, &counter);
+            scheduler.wait(counter);
+        });
+
+        float parallel_for_time = measure([&]()
+        {
+            scheduler.parallel_for(elements_count, grain_size, [&](uint32_t begin, uint32_t end)
+            {
+                transform(data, begin, end);
+            });
+        });
+
+        printf("%8u %16.3f %14.1f %18.3f %8.2fx\n", threads_count, empty_jobs_time,
+            empty_jobs_time * 1e6f / empty_jobs_count, parallel_for_time, serial_time / parallel_for_time);
+
+        scheduler.destroy();
+
+        if (threads_count < max_threads_count && threads_count * 2 > max_threads_count)
+            threads_count = max_threads_count / 2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,199 @@
+#include "mhemath.hpp"
+#include "transforms.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace mhe;
+
+namespace {
+
+// small enough to stay in cache, the benchmark measures arithmetic and not the memory bandwidth
+const uint32_t elements_count = 1 << 12;
+const uint32_t passes_count = 256;
+const uint32_t repeats_count = 10;
+// dynamic objects per frame for the batched transforms
+const uint32_t objects_count = 50000;
+// typical minUniformBufferOffsetAlignment
+const uint32_t object_stride = 256;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+float elapsed_ms(const Clock::time_point& start)
+{
+    return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+template <class F>
+float measure(F f)
+{
+    float best = 1e30f;
+    for (uint32_t i = 0; i < repeats_count; ++i)
+    {
+        Clock::time_point start = Clock::now();
+        for (uint32_t pass = 0; pass < passes_count; ++pass)
+            f();
+        float time = elapsed_ms(start);
+        if (time < best)
+            best = time;
+    }
+    return best;
+}
+
+float random_float()
+{
+    return static_cast<float>(rand()) / RAND_MAX * 2.0f - 1.0f;
+}
+
+// relative to the magnitude of the reference value, the inverse of a random matrix can be large
+float max_error(const float* res, const float* ref, size_t count)
+{
+    float error = 0.0f;
+    for (size_t i = 0; i < count; ++i)
+        error = std::max(error, std::fabs(res[i] - ref[i]) / std::max(1.0f, std::fabs(ref[i])));
+    return error;
+}
+
+void print_result(const char* name, float scalar_time, float simd_time, float error)
+{
+    printf("%12s %12.3f %12.3f %8.2fx %12g\n", name, scalar_time, simd_time, scalar_time / simd_time, error);
+}
+
+const char* backend_name()
+{
+#if defined(MHE_SIMD_AVX)
+    return "SSE + AVX";
+#elif defined(MHE_SIMD_SSE)
+    return "SSE";
+#elif defined(MHE_SIMD_NEON)
+    return "NEON";
+#else
+    return "scalar";
+#endif
+}
+
+}
+
+int main(int, char**)
+{
+    std::vector<mat4x4> a(elements_count);
+    std::vector<mat4x4> b(elements_count);
+    std::vector<vec4> v(elements_count);
+    for (uint32_t i = 0; i < elements_count; ++i)
+    {
+        for (int j = 0; j < 16; ++j)
+        {
+            a[i].data()[j] = random_float();
+            b[i].data()[j] = random_float();
+        }
+        v[i].set(random_float(), random_float(), random_float(), 1.0f);
+    }
+
+    std::vector<mat4x4> scalar_res(elements_count);
+    std::vector<mat4x4> simd_res(elements_count);
+    std::vector<vec4> scalar_vec_res(elements_count);
+    std::vector<vec4> simd_vec_res(elements_count);
+
+    printf("%u elements x %u passes, SIMD backend: %s\n", elements_count, passes_count, backend_name());
+    printf("%12s %12s %12s %9s %12s\n", "", "scalar, ms", "simd, ms", "speedup", "max error");
+
+    // the templates are called explicitly to get the scalar reference implementation
+    float scalar_time = measure([&]()
+    {
+        for (uint32_t i = 0; i < elements_count; ++i)
+            detail::multiply<float>(scalar_res[i].data(), a[i].data(), b[i].data());
+    });
+    float simd_time = measure([&]()
+    {
+        for (uint32_t i = 0; i < elements_count; ++i)
+            simd_res[i] = a[i] * b[i];
+    });
+    print_result("multiply", scalar_time, simd_time, max_error(simd_res[0].data(), scalar_res[0].data(), elements_count * 16));
+
+    scalar_time = measure([&]()
+    {
+        for (uint32_t i = 0; i < elements_count; ++i)
+            detail::invert<float>(scalar_res[i].data(), a[i].data());
+    });
+    simd_time = measure([&]()
+    {
+        for (uint32_t i = 0; i < elements_count; ++i)
+            detail::invert(simd_res[i].data(), a[i].data());
+    });
+    print_result("inverse", scalar_time, simd_time, max_error(simd_res[0].data(), scalar_res[0].data(), elements_count * 16));
+
+    scalar_time = measure([&]()
+    {
+        for (uint32_t i = 0; i < elements_count; ++i)
+            detail::transpose<float>(scalar_res[i].data(), a[i].data());
+    });
+    simd_time = measure([&]()
+    {
+        for (uint32_t i = 0; i < elements_count; ++i)
+            simd_res[i] = a[i].transposed();
+    });
+    print_result("transpose", scalar_time, simd_time, max_error(simd_res[0].data(), scalar_res[0].data(), elements_count * 16));
+
+    const mat4x4& m = a[0];
+    scalar_time = measure([&]()
+    {
+        for (uint32_t i = 0; i < elements_count; ++i)
+            detail::transform<float>(scalar_vec_res[i].c, v[i].c, m.data());
+    });
+    simd_time = measure([&]()
+    {
+        for (uint32_t i = 0; i < elements_count; ++i)
+            simd_vec_res[i] = v[i] * m;
+    });
+    print_result("vec4 * mat4", scalar_time, simd_time, max_error(simd_vec_res[0].c, scalar_vec_res[0].c, elements_count * 4));
+
+    // one frame of object transforms, every object is built and multiplied separately vs the batched SoA kernel
+    TransformArray transforms;
+    transforms.resize(objects_count);
+    for (uint32_t i = 0; i < objects_count; ++i)
+    {
+        vec4 rotation(random_float(), random_float(), random_float(), random_float());
+        rotation = rotation * (1.0f / std::sqrt(dot(rotation, rotation)));
+        transforms.set(i, vec3(random_float(), random_float(), random_float()), rotation,
+            vec3(random_float() + 2.0f, random_float() + 2.0f, random_float() + 2.0f));
+    }
+    const mat4x4 vp = mat4x4::look_at(vec3(-2.0f, 4.0f, 10.0f), vec3(0.0f, 0.0f, 0.0f), vec3::up()) *
+        mat4x4::perspective(1.0f, 1.5f, 0.1f, 100.0f);
+
+    std::vector<vec4> per_object_buffer(objects_count * object_stride / sizeof(vec4));
+    std::vector<vec4> batched_buffer(objects_count * object_stride / sizeof(vec4));
+    uint8_t* per_object_dst = reinterpret_cast<uint8_t*>(&per_object_buffer[0]);
+    uint8_t* batched_dst = reinterpret_cast<uint8_t*>(&batched_buffer[0]);
+    const uint32_t floats_per_object = object_stride / sizeof(float);
+
+    scalar_time = measure([&]()
+    {
+        for (uint32_t i = 0; i < objects_count; ++i)
+        {
+            ObjectTransform object;
+            object.world = transforms.world(i);
+            object.wvp = object.world * vp;
+            memcpy(per_object_dst + i * object_stride, &object, sizeof(ObjectTransform));
+        }
+    }) / passes_count;
+    simd_time = measure([&]()
+    {
+        compute_transforms(batched_dst, object_stride, transforms, vp, 0, objects_count);
+    }) / passes_count;
+
+    float error = 0.0f;
+    for (uint32_t i = 0; i < objects_count; ++i)
+    {
+        error = std::max(error, max_error(&batched_buffer[0].x + i * floats_per_object, &per_object_buffer[0].x + i * floats_per_object,
+            sizeof(ObjectTransform) / sizeof(float)));
+    }
+    printf("\n%u objects, per frame:\n", objects_count);
+    printf("%12s %12s %12s %9s %12s\n", "", "per object", "batched", "speedup", "max error");
+    print_result("transforms", scalar_time, simd_time, error);
+
+    return 0;
+}
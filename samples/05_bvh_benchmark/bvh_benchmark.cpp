@@ -0,0 +1,223 @@
+#include "bvh.hpp"
+#include "culling.hpp"
+#include "jobs.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace mhe;
+
+namespace {
+
+const uint32_t scene_sizes[] = { 10000, 100000, 1000000 };
+const uint32_t repeats_count = 10;
+const uint32_t rays_count = 10000;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+float elapsed_ms(const Clock::time_point& start)
+{
+    return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+template <class F>
+float measure(F f)
+{
+    float best = 1e30f;
+    for (uint32_t i = 0; i < repeats_count; ++i)
+    {
+        Clock::time_point start = Clock::now();
+        f();
+        float time = elapsed_ms(start);
+        if (time < best)
+            best = time;
+    }
+    return best;
+}
+
+float random_float()
+{
+    return static_cast<float>(rand()) / RAND_MAX;
+}
+
+// boxes of 0.5-2 units spread over a cube above the xz plane, the density doesn't depend on the count
+void create_scene(std::vector<Aabb>& boxes, uint32_t count, float size)
+{
+    boxes.resize(count);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const vec3 center(random_float() * size, (random_float() - 0.5f) * size, random_float() * size);
+        const vec3 extent(0.25f + random_float() * 0.75f, 0.25f + random_float() * 0.75f, 0.25f + random_float() * 0.75f);
+        boxes[i].min = center - extent;
+        boxes[i].max = vec3(center.x + extent.x, center.y + extent.y, center.z + extent.z);
+    }
+}
+
+void move_boxes(std::vector<Aabb>& boxes)
+{
+    for (size_t i = 0, size = boxes.size(); i < size; ++i)
+    {
+        const vec3 offset(random_float() - 0.5f, random_float() - 0.5f, random_float() - 0.5f);
+        boxes[i].min = vec3(boxes[i].min.x + offset.x, boxes[i].min.y + offset.y, boxes[i].min.z + offset.z);
+        boxes[i].max = vec3(boxes[i].max.x + offset.x, boxes[i].max.y + offset.y, boxes[i].max.z + offset.z);
+    }
+}
+
+// the results of the linear culler are sorted, the ones of the tree are in the order of its leaves
+bool same_results(std::vector<uint32_t>& a, uint32_t a_count, std::vector<uint32_t>& b, uint32_t b_count)
+{
+    if (a_count != b_count)
+        return false;
+    std::sort(a.begin(), a.begin() + a_count);
+    std::sort(b.begin(), b.begin() + b_count);
+    return std::equal(a.begin(), a.begin() + a_count, b.begin());
+}
+
+struct Camera
+{
+    const char* name;
+    vec3 position;
+    vec3 target;
+    float fov;
+    // of the scene size
+    float far;
+};
+
+// The wide camera on the edge looking at the center sees about a quarter of the scene, the linear culler
+// wins there. The narrow one inside of the scene sees a small fraction of it, the tree skips the rest.
+void cameras(Camera* result, float size)
+{
+    const Camera wide = { "wide", vec3(0.0f, 0.0f, 0.0f), vec3(size * 0.5f, 0.0f, size * 0.5f), 1.0f, 0.75f };
+    const Camera narrow = { "narrow", vec3(size * 0.5f, 0.0f, size * 0.5f), vec3(size, 0.0f, size * 0.5f), 0.5f, 0.25f };
+    result[0] = wide;
+    result[1] = narrow;
+}
+
+const uint32_t cameras_count = 2;
+
+void benchmark(jobs::Scheduler& scheduler, uint32_t count)
+{
+    const float size = 4.0f * std::cbrt(static_cast<float>(count));
+    std::vector<Aabb> boxes;
+    create_scene(boxes, count, size);
+
+    Camera scene_cameras[cameras_count];
+    cameras(scene_cameras, size);
+    Frustum frustums[cameras_count];
+    for (uint32_t i = 0; i < cameras_count; ++i)
+    {
+        const Camera& c = scene_cameras[i];
+        extract_frustum(frustums[i], mat4x4::look_at(c.position, c.target, vec3::up()) *
+            mat4x4::perspective(c.fov, 1.5f, 1.0f, size * c.far));
+    }
+    const vec3 camera = scene_cameras[0].position;
+
+    BoxArray box_array;
+    box_array.resize(count);
+    for (uint32_t i = 0; i < count; ++i)
+        box_array.set(i, boxes[i]);
+
+    SceneBVH bvh;
+    const float build_time = measure([&]()
+    {
+        bvh.build(&boxes[0], count);
+    });
+    const float parallel_build_time = measure([&]()
+    {
+        bvh.build(&boxes[0], count, SceneBVH::Settings(), &scheduler);
+    });
+
+    std::vector<uint32_t> linear_visible(count);
+    std::vector<uint32_t> bvh_visible(count);
+    uint32_t linear_counts[cameras_count];
+    float linear_times[cameras_count];
+    float bvh_times[cameras_count];
+    bool valid = true;
+    for (uint32_t i = 0; i < cameras_count; ++i)
+    {
+        uint32_t bvh_count = 0;
+        linear_times[i] = measure([&]()
+        {
+            linear_counts[i] = cull_boxes(&linear_visible[0], frustums[i], box_array, 0, count);
+        });
+        bvh_times[i] = measure([&]()
+        {
+            bvh_count = bvh.cull(&bvh_visible[0], frustums[i]);
+        });
+        valid = valid && same_results(linear_visible, linear_counts[i], bvh_visible, bvh_count);
+    }
+
+    // the moved boxes are refitted, the culling gets slower as the tree gets worse
+    move_boxes(boxes);
+    const float refit_time = measure([&]()
+    {
+        bvh.refit(&boxes[0]);
+    });
+    for (uint32_t i = 0; i < count; ++i)
+        box_array.set(i, boxes[i]);
+    float refitted_times[cameras_count];
+    for (uint32_t i = 0; i < cameras_count; ++i)
+    {
+        uint32_t bvh_count = 0;
+        refitted_times[i] = measure([&]()
+        {
+            bvh_count = bvh.cull(&bvh_visible[0], frustums[i]);
+        });
+        const uint32_t linear_count = cull_boxes(&linear_visible[0], frustums[i], box_array, 0, count);
+        valid = valid && same_results(linear_visible, linear_count, bvh_visible, bvh_count);
+    }
+
+    // nearest hits of random rays from the camera and the boxes around random points
+    std::vector<vec3> directions(rays_count);
+    std::vector<vec3> points(rays_count);
+    for (uint32_t i = 0; i < rays_count; ++i)
+    {
+        directions[i] = vec3(random_float(), random_float() - 0.5f, random_float());
+        points[i] = vec3(random_float() * size, (random_float() - 0.5f) * size, random_float() * size);
+    }
+    uint32_t hits_count = 0;
+    const float ray_time = measure([&]()
+    {
+        hits_count = 0;
+        SceneBVH::RayHit hit;
+        for (uint32_t i = 0; i < rays_count; ++i)
+            hits_count += bvh.raycast(hit, camera, directions[i], size * 2.0f) ? 1 : 0;
+    });
+    uint32_t point_results_count = 0;
+    const float point_time = measure([&]()
+    {
+        point_results_count = 0;
+        for (uint32_t i = 0; i < rays_count; ++i)
+            point_results_count += bvh.query_point(&bvh_visible[0], points[i]);
+    });
+
+    printf("%8u %10.3f %10.3f %10.3f %10.3f %10.3f %s\n", count, build_time, parallel_build_time, refit_time,
+        ray_time, point_time, valid ? "ok" : "MISMATCH");
+    for (uint32_t i = 0; i < cameras_count; ++i)
+    {
+        printf("%8s %8s %8u %10.3f %10.3f %8.2fx %10.3f\n", "", scene_cameras[i].name, linear_counts[i], linear_times[i],
+            bvh_times[i], linear_times[i] / bvh_times[i], refitted_times[i]);
+    }
+}
+
+}
+
+int main(int, char**)
+{
+    jobs::Scheduler::Settings settings;
+    jobs::Scheduler scheduler;
+    scheduler.init(settings);
+
+    printf("times in ms, %u rays and points per query\n", rays_count);
+    printf("%8s %10s %10s %10s %10s %10s\n", "boxes", "build", "par build", "refit", "rays", "points");
+    printf("%8s %8s %8s %10s %10s %9s %10s\n", "", "camera", "visible", "linear", "bvh", "speedup", "refitted");
+    for (uint32_t i = 0; i < sizeof(scene_sizes) / sizeof(scene_sizes[0]); ++i)
+        benchmark(scheduler, scene_sizes[i]);
+
+    scheduler.destroy();
+    return 0;
+}
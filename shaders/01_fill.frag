@@ -14,5 +14,5 @@ void main()
 {
     vec3 nrm = normalize(vs_nrm);
     out_color = texture(main_texture, vs_tex);
-    out_normal = vec4(vs_nrm, 1.0f);
+    out_normal = vec4(nrm, 1.0f);
 }
@@ -20,9 +20,10 @@ layout (set = 1, binding = 0) uniform PerModel
 layout(location = 0) out vec3 vs_nrm;
 layout(location = 1) out vec2 vs_tex;
 
+// invariant for the depth pre-pass of depth_only.vert
 out gl_PerVertex
 {
-    vec4 gl_Position;
+    invariant vec4 gl_Position;
 };
 
 void main()
@@ -0,0 +1,27 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// the position stream of the geometry pool, the G-buffer pass tests its depth for equality
+layout (location = 0) in vec3 pos;
+
+layout (set = 0, binding = 0) uniform PerCamera
+{
+    mat4 vp;
+};
+
+layout (set = 1, binding = 0) uniform PerModel
+{
+    mat4 world;
+};
+
+// the same math as 01_fill.vert, both are invariant to get the same depth
+out gl_PerVertex
+{
+    invariant vec4 gl_Position;
+};
+
+void main()
+{
+    gl_Position = vp * world * vec4(pos, 1);
+}
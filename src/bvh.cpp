@@ -0,0 +1,586 @@
+#include "bvh.hpp"
+#include "jobs.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+namespace mhe {
+
+namespace {
+
+const uint32_t invalid_node = std::numeric_limits<uint32_t>::max();
+const uint32_t max_bins_count = 32;
+const uint32_t all_planes_mask = (1u << Frustum::planes_count) - 1;
+// of a node relative to the test of a primitive, the leaves are culled 4 or 8 boxes at once
+const float traversal_cost = 4.0f;
+
+struct Bounds
+{
+    float min[3];
+    float max[3];
+
+    // not a constructor, the arrays of the bins are only reset up to the bins count
+    void reset()
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            min[i] = std::numeric_limits<float>::max();
+            max[i] = -std::numeric_limits<float>::max();
+        }
+    }
+
+    void grow(const float* p)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            min[i] = std::min(min[i], p[i]);
+            max[i] = std::max(max[i], p[i]);
+        }
+    }
+
+    void grow(const Bounds& other)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            min[i] = std::min(min[i], other.min[i]);
+            max[i] = std::max(max[i], other.max[i]);
+        }
+    }
+
+    void grow(const Aabb& box)
+    {
+        min[0] = std::min(min[0], box.min.x);
+        min[1] = std::min(min[1], box.min.y);
+        min[2] = std::min(min[2], box.min.z);
+        max[0] = std::max(max[0], box.max.x);
+        max[1] = std::max(max[1], box.max.y);
+        max[2] = std::max(max[2], box.max.z);
+    }
+
+    // half of the surface area, the heuristic only needs the ratios
+    float area() const
+    {
+        const float dx = max[0] - min[0];
+        const float dy = max[1] - min[1];
+        const float dz = max[2] - min[2];
+        return dx * dy + dy * dz + dz * dx;
+    }
+};
+
+struct BuildNode
+{
+    Bounds bounds;
+    // invalid_node for the leaves
+    uint32_t left;
+    uint32_t right;
+    uint32_t first;
+    uint32_t count;
+};
+
+// a copy of the box next to its index, the build passes read the primitives sequentially
+struct BuildPrimitive
+{
+    Bounds bounds;
+    uint32_t index;
+
+    float centroid(uint32_t axis) const
+    {
+        return (bounds.min[axis] + bounds.max[axis]) * 0.5f;
+    }
+};
+
+struct Bin
+{
+    Bounds bounds;
+    uint32_t count;
+};
+
+// Top-down binned SAH build. The nodes are allocated from a preallocated array, so the subtrees are built
+// by different jobs, every job partitions its own range of the primitives.
+class Builder
+{
+public:
+    Builder(const Aabb* boxes, uint32_t count, const SceneBVH::Settings& settings, jobs::Scheduler* scheduler) :
+        nodes(std::max(count * 2, 1u)),
+        nodes_count(1),
+        primitives(count),
+        bins_count_(std::min(std::max(settings.bins_count, 2u), max_bins_count)),
+        max_leaf_size_(std::max(settings.max_leaf_size, 1u)),
+        parallel_threshold_(std::max(settings.parallel_threshold, 2u)),
+        scheduler_(scheduler)
+    {
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            primitives[i].bounds.reset();
+            primitives[i].bounds.grow(boxes[i]);
+            primitives[i].index = i;
+        }
+    }
+
+    void build(uint32_t node_index, uint32_t begin, uint32_t end, uint32_t depth);
+
+    std::vector<BuildNode> nodes;
+    std::atomic<uint32_t> nodes_count;
+    // in the order of the leaves when the build is done
+    std::vector<BuildPrimitive> primitives;
+private:
+    static uint32_t bin_index(float value, float min, float scale, uint32_t bins_count)
+    {
+        const uint32_t bin = static_cast<uint32_t>((value - min) * scale);
+        return std::min(bin, bins_count - 1);
+    }
+
+    uint32_t bins_count_;
+    uint32_t max_leaf_size_;
+    uint32_t parallel_threshold_;
+    jobs::Scheduler* scheduler_;
+};
+
+void Builder::build(uint32_t node_index, uint32_t begin, uint32_t end, uint32_t depth)
+{
+    BuildNode& node = nodes[node_index];
+    node.bounds.reset();
+    Bounds centroid_bounds;
+    centroid_bounds.reset();
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        const BuildPrimitive& primitive = primitives[i];
+        node.bounds.grow(primitive.bounds);
+        const float centroid[3] = { primitive.centroid(0), primitive.centroid(1), primitive.centroid(2) };
+        centroid_bounds.grow(centroid);
+    }
+    node.first = begin;
+    node.count = end - begin;
+    node.left = node.right = invalid_node;
+    const uint32_t count = end - begin;
+    if (count <= 1 || depth + 1 >= SceneBVH::max_depth)
+        return;
+
+    // the best split between the bins of the centroids over all the axes, the small nodes need fewer bins
+    const uint32_t bins_count = std::min(bins_count_, count);
+    float best_cost = std::numeric_limits<float>::max();
+    uint32_t best_axis = 3;
+    uint32_t best_bin = 0;
+    float best_scale = 0.0f;
+    // the bins of all the axes are filled in one pass over the primitives
+    Bin bins[3][max_bins_count];
+    float scales[3];
+    for (uint32_t axis = 0; axis < 3; ++axis)
+    {
+        const float extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+        scales[axis] = extent > 0.0f ? bins_count / extent : 0.0f;
+        for (uint32_t i = 0; i < bins_count; ++i)
+        {
+            bins[axis][i].bounds.reset();
+            bins[axis][i].count = 0;
+        }
+    }
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        const BuildPrimitive& primitive = primitives[i];
+        for (uint32_t axis = 0; axis < 3; ++axis)
+        {
+            Bin& bin = bins[axis][bin_index(primitive.centroid(axis), centroid_bounds.min[axis], scales[axis], bins_count)];
+            bin.bounds.grow(primitive.bounds);
+            ++bin.count;
+        }
+    }
+    for (uint32_t axis = 0; axis < 3; ++axis)
+    {
+        if (scales[axis] <= 0.0f)
+            continue;
+        const float scale = scales[axis];
+        const Bin* axis_bins = bins[axis];
+
+        // the cost of the right side of every split, the left side is accumulated in the second sweep
+        float right_costs[max_bins_count];
+        Bounds right;
+        right.reset();
+        uint32_t right_count = 0;
+        for (uint32_t i = bins_count - 1; i > 0; --i)
+        {
+            right.grow(axis_bins[i].bounds);
+            right_count += axis_bins[i].count;
+            right_costs[i - 1] = right_count > 0 ? right.area() * right_count : -1.0f;
+        }
+        Bounds left;
+        left.reset();
+        uint32_t left_count = 0;
+        for (uint32_t i = 0; i + 1 < bins_count; ++i)
+        {
+            left.grow(axis_bins[i].bounds);
+            left_count += axis_bins[i].count;
+            if (left_count == 0 || right_costs[i] < 0.0f)
+                continue;
+            const float cost = left.area() * left_count + right_costs[i];
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = i;
+                best_scale = scale;
+            }
+        }
+    }
+
+    uint32_t middle = begin + count / 2;
+    if (best_axis < 3)
+    {
+        const float area = node.bounds.area();
+        const float split_cost = traversal_cost + (area > 0.0f ? best_cost / area : static_cast<float>(count));
+        if (count <= max_leaf_size_ && split_cost >= static_cast<float>(count))
+            return;
+        const float min = centroid_bounds.min[best_axis];
+        middle = static_cast<uint32_t>(std::partition(primitives.begin() + begin, primitives.begin() + end,
+            [&](const BuildPrimitive& primitive)
+        {
+            return bin_index(primitive.centroid(best_axis), min, best_scale, bins_count) <= best_bin;
+        }) - primitives.begin());
+        if (middle == begin || middle == end)
+            middle = begin + count / 2;
+    }
+    else if (count <= max_leaf_size_)
+    {
+        // all the centroids are the same, the order doesn't matter
+        return;
+    }
+
+    const uint32_t left = nodes_count.fetch_add(2);
+    node.left = left;
+    node.right = left + 1;
+    if (scheduler_ != nullptr && middle - begin >= parallel_threshold_ && end - middle >= parallel_threshold_)
+    {
+        jobs::Counter counter;
+        scheduler_->run([this, left, middle, end, depth]()
+        {
+            build(left + 1, middle, end, depth + 1);
+        }, &counter);
+        build(left, begin, middle, depth + 1);
+        scheduler_->wait(counter);
+    }
+    else
+    {
+        build(left, begin, middle, depth + 1);
+        build(left + 1, middle, end, depth + 1);
+    }
+}
+
+// depth-first order, the left child goes right after its parent
+uint32_t flatten(std::vector<SceneBVH::Node>& nodes, const std::vector<BuildNode>& build_nodes, uint32_t build_index)
+{
+    const BuildNode& build_node = build_nodes[build_index];
+    const uint32_t index = static_cast<uint32_t>(nodes.size());
+    nodes.push_back(SceneBVH::Node());
+    for (int i = 0; i < 3; ++i)
+    {
+        nodes[index].min[i] = build_node.bounds.min[i];
+        nodes[index].max[i] = build_node.bounds.max[i];
+    }
+    if (build_node.left == invalid_node)
+    {
+        nodes[index].offset = build_node.first;
+        nodes[index].count = build_node.count;
+        return index;
+    }
+    flatten(nodes, build_nodes, build_node.left);
+    const uint32_t right = flatten(nodes, build_nodes, build_node.right);
+    nodes[index].offset = right;
+    nodes[index].count = 0;
+    return index;
+}
+
+// -1 outside, the planes the box is completely inside of are removed from mask
+int classify(const float* min, const float* max, const Frustum& frustum, uint32_t& mask)
+{
+    const float center[3] = { (min[0] + max[0]) * 0.5f, (min[1] + max[1]) * 0.5f, (min[2] + max[2]) * 0.5f };
+    const float extent[3] = { (max[0] - min[0]) * 0.5f, (max[1] - min[1]) * 0.5f, (max[2] - min[2]) * 0.5f };
+    for (uint32_t i = 0; i < Frustum::planes_count; ++i)
+    {
+        if ((mask & (1u << i)) == 0)
+            continue;
+        const vec4& plane = frustum.planes[i];
+        const float distance = plane.x * center[0] + plane.y * center[1] + plane.z * center[2] + plane.w;
+        const float radius = std::fabs(plane.x) * extent[0] + std::fabs(plane.y) * extent[1] + std::fabs(plane.z) * extent[2];
+        if (distance + radius < 0.0f)
+            return -1;
+        if (distance - radius >= 0.0f)
+            mask &= ~(1u << i);
+    }
+    return 0;
+}
+
+// the primitives of a subtree are contiguous, from its leftmost leaf to the end of its rightmost one
+void subtree_primitives(const std::vector<SceneBVH::Node>& nodes, uint32_t index, uint32_t& begin, uint32_t& end)
+{
+    uint32_t left = index;
+    while (nodes[left].count == 0)
+        ++left;
+    uint32_t right = index;
+    while (nodes[right].count == 0)
+        right = nodes[right].offset;
+    begin = nodes[left].offset;
+    end = nodes[right].offset + nodes[right].count;
+}
+
+// the visible boxes of [begin, end) by cull_boxes(), the indices are replaced with the ones of the primitives
+uint32_t cull_leaves(uint32_t* visible, uint32_t count, const Frustum& frustum, const BoxArray& boxes,
+    const std::vector<uint32_t>& primitives, uint32_t begin, uint32_t end)
+{
+    if (begin == end)
+        return count;
+    const uint32_t leaves_count = cull_boxes(visible + count, frustum, boxes, begin, end);
+    for (uint32_t i = count, last = count + leaves_count; i < last; ++i)
+        visible[i] = primitives[visible[i]];
+    return count + leaves_count;
+}
+
+void box_bounds(const BoxArray& boxes, uint32_t index, float* min, float* max)
+{
+    const float center[3] = { boxes.component(BoxArray::center_x)[index], boxes.component(BoxArray::center_y)[index],
+        boxes.component(BoxArray::center_z)[index] };
+    const float extent[3] = { boxes.component(BoxArray::extent_x)[index], boxes.component(BoxArray::extent_y)[index],
+        boxes.component(BoxArray::extent_z)[index] };
+    for (int i = 0; i < 3; ++i)
+    {
+        min[i] = center[i] - extent[i];
+        max[i] = center[i] + extent[i];
+    }
+}
+
+// the entry distance of the ray into the box, false when it misses it or enters beyond max_distance
+bool intersect_ray(float& distance, const float* min, const float* max, const float* origin, const float* inv_direction,
+    float max_distance)
+{
+    float t_near = 0.0f;
+    float t_far = max_distance;
+    for (int i = 0; i < 3; ++i)
+    {
+        float t0 = (min[i] - origin[i]) * inv_direction[i];
+        float t1 = (max[i] - origin[i]) * inv_direction[i];
+        if (t0 > t1)
+            std::swap(t0, t1);
+        // NaN when the origin is on the slab parallel to the ray, the comparisons keep the other axes
+        t_near = t0 > t_near ? t0 : t_near;
+        t_far = t1 < t_far ? t1 : t_far;
+    }
+    distance = t_near;
+    return t_near <= t_far;
+}
+
+bool contains(const float* min, const float* max, const vec3& point)
+{
+    return point.x >= min[0] && point.x <= max[0] && point.y >= min[1] && point.y <= max[1] &&
+        point.z >= min[2] && point.z <= max[2];
+}
+
+}
+
+void SceneBVH::build(const Aabb* boxes, uint32_t count, const Settings& settings, jobs::Scheduler* scheduler)
+{
+    nodes_.clear();
+    primitives_.resize(count);
+    boxes_.resize(count);
+    if (count == 0)
+        return;
+    Builder builder(boxes, count, settings, scheduler);
+    builder.build(0, 0, count, 0);
+
+    nodes_.reserve(builder.nodes_count.load());
+    flatten(nodes_, builder.nodes, 0);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        primitives_[i] = builder.primitives[i].index;
+        boxes_.set(i, boxes[primitives_[i]]);
+    }
+}
+
+void SceneBVH::refit(const Aabb* boxes)
+{
+    for (uint32_t i = 0, size = this->size(); i < size; ++i)
+        boxes_.set(i, boxes[primitives_[i]]);
+
+    // the children follow their parents, so they're updated first in the reverse order
+    for (size_t i = nodes_.size(); i-- > 0;)
+    {
+        Node& node = nodes_[i];
+        Bounds bounds;
+        bounds.reset();
+        if (node.count > 0)
+        {
+            for (uint32_t j = node.offset, end = node.offset + node.count; j < end; ++j)
+            {
+                float min[3];
+                float max[3];
+                box_bounds(boxes_, j, min, max);
+                bounds.grow(min);
+                bounds.grow(max);
+            }
+        }
+        else
+        {
+            const Node& left = nodes_[i + 1];
+            const Node& right = nodes_[node.offset];
+            bounds.grow(left.min);
+            bounds.grow(left.max);
+            bounds.grow(right.min);
+            bounds.grow(right.max);
+        }
+        for (int j = 0; j < 3; ++j)
+        {
+            node.min[j] = bounds.min[j];
+            node.max[j] = bounds.max[j];
+        }
+    }
+}
+
+uint32_t SceneBVH::cull(uint32_t* visible, const Frustum& frustum) const
+{
+    if (nodes_.empty())
+        return 0;
+
+    // the planes a node is inside of aren't tested for its children
+    struct Entry
+    {
+        uint32_t node;
+        uint32_t mask;
+    };
+    Entry stack[max_depth + 1];
+    uint32_t stack_size = 0;
+    stack[stack_size++] = { 0, all_planes_mask };
+    uint32_t count = 0;
+    // The leaves crossing the planes are culled by cull_boxes() like the linear culler, the leaves are visited
+    // in their order, so the neighbouring ones are culled together.
+    uint32_t range_begin = 0;
+    uint32_t range_end = 0;
+    while (stack_size > 0)
+    {
+        const Entry entry = stack[--stack_size];
+        const Node& node = nodes_[entry.node];
+        uint32_t mask = entry.mask;
+        if (classify(node.min, node.max, frustum, mask) < 0)
+            continue;
+        if (mask == 0)
+        {
+            // the whole subtree is inside
+            uint32_t begin;
+            uint32_t end;
+            subtree_primitives(nodes_, entry.node, begin, end);
+            std::copy(primitives_.begin() + begin, primitives_.begin() + end, visible + count);
+            count += end - begin;
+            continue;
+        }
+        if (node.count > 0)
+        {
+            if (node.offset != range_end)
+            {
+                count = cull_leaves(visible, count, frustum, boxes_, primitives_, range_begin, range_end);
+                range_begin = node.offset;
+            }
+            range_end = node.offset + node.count;
+            continue;
+        }
+        stack[stack_size++] = { node.offset, mask };
+        stack[stack_size++] = { entry.node + 1, mask };
+    }
+    return cull_leaves(visible, count, frustum, boxes_, primitives_, range_begin, range_end);
+}
+
+bool SceneBVH::raycast(RayHit& hit, const vec3& origin, const vec3& direction, float max_distance) const
+{
+    if (nodes_.empty())
+        return false;
+
+    const float o[3] = { origin.x, origin.y, origin.z };
+    const float inv_direction[3] = { 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+    hit.index = invalid_node;
+    hit.distance = max_distance;
+
+    float distance;
+    if (!intersect_ray(distance, nodes_[0].min, nodes_[0].max, o, inv_direction, hit.distance))
+        return false;
+    // the nearer child is visited first, the farther one is skipped when a closer hit is found meanwhile
+    struct Entry
+    {
+        uint32_t node;
+        float distance;
+    };
+    Entry stack[max_depth + 1];
+    uint32_t stack_size = 0;
+    stack[stack_size++] = { 0, distance };
+    while (stack_size > 0)
+    {
+        const Entry entry = stack[--stack_size];
+        if (entry.distance > hit.distance)
+            continue;
+        const Node& node = nodes_[entry.node];
+        if (node.count > 0)
+        {
+            for (uint32_t i = node.offset, end = node.offset + node.count; i < end; ++i)
+            {
+                float min[3];
+                float max[3];
+                box_bounds(boxes_, i, min, max);
+                if (intersect_ray(distance, min, max, o, inv_direction, hit.distance) &&
+                    (distance < hit.distance || hit.index == invalid_node))
+                {
+                    hit.index = primitives_[i];
+                    hit.distance = distance;
+                }
+            }
+            continue;
+        }
+
+        float left_distance;
+        float right_distance;
+        const Node& left = nodes_[entry.node + 1];
+        const Node& right = nodes_[node.offset];
+        const bool left_hit = intersect_ray(left_distance, left.min, left.max, o, inv_direction, hit.distance);
+        const bool right_hit = intersect_ray(right_distance, right.min, right.max, o, inv_direction, hit.distance);
+        if (left_hit && right_hit)
+        {
+            const bool left_first = left_distance <= right_distance;
+            stack[stack_size++] = left_first ? Entry{ node.offset, right_distance } : Entry{ entry.node + 1, left_distance };
+            stack[stack_size++] = left_first ? Entry{ entry.node + 1, left_distance } : Entry{ node.offset, right_distance };
+        }
+        else if (left_hit)
+            stack[stack_size++] = { entry.node + 1, left_distance };
+        else if (right_hit)
+            stack[stack_size++] = { node.offset, right_distance };
+    }
+    return hit.index != invalid_node;
+}
+
+uint32_t SceneBVH::query_point(uint32_t* result, const vec3& point) const
+{
+    if (nodes_.empty())
+        return 0;
+
+    uint32_t stack[max_depth + 1];
+    uint32_t stack_size = 0;
+    stack[stack_size++] = 0;
+    uint32_t count = 0;
+    while (stack_size > 0)
+    {
+        const Node& node = nodes_[stack[--stack_size]];
+        if (!contains(node.min, node.max, point))
+            continue;
+        if (node.count > 0)
+        {
+            for (uint32_t i = node.offset, end = node.offset + node.count; i < end; ++i)
+            {
+                float min[3];
+                float max[3];
+                box_bounds(boxes_, i, min, max);
+                if (contains(min, max, point))
+                    result[count++] = primitives_[i];
+            }
+            continue;
+        }
+        stack[stack_size++] = node.offset;
+        stack[stack_size++] = static_cast<uint32_t>(&node - &nodes_[0]) + 1;
+    }
+    return count;
+}
+
+}
@@ -0,0 +1,94 @@
+#ifndef __BVH_HPP__
+#define __BVH_HPP__
+
+#include <vector>
+#include <cstdint>
+
+#include "culling.hpp"
+
+namespace mhe {
+
+namespace jobs {
+class Scheduler;
+}
+
+// Bounding volume hierarchy over the boxes of the scene, the primitives are referenced by their index in the array
+// passed to build(). The nodes are in the depth-first order, so the left child of a node is the next one.
+class SceneBVH
+{
+public:
+    struct Settings
+    {
+        // smaller nodes become leaves when it's cheaper by the surface area heuristic
+        uint32_t max_leaf_size;
+        uint32_t bins_count;
+        // smaller subtrees are built by the same job
+        uint32_t parallel_threshold;
+
+        Settings() :
+            max_leaf_size(4),
+            bins_count(16),
+            parallel_threshold(8192)
+        {}
+    };
+
+    // 32 bytes, two nodes per cache line
+    struct Node
+    {
+        float min[3];
+        // the first primitive of a leaf in primitives(), the right child of an inner node
+        uint32_t offset;
+        float max[3];
+        // 0 for the inner nodes
+        uint32_t count;
+    };
+
+    struct RayHit
+    {
+        uint32_t index;
+        // to the box along the ray, 0 when the origin is inside
+        float distance;
+    };
+
+    // the depth of the tree and of the queries' stacks
+    static const uint32_t max_depth = 64;
+
+    // The subtrees are built by the scheduler's threads when it's passed, it must be called from one of them then.
+    void build(const Aabb* boxes, uint32_t count, const Settings& settings = Settings(), jobs::Scheduler* scheduler = nullptr);
+    // Updates the bounds for the moved boxes keeping the topology, the quality of the tree degrades
+    // when they move far, rebuild it then.
+    void refit(const Aabb* boxes);
+
+    // The indices of the boxes intersecting the frustum by the test of cull_boxes(), visible must have room
+    // for size() of them. Returns their number.
+    uint32_t cull(uint32_t* visible, const Frustum& frustum) const;
+    // the nearest box hit by the ray within max_distance, direction doesn't have to be normalized
+    bool raycast(RayHit& hit, const vec3& origin, const vec3& direction, float max_distance) const;
+    // the boxes containing the point, result must have room for size() of them
+    uint32_t query_point(uint32_t* result, const vec3& point) const;
+
+    uint32_t size() const
+    {
+        return static_cast<uint32_t>(primitives_.size());
+    }
+
+    const std::vector<Node>& nodes() const
+    {
+        return nodes_;
+    }
+
+    // the indices of the boxes in the order of the leaves
+    const std::vector<uint32_t>& primitives() const
+    {
+        return primitives_;
+    }
+private:
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> primitives_;
+    // the boxes in the order of primitives_, the leaves crossing the planes are culled by cull_boxes()
+    BoxArray boxes_;
+};
+
+}
+
+#endif
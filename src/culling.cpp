@@ -0,0 +1,197 @@
+#include "culling.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace mhe {
+
+void extract_frustum(Frustum& frustum, const mat4x4& m)
+{
+    // clip = p * m, so the clip coordinates are the dot products with the columns
+    vec4 columns[4];
+    for (int i = 0; i < 4; ++i)
+        columns[i] = vec4(m(0, i), m(1, i), m(2, i), m(3, i));
+
+    frustum.planes[Frustum::left_plane] = columns[3] + columns[0];
+    frustum.planes[Frustum::right_plane] = columns[3] - columns[0];
+    frustum.planes[Frustum::bottom_plane] = columns[3] + columns[1];
+    frustum.planes[Frustum::top_plane] = columns[3] - columns[1];
+    frustum.planes[Frustum::near_plane] = columns[2];
+    frustum.planes[Frustum::far_plane] = columns[3] - columns[2];
+
+    for (int i = 0; i < Frustum::planes_count; ++i)
+    {
+        vec4& plane = frustum.planes[i];
+        const float length = std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+        if (length > 0.0f)
+            plane = plane * (1.0f / length);
+    }
+}
+
+bool sphere_visible(const Frustum& frustum, const vec3& center, float radius)
+{
+    for (int i = 0; i < Frustum::planes_count; ++i)
+    {
+        const vec4& plane = frustum.planes[i];
+        if (plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w < -radius)
+            return false;
+    }
+    return true;
+}
+
+Aabb transform_box(const Aabb& box, const mat4x4& m)
+{
+    // the center is transformed as a point, the extent by the absolute values of the 3x3 part
+    const vec3 center = box.center();
+    const vec3 extent = box.extent();
+    const float c[3] = { center.x, center.y, center.z };
+    const float e[3] = { extent.x, extent.y, extent.z };
+    float res_center[3];
+    float res_extent[3];
+    for (int j = 0; j < 3; ++j)
+    {
+        res_center[j] = m(3, j);
+        res_extent[j] = 0.0f;
+        for (int i = 0; i < 3; ++i)
+        {
+            res_center[j] += c[i] * m(i, j);
+            res_extent[j] += e[i] * std::fabs(m(i, j));
+        }
+    }
+    Aabb res;
+    res.min = vec3(res_center[0] - res_extent[0], res_center[1] - res_extent[1], res_center[2] - res_extent[2]);
+    res.max = vec3(res_center[0] + res_extent[0], res_center[1] + res_extent[1], res_center[2] + res_extent[2]);
+    return res;
+}
+
+void BoxArray::resize(uint32_t size)
+{
+    const uint32_t old_size = std::min(size_, size);
+    const uint32_t capacity = (size + 7) & ~7u;
+    if (capacity != capacity_)
+    {
+        std::vector<vec4> storage(components_count * capacity / 4);
+        for (uint32_t c = 0; c < components_count; ++c)
+        {
+            if (old_size > 0)
+                memcpy(&storage[c * capacity / 4], &storage_[c * capacity_ / 4], old_size * sizeof(float));
+        }
+        storage_.swap(storage);
+        capacity_ = capacity;
+    }
+    size_ = size;
+
+    for (uint32_t i = old_size; i < capacity_; ++i)
+        set(i, Aabb());
+}
+
+namespace {
+
+// the lanes of mask are the boxes from first, only the ones in [begin, end) are written
+uint32_t write_visible(uint32_t* visible, uint32_t count, uint32_t mask, uint32_t first, uint32_t begin, uint32_t end)
+{
+    for (; mask != 0; mask &= mask - 1)
+    {
+        uint32_t lane = 0;
+        while ((mask & (1u << lane)) == 0)
+            ++lane;
+        const uint32_t index = first + lane;
+        if (index >= begin && index < end)
+            visible[count++] = index;
+    }
+    return count;
+}
+
+}
+
+uint32_t cull_boxes(uint32_t* visible, const Frustum& frustum, const BoxArray& boxes, uint32_t begin, uint32_t end)
+{
+    const float* cx = boxes.component(BoxArray::center_x);
+    const float* cy = boxes.component(BoxArray::center_y);
+    const float* cz = boxes.component(BoxArray::center_z);
+    const float* ex = boxes.component(BoxArray::extent_x);
+    const float* ey = boxes.component(BoxArray::extent_y);
+    const float* ez = boxes.component(BoxArray::extent_z);
+
+    // A box is outside when it's behind a plane even with its corner closest to the normal:
+    // dot(n, c) + w + dot(abs(n), e) < 0. The planes are the same for all the boxes.
+    float planes[Frustum::planes_count][7];
+    for (int i = 0; i < Frustum::planes_count; ++i)
+    {
+        const vec4& plane = frustum.planes[i];
+        planes[i][0] = plane.x;
+        planes[i][1] = plane.y;
+        planes[i][2] = plane.z;
+        planes[i][3] = plane.w;
+        planes[i][4] = std::fabs(plane.x);
+        planes[i][5] = std::fabs(plane.y);
+        planes[i][6] = std::fabs(plane.z);
+    }
+
+    uint32_t count = 0;
+#if defined(MHE_SIMD_AVX)
+    __m256 p[Frustum::planes_count][7];
+    for (int i = 0; i < Frustum::planes_count; ++i)
+    {
+        for (int j = 0; j < 7; ++j)
+            p[i][j] = _mm256_set1_ps(planes[i][j]);
+    }
+    // 8 boxes per iteration, the arrays are only 16 bytes aligned
+    for (uint32_t first = begin & ~7u; first < end; first += 8)
+    {
+        const __m256 x = _mm256_loadu_ps(cx + first);
+        const __m256 y = _mm256_loadu_ps(cy + first);
+        const __m256 z = _mm256_loadu_ps(cz + first);
+        const __m256 w = _mm256_loadu_ps(ex + first);
+        const __m256 h = _mm256_loadu_ps(ey + first);
+        const __m256 d = _mm256_loadu_ps(ez + first);
+        __m256 distance = _mm256_set1_ps(std::numeric_limits<float>::max());
+        for (int i = 0; i < Frustum::planes_count; ++i)
+        {
+            __m256 v = _mm256_add_ps(_mm256_mul_ps(x, p[i][0]), p[i][3]);
+            v = _mm256_add_ps(v, _mm256_mul_ps(y, p[i][1]));
+            v = _mm256_add_ps(v, _mm256_mul_ps(z, p[i][2]));
+            v = _mm256_add_ps(v, _mm256_mul_ps(w, p[i][4]));
+            v = _mm256_add_ps(v, _mm256_mul_ps(h, p[i][5]));
+            v = _mm256_add_ps(v, _mm256_mul_ps(d, p[i][6]));
+            distance = _mm256_min_ps(distance, v);
+        }
+        const uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_ps(distance)) & 0xff;
+        count = write_visible(visible, count, mask, first, begin, end);
+    }
+#else
+    simd::float4 p[Frustum::planes_count][7];
+    for (int i = 0; i < Frustum::planes_count; ++i)
+    {
+        for (int j = 0; j < 7; ++j)
+            p[i][j] = simd::splat(planes[i][j]);
+    }
+    // every lane is a different box, 4 boxes per iteration
+    for (uint32_t first = begin & ~3u; first < end; first += 4)
+    {
+        const simd::float4 x = simd::load(cx + first);
+        const simd::float4 y = simd::load(cy + first);
+        const simd::float4 z = simd::load(cz + first);
+        const simd::float4 w = simd::load(ex + first);
+        const simd::float4 h = simd::load(ey + first);
+        const simd::float4 d = simd::load(ez + first);
+        simd::float4 distance = simd::splat(std::numeric_limits<float>::max());
+        for (int i = 0; i < Frustum::planes_count; ++i)
+        {
+            simd::float4 v = simd::madd(x, p[i][0], p[i][3]);
+            v = simd::madd(y, p[i][1], v);
+            v = simd::madd(z, p[i][2], v);
+            v = simd::madd(w, p[i][4], v);
+            v = simd::madd(h, p[i][5], v);
+            v = simd::madd(d, p[i][6], v);
+            distance = simd::min(distance, v);
+        }
+        const uint32_t mask = ~static_cast<uint32_t>(simd::sign_mask(distance)) & 0xf;
+        count = write_visible(visible, count, mask, first, begin, end);
+    }
+#endif
+    return count;
+}
+
+}
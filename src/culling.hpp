@@ -0,0 +1,138 @@
+#ifndef __CULLING_HPP__
+#define __CULLING_HPP__
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+#include "mhemath.hpp"
+
+namespace mhe {
+
+// a point p is inside when dot(plane, vec4(p, 1)) >= 0, the normals are unit vectors
+struct Frustum
+{
+    enum Plane
+    {
+        left_plane,
+        right_plane,
+        bottom_plane,
+        top_plane,
+        near_plane,
+        far_plane,
+        planes_count
+    };
+
+    vec4 planes[planes_count];
+};
+
+struct Aabb
+{
+    vec3 min;
+    vec3 max;
+
+    vec3 center() const
+    {
+        return vec3((min.x + max.x) * 0.5f, (min.y + max.y) * 0.5f, (min.z + max.z) * 0.5f);
+    }
+
+    vec3 extent() const
+    {
+        return vec3((max.x - min.x) * 0.5f, (max.y - min.y) * 0.5f, (max.z - min.z) * 0.5f);
+    }
+
+    // of the bounding sphere around center()
+    float radius() const
+    {
+        return extent().magnitude();
+    }
+};
+
+// The clip volume of m for the row vectors and the depth in [0, 1]. With m = world * vp
+// the planes are in the object space.
+void extract_frustum(Frustum& frustum, const mat4x4& m);
+
+bool sphere_visible(const Frustum& frustum, const vec3& center, float radius);
+
+// the normal cone of the triangles faces away from the camera, see Meshlet
+inline bool cone_backfacing(const vec3& center, float radius, const vec3& cone_axis, float cone_cutoff, const vec3& camera)
+{
+    const vec3 direction = center - camera;
+    return dot(direction, cone_axis) >= cone_cutoff * std::sqrt(dot(direction, direction)) + radius;
+}
+
+// the box around the transformed corners of box
+Aabb transform_box(const Aabb& box, const mat4x4& m);
+
+// from p to the closest point of box, 0 when p is inside
+inline float box_distance(const Aabb& box, const vec3& p)
+{
+    const vec3 d(std::max(std::max(box.min.x - p.x, p.x - box.max.x), 0.0f),
+        std::max(std::max(box.min.y - p.y, p.y - box.max.y), 0.0f),
+        std::max(std::max(box.min.z - p.z, p.z - box.max.z), 0.0f));
+    return std::sqrt(dot(d, d));
+}
+
+// Boxes by their centers and half extents in structure of arrays layout. The arrays are padded to a multiple of 8,
+// so the culling processes 4 or 8 boxes per iteration.
+class BoxArray
+{
+public:
+    enum Component
+    {
+        center_x,
+        center_y,
+        center_z,
+        extent_x,
+        extent_y,
+        extent_z,
+        components_count
+    };
+
+    BoxArray() :
+        size_(0), capacity_(0)
+    {}
+
+    // new boxes are empty
+    void resize(uint32_t size);
+
+    uint32_t size() const
+    {
+        return size_;
+    }
+
+    // 16 bytes aligned array of size() elements
+    const float* component(Component c) const
+    {
+        return &storage_[c * capacity_ / 4].x;
+    }
+
+    void set(uint32_t index, const Aabb& box)
+    {
+        const vec3 center = box.center();
+        const vec3 extent = box.extent();
+        component(center_x)[index] = center.x;
+        component(center_y)[index] = center.y;
+        component(center_z)[index] = center.z;
+        component(extent_x)[index] = extent.x;
+        component(extent_y)[index] = extent.y;
+        component(extent_z)[index] = extent.z;
+    }
+private:
+    float* component(Component c)
+    {
+        return &storage_[c * capacity_ / 4].x;
+    }
+
+    std::vector<vec4> storage_;
+    uint32_t size_;
+    uint32_t capacity_;
+};
+
+// Writes the indices of the boxes in [begin, end) intersecting the frustum to visible in the increasing order,
+// returns their number. Boxes crossing a plane are visible. Different ranges can be culled by different threads.
+uint32_t cull_boxes(uint32_t* visible, const Frustum& frustum, const BoxArray& boxes, uint32_t begin, uint32_t end);
+
+}
+
+#endif
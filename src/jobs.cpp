@@ -0,0 +1,320 @@
+#include "jobs.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace mhe {
+namespace jobs {
+
+namespace {
+
+struct ThreadState
+{
+    const void* scheduler;
+    uint32_t index;
+};
+
+thread_local ThreadState current_thread = { nullptr, invalid_thread_index };
+
+// failed attempts to find a job before a worker goes to sleep
+const uint32_t spins_before_sleep = 64;
+
+uint32_t xorshift(uint32_t& state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+}
+
+void WorkStealingQueue::init(uint32_t capacity)
+{
+    assert((capacity & (capacity - 1)) == 0);
+    jobs_.reset(new std::atomic<Job*>[capacity]);
+    for (uint32_t i = 0; i < capacity; ++i)
+        jobs_[i].store(nullptr, std::memory_order_relaxed);
+    mask_ = capacity - 1;
+    top_.store(0);
+    bottom_.store(0);
+}
+
+bool WorkStealingQueue::push(Job* job)
+{
+    const int64_t bottom = bottom_.load(std::memory_order_relaxed);
+    const int64_t top = top_.load(std::memory_order_acquire);
+    if (bottom - top > mask_)
+        return false;
+    jobs_[bottom & mask_].store(job, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+    return true;
+}
+
+Job* WorkStealingQueue::pop()
+{
+    const int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+    bottom_.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = top_.load(std::memory_order_relaxed);
+    if (top > bottom)
+    {
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    Job* job = jobs_[bottom & mask_].load(std::memory_order_relaxed);
+    if (top == bottom)
+    {
+        // the last job, a thief can take it at the same time
+        if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            job = nullptr;
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+Job* WorkStealingQueue::steal()
+{
+    int64_t top = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t bottom = bottom_.load(std::memory_order_acquire);
+    if (top >= bottom)
+        return nullptr;
+
+    Job* job = jobs_[top & mask_].load(std::memory_order_relaxed);
+    if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        return nullptr;
+    return job;
+}
+
+void Scheduler::init(const Settings& settings)
+{
+    settings_ = settings;
+    if (settings_.threads_count == 0)
+        settings_.threads_count = std::max(std::thread::hardware_concurrency(), 1u);
+    assert((settings_.jobs_per_thread & (settings_.jobs_per_thread - 1)) == 0);
+
+    stop_ = false;
+    pending_jobs_ = 0;
+    sleeping_threads_ = 0;
+
+    threads_.resize(settings_.threads_count);
+    for (uint32_t i = 0; i < settings_.threads_count; ++i)
+    {
+        threads_[i].reset(new ThreadData);
+        ThreadData& thread_data = *threads_[i];
+        thread_data.index = i;
+        thread_data.random_state = 0x9e3779b9u * (i + 1);
+        // the deque never holds more jobs than the thread has allocated
+        thread_data.queue.init(settings_.jobs_per_thread);
+        thread_data.jobs.reset(new Job[settings_.jobs_per_thread]);
+        thread_data.next_job = 0;
+    }
+
+    current_thread.scheduler = this;
+    current_thread.index = 0;
+    for (uint32_t i = 1; i < settings_.threads_count; ++i)
+        workers_.push_back(std::thread(&Scheduler::worker_loop, this, i));
+}
+
+void Scheduler::destroy()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        stop_ = true;
+    }
+    sleep_condition_.notify_all();
+    for (std::thread& worker : workers_)
+        worker.join();
+    workers_.clear();
+    threads_.clear();
+
+    if (current_thread.scheduler == this)
+    {
+        current_thread.scheduler = nullptr;
+        current_thread.index = invalid_thread_index;
+    }
+}
+
+uint32_t Scheduler::thread_index()
+{
+    return current_thread.index;
+}
+
+void Scheduler::run(const JobFunction& function, Counter* counter, Counter* dependency)
+{
+    assert(current_thread.scheduler == this);
+    ThreadData& thread_data = *threads_[current_thread.index];
+
+    Job* job = allocate_job(thread_data);
+    job->function = function;
+    job->counter = counter;
+    if (counter != nullptr)
+        counter->value_.fetch_add(1);
+
+    if (dependency != nullptr)
+    {
+        std::lock_guard<std::mutex> lock(dependency->mutex_);
+        if (dependency->value_.load() != 0)
+        {
+            dependency->continuations_.push_back(job);
+            return;
+        }
+    }
+
+    push(thread_data, job);
+}
+
+void Scheduler::wait(Counter& counter)
+{
+    assert(current_thread.scheduler == this);
+    ThreadData& thread_data = *threads_[current_thread.index];
+    while (!counter.done())
+    {
+        if (!execute_next(thread_data))
+            std::this_thread::yield();
+    }
+}
+
+void Scheduler::parallel_for(uint32_t count, uint32_t grain_size, const RangeFunction& function)
+{
+    if (count == 0)
+        return;
+    Counter counter;
+    run_range(&counter, 0, count, std::max(grain_size, 1u), &function);
+    wait(counter);
+}
+
+void Scheduler::run_range(Counter* counter, uint32_t begin, uint32_t end, uint32_t grain_size, const RangeFunction* function)
+{
+    run([this, counter, begin, end, grain_size, function]()
+    {
+        // keep splitting the range in halves, idle threads steal the biggest ones from the top of the deque
+        uint32_t range_end = end;
+        while (range_end - begin > grain_size)
+        {
+            const uint32_t middle = begin + (range_end - begin) / 2;
+            run_range(counter, middle, range_end, grain_size, function);
+            range_end = middle;
+        }
+        (*function)(begin, range_end);
+    }, counter);
+}
+
+Job* Scheduler::allocate_job(ThreadData& thread_data)
+{
+    Job* job = &thread_data.jobs[thread_data.next_job++ & (settings_.jobs_per_thread - 1)];
+    // the slot still holds a job allocated a whole ring ago that hasn't started yet
+    while (!job->started.load(std::memory_order_acquire))
+    {
+        if (!execute_next(thread_data))
+            std::this_thread::yield();
+    }
+    job->started.store(false, std::memory_order_relaxed);
+    return job;
+}
+
+void Scheduler::push(ThreadData& thread_data, Job* job)
+{
+    // counted before a thief can take the job
+    pending_jobs_.fetch_add(1);
+    if (!thread_data.queue.push(job))
+    {
+        pending_jobs_.fetch_sub(1);
+        execute(thread_data, job);
+        return;
+    }
+
+    if (sleeping_threads_.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        sleep_condition_.notify_one();
+    }
+}
+
+Job* Scheduler::get_job(ThreadData& thread_data)
+{
+    Job* job = thread_data.queue.pop();
+    if (job == nullptr)
+    {
+        const uint32_t threads_count = static_cast<uint32_t>(threads_.size());
+        const uint32_t first = xorshift(thread_data.random_state) % threads_count;
+        for (uint32_t i = 0; i < threads_count && job == nullptr; ++i)
+        {
+            const uint32_t victim = (first + i) % threads_count;
+            if (victim != thread_data.index)
+                job = threads_[victim]->queue.steal();
+        }
+    }
+    if (job != nullptr)
+        pending_jobs_.fetch_sub(1);
+    return job;
+}
+
+void Scheduler::execute(ThreadData& thread_data, Job* job)
+{
+    // the slot is released before the job runs, a job allocating new jobs can't end up waiting for itself
+    JobFunction function;
+    function.swap(job->function);
+    Counter* counter = job->counter;
+    job->started.store(true, std::memory_order_release);
+
+    function();
+    if (counter == nullptr)
+        return;
+
+    counter->users_.fetch_add(1);
+    if (counter->value_.fetch_sub(1) == 1)
+    {
+        std::vector<Job*> continuations;
+        {
+            std::lock_guard<std::mutex> lock(counter->mutex_);
+            continuations.swap(counter->continuations_);
+        }
+        for (Job* continuation : continuations)
+            push(thread_data, continuation);
+    }
+    counter->users_.fetch_sub(1);
+}
+
+bool Scheduler::execute_next(ThreadData& thread_data)
+{
+    Job* job = get_job(thread_data);
+    if (job == nullptr)
+        return false;
+    execute(thread_data, job);
+    return true;
+}
+
+void Scheduler::worker_loop(uint32_t index)
+{
+    current_thread.scheduler = this;
+    current_thread.index = index;
+    ThreadData& thread_data = *threads_[index];
+
+    uint32_t spins = 0;
+    while (!stop_.load())
+    {
+        if (execute_next(thread_data))
+        {
+            spins = 0;
+            continue;
+        }
+        if (++spins < spins_before_sleep)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        sleeping_threads_.fetch_add(1);
+        sleep_condition_.wait(lock, [this]() { return stop_.load() || pending_jobs_.load() > 0; });
+        sleeping_threads_.fetch_sub(1);
+        spins = 0;
+    }
+}
+
+}
+}
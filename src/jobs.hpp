@@ -0,0 +1,153 @@
+#ifndef __JOBS_HPP__
+#define __JOBS_HPP__
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <limits>
+#include <cstdint>
+
+namespace mhe {
+namespace jobs {
+
+typedef std::function<void()> JobFunction;
+typedef std::function<void(uint32_t begin, uint32_t end)> RangeFunction;
+
+const uint32_t invalid_thread_index = std::numeric_limits<uint32_t>::max();
+
+struct Job;
+
+// Number of unfinished jobs. Jobs can be made dependent on a counter, they start when it reaches zero.
+class Counter
+{
+public:
+    Counter() :
+        value_(0), users_(0)
+    {}
+
+    bool done() const
+    {
+        return value_.load() == 0 && users_.load() == 0;
+    }
+private:
+    friend class Scheduler;
+
+    std::atomic<uint32_t> value_;
+    // threads that still touch the counter after decrementing it
+    std::atomic<uint32_t> users_;
+    std::mutex mutex_;
+    std::vector<Job*> continuations_;
+};
+
+struct Job
+{
+    JobFunction function;
+    Counter* counter;
+    // the slot can be reused once the job has started
+    std::atomic<bool> started;
+
+    Job() :
+        counter(nullptr), started(true)
+    {}
+};
+
+// Chase-Lev deque of fixed capacity. push() and pop() are called only by the owner thread,
+// steal() by any other thread.
+class WorkStealingQueue
+{
+public:
+    WorkStealingQueue() :
+        mask_(0), top_(0), bottom_(0)
+    {}
+
+    // capacity must be a power of 2
+    void init(uint32_t capacity);
+
+    bool push(Job* job);
+    Job* pop();
+    Job* steal();
+private:
+    std::unique_ptr<std::atomic<Job*>[]> jobs_;
+    int64_t mask_;
+    std::atomic<int64_t> top_;
+    std::atomic<int64_t> bottom_;
+};
+
+// Work-stealing scheduler. Each worker owns a deque, idle workers steal from the others.
+// The thread calling init() becomes the thread 0 and takes part in the work while it waits.
+// Jobs can be started only from the scheduler's threads.
+class Scheduler
+{
+public:
+    struct Settings
+    {
+        // including the calling thread, 0 means one thread per hardware thread
+        uint32_t threads_count;
+        // jobs created by one thread and not started yet, a power of 2
+        uint32_t jobs_per_thread;
+
+        Settings() :
+            threads_count(0),
+            jobs_per_thread(4096)
+        {}
+    };
+
+    Scheduler() :
+        pending_jobs_(0), sleeping_threads_(0), stop_(false)
+    {}
+
+    void init(const Settings& settings);
+    void destroy();
+
+    uint32_t threads_count() const
+    {
+        return static_cast<uint32_t>(threads_.size());
+    }
+
+    // index of the calling thread inside the scheduler, invalid_thread_index for other threads
+    static uint32_t thread_index();
+
+    // counter is incremented now and decremented when the job has finished,
+    // the job doesn't start before the dependency reaches zero
+    void run(const JobFunction& function, Counter* counter = nullptr, Counter* dependency = nullptr);
+    // executes other jobs until the counter reaches zero
+    void wait(Counter& counter);
+
+    // calls function for the ranges of at most grain_size elements covering [0, count), blocks until all of them are done
+    void parallel_for(uint32_t count, uint32_t grain_size, const RangeFunction& function);
+private:
+    struct ThreadData
+    {
+        uint32_t index;
+        uint32_t random_state;
+        WorkStealingQueue queue;
+        std::unique_ptr<Job[]> jobs;
+        uint32_t next_job;
+    };
+
+    Job* allocate_job(ThreadData& thread_data);
+    void push(ThreadData& thread_data, Job* job);
+    Job* get_job(ThreadData& thread_data);
+    void execute(ThreadData& thread_data, Job* job);
+    bool execute_next(ThreadData& thread_data);
+    void worker_loop(uint32_t index);
+    void run_range(Counter* counter, uint32_t begin, uint32_t end, uint32_t grain_size, const RangeFunction* function);
+
+    Settings settings_;
+    std::vector<std::unique_ptr<ThreadData>> threads_;
+    std::vector<std::thread> workers_;
+    std::atomic<uint32_t> pending_jobs_;
+    std::atomic<uint32_t> sleeping_threads_;
+    std::mutex sleep_mutex_;
+    std::condition_variable sleep_condition_;
+    std::atomic<bool> stop_;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,281 @@
+#include "meshcache.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace mhe {
+
+#ifdef _WIN32
+MappedFile::MappedFile() :
+    data_(nullptr), size_(0), file_(INVALID_HANDLE_VALUE), mapping_(nullptr)
+{}
+#else
+MappedFile::MappedFile() :
+    data_(nullptr), size_(0), fd_(-1)
+{}
+#endif
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#ifdef _WIN32
+bool MappedFile::open(const char* filename)
+{
+    close();
+    file_ = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0)
+    {
+        close();
+        return false;
+    }
+    mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_ == nullptr)
+    {
+        close();
+        return false;
+    }
+    data_ = static_cast<const uint8_t*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+    if (data_ == nullptr)
+    {
+        close();
+        return false;
+    }
+    size_ = static_cast<size_t>(size.QuadPart);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (data_ != nullptr)
+        UnmapViewOfFile(data_);
+    if (mapping_ != nullptr)
+        CloseHandle(mapping_);
+    if (file_ != INVALID_HANDLE_VALUE)
+        CloseHandle(file_);
+    data_ = nullptr;
+    size_ = 0;
+    mapping_ = nullptr;
+    file_ = INVALID_HANDLE_VALUE;
+}
+#else
+bool MappedFile::open(const char* filename)
+{
+    close();
+    fd_ = ::open(filename, O_RDONLY);
+    if (fd_ < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd_, &st) != 0 || st.st_size == 0)
+    {
+        close();
+        return false;
+    }
+    void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (data == MAP_FAILED)
+    {
+        close();
+        return false;
+    }
+    // the whole file is read once from the beginning to the end, the advice values aren't flags
+    madvise(data, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+    madvise(data, static_cast<size_t>(st.st_size), MADV_WILLNEED);
+    data_ = static_cast<const uint8_t*>(data);
+    size_ = static_cast<size_t>(st.st_size);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (data_ != nullptr)
+        munmap(const_cast<uint8_t*>(data_), size_);
+    if (fd_ >= 0)
+        ::close(fd_);
+    data_ = nullptr;
+    size_ = 0;
+    fd_ = -1;
+}
+#endif
+
+bool get_source_file_info(SourceFileInfo& info, const char* filename)
+{
+    struct stat st;
+    if (stat(filename, &st) != 0)
+        return false;
+    info.size = static_cast<uint64_t>(st.st_size);
+    info.time = static_cast<uint64_t>(st.st_mtime);
+    return true;
+}
+
+namespace {
+
+uint64_t align_offset(uint64_t offset)
+{
+    return (offset + mesh_cache_alignment - 1) / mesh_cache_alignment * mesh_cache_alignment;
+}
+
+bool write_aligned(FILE* f, uint64_t& offset, const void* data, uint64_t size)
+{
+    static const uint8_t padding[mesh_cache_alignment] = {};
+    const uint64_t aligned_offset = align_offset(offset);
+    if (aligned_offset != offset && fwrite(padding, 1, static_cast<size_t>(aligned_offset - offset), f) != aligned_offset - offset)
+        return false;
+    offset = aligned_offset + size;
+    return size == 0 || fwrite(data, 1, static_cast<size_t>(size), f) == size;
+}
+
+// without overflowing, the counts and the offsets come from the file
+bool range_inside(uint64_t offset, uint64_t count, uint64_t total)
+{
+    return offset <= total && count <= total - offset;
+}
+
+bool parts_valid(const MeshCacheHeader& header, const MeshCachePart* parts, const Meshlet* meshlets)
+{
+    for (uint32_t i = 0; i < header.parts_count; ++i)
+    {
+        const MeshCachePart& part = parts[i];
+        if (part.vbuffer_offset > header.vertices_count ||
+            !range_inside(part.ibuffer_offset, part.indices_count, header.indices_count) ||
+            !range_inside(part.first_meshlet, part.meshlets_count, header.meshlets_count))
+            return false;
+        for (uint32_t lod = 0; lod < header.lods_count; ++lod)
+        {
+            if (!range_inside(part.lods[lod].ibuffer_offset, part.lods[lod].indices_count, header.indices_count))
+                return false;
+        }
+    }
+    for (uint32_t i = 0; i < header.meshlets_count; ++i)
+    {
+        if (!range_inside(meshlets[i].first_index, meshlets[i].indices_count, header.indices_count))
+            return false;
+    }
+    return true;
+}
+
+}
+
+bool write_mesh_cache(const char* filename, const MeshCacheData& data, const SourceFileInfo& source)
+{
+    MeshCacheHeader header = {};
+    header.magic = mesh_cache_magic;
+    header.version = mesh_cache_version;
+    header.vertex_size = data.vertex_size;
+    header.index_size = data.index_size;
+    header.parts_count = data.parts_count;
+    header.vertices_count = data.vertices_count;
+    header.indices_count = data.indices_count;
+    header.meshlets_count = data.meshlets_count;
+    header.vertex_format = data.vertex_format;
+    header.import_flags = data.import_flags;
+    header.lods_count = data.lods_count;
+    for (uint32_t i = 0; i < mesh_cache_max_lods; ++i)
+        header.lod_errors[i] = data.lod_errors[i];
+    for (int i = 0; i < 3; ++i)
+        header.position_offset[i] = data.position_offset[i];
+    header.position_scale = data.position_scale;
+    header.source_size = source.size;
+    header.source_time = source.time;
+
+    const uint64_t parts_size = static_cast<uint64_t>(data.parts_count) * sizeof(MeshCachePart);
+    const uint64_t vertices_size = static_cast<uint64_t>(data.vertices_count) * data.vertex_size;
+    const uint64_t indices_size = static_cast<uint64_t>(data.indices_count) * data.index_size;
+    const uint64_t meshlets_size = static_cast<uint64_t>(data.meshlets_count) * sizeof(Meshlet);
+    header.parts_offset = align_offset(sizeof(MeshCacheHeader));
+    header.vertices_offset = align_offset(header.parts_offset + parts_size);
+    header.indices_offset = align_offset(header.vertices_offset + vertices_size);
+    header.meshlets_offset = align_offset(header.indices_offset + indices_size);
+
+    // a partially written file would be picked up by the next run, it's written under a temporary name first
+    const std::string tmp_filename = std::string(filename) + ".tmp";
+    FILE* f = fopen(tmp_filename.c_str(), "wb");
+    if (!f)
+        return false;
+    uint64_t offset = 0;
+    bool res = write_aligned(f, offset, &header, sizeof(MeshCacheHeader)) &&
+        write_aligned(f, offset, data.parts, parts_size) &&
+        write_aligned(f, offset, data.vertices, vertices_size) &&
+        write_aligned(f, offset, data.indices, indices_size) &&
+        write_aligned(f, offset, data.meshlets, meshlets_size);
+    res = fclose(f) == 0 && res;
+    if (res)
+    {
+        ::remove(filename);
+        res = ::rename(tmp_filename.c_str(), filename) == 0;
+    }
+    if (!res)
+        ::remove(tmp_filename.c_str());
+    return res;
+}
+
+bool read_mesh_cache(MeshCacheData& data, const uint8_t* memory, size_t size, uint32_t vertex_format, uint32_t vertex_size,
+    uint32_t import_flags, const SourceFileInfo& source)
+{
+    if (size < sizeof(MeshCacheHeader))
+        return false;
+    const MeshCacheHeader* header = reinterpret_cast<const MeshCacheHeader*>(memory);
+    if (header->magic != mesh_cache_magic || header->version != mesh_cache_version ||
+        header->vertex_format != vertex_format || header->vertex_size != vertex_size || header->import_flags != import_flags)
+        return false;
+    if (header->index_size != sizeof(uint16_t) && header->index_size != sizeof(uint32_t))
+        return false;
+    if (header->lods_count == 0 || header->lods_count > mesh_cache_max_lods)
+        return false;
+    if (source.size != 0 && (header->source_size != source.size || header->source_time != source.time))
+        return false;
+
+    const uint64_t parts_size = static_cast<uint64_t>(header->parts_count) * sizeof(MeshCachePart);
+    const uint64_t vertices_size = static_cast<uint64_t>(header->vertices_count) * header->vertex_size;
+    const uint64_t indices_size = static_cast<uint64_t>(header->indices_count) * header->index_size;
+    const uint64_t meshlets_size = static_cast<uint64_t>(header->meshlets_count) * sizeof(Meshlet);
+    if (!range_inside(header->parts_offset, parts_size, size) || !range_inside(header->vertices_offset, vertices_size, size) ||
+        !range_inside(header->indices_offset, indices_size, size) || !range_inside(header->meshlets_offset, meshlets_size, size))
+        return false;
+    if ((header->parts_offset | header->vertices_offset | header->indices_offset | header->meshlets_offset) %
+        mesh_cache_alignment != 0)
+        return false;
+    // a corrupted file is imported again instead of drawing out of the pools
+    if (!parts_valid(*header, reinterpret_cast<const MeshCachePart*>(memory + header->parts_offset),
+        reinterpret_cast<const Meshlet*>(memory + header->meshlets_offset)))
+        return false;
+
+    data.parts = reinterpret_cast<const MeshCachePart*>(memory + header->parts_offset);
+    data.vertices = memory + header->vertices_offset;
+    data.indices = memory + header->indices_offset;
+    data.meshlets = reinterpret_cast<const Meshlet*>(memory + header->meshlets_offset);
+    data.parts_count = header->parts_count;
+    data.vertices_count = header->vertices_count;
+    data.indices_count = header->indices_count;
+    data.meshlets_count = header->meshlets_count;
+    data.vertex_size = header->vertex_size;
+    data.index_size = header->index_size;
+    data.vertex_format = header->vertex_format;
+    data.import_flags = header->import_flags;
+    data.lods_count = header->lods_count;
+    for (uint32_t i = 0; i < mesh_cache_max_lods; ++i)
+        data.lod_errors[i] = header->lod_errors[i];
+    for (int i = 0; i < 3; ++i)
+        data.position_offset[i] = header->position_offset[i];
+    data.position_scale = header->position_scale;
+    return true;
+}
+
+}
@@ -0,0 +1,159 @@
+#ifndef __MESHCACHE_HPP__
+#define __MESHCACHE_HPP__
+
+#include <cstdint>
+#include <cstddef>
+
+#include "meshopt.hpp"
+
+namespace mhe {
+
+// Read-only mapping of a whole file into memory
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    bool open(const char* filename);
+    void close();
+
+    const uint8_t* data() const
+    {
+        return data_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator= (const MappedFile&);
+
+    const uint8_t* data_;
+    size_t size_;
+#ifdef _WIN32
+    void* file_;
+    void* mapping_;
+#else
+    int fd_;
+#endif
+};
+
+// "MHEM"
+const uint32_t mesh_cache_magic = 0x4d45484d;
+// bump it whenever the layout of the file, of the vertices or the meaning of the LOD errors changes
+const uint32_t mesh_cache_version = 8;
+// the blobs are aligned, so they're copied to the staging memory straight from the mapping
+const uint32_t mesh_cache_alignment = 16;
+const uint32_t mesh_cache_max_lods = 4;
+
+// .mhemesh file: header, part table, vertices, indices, meshlets
+struct MeshCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vertex_size;
+    // 2 or 4 bytes
+    uint32_t index_size;
+    uint32_t parts_count;
+    uint32_t vertices_count;
+    uint32_t indices_count;
+    // vk::VertexFormat
+    uint32_t vertex_format;
+    // the optimizations done at import, a cache cooked with different ones is rebuilt
+    uint32_t import_flags;
+    uint32_t lods_count;
+    // dequantization of the positions, identity for the unquantized formats
+    float position_offset[3];
+    float position_scale;
+    // in the units of the source asset
+    float lod_errors[mesh_cache_max_lods];
+    uint32_t meshlets_count;
+    uint32_t reserved;
+    // the source asset the cache was cooked from
+    uint64_t source_size;
+    uint64_t source_time;
+    // from the beginning of the file
+    uint64_t parts_offset;
+    uint64_t vertices_offset;
+    uint64_t indices_offset;
+    uint64_t meshlets_offset;
+};
+
+struct MeshCacheLod
+{
+    uint32_t ibuffer_offset;
+    uint32_t indices_count;
+};
+
+// Offsets are relative to the mesh data, lods[0] is the full detail range. The meshlets split lods[0],
+// their first_index are relative to the mesh data too. The bounds are in the space of the stored vertices.
+struct MeshCachePart
+{
+    uint32_t vbuffer_offset;
+    uint32_t ibuffer_offset;
+    uint32_t indices_count;
+    uint32_t first_meshlet;
+    uint32_t meshlets_count;
+    MeshCacheLod lods[mesh_cache_max_lods];
+    float bounds_min[3];
+    float bounds_max[3];
+};
+
+// pointers to the mesh data, they point into the mapping when the cache is read
+struct MeshCacheData
+{
+    const MeshCachePart* parts;
+    const uint8_t* vertices;
+    const uint8_t* indices;
+    const Meshlet* meshlets;
+    uint32_t parts_count;
+    uint32_t vertices_count;
+    uint32_t indices_count;
+    uint32_t meshlets_count;
+    uint32_t vertex_size;
+    uint32_t index_size;
+    uint32_t vertex_format;
+    uint32_t import_flags;
+    uint32_t lods_count;
+    float position_offset[3];
+    float position_scale;
+    float lod_errors[mesh_cache_max_lods];
+
+    MeshCacheData() :
+        parts(nullptr), vertices(nullptr), indices(nullptr), meshlets(nullptr),
+        parts_count(0), vertices_count(0), indices_count(0), meshlets_count(0),
+        vertex_size(0), index_size(0), vertex_format(0), import_flags(0), lods_count(1),
+        position_scale(1.0f)
+    {
+        position_offset[0] = position_offset[1] = position_offset[2] = 0.0f;
+        for (uint32_t i = 0; i < mesh_cache_max_lods; ++i)
+            lod_errors[i] = 0.0f;
+    }
+};
+
+struct SourceFileInfo
+{
+    uint64_t size;
+    uint64_t time;
+
+    SourceFileInfo() :
+        size(0), time(0)
+    {}
+};
+
+// false if the file doesn't exist
+bool get_source_file_info(SourceFileInfo& info, const char* filename);
+
+bool write_mesh_cache(const char* filename, const MeshCacheData& data, const SourceFileInfo& source);
+// Validates the header against the expected vertex format and size, import flags and the source file,
+// a missing source (size 0) matches any cache. The ranges of the parts and the meshlets are checked against the blobs.
+// The pointers of data point into memory.
+bool read_mesh_cache(MeshCacheData& data, const uint8_t* memory, size_t size, uint32_t vertex_format, uint32_t vertex_size,
+    uint32_t import_flags, const SourceFileInfo& source);
+
+}
+
+#endif
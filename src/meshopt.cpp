@@ -0,0 +1,796 @@
+#include "meshopt.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+namespace mhe {
+
+namespace {
+
+// FIFO cache with timestamps, a vertex is in the cache when it was added less than cache_size misses ago
+class FifoCache
+{
+public:
+    FifoCache(uint32_t vertices_count, uint32_t cache_size) :
+        timestamps_(vertices_count, 0), time_(cache_size + 1), cache_size_(cache_size)
+    {}
+
+    // true on a miss
+    bool access(uint32_t vertex)
+    {
+        if (time_ - timestamps_[vertex] <= cache_size_)
+            return false;
+        timestamps_[vertex] = time_++;
+        return true;
+    }
+private:
+    std::vector<uint32_t> timestamps_;
+    uint32_t time_;
+    uint32_t cache_size_;
+};
+
+}
+
+VertexCacheStatistics analyze_vertex_cache(const uint32_t* indices, size_t indices_count, uint32_t vertices_count,
+    uint32_t cache_size)
+{
+    assert(indices_count % 3 == 0);
+    VertexCacheStatistics res;
+    FifoCache cache(vertices_count, cache_size);
+    std::vector<uint8_t> used(vertices_count, 0);
+    for (size_t i = 0; i < indices_count; ++i)
+    {
+        assert(indices[i] < vertices_count);
+        if (cache.access(indices[i]))
+            ++res.vertices_transformed;
+        if (!used[indices[i]])
+        {
+            used[indices[i]] = 1;
+            ++res.vertices_count;
+        }
+    }
+    res.triangles_count = static_cast<uint32_t>(indices_count / 3);
+    return res;
+}
+
+namespace {
+
+const uint32_t max_cache_size = 32;
+const uint32_t max_valence = 32;
+
+// Forsyth's scoring: the vertices of the last triangle get a fixed score, the older ones decay with the position,
+// vertices with a few remaining triangles are boosted to finish them off
+class VertexScoreTable
+{
+public:
+    VertexScoreTable()
+    {
+        const float cache_decay_power = 1.5f;
+        const float last_triangle_score = 0.75f;
+        const float valence_boost_scale = 2.0f;
+        const float valence_boost_power = 0.5f;
+
+        for (uint32_t i = 0; i < max_cache_size; ++i)
+        {
+            if (i < 3)
+                cache_scores_[i] = last_triangle_score;
+            else
+            {
+                const float scaler = 1.0f / (max_cache_size - 3);
+                cache_scores_[i] = std::pow(1.0f - (i - 3) * scaler, cache_decay_power);
+            }
+        }
+        valence_scores_[0] = 0.0f;
+        for (uint32_t i = 1; i <= max_valence; ++i)
+            valence_scores_[i] = valence_boost_scale * std::pow(static_cast<float>(i), -valence_boost_power);
+    }
+
+    float score(int32_t cache_position, uint32_t live_triangles) const
+    {
+        if (live_triangles == 0)
+            return -1.0f;
+        const float cache_score = cache_position >= 0 ? cache_scores_[cache_position] : 0.0f;
+        return cache_score + valence_scores_[std::min(live_triangles, max_valence)];
+    }
+private:
+    float cache_scores_[max_cache_size];
+    float valence_scores_[max_valence + 1];
+};
+
+}
+
+void optimize_vertex_cache(uint32_t* dst, const uint32_t* indices, size_t indices_count, uint32_t vertices_count)
+{
+    assert(indices_count % 3 == 0);
+    const size_t triangles_count = indices_count / 3;
+    if (triangles_count == 0)
+        return;
+    // dst may be the same array
+    const std::vector<uint32_t> input(indices, indices + indices_count);
+
+    // triangles of every vertex, the live ones are first
+    std::vector<uint32_t> live_triangles(vertices_count, 0);
+    for (size_t i = 0; i < indices_count; ++i)
+        ++live_triangles[input[i]];
+    std::vector<uint32_t> adjacency_offsets(vertices_count + 1, 0);
+    for (uint32_t i = 0; i < vertices_count; ++i)
+        adjacency_offsets[i + 1] = adjacency_offsets[i] + live_triangles[i];
+    std::vector<uint32_t> adjacency(indices_count);
+    {
+        std::vector<uint32_t> cursors(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+        for (size_t i = 0; i < indices_count; ++i)
+            adjacency[cursors[input[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    const VertexScoreTable score_table;
+    std::vector<int32_t> cache_positions(vertices_count, -1);
+    std::vector<float> vertex_scores(vertices_count);
+    for (uint32_t i = 0; i < vertices_count; ++i)
+        vertex_scores[i] = score_table.score(-1, live_triangles[i]);
+    std::vector<float> triangle_scores(triangles_count);
+    for (size_t i = 0; i < triangles_count; ++i)
+        triangle_scores[i] = vertex_scores[input[i * 3]] + vertex_scores[input[i * 3 + 1]] + vertex_scores[input[i * 3 + 2]];
+    std::vector<uint8_t> emitted(triangles_count, 0);
+
+    uint32_t cache[max_cache_size + 3];
+    uint32_t cache_count = 0;
+    size_t input_cursor = 0;
+    size_t best_triangle = 0;
+    bool has_best_triangle = false;
+
+    for (size_t output_triangle = 0; output_triangle < triangles_count; ++output_triangle)
+    {
+        // nothing in the cache has live triangles, continue from the next triangle of the input
+        if (!has_best_triangle)
+        {
+            while (emitted[input_cursor])
+                ++input_cursor;
+            best_triangle = input_cursor;
+        }
+
+        const uint32_t* triangle = &input[best_triangle * 3];
+        dst[output_triangle * 3 + 0] = triangle[0];
+        dst[output_triangle * 3 + 1] = triangle[1];
+        dst[output_triangle * 3 + 2] = triangle[2];
+        emitted[best_triangle] = 1;
+
+        // the triangle's vertices go to the front of the LRU cache
+        uint32_t new_cache[max_cache_size + 3];
+        uint32_t new_cache_count = 0;
+        for (uint32_t k = 0; k < 3; ++k)
+        {
+            const uint32_t v = triangle[k];
+            uint32_t* triangles = &adjacency[adjacency_offsets[v]];
+            uint32_t& live = live_triangles[v];
+            for (uint32_t i = 0; i < live; ++i)
+            {
+                if (triangles[i] == best_triangle)
+                {
+                    std::swap(triangles[i], triangles[live - 1]);
+                    --live;
+                    break;
+                }
+            }
+            if (std::find(new_cache, new_cache + new_cache_count, v) == new_cache + new_cache_count)
+                new_cache[new_cache_count++] = v;
+        }
+        for (uint32_t i = 0; i < cache_count; ++i)
+        {
+            const uint32_t v = cache[i];
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+                new_cache[new_cache_count++] = v;
+        }
+
+        // the scores of the vertices that moved or fell out of the cache change, so do the scores of their triangles
+        for (uint32_t i = 0; i < new_cache_count; ++i)
+        {
+            const uint32_t v = new_cache[i];
+            cache_positions[v] = i < max_cache_size ? static_cast<int32_t>(i) : -1;
+            const float score = score_table.score(cache_positions[v], live_triangles[v]);
+            const float delta = score - vertex_scores[v];
+            vertex_scores[v] = score;
+            const uint32_t* triangles = &adjacency[adjacency_offsets[v]];
+            for (uint32_t j = 0; j < live_triangles[v]; ++j)
+                triangle_scores[triangles[j]] += delta;
+        }
+        cache_count = std::min(new_cache_count, max_cache_size);
+        std::copy(new_cache, new_cache + cache_count, cache);
+
+        // only the triangles of the cached vertices are candidates
+        has_best_triangle = false;
+        float best_score = -std::numeric_limits<float>::max();
+        for (uint32_t i = 0; i < cache_count; ++i)
+        {
+            const uint32_t v = cache[i];
+            const uint32_t* triangles = &adjacency[adjacency_offsets[v]];
+            for (uint32_t j = 0; j < live_triangles[v]; ++j)
+            {
+                if (triangle_scores[triangles[j]] > best_score)
+                {
+                    best_score = triangle_scores[triangles[j]];
+                    best_triangle = triangles[j];
+                    has_best_triangle = true;
+                }
+            }
+        }
+    }
+}
+
+namespace {
+
+struct Cluster
+{
+    uint32_t first_triangle;
+    uint32_t triangles_count;
+    float sort_key;
+};
+
+}
+
+void optimize_overdraw(uint32_t* dst, const uint32_t* indices, size_t indices_count,
+    const float* positions, size_t positions_stride, uint32_t vertices_count, float threshold)
+{
+    assert(indices_count % 3 == 0);
+    const uint32_t triangles_count = static_cast<uint32_t>(indices_count / 3);
+    if (triangles_count == 0)
+        return;
+    const std::vector<uint32_t> input(indices, indices + indices_count);
+
+    // a triangle that misses all its vertices starts a new cluster, moving the clusters around
+    // keeps the cache behaviour inside of them
+    std::vector<Cluster> clusters;
+    {
+        FifoCache cache(vertices_count, 16);
+        for (uint32_t i = 0; i < triangles_count; ++i)
+        {
+            uint32_t misses = 0;
+            for (uint32_t k = 0; k < 3; ++k)
+                misses += cache.access(input[i * 3 + k]) ? 1 : 0;
+            if (misses == 3 || i == 0)
+            {
+                Cluster cluster = { i, 0, 0.0f };
+                clusters.push_back(cluster);
+            }
+            ++clusters.back().triangles_count;
+        }
+    }
+    if (clusters.size() < 2)
+    {
+        std::copy(input.begin(), input.end(), dst);
+        return;
+    }
+
+    // area weighted centroids and normals, the clusters facing away from the center of the mesh are drawn first
+    std::vector<float> centroids(clusters.size() * 3, 0.0f);
+    std::vector<float> normals(clusters.size() * 3, 0.0f);
+    float mesh_centroid[3] = { 0.0f, 0.0f, 0.0f };
+    float mesh_area = 0.0f;
+    const uint8_t* position_bytes = reinterpret_cast<const uint8_t*>(positions);
+    for (size_t c = 0; c < clusters.size(); ++c)
+    {
+        float area_sum = 0.0f;
+        for (uint32_t t = clusters[c].first_triangle, end = t + clusters[c].triangles_count; t < end; ++t)
+        {
+            const float* p0 = reinterpret_cast<const float*>(position_bytes + input[t * 3 + 0] * positions_stride);
+            const float* p1 = reinterpret_cast<const float*>(position_bytes + input[t * 3 + 1] * positions_stride);
+            const float* p2 = reinterpret_cast<const float*>(position_bytes + input[t * 3 + 2] * positions_stride);
+            const float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+            const float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+            const float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+            const float area = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (int i = 0; i < 3; ++i)
+            {
+                centroids[c * 3 + i] += (p0[i] + p1[i] + p2[i]) * (area / 3.0f);
+                normals[c * 3 + i] += n[i];
+            }
+            area_sum += area;
+        }
+        for (int i = 0; i < 3; ++i)
+            mesh_centroid[i] += centroids[c * 3 + i];
+        if (area_sum > 0.0f)
+        {
+            for (int i = 0; i < 3; ++i)
+                centroids[c * 3 + i] /= area_sum;
+        }
+        mesh_area += area_sum;
+    }
+    if (mesh_area > 0.0f)
+    {
+        for (int i = 0; i < 3; ++i)
+            mesh_centroid[i] /= mesh_area;
+    }
+
+    for (size_t c = 0; c < clusters.size(); ++c)
+    {
+        const float* n = &normals[c * 3];
+        const float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        float key = 0.0f;
+        for (int i = 0; i < 3; ++i)
+            key += (centroids[c * 3 + i] - mesh_centroid[i]) * n[i];
+        clusters[c].sort_key = length > 0.0f ? key / length : 0.0f;
+    }
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b)
+    {
+        return a.sort_key > b.sort_key;
+    });
+
+    uint32_t* output = dst;
+    for (size_t c = 0; c < clusters.size(); ++c)
+    {
+        const uint32_t* begin = &input[clusters[c].first_triangle * 3];
+        output = std::copy(begin, begin + clusters[c].triangles_count * 3, output);
+    }
+
+    const float acmr = analyze_vertex_cache(&input[0], indices_count, vertices_count).acmr();
+    if (analyze_vertex_cache(dst, indices_count, vertices_count).acmr() > acmr * threshold)
+        std::copy(input.begin(), input.end(), dst);
+}
+
+namespace {
+
+const float* position_at(const float* positions, size_t positions_stride, uint32_t index)
+{
+    return reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + index * positions_stride);
+}
+
+// symmetric 4x4 matrix of the squared distances to the planes, error(p) = (p * A * p + 2 * b * p + c) / weight,
+// the weighted average of the squared distances
+struct Quadric
+{
+    float a00, a01, a02, a11, a12, a22;
+    float b0, b1, b2;
+    float c;
+    // the sum of the weights of the planes
+    float weight;
+
+    Quadric() :
+        a00(0.0f), a01(0.0f), a02(0.0f), a11(0.0f), a12(0.0f), a22(0.0f),
+        b0(0.0f), b1(0.0f), b2(0.0f), c(0.0f), weight(0.0f)
+    {}
+
+    // plane n * p + d = 0 with weight w
+    void add_plane(const float* n, float d, float w)
+    {
+        a00 += w * n[0] * n[0];
+        a01 += w * n[0] * n[1];
+        a02 += w * n[0] * n[2];
+        a11 += w * n[1] * n[1];
+        a12 += w * n[1] * n[2];
+        a22 += w * n[2] * n[2];
+        b0 += w * n[0] * d;
+        b1 += w * n[1] * d;
+        b2 += w * n[2] * d;
+        c += w * d * d;
+        weight += w;
+    }
+
+    Quadric& operator+= (const Quadric& q)
+    {
+        a00 += q.a00; a01 += q.a01; a02 += q.a02; a11 += q.a11; a12 += q.a12; a22 += q.a22;
+        b0 += q.b0; b1 += q.b1; b2 += q.b2;
+        c += q.c;
+        weight += q.weight;
+        return *this;
+    }
+
+    float error(const float* p) const
+    {
+        const float rx = a00 * p[0] + a01 * p[1] + a02 * p[2] + b0;
+        const float ry = a01 * p[0] + a11 * p[1] + a12 * p[2] + b1;
+        const float rz = a02 * p[0] + a12 * p[1] + a22 * p[2] + b2;
+        const float e = rx * p[0] + ry * p[1] + rz * p[2] + b0 * p[0] + b1 * p[1] + b2 * p[2] + c;
+        return e > 0.0f && weight > 0.0f ? e / weight : 0.0f;
+    }
+};
+
+void triangle_normal(float* n, const float* p0, const float* p1, const float* p2)
+{
+    const float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+    const float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+struct Collapse
+{
+    uint32_t from;
+    uint32_t to;
+    float error;
+};
+
+}
+
+float position_extent(const float* positions, size_t positions_stride, uint32_t vertices_count)
+{
+    if (vertices_count == 0)
+        return 0.0f;
+    float min[3], max[3];
+    const float* p = position_at(positions, positions_stride, 0);
+    for (int i = 0; i < 3; ++i)
+        min[i] = max[i] = p[i];
+    for (uint32_t v = 1; v < vertices_count; ++v)
+    {
+        p = position_at(positions, positions_stride, v);
+        for (int i = 0; i < 3; ++i)
+        {
+            min[i] = std::min(min[i], p[i]);
+            max[i] = std::max(max[i], p[i]);
+        }
+    }
+    return std::max(max[0] - min[0], std::max(max[1] - min[1], max[2] - min[2]));
+}
+
+size_t simplify(uint32_t* dst, const uint32_t* indices, size_t indices_count, const float* positions, size_t positions_stride,
+    uint32_t vertices_count, size_t target_indices_count, float target_error, float* result_error)
+{
+    assert(indices_count % 3 == 0);
+    std::vector<uint32_t> current(indices, indices + indices_count);
+    float max_error = 0.0f;
+
+    // positions scaled to [0, 1], the errors don't depend on the units of the mesh
+    const float extent = position_extent(positions, positions_stride, vertices_count);
+    const float inv_extent = extent > 0.0f ? 1.0f / extent : 0.0f;
+    std::vector<float> points(vertices_count * 3);
+    for (uint32_t v = 0; v < vertices_count; ++v)
+    {
+        const float* p = position_at(positions, positions_stride, v);
+        for (int i = 0; i < 3; ++i)
+            points[v * 3 + i] = p[i] * inv_extent;
+    }
+
+    // vertices with the same position share the topology and the quadric
+    std::vector<uint32_t> canonical(vertices_count);
+    std::vector<uint8_t> locked(vertices_count, 0);
+    {
+        std::vector<uint32_t> order(vertices_count);
+        for (uint32_t v = 0; v < vertices_count; ++v)
+            order[v] = v;
+        std::sort(order.begin(), order.end(), [&points](uint32_t a, uint32_t b)
+        {
+            return std::lexicographical_compare(&points[a * 3], &points[a * 3 + 3], &points[b * 3], &points[b * 3 + 3]);
+        });
+        for (uint32_t i = 0; i < vertices_count;)
+        {
+            uint32_t j = i + 1;
+            while (j < vertices_count && std::equal(&points[order[i] * 3], &points[order[i] * 3 + 3], &points[order[j] * 3]))
+                ++j;
+            const uint32_t first = *std::min_element(&order[i], &order[0] + j);
+            for (uint32_t k = i; k < j; ++k)
+            {
+                canonical[order[k]] = first;
+                // the attributes would be lost on the one side of the seam
+                locked[order[k]] = j - i > 1 ? 1 : 0;
+            }
+            i = j;
+        }
+    }
+
+    // an edge without the opposite one is on the open border, its vertices keep the outline of the mesh
+    {
+        std::vector<uint64_t> edges;
+        edges.reserve(indices_count);
+        for (size_t t = 0; t < indices_count; t += 3)
+        {
+            for (uint32_t k = 0; k < 3; ++k)
+            {
+                const uint64_t a = canonical[current[t + k]];
+                const uint64_t b = canonical[current[t + (k + 1) % 3]];
+                edges.push_back((a << 32) | b);
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+        for (size_t t = 0; t < indices_count; t += 3)
+        {
+            for (uint32_t k = 0; k < 3; ++k)
+            {
+                const uint32_t a = current[t + k];
+                const uint32_t b = current[t + (k + 1) % 3];
+                const uint64_t opposite = (static_cast<uint64_t>(canonical[b]) << 32) | canonical[a];
+                if (!std::binary_search(edges.begin(), edges.end(), opposite))
+                    locked[a] = locked[b] = 1;
+            }
+        }
+        for (uint32_t v = 0; v < vertices_count; ++v)
+        {
+            if (locked[v])
+                locked[canonical[v]] = 1;
+        }
+        for (uint32_t v = 0; v < vertices_count; ++v)
+            locked[v] = locked[canonical[v]];
+    }
+
+    // area weighted planes of the triangles
+    std::vector<Quadric> quadrics(vertices_count);
+    for (size_t t = 0; t < indices_count; t += 3)
+    {
+        const float* p0 = &points[current[t] * 3];
+        float n[3];
+        triangle_normal(n, p0, &points[current[t + 1] * 3], &points[current[t + 2] * 3]);
+        const float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length == 0.0f)
+            continue;
+        for (int i = 0; i < 3; ++i)
+            n[i] /= length;
+        const float d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+        for (uint32_t k = 0; k < 3; ++k)
+            quadrics[canonical[current[t + k]]].add_plane(n, d, length * 0.5f);
+    }
+
+    const float error_limit = target_error * target_error;
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> remap(vertices_count);
+    std::vector<uint8_t> touched(vertices_count);
+    std::vector<uint32_t> adjacency_offsets(vertices_count + 1);
+    std::vector<uint32_t> adjacency;
+
+    // every pass collapses a set of independent edges, the cheapest first
+    while (current.size() > target_indices_count)
+    {
+        // triangles around every vertex
+        std::fill(adjacency_offsets.begin(), adjacency_offsets.end(), 0);
+        for (size_t i = 0; i < current.size(); ++i)
+            ++adjacency_offsets[current[i] + 1];
+        for (uint32_t v = 0; v < vertices_count; ++v)
+            adjacency_offsets[v + 1] += adjacency_offsets[v];
+        adjacency.resize(current.size());
+        {
+            std::vector<uint32_t> cursors(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+            for (size_t i = 0; i < current.size(); ++i)
+                adjacency[cursors[current[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+
+        collapses.clear();
+        for (size_t t = 0; t < current.size(); t += 3)
+        {
+            for (uint32_t k = 0; k < 3; ++k)
+            {
+                const uint32_t a = current[t + k];
+                const uint32_t b = current[t + (k + 1) % 3];
+                for (uint32_t direction = 0; direction < 2; ++direction)
+                {
+                    const uint32_t from = direction == 0 ? a : b;
+                    const uint32_t to = direction == 0 ? b : a;
+                    if (locked[from])
+                        continue;
+                    Quadric q = quadrics[canonical[from]];
+                    q += quadrics[canonical[to]];
+                    const Collapse collapse = { from, to, q.error(&points[to * 3]) };
+                    if (collapse.error <= error_limit)
+                        collapses.push_back(collapse);
+                }
+            }
+        }
+        if (collapses.empty())
+            break;
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b)
+        {
+            return a.error < b.error;
+        });
+
+        // a collapse removes two triangles of a closed mesh
+        const size_t triangles_to_remove = (current.size() - target_indices_count) / 3;
+        const size_t max_collapses = std::max<size_t>(triangles_to_remove / 2, 1);
+        size_t collapses_count = 0;
+        for (uint32_t v = 0; v < vertices_count; ++v)
+            remap[v] = v;
+        std::fill(touched.begin(), touched.end(), 0);
+        for (size_t i = 0; i < collapses.size() && collapses_count < max_collapses; ++i)
+        {
+            const Collapse& collapse = collapses[i];
+            if (touched[canonical[collapse.from]] || touched[canonical[collapse.to]])
+                continue;
+
+            // the triangles that stay must not flip
+            bool flipped = false;
+            const float* to_point = &points[collapse.to * 3];
+            for (uint32_t j = adjacency_offsets[collapse.from]; j < adjacency_offsets[collapse.from + 1] && !flipped; ++j)
+            {
+                const uint32_t* triangle = &current[adjacency[j] * 3];
+                if (canonical[triangle[0]] == canonical[collapse.to] || canonical[triangle[1]] == canonical[collapse.to] ||
+                    canonical[triangle[2]] == canonical[collapse.to])
+                    continue;
+                const float* p[3];
+                const float* q[3];
+                for (uint32_t k = 0; k < 3; ++k)
+                {
+                    p[k] = &points[triangle[k] * 3];
+                    q[k] = triangle[k] == collapse.from ? to_point : p[k];
+                }
+                float n0[3], n1[3];
+                triangle_normal(n0, p[0], p[1], p[2]);
+                triangle_normal(n1, q[0], q[1], q[2]);
+                flipped = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2] <= 0.0f;
+            }
+            if (flipped)
+                continue;
+
+            // the neighbours keep their positions during the pass, so the flip checks stay valid
+            for (uint32_t j = adjacency_offsets[collapse.from]; j < adjacency_offsets[collapse.from + 1]; ++j)
+            {
+                const uint32_t* triangle = &current[adjacency[j] * 3];
+                for (uint32_t k = 0; k < 3; ++k)
+                    touched[canonical[triangle[k]]] = 1;
+            }
+            touched[canonical[collapse.to]] = 1;
+
+            remap[collapse.from] = collapse.to;
+            quadrics[canonical[collapse.to]] += quadrics[canonical[collapse.from]];
+            max_error = std::max(max_error, collapse.error);
+            ++collapses_count;
+        }
+        if (collapses_count == 0)
+            break;
+
+        // the collapsed triangles are degenerate now
+        size_t write = 0;
+        for (size_t t = 0; t < current.size(); t += 3)
+        {
+            const uint32_t a = remap[current[t]];
+            const uint32_t b = remap[current[t + 1]];
+            const uint32_t c = remap[current[t + 2]];
+            if (canonical[a] == canonical[b] || canonical[b] == canonical[c] || canonical[a] == canonical[c])
+                continue;
+            current[write++] = a;
+            current[write++] = b;
+            current[write++] = c;
+        }
+        current.resize(write);
+    }
+
+    if (result_error != nullptr)
+        *result_error = std::sqrt(max_error);
+    std::copy(current.begin(), current.end(), dst);
+    return current.size();
+}
+
+size_t max_meshlets_count(size_t indices_count, uint32_t max_vertices, uint32_t max_triangles)
+{
+    // a meshlet is closed when it can't take 3 new vertices or another triangle
+    const size_t min_triangles = std::max<size_t>(std::min<size_t>((max_vertices - 2) / 3, max_triangles), 1);
+    const size_t triangles_count = indices_count / 3;
+    return (triangles_count + min_triangles - 1) / min_triangles;
+}
+
+namespace {
+
+void compute_meshlet_bounds(Meshlet& meshlet, const uint32_t* indices, const float* positions, size_t positions_stride)
+{
+    // the sphere around the center of the box is good enough for the culling
+    float min[3] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+    float max[3] = { -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max() };
+    for (uint32_t i = 0; i < meshlet.indices_count; ++i)
+    {
+        const float* p = position_at(positions, positions_stride, indices[i]);
+        for (int k = 0; k < 3; ++k)
+        {
+            min[k] = std::min(min[k], p[k]);
+            max[k] = std::max(max[k], p[k]);
+        }
+    }
+    float radius2 = 0.0f;
+    for (int k = 0; k < 3; ++k)
+        meshlet.center[k] = (min[k] + max[k]) * 0.5f;
+    for (uint32_t i = 0; i < meshlet.indices_count; ++i)
+    {
+        const float* p = position_at(positions, positions_stride, indices[i]);
+        const float d[3] = { p[0] - meshlet.center[0], p[1] - meshlet.center[1], p[2] - meshlet.center[2] };
+        radius2 = std::max(radius2, d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+    }
+    meshlet.radius = std::sqrt(radius2);
+
+    // the axis is the average of the normals, the cone opens to the normal furthest from it
+    std::vector<float> normals(meshlet.indices_count);
+    uint32_t normals_count = 0;
+    float axis[3] = { 0.0f, 0.0f, 0.0f };
+    for (uint32_t i = 0; i < meshlet.indices_count; i += 3)
+    {
+        float n[3];
+        triangle_normal(n, position_at(positions, positions_stride, indices[i]), position_at(positions, positions_stride, indices[i + 1]),
+            position_at(positions, positions_stride, indices[i + 2]));
+        const float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length == 0.0f)
+            continue;
+        for (int k = 0; k < 3; ++k)
+        {
+            normals[normals_count * 3 + k] = n[k] / length;
+            axis[k] += n[k] / length;
+        }
+        ++normals_count;
+    }
+    const float axis_length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    meshlet.cone_cutoff = 1.0f;
+    for (int k = 0; k < 3; ++k)
+        meshlet.cone_axis[k] = axis_length > 0.0f ? axis[k] / axis_length : 0.0f;
+    if (axis_length == 0.0f)
+        return;
+    float min_dot = 1.0f;
+    for (uint32_t i = 0; i < normals_count; ++i)
+        min_dot = std::min(min_dot, normals[i * 3] * meshlet.cone_axis[0] + normals[i * 3 + 1] * meshlet.cone_axis[1] +
+            normals[i * 3 + 2] * meshlet.cone_axis[2]);
+    // a cone wider than a half space never faces away
+    if (min_dot > 0.0f)
+        meshlet.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+}
+
+}
+
+size_t build_meshlets(Meshlet* meshlets, const uint32_t* indices, size_t indices_count, const float* positions,
+    size_t positions_stride, uint32_t vertices_count, uint32_t max_vertices, uint32_t max_triangles)
+{
+    assert(indices_count % 3 == 0);
+    assert(max_vertices >= 3 && max_triangles >= 1);
+    // the meshlet that used the vertex last
+    std::vector<uint32_t> marks(vertices_count, std::numeric_limits<uint32_t>::max());
+    size_t meshlets_count = 0;
+    uint32_t meshlet_vertices = 0;
+    size_t first_index = 0;
+    // vertices of the triangle not in the current meshlet yet
+    auto new_vertices_count = [&](size_t i)
+    {
+        uint32_t res = 0;
+        for (uint32_t k = 0; k < 3; ++k)
+        {
+            const uint32_t v = indices[i + k];
+            res += marks[v] != meshlets_count && (k == 0 || v != indices[i]) && (k < 2 || v != indices[i + 1]) ? 1 : 0;
+        }
+        return res;
+    };
+    for (size_t i = 0; i < indices_count; i += 3)
+    {
+        uint32_t new_vertices = new_vertices_count(i);
+        const size_t triangles = (i - first_index) / 3;
+        if (i > first_index && (meshlet_vertices + new_vertices > max_vertices || triangles + 1 > max_triangles))
+        {
+            Meshlet& meshlet = meshlets[meshlets_count++];
+            meshlet.first_index = static_cast<uint32_t>(first_index);
+            meshlet.indices_count = static_cast<uint32_t>(i - first_index);
+            compute_meshlet_bounds(meshlet, indices + first_index, positions, positions_stride);
+            first_index = i;
+            meshlet_vertices = 0;
+            new_vertices = new_vertices_count(i);
+        }
+        for (uint32_t k = 0; k < 3; ++k)
+            marks[indices[i + k]] = static_cast<uint32_t>(meshlets_count);
+        meshlet_vertices += new_vertices;
+    }
+    if (indices_count > first_index)
+    {
+        Meshlet& meshlet = meshlets[meshlets_count++];
+        meshlet.first_index = static_cast<uint32_t>(first_index);
+        meshlet.indices_count = static_cast<uint32_t>(indices_count - first_index);
+        compute_meshlet_bounds(meshlet, indices + first_index, positions, positions_stride);
+    }
+    return meshlets_count;
+}
+
+uint32_t optimize_vertex_fetch_remap(uint32_t* remap, const uint32_t* indices, size_t indices_count, uint32_t vertices_count)
+{
+    const uint32_t unused = std::numeric_limits<uint32_t>::max();
+    std::fill(remap, remap + vertices_count, unused);
+    uint32_t next = 0;
+    for (size_t i = 0; i < indices_count; ++i)
+    {
+        assert(indices[i] < vertices_count);
+        if (remap[indices[i]] == unused)
+            remap[indices[i]] = next++;
+    }
+    const uint32_t used = next;
+    for (uint32_t i = 0; i < vertices_count; ++i)
+    {
+        if (remap[i] == unused)
+            remap[i] = next++;
+    }
+    return used;
+}
+
+void remap_indices(uint32_t* indices, size_t indices_count, const uint32_t* remap)
+{
+    for (size_t i = 0; i < indices_count; ++i)
+        indices[i] = remap[indices[i]];
+}
+
+}
@@ -0,0 +1,98 @@
+#ifndef __MESHOPT_HPP__
+#define __MESHOPT_HPP__
+
+#include <cstdint>
+#include <cstddef>
+
+namespace mhe {
+
+// Triangle lists optimizations done at import. Indices are 32 bit and relative to the first vertex of the mesh,
+// dst may be the same array as indices.
+
+struct VertexCacheStatistics
+{
+    uint32_t vertices_transformed;
+    uint32_t triangles_count;
+    uint32_t vertices_count;
+
+    VertexCacheStatistics() :
+        vertices_transformed(0), triangles_count(0), vertices_count(0)
+    {}
+
+    // average cache miss ratio, transformed vertices per triangle, 0.5 is the best for the regular grids
+    float acmr() const
+    {
+        return triangles_count != 0 ? static_cast<float>(vertices_transformed) / triangles_count : 0.0f;
+    }
+
+    // average transform to vertex ratio, 1 is the best
+    float atvr() const
+    {
+        return vertices_count != 0 ? static_cast<float>(vertices_transformed) / vertices_count : 0.0f;
+    }
+
+    VertexCacheStatistics& operator+= (const VertexCacheStatistics& other)
+    {
+        vertices_transformed += other.vertices_transformed;
+        triangles_count += other.triangles_count;
+        vertices_count += other.vertices_count;
+        return *this;
+    }
+};
+
+// simulates a FIFO post-transform cache of cache_size entries
+VertexCacheStatistics analyze_vertex_cache(const uint32_t* indices, size_t indices_count, uint32_t vertices_count,
+    uint32_t cache_size = 16);
+
+// Reorders the triangles for the post-transform cache, Forsyth's linear-speed algorithm with a 32 entries LRU cache.
+// It doesn't depend on the exact cache size of the GPU.
+void optimize_vertex_cache(uint32_t* dst, const uint32_t* indices, size_t indices_count, uint32_t vertices_count);
+
+// Reorders the clusters of the cache optimized triangles so the outer ones go first and occlude the rest.
+// The clusters start where the cache is flushed, the result is discarded when its ACMR is above
+// threshold * the original one. positions_stride is in bytes.
+void optimize_overdraw(uint32_t* dst, const uint32_t* indices, size_t indices_count,
+    const float* positions, size_t positions_stride, uint32_t vertices_count, float threshold);
+
+// Edge collapse simplification with quadric error metrics. Vertices are collapsed onto their neighbours, so the result
+// references the same vertices. The vertices on the open borders and on the attribute seams (the same position
+// in several vertices) are kept. Stops at target_indices_count or when the next collapse would exceed target_error.
+// The errors are relative to position_extent(). Returns the number of indices written to dst.
+size_t simplify(uint32_t* dst, const uint32_t* indices, size_t indices_count, const float* positions, size_t positions_stride,
+    uint32_t vertices_count, size_t target_indices_count, float target_error, float* result_error = nullptr);
+// the largest size of the bounding box
+float position_extent(const float* positions, size_t positions_stride, uint32_t vertices_count);
+
+// Contiguous range of triangles with a few vertices, the unit of culling finer than a mesh part
+struct Meshlet
+{
+    uint32_t first_index;
+    uint32_t indices_count;
+    // bounding sphere
+    float center[3];
+    float radius;
+    // All the triangles face away from a camera at c when
+    // dot(center - c, cone_axis) >= cone_cutoff * length(center - c) + radius, cone_cutoff is 1 for the wide cones.
+    float cone_axis[3];
+    float cone_cutoff;
+};
+
+// the limits of the common mesh shader implementations, the same clusters may go to them later
+const uint32_t max_meshlet_vertices = 64;
+const uint32_t max_meshlet_triangles = 124;
+
+// the worst case of build_meshlets()
+size_t max_meshlets_count(size_t indices_count, uint32_t max_vertices, uint32_t max_triangles);
+// Splits the triangles in their order into meshlets, indices should be optimized for the vertex cache first,
+// the first_index of the meshlets are relative to indices. Returns the number of the meshlets.
+size_t build_meshlets(Meshlet* meshlets, const uint32_t* indices, size_t indices_count, const float* positions,
+    size_t positions_stride, uint32_t vertices_count, uint32_t max_vertices, uint32_t max_triangles);
+
+// Computes the new places of the vertices in the order of their first use, the unused vertices go to the end.
+// Returns the number of the used vertices.
+uint32_t optimize_vertex_fetch_remap(uint32_t* remap, const uint32_t* indices, size_t indices_count, uint32_t vertices_count);
+void remap_indices(uint32_t* indices, size_t indices_count, const uint32_t* remap);
+
+}
+
+#endif
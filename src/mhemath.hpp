@@ -0,0 +1,662 @@
+#ifndef __MHEMATH_HPP__
+#define __MHEMATH_HPP__
+
+#include <cmath>
+#include <cstring>
+#include <cassert>
+
+#include "simd.hpp"
+
+namespace mhe {
+
+const float pi = 3.14f;
+
+template <class T>
+T deg_to_rad(T d)
+{
+    return d * (T)180 / (T)pi;
+}
+
+template <class T>
+class vector2
+{
+public:
+    T x;
+    T y;
+
+    vector2() : x(0), y(0) {}
+    vector2(T newx, T newy) : x(newx), y(newy) {}
+};
+
+template <class T>
+class vector3
+{
+public:
+    T x;
+    T y;
+    T z;
+
+    vector3() : x(0), y(0), z(0) {}
+    vector3(T newx, T newy, T newz) : x(newx), y(newy), z(newz) {}
+
+    void normalize()
+    {
+        T m = magnitude();
+        x /= m;
+        y /= m;
+        z /= m;
+    }
+
+    T magnitude() const
+    {
+        return sqrt(x * x + y * y + z * z);
+    }
+
+    vector3 operator- (const vector3& other) const
+    {
+        return vector3(x - other.x, y - other.y, z - other.z);
+    }
+
+    static vector3 up()
+    {
+        return vector3(0, 1, 0);
+    }
+};
+
+template <class T>
+T dot(const vector3<T>& v1, const vector3<T>& v2)
+{
+    return v1.x * v2.x + v1.y * v2.y + v1.z * v2.z;
+}
+
+template <class T>
+vector3<T> cross(const vector3<T>& v1, const vector3<T>& v2)
+{
+    return vector3<T>(v1.y * v2.z - v2.y * v1.z,
+        v2.x * v1.z - v1.x * v2.z,
+        v1.x * v2.y - v2.x * v1.y);
+}
+
+template <class T>
+vector3<T> operator- (const vector3<T>& v)
+{
+    return vector3<T>(-v.x, -v.y, -v.z);
+}
+
+// 16 bytes aligned, so vec4 can be loaded into a SIMD register directly
+template <class T>
+class alignas(16) vector4
+{
+public:
+    union
+    {
+        struct
+        {
+            T x, y, z, w;
+        };
+
+        struct
+        {
+            T c[4];
+        };
+    };
+
+    vector4() : x(0), y(0), z(0), w(0) {}
+    vector4(T newx, T newy, T newz, T neww) : x(newx), y(newy), z(newz), w(neww) {}
+
+    void set(T newx, T newy, T newz, T neww)
+    {
+        x = newx;
+        y = newy;
+        z = newz;
+        w = neww;
+    }
+
+    static vector4 zero()
+    {
+        return vector4();
+    }
+};
+
+// Kernels working on raw row-major data. The templates are the reference scalar implementation,
+// the float overloads use SIMD and are preferred by overload resolution.
+namespace detail {
+
+template <class T>
+void add(T* res, const T* a, const T* b)
+{
+    for (int i = 0; i < 4; ++i)
+        res[i] = a[i] + b[i];
+}
+
+template <class T>
+void sub(T* res, const T* a, const T* b)
+{
+    for (int i = 0; i < 4; ++i)
+        res[i] = a[i] - b[i];
+}
+
+template <class T>
+void mul(T* res, const T* a, const T* b)
+{
+    for (int i = 0; i < 4; ++i)
+        res[i] = a[i] * b[i];
+}
+
+template <class T>
+void scale(T* res, const T* a, T s)
+{
+    for (int i = 0; i < 4; ++i)
+        res[i] = a[i] * s;
+}
+
+template <class T>
+T dot(const T* a, const T* b)
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+}
+
+// res = v * m, v is a row vector
+template <class T>
+void transform(T* res, const T* v, const T* m)
+{
+    T tmp[4];
+    for (int j = 0; j < 4; ++j)
+        tmp[j] = v[0] * m[j] + v[1] * m[4 + j] + v[2] * m[8 + j] + v[3] * m[12 + j];
+    memcpy(res, tmp, sizeof(tmp));
+}
+
+// res = a * b, res may alias a or b
+template <class T>
+void multiply(T* res, const T* a, const T* b)
+{
+    T tmp[16];
+    for (int i = 0; i < 4; ++i)
+    {
+        for (int j = 0; j < 4; ++j)
+            tmp[i * 4 + j] = a[i * 4] * b[j] + a[i * 4 + 1] * b[4 + j] + a[i * 4 + 2] * b[8 + j] + a[i * 4 + 3] * b[12 + j];
+    }
+    memcpy(res, tmp, sizeof(tmp));
+}
+
+template <class T>
+void transpose(T* res, const T* m)
+{
+    T tmp[16];
+    for (int i = 0; i < 4; ++i)
+    {
+        for (int j = 0; j < 4; ++j)
+            tmp[j * 4 + i] = m[i * 4 + j];
+    }
+    memcpy(res, tmp, sizeof(tmp));
+}
+
+// returns false and leaves res untouched if the matrix is singular
+template <class T>
+bool invert(T* res, const T* data)
+{
+    typedef T row[4];
+    const row* m_ = reinterpret_cast<const row*>(data);
+    T r[4][4];
+    T m2233 = m_[2][2] * m_[3][3] - m_[2][3] * m_[3][2];
+    T m2133 = m_[2][1] * m_[3][3] - m_[2][3] * m_[3][1];
+    T m2132 = m_[2][1] * m_[3][2] - m_[2][2] * m_[3][1];
+    T m1033 = m_[1][0] * m_[3][3] - m_[1][3] * m_[3][0];
+    T m1032 = m_[1][0] * m_[3][2] - m_[1][2] * m_[3][0];
+    T m2032 = m_[2][0] * m_[3][2] - m_[2][2] * m_[3][0];
+    T m2031 = m_[2][0] * m_[3][1] - m_[2][1] * m_[3][0];
+    T m2033 = m_[2][0] * m_[3][3] - m_[2][3] * m_[3][0];
+    T m1233 = m_[1][2] * m_[3][3] - m_[1][3] * m_[3][2];
+    T m1133 = m_[1][1] * m_[3][3] - m_[1][3] * m_[3][1];
+    T m1132 = m_[1][1] * m_[3][2] - m_[1][2] * m_[3][1];
+    T m1031 = m_[1][0] * m_[3][1] - m_[1][1] * m_[3][0];
+    T m1223 = m_[1][2] * m_[2][3] - m_[1][3] * m_[2][2];
+    T m1123 = m_[1][1] * m_[2][3] - m_[1][3] * m_[2][1];
+    T m1122 = m_[1][1] * m_[2][2] - m_[1][2] * m_[2][1];
+    T m1023 = m_[1][0] * m_[2][3] - m_[1][3] * m_[2][0];
+    T m1022 = m_[1][0] * m_[2][2] - m_[1][2] * m_[2][0];
+    T m1021 = m_[1][0] * m_[2][1] - m_[1][1] * m_[2][0];
+
+    r[0][0] = m_[1][1] * m2233 - m_[1][2] * m2133 + m_[1][3] * m2132;
+    r[1][0] = -(m_[1][0] * m2233 - m_[1][2] * m2033 + m_[1][3] * m2032);
+    r[2][0] = m_[1][0] * m2133 - m_[1][1] * m2033 + m_[1][3] * m2031;
+    r[3][0] = -(m_[1][0] * m2132 - m_[1][1] * m2032 + m_[1][2] * m2031);
+    r[0][1] = -(m_[0][1] * m2233 - m_[0][2] * m2133 + m_[0][3] * m2132);
+    r[1][1] = m_[0][0] * m2233 - m_[0][2] * m2033 + m_[0][3] * m2032;
+    r[2][1] = -(m_[0][0] * m2133 - m_[0][1] * m2033 + m_[0][3] * m2031);
+    r[3][1] = m_[0][0] * m2132 - m_[0][1] * m2032 + m_[0][2] * m2031;
+    r[0][2] = m_[0][1] * m1233 - m_[0][2] * m1133 + m_[0][3] * m1132;
+    r[1][2] = -(m_[0][0] * m1233 - m_[0][2] * m1033 + m_[0][3] * m1032);
+    r[2][2] = m_[0][0] * m1133 - m_[0][1] * m1033 + m_[0][3] * m1031;
+    r[3][2] = -(m_[0][0] * m1132 - m_[0][1] * m1032 + m_[0][2] * m1031);
+    r[0][3] = -(m_[0][1] * m1223 - m_[0][2] * m1123 + m_[0][3] * m1122);
+    r[1][3] = m_[0][0] * m1223 - m_[0][2] * m1023 + m_[0][3] * m1022;
+    r[2][3] = -(m_[0][0] * m1123 - m_[0][1] * m1023 + m_[0][3] * m1021);
+    r[3][3] = m_[0][0] * m1122 - m_[0][1] * m1022 + m_[0][2] * m1021;
+
+    T det = m_[0][0] * r[0][0] + m_[0][1] * r[1][0] + m_[0][2] * r[2][0] + m_[0][3] * r[3][0];
+    if (det == 0)
+        return false;
+    T inv_det = (T)1 / det;
+    for (int i = 0; i < 4; ++i)
+    {
+        for (int j = 0; j < 4; ++j)
+            res[i * 4 + j] = r[i][j] * inv_det;
+    }
+    return true;
+}
+
+// SIMD versions, all the pointers must be 16 bytes aligned
+
+inline void add(float* res, const float* a, const float* b)
+{
+    simd::store(res, simd::add(simd::load(a), simd::load(b)));
+}
+
+inline void sub(float* res, const float* a, const float* b)
+{
+    simd::store(res, simd::sub(simd::load(a), simd::load(b)));
+}
+
+inline void mul(float* res, const float* a, const float* b)
+{
+    simd::store(res, simd::mul(simd::load(a), simd::load(b)));
+}
+
+inline void scale(float* res, const float* a, float s)
+{
+    simd::store(res, simd::mul(simd::load(a), simd::splat(s)));
+}
+
+inline float dot(const float* a, const float* b)
+{
+    return simd::dot(simd::load(a), simd::load(b));
+}
+
+inline void transform(float* res, const float* v, const float* m)
+{
+    simd::float4 vec = simd::load(v);
+    simd::float4 r = simd::mul(simd::broadcast<0>(vec), simd::load(m));
+    r = simd::madd(simd::broadcast<1>(vec), simd::load(m + 4), r);
+    r = simd::madd(simd::broadcast<2>(vec), simd::load(m + 8), r);
+    r = simd::madd(simd::broadcast<3>(vec), simd::load(m + 12), r);
+    simd::store(res, r);
+}
+
+// every row of the result is a linear combination of the rows of b
+inline void multiply(float* res, const float* a, const float* b)
+{
+#if defined(MHE_SIMD_AVX)
+    // two rows per iteration
+    __m256 b0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(b));
+    __m256 b1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(b + 4));
+    __m256 b2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(b + 8));
+    __m256 b3 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(b + 12));
+    __m256 a01 = _mm256_loadu_ps(a);
+    __m256 a23 = _mm256_loadu_ps(a + 8);
+    __m256 r01 = _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, 0x00), b0);
+    r01 = _mm256_add_ps(r01, _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, 0x55), b1));
+    r01 = _mm256_add_ps(r01, _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, 0xaa), b2));
+    r01 = _mm256_add_ps(r01, _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, 0xff), b3));
+    __m256 r23 = _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, 0x00), b0);
+    r23 = _mm256_add_ps(r23, _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, 0x55), b1));
+    r23 = _mm256_add_ps(r23, _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, 0xaa), b2));
+    r23 = _mm256_add_ps(r23, _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, 0xff), b3));
+    _mm256_storeu_ps(res, r01);
+    _mm256_storeu_ps(res + 8, r23);
+#else
+    simd::float4 b0 = simd::load(b);
+    simd::float4 b1 = simd::load(b + 4);
+    simd::float4 b2 = simd::load(b + 8);
+    simd::float4 b3 = simd::load(b + 12);
+    simd::float4 r[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        simd::float4 row = simd::load(a + i * 4);
+        r[i] = simd::mul(simd::broadcast<0>(row), b0);
+        r[i] = simd::madd(simd::broadcast<1>(row), b1, r[i]);
+        r[i] = simd::madd(simd::broadcast<2>(row), b2, r[i]);
+        r[i] = simd::madd(simd::broadcast<3>(row), b3, r[i]);
+    }
+    for (int i = 0; i < 4; ++i)
+        simd::store(res + i * 4, r[i]);
+#endif
+}
+
+inline void transpose(float* res, const float* m)
+{
+    simd::float4 r0 = simd::load(m);
+    simd::float4 r1 = simd::load(m + 4);
+    simd::float4 r2 = simd::load(m + 8);
+    simd::float4 r3 = simd::load(m + 12);
+    simd::transpose(r0, r1, r2, r3);
+    simd::store(res, r0);
+    simd::store(res + 4, r1);
+    simd::store(res + 8, r2);
+    simd::store(res + 12, r3);
+}
+
+// 2x2 row-major blocks packed into one register
+inline simd::float4 mat2_mul(simd::float4 a, simd::float4 b)
+{
+    return simd::add(simd::mul(a, simd::swizzle<0, 3, 0, 3>(b)),
+        simd::mul(simd::swizzle<1, 0, 3, 2>(a), simd::swizzle<2, 1, 2, 1>(b)));
+}
+
+// adj(a) * b
+inline simd::float4 mat2_adj_mul(simd::float4 a, simd::float4 b)
+{
+    return simd::sub(simd::mul(simd::swizzle<3, 3, 0, 0>(a), b),
+        simd::mul(simd::swizzle<1, 1, 2, 2>(a), simd::swizzle<2, 3, 0, 1>(b)));
+}
+
+// a * adj(b)
+inline simd::float4 mat2_mul_adj(simd::float4 a, simd::float4 b)
+{
+    return simd::sub(simd::mul(a, simd::swizzle<3, 0, 3, 0>(b)),
+        simd::mul(simd::swizzle<1, 0, 3, 2>(a), simd::swizzle<2, 1, 2, 1>(b)));
+}
+
+// block-wise inverse of a general matrix through the 2x2 sub-matrices
+inline bool invert(float* res, const float* m)
+{
+    simd::float4 r0 = simd::load(m);
+    simd::float4 r1 = simd::load(m + 4);
+    simd::float4 r2 = simd::load(m + 8);
+    simd::float4 r3 = simd::load(m + 12);
+
+    simd::float4 a = simd::shuffle<0, 1, 0, 1>(r0, r1);
+    simd::float4 b = simd::shuffle<2, 3, 2, 3>(r0, r1);
+    simd::float4 c = simd::shuffle<0, 1, 0, 1>(r2, r3);
+    simd::float4 d = simd::shuffle<2, 3, 2, 3>(r2, r3);
+
+    // determinants of the blocks as (|A|, |B|, |C|, |D|)
+    simd::float4 det_sub = simd::sub(
+        simd::mul(simd::shuffle<0, 2, 0, 2>(r0, r2), simd::shuffle<1, 3, 1, 3>(r1, r3)),
+        simd::mul(simd::shuffle<1, 3, 1, 3>(r0, r2), simd::shuffle<0, 2, 0, 2>(r1, r3)));
+    simd::float4 det_a = simd::broadcast<0>(det_sub);
+    simd::float4 det_b = simd::broadcast<1>(det_sub);
+    simd::float4 det_c = simd::broadcast<2>(det_sub);
+    simd::float4 det_d = simd::broadcast<3>(det_sub);
+
+    simd::float4 d_c = mat2_adj_mul(d, c);
+    simd::float4 a_b = mat2_adj_mul(a, b);
+    simd::float4 x = simd::sub(simd::mul(det_d, a), mat2_mul(b, d_c));
+    simd::float4 w = simd::sub(simd::mul(det_a, d), mat2_mul(c, a_b));
+    simd::float4 y = simd::sub(simd::mul(det_b, c), mat2_mul_adj(d, a_b));
+    simd::float4 z = simd::sub(simd::mul(det_c, b), mat2_mul_adj(a, d_c));
+
+    // |M| = |A||D| + |B||C| - tr(adj(A)B adj(D)C)
+    simd::float4 det = simd::add(simd::mul(det_a, det_d), simd::mul(det_b, det_c));
+    det = simd::sub(det, simd::hsum(simd::mul(a_b, simd::swizzle<0, 2, 1, 3>(d_c))));
+    if (simd::x(det) == 0.0f)
+        return false;
+
+    simd::float4 inv_det = simd::div(simd::set(1.0f, -1.0f, -1.0f, 1.0f), det);
+    x = simd::mul(x, inv_det);
+    y = simd::mul(y, inv_det);
+    z = simd::mul(z, inv_det);
+    w = simd::mul(w, inv_det);
+
+    // the adjugate shuffle is merged into the store
+    simd::store(res, simd::shuffle<3, 1, 3, 1>(x, y));
+    simd::store(res + 4, simd::shuffle<2, 0, 2, 0>(x, y));
+    simd::store(res + 8, simd::shuffle<3, 1, 3, 1>(z, w));
+    simd::store(res + 12, simd::shuffle<2, 0, 2, 0>(z, w));
+    return true;
+}
+
+}
+
+template <class T>
+vector4<T> operator+ (const vector4<T>& v1, const vector4<T>& v2)
+{
+    vector4<T> res;
+    detail::add(res.c, v1.c, v2.c);
+    return res;
+}
+
+template <class T>
+vector4<T> operator- (const vector4<T>& v1, const vector4<T>& v2)
+{
+    vector4<T> res;
+    detail::sub(res.c, v1.c, v2.c);
+    return res;
+}
+
+// component-wise
+template <class T>
+vector4<T> operator* (const vector4<T>& v1, const vector4<T>& v2)
+{
+    vector4<T> res;
+    detail::mul(res.c, v1.c, v2.c);
+    return res;
+}
+
+template <class T>
+vector4<T> operator* (const vector4<T>& v, T s)
+{
+    vector4<T> res;
+    detail::scale(res.c, v.c, s);
+    return res;
+}
+
+template <class T>
+T dot(const vector4<T>& v1, const vector4<T>& v2)
+{
+    return detail::dot(v1.c, v2.c);
+}
+
+template <class T>
+class matrix4x4
+{
+public:
+    matrix4x4()
+    {
+        load_identity();
+    }
+
+    void load_identity()
+    {
+        set(1, 0, 0, 0,
+            0, 1, 0, 0,
+            0, 0, 1, 0,
+            0, 0, 0, 1);
+    }
+
+    void set(T a00, T a01, T a02, T a03,
+        T a10, T a11, T a12, T a13,
+        T a20, T a21, T a22, T a23,
+        T a30, T a31, T a32, T a33)
+    {
+        m_[0][0] = a00; m_[0][1] = a01; m_[0][2] = a02, m_[0][3] = a03;
+        m_[1][0] = a10; m_[1][1] = a11; m_[1][2] = a12, m_[1][3] = a13;
+        m_[2][0] = a20; m_[2][1] = a21; m_[2][2] = a22, m_[2][3] = a23;
+        m_[3][0] = a30; m_[3][1] = a31; m_[3][2] = a32, m_[3][3] = a33;
+    }
+
+    void set(const T* data)
+    {
+        memcpy(&m_, data, 16 * sizeof(T));
+    }
+
+    T* data()
+    {
+        return reinterpret_cast<T*>(m_);
+    }
+
+    const T* data() const
+    {
+        return reinterpret_cast<const T*>(m_);
+    }
+
+    T operator() (size_t i, size_t j) const
+    {
+        assert(i < 4 && j < 4);
+        return m_[i][j];
+    }
+
+    matrix4x4& operator= (const matrix4x4& other)
+    {
+        if (this == &other)
+            return *this;
+        memcpy(m_, other.data(), sizeof(T) * 16);
+        return *this;
+    }
+
+    matrix4x4 operator* (const matrix4x4& other) const
+    {
+        matrix4x4 res;
+        detail::multiply(res.data(), data(), other.data());
+        return res;
+    }
+
+    matrix4x4& operator*= (const matrix4x4& other)
+    {
+        detail::multiply(data(), data(), other.data());
+        return *this;
+    }
+
+    matrix4x4& operator*= (T v)
+    {
+        for (int i = 0; i < 4; ++i)
+            detail::scale(m_[i], m_[i], v);
+        return *this;
+    }
+
+    vector4<T> row(size_t index) const
+    {
+        assert(index < 4);
+        return vector4<T>(m_[index][0], m_[index][1], m_[index][2], m_[index][3]);
+    }
+
+    void transpose()
+    {
+        detail::transpose(data(), data());
+    }
+
+    matrix4x4 transposed() const
+    {
+        matrix4x4 res;
+        detail::transpose(res.data(), data());
+        return res;
+    }
+
+    void invert()
+    {
+        if (!detail::invert(data(), data()))
+        {
+            assert(0);
+            load_identity();
+        }
+    }
+
+    static matrix4x4 identity()
+    {
+        return matrix4x4();
+    }
+
+    static matrix4x4 scaling(T s)
+    {
+        matrix4x4 m;
+        m.set(s, 0, 0, 0,
+            0, s, 0, 0,
+            0, 0, s, 0,
+            0, 0, 0, 1);
+        return m;
+    }
+
+    static matrix4x4 translation(const vector3<T>& v)
+    {
+        matrix4x4 m;
+        m.set(1, 0, 0, 0,
+            0, 1, 0, 0,
+            0, 0, 1, 0,
+            v.x, v.y, v.z, 1);
+        return m;
+    }
+
+    static matrix4x4 rotation_around_y(T angle)
+    {
+        T s = sin(angle);
+        T c = cos(angle);
+
+        matrix4x4 m;
+        m.set(c, 0, s, 0,
+            0, 1, 0, 0,
+            -s, 0, c, 0,
+            0, 0, 0, 1);
+        return m;
+    }
+
+    static matrix4x4 look_at(const vector3<T>& pos, const vector3<T>& dir, const vector3<T>& up)
+    {
+        matrix4x4 m;
+        vector3<T> f = dir - pos;
+        f.normalize();
+        vector3<T> s = cross(f, up);
+        s.normalize();
+        vector3<T> u = cross(s, f);
+        u.normalize();
+        m.set(s.x, -u.x, f.x, 0,
+            s.y, -u.y, f.y, 0,
+            s.z, -u.z, f.z, 0,
+            -dot(pos, s), -dot(pos, u), -dot(pos, f), 1);
+        return m;
+    }
+
+    static matrix4x4 frustum(T l, T r, T t, T b, T n, T f)
+    {
+        matrix4x4 m;
+        // suppose that we have depth mapped to [0..1] interval
+        m.set((T)2 / (r - l), 0, 0, 0,
+            0, (T)2 / (t - b), 0, 0,
+            -(r + l) / (r - l), -(t + b) / (t - b), -f / (n - f), 1,
+            0, 0, n * f / (n - f), 0);
+        return m;
+    }
+
+    static matrix4x4 perspective(T fov, T aspect, T znear, T zfar)
+    {
+        T fov_tan = (T)tan(fov * 0.5f);
+        T right = fov_tan * aspect * znear;
+        T left = -right;
+        T top = fov_tan * znear;
+        T bottom = -top;
+        return frustum(left, right, top, bottom, znear, zfar);
+    }
+private:
+    alignas(16) T m_[4][4];
+};
+
+// v is a row vector
+template <class T>
+vector4<T> operator* (const vector4<T>& v, const matrix4x4<T>& m)
+{
+    vector4<T> res;
+    detail::transform(res.c, v.c, m.data());
+    return res;
+}
+
+template <class T>
+matrix4x4<T> transpose(const matrix4x4<T>& m)
+{
+    return m.transposed();
+}
+
+template <class T>
+matrix4x4<T> inverse(const matrix4x4<T>& m)
+{
+    matrix4x4<T> copy = m;
+    copy.invert();
+    return copy;
+}
+
+typedef vector2<float> vec2;
+typedef vector3<float> vec3;
+typedef vector4<float> vec4;
+typedef matrix4x4<float> mat4x4;
+
+}
+
+#endif
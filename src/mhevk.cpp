@@ -1,10 +1,103 @@
 #include "mhevk.hpp"
+#include "meshcache.hpp"
+#include "quantization.hpp"
+#include "meshopt.hpp"
+#include "culling.hpp"
+#include "jobs.hpp"
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include <algorithm>
+
 namespace mhe {
+
+void BuddyAllocator::init(uint64_t size, uint64_t min_size)
+{
+    ASSERT(next_pow2(size) == size && next_pow2(min_size) == min_size && min_size <= size, "Buddy allocator sizes must be powers of 2");
+    size_ = size;
+    min_size_ = min_size;
+    used_ = 0;
+    requested_ = 0;
+    allocated_.clear();
+    free_lists_.clear();
+    free_lists_.resize(order_for(size) + 1);
+    free_lists_.back().insert(0);
+}
+
+uint32_t BuddyAllocator::order_for(uint64_t size) const
+{
+    uint32_t order = 0;
+    while (node_size(order) < size)
+        ++order;
+    return order;
+}
+
+uint64_t BuddyAllocator::allocate(uint64_t size, uint64_t alignment)
+{
+    uint64_t aligned_size = size > alignment ? size : alignment;
+    if (aligned_size > size_)
+        return invalid_offset;
+    uint32_t order = order_for(aligned_size);
+    uint32_t free_order = order;
+    while (free_order < free_lists_.size() && free_lists_[free_order].empty())
+        ++free_order;
+    if (free_order == free_lists_.size())
+        return invalid_offset;
+
+    uint64_t offset = *free_lists_[free_order].begin();
+    free_lists_[free_order].erase(free_lists_[free_order].begin());
+    // split the node until it has the required size, the right halves go to the free lists
+    while (free_order > order)
+    {
+        --free_order;
+        free_lists_[free_order].insert(offset + node_size(free_order));
+    }
+
+    AllocatedNode& node = allocated_[offset];
+    node.order = order;
+    node.requested = size;
+    used_ += node_size(order);
+    requested_ += size;
+    return offset;
+}
+
+void BuddyAllocator::free(uint64_t offset)
+{
+    auto it = allocated_.find(offset);
+    ASSERT(it != allocated_.end(), "Invalid offset passed to BuddyAllocator::free");
+    if (it == allocated_.end())
+        return;
+    uint32_t order = it->second.order;
+    used_ -= node_size(order);
+    requested_ -= it->second.requested;
+    allocated_.erase(it);
+
+    // merge with the free buddies
+    while (order + 1 < free_lists_.size())
+    {
+        uint64_t buddy = offset ^ node_size(order);
+        auto buddy_it = free_lists_[order].find(buddy);
+        if (buddy_it == free_lists_[order].end())
+            break;
+        free_lists_[order].erase(buddy_it);
+        offset = offset < buddy ? offset : buddy;
+        ++order;
+    }
+    free_lists_[order].insert(offset);
+}
+
+uint64_t BuddyAllocator::largest_free() const
+{
+    for (size_t i = free_lists_.size(); i > 0; --i)
+    {
+        if (!free_lists_[i - 1].empty())
+            return node_size(static_cast<uint32_t>(i - 1));
+    }
+    return 0;
+}
+
 namespace vk {
 
 VKAPI_ATTR VkBool32 VKAPI_CALL debug_callback(VkFlags msgFlags, VkDebugReportObjectTypeEXT objType,
@@ -269,16 +362,22 @@ VkResult init_pipeline_cache(VulkanContext& context)
 
 VkResult init_descriptor_pools(VulkanContext& context)
 {
-    VkDescriptorPoolSize descriptor_pool_size[2] =
+    // a set per mip of DepthPyramid
+    VkDescriptorPoolSize descriptor_pool_size[5] =
     {
         { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 16 },
-        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 16 }
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 8 },
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 32 },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 32 },
+        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 16 }
     };
 
     VkDescriptorPoolCreateInfo descriptor_pool_create_info = {};
     descriptor_pool_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    descriptor_pool_create_info.maxSets = 8;
-    descriptor_pool_create_info.poolSizeCount = 2;
+    // the resources free their sets on destroy
+    descriptor_pool_create_info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    descriptor_pool_create_info.maxSets = 64;
+    descriptor_pool_create_info.poolSizeCount = array_size(descriptor_pool_size);
     descriptor_pool_create_info.pPoolSizes = descriptor_pool_size;
     VK_CHECK(vkCreateDescriptorPool(*context.main_device, &descriptor_pool_create_info, context.allocation_callbacks, &context.descriptor_pools.main_descriptor_pool));
 
@@ -307,6 +406,16 @@ VkResult init_descriptor_set_layouts(VulkanContext& context)
     descriptor_set_layout_create_info.bindingCount = array_size(per_model_layout_binding);
     VK_CHECK(vkCreateDescriptorSetLayout(*context.main_device, &descriptor_set_layout_create_info, context.allocation_callbacks, &context.descriptor_set_layouts.mesh_layout));
 
+    // the same data for many objects in one buffer, every draw selects its object with a dynamic offset
+    VkDescriptorSetLayoutBinding dynamic_model_layout_binding[1] =
+    {
+        { 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr }
+    };
+
+    descriptor_set_layout_create_info.pBindings = dynamic_model_layout_binding;
+    descriptor_set_layout_create_info.bindingCount = array_size(dynamic_model_layout_binding);
+    VK_CHECK(vkCreateDescriptorSetLayout(*context.main_device, &descriptor_set_layout_create_info, context.allocation_callbacks, &context.descriptor_set_layouts.dynamic_mesh_layout));
+
     VkDescriptorSetLayoutBinding material_layout_binding[2] =
     {
         { 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr },
@@ -334,6 +443,7 @@ void destroy_descriptor_set_layouts(VulkanContext& context)
 {
     vkDestroyDescriptorSetLayout(*context.main_device, context.descriptor_set_layouts.material_layout, context.allocation_callbacks);
     vkDestroyDescriptorSetLayout(*context.main_device, context.descriptor_set_layouts.mesh_layout, context.allocation_callbacks);
+    vkDestroyDescriptorSetLayout(*context.main_device, context.descriptor_set_layouts.dynamic_mesh_layout, context.allocation_callbacks);
     vkDestroyDescriptorSetLayout(*context.main_device, context.descriptor_set_layouts.gbuffer_layout, context.allocation_callbacks);
     vkDestroyDescriptorSetLayout(*context.main_device, context.descriptor_set_layouts.camera_layout, context.allocation_callbacks);
 }
@@ -350,6 +460,20 @@ VkResult init_default_texture(VulkanContext& context)
         reinterpret_cast<const uint8_t*>(&data), sizeof(data)));
     return VK_SUCCESS;
 }
+
+// the buffers and images used by both the graphics and the async compute queue are shared concurrently instead of
+// transferring their ownership every frame, queue_family_indices must live until the resource is created
+template <class S>
+void share_with_compute_queue(S& settings, uint32_t (&queue_family_indices)[2], Device& device)
+{
+    if (!device.has_compute_queue())
+        return;
+    queue_family_indices[0] = device.physical_device()->graphics_queue_family_index();
+    queue_family_indices[1] = device.compute_queue_family_index();
+    settings.queue_family_indices = queue_family_indices;
+    settings.queue_family_indices_count = 2;
+    settings.sharing_mode = VK_SHARING_MODE_CONCURRENT;
+}
 }
 
 VkSamplerCreateInfo SamplerCreateInfo(VkFilter mag_filter, VkFilter min_filter, VkSamplerMipmapMode mipmap_mode,
@@ -456,6 +580,8 @@ VkResult init_vulkan_context(VulkanContext& context, const char* appname, uint32
 
     context.default_gpu_interface.device = context.main_device;
 
+    VK_CHECK(context.memory_allocator.init(context, context.default_gpu_interface, MemoryAllocator::Settings()));
+
     // swapchain
     Swapchain::Settings swapchain_settings;
     VK_CHECK(context.main_swapchain.init(context, context.main_device, swapchain_settings));
@@ -486,7 +612,12 @@ VkResult init_vulkan_context(VulkanContext& context, const char* appname, uint32
     VK_CHECK(context.main_swapchain.create_framebuffers(context, &context.render_passes.main_render_pass));
 
     VK_CHECK(context.command_pools.main_graphics_command_pool.init(context, gpu_iface));
-    VK_CHECK(context.command_pools.resource_uploading_command_pool.init(context, gpu_iface));
+    VK_CHECK(context.command_pools.resource_uploading_command_pool.init(context, gpu_iface, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT));
+    VK_CHECK(context.command_pools.transfer_command_pool.init(context, gpu_iface, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        context.main_device->transfer_queue_family_index()));
+    VK_CHECK(context.staging_ring.init(context, gpu_iface, StagingRing::Settings()));
+
+    // the geometry pools are created by the first meshes using them
 
     VK_CHECK(init_pipeline_cache(context));
 
@@ -511,6 +642,12 @@ void destroy_vulkan_context(VulkanContext& context)
 
     vkDestroyPipelineCache(*context.main_device, context.main_pipeline_cache, context.allocation_callbacks);
 
+    context.geometry_pools.fullscreen_geometry_pool.destroy(context);
+    context.geometry_pools.quantized_geometry_pool.destroy(context);
+    context.geometry_pools.compact_geometry_pool.destroy(context);
+    context.geometry_pools.main_geometry_pool.destroy(context);
+    context.staging_ring.destroy(context);
+    context.command_pools.transfer_command_pool.destroy(context);
     context.command_pools.resource_uploading_command_pool.destroy(context);
     context.command_pools.main_graphics_command_pool.destroy(context);
 
@@ -520,6 +657,8 @@ void destroy_vulkan_context(VulkanContext& context)
 
     context.main_swapchain.destroy(context);
 
+    context.memory_allocator.destroy(context);
+
     for (PhysicalDevice& physical_device : context.gpus)
         physical_device.destroy(context);
 
@@ -532,6 +671,11 @@ void destroy_vulkan_context(VulkanContext& context)
     vkDestroyInstance(context.instance, context.allocation_callbacks);
 }
 
+VkResult flush_uploads(VulkanContext& context)
+{
+    return context.staging_ring.flush(context);
+}
+
 bool app_message_loop(VulkanContext& context)
 {
 #ifdef _WIN32
@@ -569,6 +713,7 @@ VkResult PhysicalDevice::check_properties(VulkanContext& context)
 {
     vkGetPhysicalDeviceProperties(id_, &properties_);
     vkGetPhysicalDeviceMemoryProperties(id_, &memory_properties_);
+    vkGetPhysicalDeviceFeatures(id_, &features_);
 
     const uint32_t max_uint32 = std::numeric_limits<uint32_t>::max();
 
@@ -588,8 +733,18 @@ VkResult PhysicalDevice::check_properties(VulkanContext& context)
             rendering_queue_found = true;
             graphics_queue_family_index_ = i;
         }
-        if (properties.queueCount & VK_QUEUE_COMPUTE_BIT)
+        if (properties.queueFlags & VK_QUEUE_COMPUTE_BIT)
+        {
+            // prefer a family that can run compute asynchronously
+            if (!compute_queue_found || !(properties.queueFlags & VK_QUEUE_GRAPHICS_BIT))
+                compute_queue_family_index_ = i;
             compute_queue_found = true;
+        }
+        // a transfer-only family is usually backed by the DMA engines
+        if ((properties.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+            !(properties.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+            transfer_queue_family_index_ == invalid_index)
+            transfer_queue_family_index_ = i;
     }
 
     VERIFY(rendering_queue_found, "Rendering queue hasn't been found", VK_ERROR_INITIALIZATION_FAILED);
@@ -642,78 +797,99 @@ uint32_t PhysicalDevice::get_memory_type_index(const VkMemoryRequirements& memor
     return 0;
 }
 
-VkResult Queue::init(VulkanContext& context, const GPUInterface& gpu_iface, VkQueue id)
+VkResult Queue::init(VulkanContext&, const GPUInterface& gpu_iface, VkQueue id)
 {
     id_ = id;
     gpu_iface_ = gpu_iface;
-    VkSemaphoreCreateInfo create_info = {};
-    create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-    VK_CHECK(vkCreateSemaphore(*gpu_iface.device, &create_info, context.allocation_callbacks, &present_semaphore_));
-    VkFenceCreateInfo fence_create_info = {};
-    fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    VK_CHECK(vkCreateFence(*gpu_iface.device, &fence_create_info, context.allocation_callbacks, &submit_fence_));
     return VK_SUCCESS;
 }
 
-void Queue::destroy(VulkanContext& context)
-{
-    vkDestroyFence(*gpu_iface_.device, submit_fence_, context.allocation_callbacks);
-    vkDestroySemaphore(*gpu_iface_.device, present_semaphore_, context.allocation_callbacks);
-}
+void Queue::destroy(VulkanContext&)
+{}
 
 VkResult Queue::submit(const CommandBuffer* command_buffers, uint32_t count,
     const VkSemaphore* wait_semaphores, uint32_t wait_semaphores_count,
-    const VkSemaphore* signal_semaphores, uint32_t signal_semaphores_count)
+    const VkSemaphore* signal_semaphores, uint32_t signal_semaphores_count,
+    VkFence fence, VkPipelineStageFlags wait_stage)
 {
     std::vector<VkCommandBuffer> buffers(count);
     for (uint32_t i = 0; i < count; ++i)
         buffers[i] = command_buffers[i];
 
-    VkPipelineStageFlags wait_stages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    std::vector<VkPipelineStageFlags> wait_stages(wait_semaphores_count, wait_stage);
 
     VkSubmitInfo submit_info = {};
     submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submit_info.commandBufferCount = count;
-    submit_info.pCommandBuffers = &buffers[0];
+    submit_info.pCommandBuffers = count > 0 ? &buffers[0] : nullptr;
     submit_info.pSignalSemaphores = signal_semaphores;
     submit_info.signalSemaphoreCount = signal_semaphores_count;
     submit_info.pWaitSemaphores = wait_semaphores;
     submit_info.waitSemaphoreCount = wait_semaphores_count;
-    submit_info.pWaitDstStageMask = &wait_stages;
+    submit_info.pWaitDstStageMask = wait_semaphores_count > 0 ? &wait_stages[0] : nullptr;
 
-    VK_CHECK(vkQueueSubmit(id_, 1, &submit_info, submit_fence_));
+    VK_VERIFY(vkQueueSubmit(id_, 1, &submit_info, fence));
 
     return VK_SUCCESS;
 }
 
-VkResult Queue::present(const Swapchain* swapchain)
+VkResult Queue::submit(const FrameContext& frame, const CommandBuffer* command_buffers, uint32_t count)
 {
-    VkResult res = VK_TIMEOUT;
-    do
-    {
-        res = vkWaitForFences(*gpu_iface_.device, 1, &submit_fence_, VK_TRUE, std::numeric_limits<uint64_t>::max());
-    }
-    while (res == VK_TIMEOUT);
+    VkSemaphore wait_semaphore = frame.image_acquired_semaphore();
+    VkSemaphore signal_semaphore = frame.render_finished_semaphore();
+    return submit(command_buffers, count, &wait_semaphore, 1, &signal_semaphore, 1, frame.fence());
+}
+
+VkResult Queue::submit(const FrameContext& frame, const CommandBuffer* command_buffers, uint32_t count,
+    VkSemaphore wait_semaphore, VkPipelineStageFlags wait_stage, VkSemaphore signal_semaphore)
+{
+    std::vector<VkCommandBuffer> buffers(count);
+    for (uint32_t i = 0; i < count; ++i)
+        buffers[i] = command_buffers[i];
+
+    VkSemaphore wait_semaphores[2] = { frame.image_acquired_semaphore(), wait_semaphore };
+    VkPipelineStageFlags wait_stages[2] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, wait_stage };
+    VkSemaphore signal_semaphores[2] = { frame.render_finished_semaphore(), signal_semaphore };
+
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = count;
+    submit_info.pCommandBuffers = count > 0 ? &buffers[0] : nullptr;
+    submit_info.pSignalSemaphores = signal_semaphores;
+    submit_info.signalSemaphoreCount = signal_semaphore != VK_NULL_HANDLE ? 2 : 1;
+    submit_info.pWaitSemaphores = wait_semaphores;
+    submit_info.waitSemaphoreCount = wait_semaphore != VK_NULL_HANDLE ? 2 : 1;
+    submit_info.pWaitDstStageMask = wait_stages;
 
+    VK_VERIFY(vkQueueSubmit(id_, 1, &submit_info, frame.fence()));
+
+    return VK_SUCCESS;
+}
+
+VkResult Queue::present(const Swapchain* swapchain, VkSemaphore wait_semaphore)
+{
     VkSwapchainKHR tmp_swapchain = *swapchain;
 
     uint32_t current_buffer = swapchain->current_buffer();
 
-    VkSemaphore wait_semaphore = present_semaphore_;
-
     VkPresentInfoKHR present_info = {};
     present_info.pImageIndices = &current_buffer;
     present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
     present_info.pSwapchains = &tmp_swapchain;
     present_info.swapchainCount = 1;
     present_info.pWaitSemaphores = &wait_semaphore;
-    present_info.waitSemaphoreCount = 1;
+    present_info.waitSemaphoreCount = wait_semaphore != VK_NULL_HANDLE ? 1 : 0;
 
     VK_CHECK(vkQueuePresentKHR(id_, &present_info));
 
     return VK_SUCCESS;
 }
 
+VkResult Queue::present(const Swapchain* swapchain, const FrameContext& frame)
+{
+    return present(swapchain, frame.render_finished_semaphore());
+}
+
 VkResult Queue::wait_idle()
 {
     VK_CHECK(vkQueueWaitIdle(id_));
@@ -757,11 +933,25 @@ VkResult Device::init(VulkanContext& context, PhysicalDevice* physical_device)
     const char* const* validation_layers = validation_layers_count > 0 ? &device_debug_layers[0] : nullptr;
 
     const float queue_priority = 0.0f;
-    DeviceQueueCreateInfo queue_create_info(physical_device->graphics_queue_family_index(), 1, &queue_priority);
-    DeviceCreateInfo device_create_info(1, &queue_create_info,
+    std::vector<DeviceQueueCreateInfo> queue_create_infos;
+    queue_create_infos.push_back(DeviceQueueCreateInfo(physical_device->graphics_queue_family_index(), 1, &queue_priority));
+    has_transfer_queue_ = physical_device->transfer_queue_family_index() != invalid_index;
+    if (has_transfer_queue_)
+        queue_create_infos.push_back(DeviceQueueCreateInfo(physical_device->transfer_queue_family_index(), 1, &queue_priority));
+    has_compute_queue_ = physical_device->compute_queue_family_index() != invalid_index &&
+        physical_device->compute_queue_family_index() != physical_device->graphics_queue_family_index();
+    if (has_compute_queue_)
+        queue_create_infos.push_back(DeviceQueueCreateInfo(physical_device->compute_queue_family_index(), 1, &queue_priority));
+
+    // indirect draws of many parts with a single command, IndirectDrawBuffer loops over the commands without it
+    const VkPhysicalDeviceFeatures& features = physical_device->features();
+    enabled_features_ = VkPhysicalDeviceFeatures();
+    enabled_features_.multiDrawIndirect = features.multiDrawIndirect;
+
+    DeviceCreateInfo device_create_info(static_cast<uint32_t>(queue_create_infos.size()), &queue_create_infos[0],
         validation_layers_count, validation_layers,
         device_enabled_extensions_count, &device_enabled_extensions_[0],
-        nullptr);
+        &enabled_features_);
     VK_VERIFY(vkCreateDevice(physical_device->id(), device_create_info.c_struct(), context.allocation_callbacks, &id_));
 
     VkQueue graphics_queue_id;
@@ -771,11 +961,29 @@ VkResult Device::init(VulkanContext& context, PhysicalDevice* physical_device)
     gpu_iface.device = this;
     VK_CHECK(graphics_queue_.init(context, gpu_iface, graphics_queue_id));
 
+    if (has_transfer_queue_)
+    {
+        VkQueue transfer_queue_id;
+        vkGetDeviceQueue(id_, physical_device->transfer_queue_family_index(), 0, &transfer_queue_id);
+        VK_CHECK(transfer_queue_.init(context, gpu_iface, transfer_queue_id));
+    }
+
+    if (has_compute_queue_)
+    {
+        VkQueue compute_queue_id;
+        vkGetDeviceQueue(id_, physical_device->compute_queue_family_index(), 0, &compute_queue_id);
+        VK_CHECK(compute_queue_.init(context, gpu_iface, compute_queue_id));
+    }
+
     return VK_SUCCESS;
 }
 
 void Device::destroy(VulkanContext& context)
 {
+    if (has_compute_queue_)
+        compute_queue_.destroy(context);
+    if (has_transfer_queue_)
+        transfer_queue_.destroy(context);
     graphics_queue_.destroy(context);
     vkDestroyDevice(id_, context.allocation_callbacks);
 }
@@ -785,6 +993,280 @@ uint32_t Device::get_memory_type_index(const VkMemoryRequirements& memory_requir
     return physical_device_->get_memory_type_index(memory_requirements, flags);
 }
 
+VkResult MemoryAllocator::init(VulkanContext&, const GPUInterface& gpu_iface, const Settings& settings)
+{
+    gpu_iface_ = gpu_iface;
+    settings_ = settings;
+    // buddy blocks must be powers of 2
+    settings_.block_size = next_pow2(settings.block_size);
+    settings_.min_allocation_size = next_pow2(settings.min_allocation_size);
+    pools_.resize(pool_index(VK_MAX_MEMORY_TYPES, resource_linear, usage_persistent));
+    device_allocations_count_ = 0;
+    return VK_SUCCESS;
+}
+
+void MemoryAllocator::destroy(VulkanContext& context)
+{
+    for (Pool& pool : pools_)
+    {
+        for (Block& block : pool.blocks)
+        {
+            if (block.memory != VK_NULL_HANDLE)
+                destroy_block(context, block);
+        }
+    }
+    pools_.clear();
+}
+
+VkResult MemoryAllocator::create_block(VulkanContext& context, uint32_t pool, VkDeviceSize size, bool dedicated, uint32_t& block_index)
+{
+    const PhysicalDevice* physical_device = gpu_iface_.device->physical_device();
+    VERIFY(device_allocations_count_ < physical_device->properties().limits.maxMemoryAllocationCount,
+        "maxMemoryAllocationCount has been reached", VK_ERROR_TOO_MANY_OBJECTS);
+
+    const uint32_t memory_type_index = pool_memory_type(pool);
+
+    Block block;
+    block.mapped = nullptr;
+    block.size = size;
+    block.linear_head = 0;
+    block.linear_allocations = 0;
+    block.dedicated = dedicated;
+
+    MemoryAllocateInfo allocate_info(size, memory_type_index);
+    VK_VERIFY(vkAllocateMemory(*gpu_iface_.device, allocate_info.c_struct(), context.allocation_callbacks, &block.memory));
+    ++device_allocations_count_;
+
+    // host visible blocks stay mapped for their whole lifetime
+    if (physical_device->memory_properties().memoryTypes[memory_type_index].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        void* mapped = nullptr;
+        VK_VERIFY(vkMapMemory(*gpu_iface_.device, block.memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+        block.mapped = static_cast<uint8_t*>(mapped);
+    }
+
+    if (!dedicated && pool_usage(pool) == usage_persistent)
+        block.buddy.init(size, settings_.min_allocation_size);
+
+    // reuse a released slot, indices of the live blocks must stay valid
+    std::vector<Block>& blocks = pools_[pool].blocks;
+    for (size_t i = 0, count = blocks.size(); i < count; ++i)
+    {
+        if (blocks[i].memory == VK_NULL_HANDLE)
+        {
+            blocks[i] = block;
+            block_index = static_cast<uint32_t>(i);
+            return VK_SUCCESS;
+        }
+    }
+    block_index = static_cast<uint32_t>(blocks.size());
+    blocks.push_back(block);
+
+    return VK_SUCCESS;
+}
+
+void MemoryAllocator::destroy_block(VulkanContext& context, Block& block)
+{
+    if (block.mapped != nullptr)
+        vkUnmapMemory(*gpu_iface_.device, block.memory);
+    vkFreeMemory(*gpu_iface_.device, block.memory, context.allocation_callbacks);
+    --device_allocations_count_;
+    block.memory = VK_NULL_HANDLE;
+    block.mapped = nullptr;
+    block.buddy = BuddyAllocator();
+}
+
+bool MemoryAllocator::allocate_from_block(Block& block, Usage usage, const VkMemoryRequirements& requirements, VkDeviceSize& offset)
+{
+    if (block.dedicated)
+        return false;
+
+    if (usage == usage_transient)
+    {
+        VkDeviceSize aligned_offset = align_up(block.linear_head, requirements.alignment);
+        if (aligned_offset + requirements.size > block.size)
+            return false;
+        offset = aligned_offset;
+        block.linear_head = aligned_offset + requirements.size;
+        ++block.linear_allocations;
+        return true;
+    }
+
+    uint64_t buddy_offset = block.buddy.allocate(requirements.size, requirements.alignment);
+    if (buddy_offset == BuddyAllocator::invalid_offset)
+        return false;
+    offset = buddy_offset;
+    return true;
+}
+
+VkResult MemoryAllocator::allocate(VulkanContext& context, const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties,
+    ResourceType resource_type, Usage usage, MemoryAllocation& allocation)
+{
+    const uint32_t pool = pool_index(gpu_iface_.device->get_memory_type_index(requirements, properties), resource_type, usage);
+    const VkDeviceSize block_size = usage == usage_persistent ? settings_.block_size : settings_.transient_page_size;
+
+    uint32_t block_index = invalid_index;
+    VkDeviceSize offset = 0;
+    if (requirements.size > block_size / 2)
+    {
+        // large resources get their own memory, a shared block would be wasted anyway
+        VK_VERIFY(create_block(context, pool, requirements.size, true, block_index));
+    }
+    else
+    {
+        std::vector<Block>& blocks = pools_[pool].blocks;
+        for (size_t i = 0, count = blocks.size(); i < count; ++i)
+        {
+            if (blocks[i].memory != VK_NULL_HANDLE && allocate_from_block(blocks[i], usage, requirements, offset))
+            {
+                block_index = static_cast<uint32_t>(i);
+                break;
+            }
+        }
+
+        if (block_index == invalid_index)
+        {
+            VK_VERIFY(create_block(context, pool, block_size, false, block_index));
+            bool res = allocate_from_block(pools_[pool].blocks[block_index], usage, requirements, offset);
+            VERIFY(res, "Allocation doesn't fit into a new memory block", VK_ERROR_OUT_OF_DEVICE_MEMORY);
+        }
+    }
+
+    const Block& block = pools_[pool].blocks[block_index];
+    allocation.memory = block.memory;
+    allocation.offset = offset;
+    allocation.size = requirements.size;
+    allocation.mapped = block.mapped != nullptr ? block.mapped + offset : nullptr;
+    allocation.pool = pool;
+    allocation.block = block_index;
+
+    return VK_SUCCESS;
+}
+
+void MemoryAllocator::free(VulkanContext& context, MemoryAllocation& allocation)
+{
+    if (allocation.memory == VK_NULL_HANDLE)
+        return;
+
+    std::vector<Block>& blocks = pools_[allocation.pool].blocks;
+    Block& block = blocks[allocation.block];
+    const bool transient = pool_usage(allocation.pool) == usage_transient;
+
+    bool empty = true;
+    if (!block.dedicated)
+    {
+        if (transient)
+        {
+            // a linear page is rewound only when all its allocations are gone
+            if (--block.linear_allocations == 0)
+                block.linear_head = 0;
+            empty = block.linear_allocations == 0;
+        }
+        else
+        {
+            block.buddy.free(allocation.offset);
+            empty = block.buddy.empty();
+        }
+
+        // keep a single empty block per pool to avoid vkAllocateMemory/vkFreeMemory ping-pong
+        if (empty)
+        {
+            uint32_t empty_blocks = 0;
+            for (const Block& b : blocks)
+            {
+                if (b.memory != VK_NULL_HANDLE && !b.dedicated &&
+                    (transient ? b.linear_allocations == 0 : b.buddy.empty()))
+                    ++empty_blocks;
+            }
+            empty = empty_blocks > 1;
+        }
+    }
+
+    if (empty)
+        destroy_block(context, block);
+
+    allocation = MemoryAllocation();
+}
+
+VkResult MemoryAllocator::flush(const MemoryAllocation& allocation, VkDeviceSize offset, VkDeviceSize size)
+{
+    const PhysicalDevice* physical_device = gpu_iface_.device->physical_device();
+    const uint32_t memory_type_index = pool_memory_type(allocation.pool);
+    if (physical_device->memory_properties().memoryTypes[memory_type_index].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+        return VK_SUCCESS;
+
+    const Block& block = pools_[allocation.pool].blocks[allocation.block];
+    const VkDeviceSize atom_size = physical_device->properties().limits.nonCoherentAtomSize;
+    VkDeviceSize begin = (allocation.offset + offset) / atom_size * atom_size;
+    VkDeviceSize end = align_up(allocation.offset + offset + size, atom_size);
+    if (end > block.size)
+        end = block.size;
+
+    VkMappedMemoryRange range = {};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = allocation.memory;
+    range.offset = begin;
+    range.size = end - begin;
+    VK_VERIFY(vkFlushMappedMemoryRanges(*gpu_iface_.device, 1, &range));
+
+    return VK_SUCCESS;
+}
+
+void MemoryAllocator::stats(MemoryStats& stats) const
+{
+    memset(&stats, 0, sizeof(MemoryStats));
+    VkDeviceSize free_bytes = 0;
+    for (size_t i = 0, size = pools_.size(); i < size; ++i)
+    {
+        const bool transient = pool_usage(static_cast<uint32_t>(i)) == usage_transient;
+        for (const Block& block : pools_[i].blocks)
+        {
+            if (block.memory == VK_NULL_HANDLE)
+                continue;
+            ++stats.blocks_count;
+            stats.allocated_bytes += block.size;
+            if (block.dedicated)
+            {
+                ++stats.dedicated_blocks_count;
+                ++stats.allocations_count;
+                stats.used_bytes += block.size;
+                stats.requested_bytes += block.size;
+                continue;
+            }
+
+            VkDeviceSize largest_free = 0;
+            if (transient)
+            {
+                stats.allocations_count += block.linear_allocations;
+                stats.used_bytes += block.linear_head;
+                stats.requested_bytes += block.linear_head;
+                largest_free = block.size - block.linear_head;
+            }
+            else
+            {
+                stats.allocations_count += block.buddy.allocations_count();
+                stats.used_bytes += block.buddy.used();
+                stats.requested_bytes += block.buddy.requested();
+                largest_free = block.buddy.largest_free();
+            }
+            free_bytes += block.size - (transient ? block.linear_head : block.buddy.used());
+            if (largest_free > stats.largest_free_range)
+                stats.largest_free_range = largest_free;
+        }
+    }
+    stats.fragmentation = free_bytes > 0 ? 1.0f - static_cast<float>(stats.largest_free_range) / free_bytes : 0.0f;
+}
+
+void MemoryAllocator::print_stats() const
+{
+    MemoryStats s;
+    stats(s);
+    printf("memory: blocks:%u (dedicated:%u) allocations:%u allocated:%llu used:%llu requested:%llu largest free:%llu fragmentation:%.3f\n",
+        s.blocks_count, s.dedicated_blocks_count, s.allocations_count,
+        static_cast<unsigned long long>(s.allocated_bytes), static_cast<unsigned long long>(s.used_bytes),
+        static_cast<unsigned long long>(s.requested_bytes), static_cast<unsigned long long>(s.largest_free_range), s.fragmentation);
+}
+
 VkResult Swapchain::init(VulkanContext& context, Device* device, const Settings& settings)
 {
     device_ = device;
@@ -881,9 +1363,11 @@ VkResult Swapchain::init_images(VulkanContext& context)
     return VK_SUCCESS;
 }
 
-VkResult Swapchain::acquire_next_image()
+VkResult Swapchain::acquire_next_image(VkSemaphore semaphore)
 {
-    VK_CHECK(vkAcquireNextImageKHR(*device_, id_, std::numeric_limits<uint64_t>::max(), next_image_semaphore_, VK_NULL_HANDLE, &current_buffer_));
+    if (semaphore == VK_NULL_HANDLE)
+        semaphore = next_image_semaphore_;
+    VK_CHECK(vkAcquireNextImageKHR(*device_, id_, std::numeric_limits<uint64_t>::max(), semaphore, VK_NULL_HANDLE, &current_buffer_));
     return VK_SUCCESS;
 }
 
@@ -918,7 +1402,9 @@ VkResult ImageView::init(VulkanContext& context, const GPUInterface& gpu_iface,
 
     VkExtent3D extent = {settings.width, settings.height, settings.depth};
     ImageCreateInfo image_create_info(VK_IMAGE_TYPE_2D, settings.format, extent, settings.mip_levels, settings.array_layers, VK_SAMPLE_COUNT_1_BIT,
-        settings.usage, VK_SHARING_MODE_EXCLUSIVE);
+        settings.usage, settings.sharing_mode);
+    image_create_info.queueFamilyIndexCount = settings.queue_family_indices_count;
+    image_create_info.pQueueFamilyIndices = settings.queue_family_indices;
     if (data != nullptr)
         image_create_info.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 
@@ -928,62 +1414,21 @@ VkResult ImageView::init(VulkanContext& context, const GPUInterface& gpu_iface,
         VK_CHECK(vkCreateImage(device, image_create_info.c_struct(), context.allocation_callbacks, &image_));
 
         vkGetImageMemoryRequirements(device, image_, &image_memory_requirements);
-        MemoryAllocateInfo allocate_info(image_memory_requirements.size,
-            gpu_iface.device->get_memory_type_index(image_memory_requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
-        VK_CHECK(vkAllocateMemory(device, allocate_info.c_struct(), context.allocation_callbacks, &memory_));
-        VK_CHECK(vkBindImageMemory(device, image_, memory_, 0));
+        VK_CHECK(context.memory_allocator.allocate(context, image_memory_requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            MemoryAllocator::resource_optimal, MemoryAllocator::usage_persistent, allocation_));
+        VK_CHECK(vkBindImageMemory(device, image_, allocation_.memory, allocation_.offset));
     }
     else
         image_ = image;
 
     if (data != nullptr)
     {
-        VkImage src_image;
-        VkDeviceMemory src_memory;
-
-        image_create_info.initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED;
-        image_create_info.tiling = VK_IMAGE_TILING_LINEAR;
-        image_create_info.usage = settings.usage | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-
-        VK_CHECK(vkCreateImage(device, image_create_info.c_struct(), context.allocation_callbacks, &src_image));
-        vkGetImageMemoryRequirements(device, src_image, &image_memory_requirements);
-
-        // allocate memory for the image
-        MemoryAllocateInfo allocate_info(image_memory_requirements.size,
-            gpu_iface.device->get_memory_type_index(image_memory_requirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT));
-        VK_CHECK(vkAllocateMemory(device, allocate_info.c_struct(), context.allocation_callbacks, &src_memory));
-        VK_CHECK(vkBindImageMemory(device, src_image, src_memory, 0));
-
-        // init source image
-        void* dst = nullptr;
-        VK_CHECK(vkMapMemory(device, src_memory, 0, size, 0, &dst));
-        memcpy(dst, data, size);
-        vkUnmapMemory(device, src_memory);
-
-        // command buffer for copying data to the VRAM
-        CommandBuffer command_buffer;
-        context.command_pools.resource_uploading_command_pool.create_command_buffers(context, &command_buffer, 1);
-
-        VkImageCopy image_copy = {};
-        image_copy.extent = { settings.width, settings.height, settings.depth };
-        image_copy.srcSubresource.aspectMask = settings.aspect_mask;
-        image_copy.srcSubresource.baseArrayLayer = 0;
-        image_copy.srcSubresource.layerCount = settings.array_layers;
-        image_copy.srcSubresource.mipLevel = 0;
-        image_copy.dstSubresource = image_copy.srcSubresource;
-
-        command_buffer
-        .begin()
-            .copy_image_command(src_image, image_, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &image_copy, 1)
-        .end();
-
-        context.main_device->graphics_queue().submit(&command_buffer, 1);
-        context.main_device->graphics_queue().wait_idle();
-
-        context.command_pools.resource_uploading_command_pool.destroy_command_buffers(context, &command_buffer, 1);
-
-        vkFreeMemory(device, src_memory, context.allocation_callbacks);
-        vkDestroyImage(device, src_image, context.allocation_callbacks);
+        VkImageSubresourceLayers subresource = {};
+        subresource.aspectMask = settings.aspect_mask;
+        subresource.mipLevel = 0;
+        subresource.baseArrayLayer = 0;
+        subresource.layerCount = settings.array_layers;
+        VK_CHECK(context.staging_ring.upload_image(context, image_, subresource, extent, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, data, size));
     }
 
     VkImageViewCreateInfo image_view_create_info;
@@ -1007,10 +1452,11 @@ VkResult ImageView::init(VulkanContext& context, const GPUInterface& gpu_iface,
 void ImageView::destroy(VulkanContext& context)
 {
     vkDestroyImageView(gpu_iface_.device->id(), imageview_, context.allocation_callbacks);
-    if (memory_ != VK_NULL_HANDLE)
+    // swapchain images don't have an allocation and are owned by the swapchain
+    if (allocation_.memory != VK_NULL_HANDLE)
     {
-        vkFreeMemory(gpu_iface_.device->id(), memory_, context.allocation_callbacks);
         vkDestroyImage(gpu_iface_.device->id(), image_, context.allocation_callbacks);
+        context.memory_allocator.free(context, allocation_);
     }
 }
 
@@ -1025,6 +1471,9 @@ VkResult Buffer::init(VulkanContext& context, const GPUInterface& gpu_iface, con
     create_info.queueFamilyIndexCount = settings.queue_family_indices_count;
     create_info.sharingMode = settings.sharing_mode;
     create_info.usage = settings.usage;
+    // device local buffers are filled by the staging ring
+    if (!(settings.memory_properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT))
+        create_info.usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
     create_info.size = size;
     VK_CHECK(vkCreateBuffer(*gpu_iface_.device, &create_info, context.allocation_callbacks, &buffer_));
 
@@ -1034,12 +1483,9 @@ VkResult Buffer::init(VulkanContext& context, const GPUInterface& gpu_iface, con
 
     VkMemoryRequirements buffer_memory_requirements;
     vkGetBufferMemoryRequirements(*gpu_iface_.device, buffer_, &buffer_memory_requirements);
-    VkMemoryAllocateInfo memory_allocate_info = {};
-    memory_allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    memory_allocate_info.allocationSize = buffer_memory_requirements.size;
-    memory_allocate_info.memoryTypeIndex = gpu_iface_.device->get_memory_type_index(buffer_memory_requirements, settings.memory_properties);
-    VK_CHECK(vkAllocateMemory(*gpu_iface_.device, &memory_allocate_info, context.allocation_callbacks, &memory_));
-    VK_CHECK(vkBindBufferMemory(*gpu_iface_.device, buffer_, memory_, 0));
+    VK_CHECK(context.memory_allocator.allocate(context, buffer_memory_requirements, settings.memory_properties,
+        MemoryAllocator::resource_linear, MemoryAllocator::usage_persistent, allocation_));
+    VK_CHECK(vkBindBufferMemory(*gpu_iface_.device, buffer_, allocation_.memory, allocation_.offset));
 
     if (data != nullptr)
         return update(context, data, size);
@@ -1049,71 +1495,20 @@ VkResult Buffer::init(VulkanContext& context, const GPUInterface& gpu_iface, con
 
 void Buffer::destroy(VulkanContext& context)
 {
-    if (memory_ != VK_NULL_HANDLE)
-        vkFreeMemory(*gpu_iface_.device, memory_, context.allocation_callbacks);
     if (buffer_ != VK_NULL_HANDLE)
         vkDestroyBuffer(*gpu_iface_.device, buffer_, context.allocation_callbacks);
+    context.memory_allocator.free(context, allocation_);
 }
 
 VkResult Buffer::update(VulkanContext& context, const uint8_t* data, uint32_t size)
 {
     if (settings_.memory_properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
     {
-        void* mapped_memory = nullptr;
-        VK_CHECK(vkMapMemory(*gpu_iface_.device, memory_, 0, size, 0, &mapped_memory));
-        memcpy(mapped_memory, data, size);
-        vkUnmapMemory(*gpu_iface_.device, memory_);
-        return VK_SUCCESS;
+        memcpy(allocation_.mapped, data, size);
+        return context.memory_allocator.flush(allocation_, 0, size);
     }
 
-    VkBufferCreateInfo create_info = {};
-    create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    create_info.pQueueFamilyIndices = settings_.queue_family_indices;
-    create_info.queueFamilyIndexCount = settings_.queue_family_indices_count;
-    create_info.sharingMode = settings_.sharing_mode;
-    create_info.usage = settings_.usage;
-    create_info.size = size;
-
-    VkMemoryRequirements buffer_memory_requirements;
-    VkMemoryAllocateInfo memory_allocate_info = {};
-    memory_allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;;
-
-    VkBuffer src_buffer;
-    VkDeviceMemory src_memory;
-    VK_CHECK(vkCreateBuffer(*gpu_iface_.device, &create_info, context.allocation_callbacks, &src_buffer));
-    vkGetBufferMemoryRequirements(*gpu_iface_.device, src_buffer, &buffer_memory_requirements);
-    memory_allocate_info.allocationSize = buffer_memory_requirements.size;
-    memory_allocate_info.memoryTypeIndex = gpu_iface_.device->get_memory_type_index(buffer_memory_requirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-    VK_CHECK(vkAllocateMemory(*gpu_iface_.device, &memory_allocate_info, context.allocation_callbacks, &src_memory));
-    VK_CHECK(vkBindBufferMemory(*gpu_iface_.device, src_buffer, src_memory, 0));
-
-    void* mapped_memory = nullptr;
-    VK_CHECK(vkMapMemory(*gpu_iface_.device, src_memory, 0, size, 0, &mapped_memory));
-    memcpy(mapped_memory, data, size);
-    vkUnmapMemory(*gpu_iface_.device, src_memory);
-
-    // upload data
-    // command buffer for copying data to the VRAM
-    CommandBuffer command_buffer;
-    context.command_pools.resource_uploading_command_pool.create_command_buffers(context, &command_buffer, 1);
-
-    VkBufferCopy buffer_copy = {};
-    buffer_copy.size = size;
-
-    command_buffer
-        .begin()
-        .copy_buffer(src_buffer, buffer_, &buffer_copy, 1)
-        .end();
-
-    context.main_device->graphics_queue().submit(&command_buffer, 1);
-    context.main_device->graphics_queue().wait_idle();
-
-    context.command_pools.resource_uploading_command_pool.destroy_command_buffers(context, &command_buffer, 1);
-
-    vkFreeMemory(*gpu_iface_.device, src_memory, context.allocation_callbacks);
-    vkDestroyBuffer(*gpu_iface_.device, src_buffer, context.allocation_callbacks);
-
-    return VK_SUCCESS;
+    return context.staging_ring.upload_buffer(context, buffer_, 0, data, size);
 }
 
 VkResult RenderPass::init(VulkanContext& context, const GPUInterface& gpu_iface, const Settings& settings)
@@ -1123,14 +1518,16 @@ VkResult RenderPass::init(VulkanContext& context, const GPUInterface& gpu_iface,
     VkAttachmentDescription attachment_descriptions[max_attachments];
     for (uint32_t i = 0; i < settings.count; ++i)
     {
-        if (settings.descs[i].layout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
+        if (settings.descs[i].final_layout != VK_IMAGE_LAYOUT_UNDEFINED)
+            attachment_descriptions[i].finalLayout = settings.descs[i].final_layout;
+        else if (settings.descs[i].layout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
             attachment_descriptions[i].finalLayout = settings.descs[i].layout;
         else
             attachment_descriptions[i].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
         attachment_descriptions[i].flags = 0;
         attachment_descriptions[i].format = settings.descs[i].format;
         attachment_descriptions[i].initialLayout = settings.descs[i].layout;
-        attachment_descriptions[i].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        attachment_descriptions[i].loadOp = settings.descs[i].load_op;
         attachment_descriptions[i].samples = VK_SAMPLE_COUNT_1_BIT;
         attachment_descriptions[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         attachment_descriptions[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
@@ -1248,7 +1645,7 @@ VkResult Texture::init(VulkanContext& context, const GPUInterface& gpu_iface,
     sampler_create_info.mipmapMode = sampler_settings.mipmap_mode;
     VK_CHECK(vkCreateSampler(*gpu_iface.device, &sampler_create_info, context.allocation_callbacks, &sampler_));
 
-    descriptor_image_info_.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    descriptor_image_info_.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
     descriptor_image_info_.imageView = image_view_.image_view_id();
     descriptor_image_info_.sampler = sampler_;
 
@@ -1261,13 +1658,68 @@ void Texture::destroy(VulkanContext& context)
     image_view_.destroy(context);
 }
 
-VkResult CommandPool::init(VulkanContext& context, const GPUInterface& gpu_iface)
+VkResult ComputePipeline::init(VulkanContext& context, const GPUInterface& gpu_iface, const Settings& settings)
+{
+    gpu_iface_ = gpu_iface;
+
+    std::vector<uint8_t> shader_data;
+    VERIFY(settings.shader != nullptr && read_entire_file(shader_data, settings.shader, "rb") && !shader_data.empty(),
+        "Can't read compute shader data", VK_ERROR_INITIALIZATION_FAILED);
+    VkShaderModuleCreateInfo shader_create_info = {};
+    shader_create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shader_create_info.pCode = reinterpret_cast<const uint32_t*>(&shader_data[0]);
+    shader_create_info.codeSize = shader_data.size();
+    VkShaderModule shader_module;
+    VK_CHECK(vkCreateShaderModule(*gpu_iface.device, &shader_create_info, context.allocation_callbacks, &shader_module));
+
+    VkPushConstantRange push_constant_range = {};
+    push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    push_constant_range.size = settings.push_constants_size;
+
+    VkPipelineLayoutCreateInfo layout_create_info = {};
+    layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layout_create_info.pSetLayouts = settings.descriptor_set_layouts;
+    layout_create_info.setLayoutCount = settings.descriptor_set_layouts_count;
+    layout_create_info.pPushConstantRanges = settings.push_constants_size > 0 ? &push_constant_range : nullptr;
+    layout_create_info.pushConstantRangeCount = settings.push_constants_size > 0 ? 1 : 0;
+    VK_CHECK(vkCreatePipelineLayout(*gpu_iface.device, &layout_create_info, context.allocation_callbacks, &layout_));
+
+    VkComputePipelineCreateInfo create_info = {};
+    create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    create_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    create_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    create_info.stage.module = shader_module;
+    create_info.stage.pName = "main";
+    create_info.layout = layout_;
+    // VK_VERIFY declares its own res
+    const VkResult result = vkCreateComputePipelines(*gpu_iface.device, context.main_pipeline_cache, 1, &create_info,
+        context.allocation_callbacks, &pipeline_);
+    vkDestroyShaderModule(*gpu_iface.device, shader_module, context.allocation_callbacks);
+    VK_VERIFY(result);
+
+    return VK_SUCCESS;
+}
+
+void ComputePipeline::destroy(VulkanContext& context)
+{
+    if (pipeline_ != VK_NULL_HANDLE)
+        vkDestroyPipeline(*gpu_iface_.device, pipeline_, context.allocation_callbacks);
+    if (layout_ != VK_NULL_HANDLE)
+        vkDestroyPipelineLayout(*gpu_iface_.device, layout_, context.allocation_callbacks);
+    pipeline_ = VK_NULL_HANDLE;
+    layout_ = VK_NULL_HANDLE;
+}
+
+VkResult CommandPool::init(VulkanContext& context, const GPUInterface& gpu_iface, VkCommandPoolCreateFlags flags,
+    uint32_t queue_family_index)
 {
     gpu_iface_ = gpu_iface;
 
     VkCommandPoolCreateInfo create_info = {};
     create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    create_info.queueFamilyIndex = gpu_iface.device->physical_device()->graphics_queue_family_index();
+    create_info.flags = flags;
+    create_info.queueFamilyIndex = queue_family_index != invalid_index ?
+        queue_family_index : gpu_iface.device->physical_device()->graphics_queue_family_index();
     VK_CHECK(vkCreateCommandPool(*gpu_iface.device, &create_info, context.allocation_callbacks, &id_));
 
     return VK_SUCCESS;
@@ -1278,12 +1730,13 @@ void CommandPool::destroy(VulkanContext& context)
     vkDestroyCommandPool(*gpu_iface_.device, id_, context.allocation_callbacks);
 }
 
-VkResult CommandPool::create_command_buffers(VulkanContext& context, CommandBuffer* buffers, uint32_t count)
+VkResult CommandPool::create_command_buffers(VulkanContext& context, CommandBuffer* buffers, uint32_t count,
+    VkCommandBufferLevel level)
 {
     VkCommandBufferAllocateInfo allocate_info = {};
     allocate_info.commandPool = id_;
     allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocate_info.level = level;
     allocate_info.commandBufferCount = count;
 
     std::vector<VkCommandBuffer> tmp_buffers(count);
@@ -1307,32 +1760,496 @@ void CommandPool::destroy_command_buffers(VulkanContext& context, CommandBuffer*
     vkFreeCommandBuffers(*gpu_iface_.device, id_, count, &tmp_buffers[0]);
 }
 
-VkResult CommandBuffer::init(VulkanContext&, VkCommandBuffer id)
+VkResult CommandPool::reset(VulkanContext&)
 {
-    id_ = id;
+    VK_VERIFY(vkResetCommandPool(*gpu_iface_.device, id_, 0));
     return VK_SUCCESS;
 }
 
-void CommandBuffer::destroy(VulkanContext&)
+VkResult FrameContext::init(VulkanContext& context, const GPUInterface& gpu_iface, uint32_t command_buffers_count, uint32_t uniform_size,
+    uint32_t recording_threads_count, uint32_t secondary_command_buffers_count, uint32_t compute_command_buffers_count)
 {
+    gpu_iface_ = gpu_iface;
+
+    VK_CHECK(command_pool_.init(context, gpu_iface));
+    command_buffers_.resize(command_buffers_count);
+    VK_CHECK(command_pool_.create_command_buffers(context, &command_buffers_[0], command_buffers_count));
+
+    // command pools are externally synchronized, so each thread records from its own one
+    thread_commands_.resize(secondary_command_buffers_count > 0 ? recording_threads_count : 0);
+    for (ThreadCommands& thread_commands : thread_commands_)
+    {
+        VK_CHECK(thread_commands.command_pool.init(context, gpu_iface));
+        thread_commands.secondary_command_buffers.resize(secondary_command_buffers_count);
+        VK_CHECK(thread_commands.command_pool.create_command_buffers(context, &thread_commands.secondary_command_buffers[0],
+            secondary_command_buffers_count, VK_COMMAND_BUFFER_LEVEL_SECONDARY));
+    }
+
+    if (compute_command_buffers_count > 0)
+    {
+        VK_CHECK(compute_command_pool_.init(context, gpu_iface, 0, gpu_iface.device->compute_queue_family_index()));
+        compute_command_buffers_.resize(compute_command_buffers_count);
+        VK_CHECK(compute_command_pool_.create_command_buffers(context, &compute_command_buffers_[0], compute_command_buffers_count));
+    }
+
+    // the first wait() must not block
+    VkFenceCreateInfo fence_create_info = {};
+    fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fence_create_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    VK_CHECK(vkCreateFence(*gpu_iface.device, &fence_create_info, context.allocation_callbacks, &fence_));
+
+    VkSemaphoreCreateInfo semaphore_create_info = SemaphoreCreateInfo();
+    VK_CHECK(vkCreateSemaphore(*gpu_iface.device, &semaphore_create_info, context.allocation_callbacks, &image_acquired_semaphore_));
+    VK_CHECK(vkCreateSemaphore(*gpu_iface.device, &semaphore_create_info, context.allocation_callbacks, &render_finished_semaphore_));
+    if (compute_command_buffers_count > 0)
+        VK_CHECK(vkCreateSemaphore(*gpu_iface.device, &semaphore_create_info, context.allocation_callbacks, &compute_finished_semaphore_));
+
+    if (uniform_size > 0)
+    {
+        Buffer::Settings uniform_settings;
+        uniform_settings.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+        uniform_settings.memory_properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        VK_CHECK(uniform_.init(context, gpu_iface, uniform_settings, nullptr, uniform_size));
+    }
+
+    return VK_SUCCESS;
 }
 
-CommandBuffer& CommandBuffer::begin()
+void FrameContext::destroy(VulkanContext& context)
 {
-    VkCommandBufferBeginInfo begin_info = {};
-    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    VK_CHECK(vkBeginCommandBuffer(id_, &begin_info));
-    return *this;
+    uniform_.destroy(context);
+    if (compute_finished_semaphore_ != VK_NULL_HANDLE)
+        vkDestroySemaphore(*gpu_iface_.device, compute_finished_semaphore_, context.allocation_callbacks);
+    vkDestroySemaphore(*gpu_iface_.device, render_finished_semaphore_, context.allocation_callbacks);
+    vkDestroySemaphore(*gpu_iface_.device, image_acquired_semaphore_, context.allocation_callbacks);
+    vkDestroyFence(*gpu_iface_.device, fence_, context.allocation_callbacks);
+    for (ThreadCommands& thread_commands : thread_commands_)
+    {
+        thread_commands.command_pool.destroy_command_buffers(context, &thread_commands.secondary_command_buffers[0],
+            static_cast<uint32_t>(thread_commands.secondary_command_buffers.size()));
+        thread_commands.command_pool.destroy(context);
+    }
+    thread_commands_.clear();
+    if (!compute_command_buffers_.empty())
+    {
+        compute_command_pool_.destroy_command_buffers(context, &compute_command_buffers_[0], static_cast<uint32_t>(compute_command_buffers_.size()));
+        compute_command_pool_.destroy(context);
+        compute_command_buffers_.clear();
+    }
+    command_pool_.destroy_command_buffers(context, &command_buffers_[0], static_cast<uint32_t>(command_buffers_.size()));
+    command_pool_.destroy(context);
 }
 
-void CommandBuffer::end()
+VkResult FrameContext::wait(VulkanContext& context)
+{
+    // not res, VK_VERIFY declares its own
+    VkResult result = VK_TIMEOUT;
+    do
+    {
+        result = vkWaitForFences(*gpu_iface_.device, 1, &fence_, VK_TRUE, std::numeric_limits<uint64_t>::max());
+    }
+    while (result == VK_TIMEOUT);
+    VK_VERIFY(result);
+    VK_VERIFY(vkResetFences(*gpu_iface_.device, 1, &fence_));
+    for (ThreadCommands& thread_commands : thread_commands_)
+        VK_VERIFY(thread_commands.command_pool.reset(context));
+    // the rendering of the frame has waited for its compute work, so the fence covers both
+    if (!compute_command_buffers_.empty())
+        VK_VERIFY(compute_command_pool_.reset(context));
+    return command_pool_.reset(context);
+}
+
+VkResult FrameContextRing::init(VulkanContext& context, const GPUInterface& gpu_iface, const Settings& settings)
+{
+    ASSERT(settings.frames_count > 0, "At least one frame context is required");
+    frames_.resize(settings.frames_count);
+    for (FrameContext& frame : frames_)
+        VK_CHECK(frame.init(context, gpu_iface, settings.command_buffers_count, settings.uniform_size,
+            settings.recording_threads_count, settings.secondary_command_buffers_count, settings.compute_command_buffers_count));
+    current_ = settings.frames_count - 1;
+    frame_time_ = 0.0f;
+    return VK_SUCCESS;
+}
+
+void FrameContextRing::destroy(VulkanContext& context)
+{
+    for (FrameContext& frame : frames_)
+        frame.destroy(context);
+    frames_.clear();
+}
+
+VkResult StagingRing::init(VulkanContext& context, const GPUInterface& gpu_iface, const Settings& settings)
+{
+    gpu_iface_ = gpu_iface;
+    settings_ = settings;
+
+    Buffer::Settings buffer_settings;
+    buffer_settings.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    buffer_settings.memory_properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    VK_CHECK(buffer_.init(context, gpu_iface, buffer_settings, nullptr, static_cast<uint32_t>(settings.size)));
+
+    dedicated_transfer_queue_ = gpu_iface.device->has_transfer_queue();
+
+    VkFenceCreateInfo fence_create_info = {};
+    fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    VkSemaphoreCreateInfo semaphore_create_info = {};
+    semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    batches_.resize(settings.batches_count);
+    for (Batch& batch : batches_)
+    {
+        VK_CHECK(context.command_pools.transfer_command_pool.create_command_buffers(context, &batch.command_buffer, 1));
+        VK_CHECK(vkCreateFence(*gpu_iface.device, &fence_create_info, context.allocation_callbacks, &batch.fence));
+        batch.transfer_finished_semaphore = VK_NULL_HANDLE;
+        if (dedicated_transfer_queue_)
+        {
+            VK_CHECK(context.command_pools.resource_uploading_command_pool.create_command_buffers(context, &batch.acquire_command_buffer, 1));
+            VK_CHECK(vkCreateSemaphore(*gpu_iface.device, &semaphore_create_info, context.allocation_callbacks, &batch.transfer_finished_semaphore));
+        }
+        batch.end = 0;
+        batch.recording = false;
+    }
+
+    return VK_SUCCESS;
+}
+
+void StagingRing::destroy(VulkanContext& context)
+{
+    VK_CHECK(wait_idle(context));
+    for (Batch& batch : batches_)
+    {
+        vkDestroyFence(*gpu_iface_.device, batch.fence, context.allocation_callbacks);
+        context.command_pools.transfer_command_pool.destroy_command_buffers(context, &batch.command_buffer, 1);
+        if (dedicated_transfer_queue_)
+        {
+            vkDestroySemaphore(*gpu_iface_.device, batch.transfer_finished_semaphore, context.allocation_callbacks);
+            context.command_pools.resource_uploading_command_pool.destroy_command_buffers(context, &batch.acquire_command_buffer, 1);
+        }
+    }
+    batches_.clear();
+    buffer_.destroy(context);
+}
+
+VkResult StagingRing::current_batch(VulkanContext& context, Batch*& batch)
+{
+    if (submitted_count_ == batches_.size())
+        VK_VERIFY(retire(context, true));
+    batch = &batches_[(first_submitted_ + submitted_count_) % batches_.size()];
+    if (!batch->recording)
+    {
+        batch->command_buffer.begin();
+        batch->recording = true;
+    }
+    return VK_SUCCESS;
+}
+
+VkResult StagingRing::reserve(VulkanContext& context, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
+{
+    const uint64_t ring_size = settings_.size;
+    // the offset in the buffer is aligned, the ring size doesn't have to be a multiple of the alignment, e.g. of 12 byte texels
+    const uint64_t ring_offset = head_ % ring_size;
+    const uint64_t aligned_offset = align_up(ring_offset, alignment);
+    uint64_t start = head_ - ring_offset + aligned_offset;
+    // a single upload never wraps around the end of the buffer, the beginning of the buffer is aligned for any upload
+    if (aligned_offset + size > ring_size)
+        start = head_ - ring_offset + ring_size;
+
+    const bool recording = batches_[(first_submitted_ + submitted_count_) % batches_.size()].recording;
+    if (submitted_count_ == 0 && !recording)
+        tail_ = start;
+
+    while (start + size - tail_ > ring_size)
+    {
+        // the space is still in use, the oldest batch has to finish first
+        if (submitted_count_ == 0)
+            VK_VERIFY(flush(context));
+        VK_VERIFY(retire(context, true));
+    }
+
+    head_ = start + size;
+    offset = start % ring_size;
+    return VK_SUCCESS;
+}
+
+VkResult StagingRing::retire(VulkanContext& context, bool wait)
+{
+    while (submitted_count_ > 0)
+    {
+        Batch& batch = batches_[first_submitted_];
+        if (wait)
+        {
+            // not res, VK_VERIFY declares its own
+            VkResult result = VK_TIMEOUT;
+            do
+            {
+                result = vkWaitForFences(*gpu_iface_.device, 1, &batch.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+            }
+            while (result == VK_TIMEOUT);
+            VK_VERIFY(result);
+            wait = false;
+        }
+        else if (vkGetFenceStatus(*gpu_iface_.device, batch.fence) != VK_SUCCESS)
+            break;
+
+        VK_VERIFY(vkResetFences(*gpu_iface_.device, 1, &batch.fence));
+        for (Buffer& buffer : batch.temporary_buffers)
+            buffer.destroy(context);
+        batch.temporary_buffers.clear();
+
+        tail_ = batch.end;
+        first_submitted_ = (first_submitted_ + 1) % batches_.size();
+        --submitted_count_;
+    }
+    return VK_SUCCESS;
+}
+
+VkResult StagingRing::upload_buffer(VulkanContext& context, VkBuffer dst, VkDeviceSize dst_offset, const uint8_t* data, VkDeviceSize size)
+{
+    // big uploads are split, so they can't take the whole ring
+    const VkDeviceSize max_chunk_size = settings_.size / 2;
+    while (size > max_chunk_size)
+    {
+        VK_VERIFY(upload_buffer(context, dst, dst_offset, data, max_chunk_size));
+        dst_offset += max_chunk_size;
+        data += max_chunk_size;
+        size -= max_chunk_size;
+    }
+
+    VkDeviceSize offset = 0;
+    VK_VERIFY(reserve(context, size, 16, offset));
+    memcpy(buffer_.mapped() + offset, data, size);
+
+    VkBufferCopy buffer_copy = {};
+    buffer_copy.srcOffset = offset;
+    buffer_copy.dstOffset = dst_offset;
+    buffer_copy.size = size;
+    Batch* batch = nullptr;
+    VK_VERIFY(current_batch(context, batch));
+    batch->command_buffer.copy_buffer(buffer_, dst, &buffer_copy, 1);
+    ++uploads_count_;
+
+    // the previous contents of the range are discarded, so only the transfer to the graphics queue is needed
+    if (dedicated_transfer_queue_)
+    {
+        VkBufferMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcQueueFamilyIndex = gpu_iface_.device->transfer_queue_family_index();
+        barrier.dstQueueFamilyIndex = gpu_iface_.device->physical_device()->graphics_queue_family_index();
+        barrier.buffer = dst;
+        barrier.offset = dst_offset;
+        barrier.size = size;
+        batch->buffer_ownership_barriers.push_back(barrier);
+    }
+
+    return VK_SUCCESS;
+}
+
+VkResult StagingRing::upload_image(VulkanContext& context, VkImage dst, const VkImageSubresourceLayers& subresource, const VkExtent3D& extent,
+    VkImageLayout final_layout, const uint8_t* data, VkDeviceSize size)
+{
+    const VkDeviceSize texels_count = static_cast<VkDeviceSize>(extent.width) * extent.height * extent.depth * subresource.layerCount;
+    const VkDeviceSize texel_size = texels_count > 0 && size >= texels_count ? size / texels_count : 1;
+
+    VkBuffer src = buffer_;
+    VkDeviceSize src_offset = 0;
+    if (size > settings_.size / 2)
+    {
+        // images can't be split as easily as buffers, use a temporary buffer released with the batch
+        Buffer temporary_buffer;
+        Buffer::Settings buffer_settings;
+        buffer_settings.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        buffer_settings.memory_properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        VK_VERIFY(temporary_buffer.init(context, gpu_iface_, buffer_settings, data, static_cast<uint32_t>(size)));
+        Batch* batch = nullptr;
+        VK_VERIFY(current_batch(context, batch));
+        batch->temporary_buffers.push_back(temporary_buffer);
+        src = temporary_buffer;
+    }
+    else
+    {
+        // bufferOffset must be a multiple of 4 and of the texel size
+        VK_VERIFY(reserve(context, size, texel_size * 4, src_offset));
+        memcpy(buffer_.mapped() + src_offset, data, size);
+    }
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = src_offset;
+    region.imageSubresource = subresource;
+    region.imageExtent = extent;
+
+    Batch* batch = nullptr;
+    VK_VERIFY(current_batch(context, batch));
+    batch->command_buffer
+        .image_barrier(dst, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresource.aspectMask,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, VK_ACCESS_TRANSFER_WRITE_BIT)
+        .copy_buffer_to_image(src, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &region, 1);
+    ++uploads_count_;
+
+    if (!dedicated_transfer_queue_)
+    {
+        batch->command_buffer.image_barrier(dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, final_layout, subresource.aspectMask,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+        return VK_SUCCESS;
+    }
+
+    // the layout transition is a part of the ownership transfer and happens in flush()
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = gpu_iface_.device->transfer_queue_family_index();
+    barrier.dstQueueFamilyIndex = gpu_iface_.device->physical_device()->graphics_queue_family_index();
+    barrier.image = dst;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = final_layout;
+    barrier.subresourceRange.aspectMask = subresource.aspectMask;
+    barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+    barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    batch->image_ownership_barriers.push_back(barrier);
+
+    return VK_SUCCESS;
+}
+
+VkResult StagingRing::flush(VulkanContext& context)
+{
+    VK_VERIFY(retire(context, false));
+
+    Batch& batch = batches_[(first_submitted_ + submitted_count_) % batches_.size()];
+    if (!batch.recording)
+        return VK_SUCCESS;
+
+    const VkAccessFlags read_access = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT |
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+    batch.recording = false;
+    batch.end = head_;
+
+    if (!dedicated_transfer_queue_)
+    {
+        // everything submitted after the batch sees the uploaded data
+        batch.command_buffer.memory_barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+            VK_ACCESS_TRANSFER_WRITE_BIT, read_access);
+        batch.command_buffer.end();
+        VK_VERIFY(context.main_device->graphics_queue().submit(&batch.command_buffer, 1, nullptr, 0, nullptr, 0, batch.fence));
+        ++submitted_count_;
+        ++submits_count_;
+        return VK_SUCCESS;
+    }
+
+    std::vector<VkBufferMemoryBarrier>& buffer_barriers = batch.buffer_ownership_barriers;
+    std::vector<VkImageMemoryBarrier>& image_barriers = batch.image_ownership_barriers;
+    const uint32_t buffer_barriers_count = static_cast<uint32_t>(buffer_barriers.size());
+    const uint32_t image_barriers_count = static_cast<uint32_t>(image_barriers.size());
+
+    // release on the transfer queue
+    for (VkBufferMemoryBarrier& barrier : buffer_barriers)
+    {
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = 0;
+    }
+    for (VkImageMemoryBarrier& barrier : image_barriers)
+    {
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = 0;
+    }
+    batch.command_buffer
+        .pipeline_barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            buffer_barriers.empty() ? nullptr : &buffer_barriers[0], buffer_barriers_count,
+            image_barriers.empty() ? nullptr : &image_barriers[0], image_barriers_count)
+        .end();
+    VK_VERIFY(context.main_device->transfer_queue().submit(&batch.command_buffer, 1, nullptr, 0,
+        &batch.transfer_finished_semaphore, 1));
+
+    // and acquire on the graphics queue, the same barriers have to be recorded on both sides
+    for (VkBufferMemoryBarrier& barrier : buffer_barriers)
+    {
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = read_access;
+    }
+    for (VkImageMemoryBarrier& barrier : image_barriers)
+    {
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    }
+    batch.acquire_command_buffer.begin();
+    batch.acquire_command_buffer
+        .pipeline_barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+            buffer_barriers.empty() ? nullptr : &buffer_barriers[0], buffer_barriers_count,
+            image_barriers.empty() ? nullptr : &image_barriers[0], image_barriers_count)
+        .end();
+    buffer_barriers.clear();
+    image_barriers.clear();
+
+    // the graphics queue waits for the copies only in the transfer stage
+    VK_VERIFY(context.main_device->graphics_queue().submit(&batch.acquire_command_buffer, 1,
+        &batch.transfer_finished_semaphore, 1, nullptr, 0, batch.fence, VK_PIPELINE_STAGE_TRANSFER_BIT));
+    ++submitted_count_;
+    ++submits_count_;
+
+    return VK_SUCCESS;
+}
+
+VkResult StagingRing::wait_idle(VulkanContext& context)
+{
+    VK_VERIFY(flush(context));
+    while (submitted_count_ > 0)
+        VK_VERIFY(retire(context, true));
+    return VK_SUCCESS;
+}
+
+FrameContext& FrameContextRing::begin_frame(VulkanContext& context)
+{
+    const float elapsed = timer_.elapsed();
+    timer_.start();
+    frame_time_ = frame_time_ * 0.95f + elapsed * 0.05f;
+
+    current_ = (current_ + 1) % frames_.size();
+    FrameContext& frame = frames_[current_];
+    VK_CHECK(frame.wait(context));
+    VK_CHECK(context.main_swapchain.acquire_next_image(frame.image_acquired_semaphore()));
+    return frame;
+}
+
+VkResult CommandBuffer::init(VulkanContext&, VkCommandBuffer id)
+{
+    id_ = id;
+    return VK_SUCCESS;
+}
+
+void CommandBuffer::destroy(VulkanContext&)
+{
+}
+
+CommandBuffer& CommandBuffer::begin()
+{
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    VK_CHECK(vkBeginCommandBuffer(id_, &begin_info));
+    return *this;
+}
+
+CommandBuffer& CommandBuffer::begin_secondary(const Framebuffer* framebuffer, uint32_t subpass)
+{
+    VkCommandBufferInheritanceInfo inheritance_info = {};
+    inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritance_info.renderPass = *framebuffer->render_pass();
+    inheritance_info.subpass = subpass;
+    inheritance_info.framebuffer = *framebuffer;
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    begin_info.pInheritanceInfo = &inheritance_info;
+    VK_CHECK(vkBeginCommandBuffer(id_, &begin_info));
+    return *this;
+}
+
+void CommandBuffer::end()
 {
     VK_CHECK(vkEndCommandBuffer(id_));
 }
 
 CommandBuffer& CommandBuffer::begin_render_pass_command(
     const Framebuffer* framebuffer, const vec4& color, float depth, uint32_t stencil,
-    uint32_t clear_color, bool clear_depth, bool clear_stencil)
+    uint32_t clear_color, bool clear_depth, bool clear_stencil, VkSubpassContents contents)
 {
     uint32_t clear_value_count = clear_color + (clear_depth | clear_stencil);
 
@@ -1347,24 +2264,23 @@ CommandBuffer& CommandBuffer::begin_render_pass_command(
     VkClearDepthStencilValue clear_depth_stencil_value;
     clear_depth_stencil_value.depth = depth;
     clear_depth_stencil_value.stencil = stencil;
-    clear_values[clear_color].depthStencil = clear_depth_stencil_value;
+    if (clear_depth || clear_stencil)
+        clear_values[clear_color].depthStencil = clear_depth_stencil_value;
 
     VkRect2D rect;
     rect.offset.x = rect.offset.y = 0;
     rect.extent.width = framebuffer->width();
     rect.extent.height = framebuffer->height();
 
-    const VkClearValue* clear_value = clear_color ? &clear_values[0] : &clear_values[1];
-
     VkRenderPassBeginInfo render_pass_begin_info;
     render_pass_begin_info.clearValueCount = clear_value_count;
     render_pass_begin_info.framebuffer = *framebuffer;
-    render_pass_begin_info.pClearValues = clear_value;
+    render_pass_begin_info.pClearValues = clear_value_count > 0 ? &clear_values[0] : nullptr;
     render_pass_begin_info.pNext = nullptr;
     render_pass_begin_info.renderArea = rect;
     render_pass_begin_info.renderPass = *framebuffer->render_pass();
     render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    vkCmdBeginRenderPass(id_, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBeginRenderPass(id_, &render_pass_begin_info, contents);
 
     return *this;
 }
@@ -1408,6 +2324,13 @@ CommandBuffer& CommandBuffer::copy_buffer(VkBuffer src, VkBuffer dst, const VkBu
     return *this;
 }
 
+CommandBuffer& CommandBuffer::copy_buffer_to_image(VkBuffer src, VkImage dst, VkImageLayout dst_layout,
+    const VkBufferImageCopy* regions, uint32_t regions_count)
+{
+    vkCmdCopyBufferToImage(id_, src, dst, dst_layout, regions_count, regions);
+    return *this;
+}
+
 CommandBuffer& CommandBuffer::bind_pipeline(VkPipeline pipeline, VkPipelineBindPoint bind_point)
 {
     vkCmdBindPipeline(id_, bind_point, pipeline);
@@ -1415,24 +2338,117 @@ CommandBuffer& CommandBuffer::bind_pipeline(VkPipeline pipeline, VkPipelineBindP
 }
 
 CommandBuffer& CommandBuffer::bind_descriptor_set(VkPipelineBindPoint bind_point, VkPipelineLayout pipeline_layout,
-    const VkDescriptorSet* descriptor_sets, uint32_t descriptor_sets_count, uint32_t first)
+    const VkDescriptorSet* descriptor_sets, uint32_t descriptor_sets_count, uint32_t first,
+    const uint32_t* dynamic_offsets, uint32_t dynamic_offsets_count)
+{
+    vkCmdBindDescriptorSets(id_, bind_point, pipeline_layout, first, descriptor_sets_count, descriptor_sets,
+        dynamic_offsets_count, dynamic_offsets);
+    return *this;
+}
+
+CommandBuffer& CommandBuffer::push_constants(VkPipelineLayout pipeline_layout, VkShaderStageFlags stages, const void* data, uint32_t size,
+    uint32_t offset)
+{
+    vkCmdPushConstants(id_, pipeline_layout, stages, offset, size, data);
+    return *this;
+}
+
+CommandBuffer& CommandBuffer::dispatch(uint32_t groups_count_x, uint32_t groups_count_y, uint32_t groups_count_z)
+{
+    vkCmdDispatch(id_, groups_count_x, groups_count_y, groups_count_z);
+    return *this;
+}
+
+CommandBuffer& CommandBuffer::fill_buffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, uint32_t value)
 {
-    vkCmdBindDescriptorSets(id_, bind_point, pipeline_layout, first, descriptor_sets_count, descriptor_sets, 0, nullptr);
+    vkCmdFillBuffer(id_, buffer, offset, size, value);
     return *this;
 }
 
 CommandBuffer& CommandBuffer::draw(const Mesh& mesh, size_t part_index)
+{
+    return bind_mesh(mesh).draw_instanced(mesh, part_index, 1);
+}
+
+CommandBuffer& CommandBuffer::bind_geometry(const GeometryPool& geometry_pool, VkIndexType index_type, const Buffer* instance_buffer)
+{
+    VkBuffer buffers[2] = { geometry_pool.vbuffer(), VK_NULL_HANDLE };
+    VkDeviceSize offsets[2] = { 0, 0 };
+    uint32_t buffers_count = 1;
+    if (instance_buffer != nullptr)
+        buffers[buffers_count++] = *instance_buffer;
+
+    vkCmdBindVertexBuffers(id_, 0, buffers_count, buffers, offsets);
+    vkCmdBindIndexBuffer(id_, geometry_pool.ibuffer(), 0, index_type);
+    return *this;
+}
+
+CommandBuffer& CommandBuffer::bind_positions(const GeometryPool& geometry_pool, VkIndexType index_type)
+{
+    ASSERT(geometry_pool.has_positions(), "The geometry pool has no position stream");
+    VkBuffer buffer = geometry_pool.pbuffer();
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(id_, 0, 1, &buffer, &offset);
+    vkCmdBindIndexBuffer(id_, geometry_pool.ibuffer(), 0, index_type);
+    return *this;
+}
+
+CommandBuffer& CommandBuffer::bind_mesh(const Mesh& mesh, const Buffer* instance_buffer)
+{
+    return bind_geometry(*mesh.geometry_pool(), mesh.index_type(), instance_buffer);
+}
+
+CommandBuffer& CommandBuffer::draw_instanced(const Mesh& mesh, size_t part_index, uint32_t instances_count, uint32_t first_instance)
 {
     const MeshPart& part = mesh.parts()[part_index];
-    const Buffer& vbuffer = mesh.vbuffer();
-    const Buffer& ibuffer = mesh.ibuffer();
-    VkBuffer vk_buffer = vbuffer;
+    vkCmdDrawIndexed(id_, part.indices_count, instances_count, part.ibuffer_offset, part.vbuffer_offset, first_instance);
+    return *this;
+}
 
-    VkDeviceSize size[1] = {0};
+CommandBuffer& CommandBuffer::draw_indexed_indirect(VkBuffer buffer, VkDeviceSize offset, uint32_t draw_count, uint32_t stride)
+{
+    vkCmdDrawIndexedIndirect(id_, buffer, offset, draw_count, stride);
+    return *this;
+}
+
+CommandBuffer& CommandBuffer::draw_indirect(const IndirectDrawBuffer& draws, size_t batch_index, uint32_t lod)
+{
+    const IndirectDrawBuffer::Batch& batch = draws.batches()[batch_index];
+    ASSERT(lod < batch.mesh->lods_count(), "Invalid level of detail");
+    const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+    const uint32_t first_command = batch.first_command + lod * batch.commands_count;
+    // a single command per batch with multiDrawIndirect, one command per part otherwise
+    for (uint32_t i = 0; i < batch.commands_count; i += draws.max_draw_count())
+    {
+        const uint32_t count = std::min(batch.commands_count - i, draws.max_draw_count());
+        draw_indexed_indirect(draws.buffer(), (first_command + i) * stride, count, stride);
+    }
+    return *this;
+}
+
+CommandBuffer& CommandBuffer::draw_meshlets(const MeshletDrawBuffer& draws, uint32_t frame_index, size_t batch_index)
+{
+    const MeshletDrawBuffer::Batch& batch = draws.batches()[batch_index];
+    const uint32_t commands_count = draws.commands_count(frame_index, batch_index);
+    const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+    const VkDeviceSize offset = draws.frame_offset(frame_index) + static_cast<VkDeviceSize>(batch.first_command) * stride;
+    for (uint32_t i = 0; i < commands_count; i += draws.max_draw_count())
+    {
+        const uint32_t count = std::min(commands_count - i, draws.max_draw_count());
+        draw_indexed_indirect(draws.buffer(), offset + i * stride, count, stride);
+    }
+    return *this;
+}
 
-    vkCmdBindVertexBuffers(id_, 0, 1, &vk_buffer, size);
-    vkCmdBindIndexBuffer(id_, ibuffer, 0, VK_INDEX_TYPE_UINT16);
-    vkCmdDrawIndexed(id_, part.indices_count, 1, part.ibuffer_offset, part.vbuffer_offset, 0);
+CommandBuffer& CommandBuffer::draw_culled(const CulledDrawBuffer& draws, uint32_t frame_index, size_t batch_index)
+{
+    const IndirectDrawBuffer::Batch& batch = draws.batches()[batch_index];
+    const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+    for (uint32_t i = 0; i < batch.commands_count; i += draws.max_draw_count())
+    {
+        const uint32_t count = std::min(batch.commands_count - i, draws.max_draw_count());
+        draw_indexed_indirect(draws.commands_buffer(frame_index), (batch.first_command + i) * stride, count, stride);
+    }
     return *this;
 }
 
@@ -1472,6 +2488,56 @@ CommandBuffer& CommandBuffer::render_target_barrier(VkImage image, VkImageLayout
     return *this;
 }
 
+CommandBuffer& CommandBuffer::memory_barrier(VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage,
+    VkAccessFlags src_access, VkAccessFlags dst_access)
+{
+    VkMemoryBarrier memory_barrier = {};
+    memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memory_barrier.srcAccessMask = src_access;
+    memory_barrier.dstAccessMask = dst_access;
+    vkCmdPipelineBarrier(id_, src_stage, dst_stage, 0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+    return *this;
+}
+
+CommandBuffer& CommandBuffer::image_barrier(VkImage image, VkImageLayout src_layout, VkImageLayout dst_layout, VkImageAspectFlags aspect_flags,
+    VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage, VkAccessFlags src_access, VkAccessFlags dst_access)
+{
+    VkImageMemoryBarrier image_memory_barrier = {};
+    image_memory_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    image_memory_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    image_memory_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    image_memory_barrier.image = image;
+    image_memory_barrier.oldLayout = src_layout;
+    image_memory_barrier.newLayout = dst_layout;
+    image_memory_barrier.srcAccessMask = src_access;
+    image_memory_barrier.dstAccessMask = dst_access;
+    image_memory_barrier.subresourceRange.aspectMask = aspect_flags;
+    image_memory_barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+    image_memory_barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    vkCmdPipelineBarrier(id_, src_stage, dst_stage, 0, 0, nullptr, 0, nullptr, 1, &image_memory_barrier);
+
+    return *this;
+}
+
+CommandBuffer& CommandBuffer::pipeline_barrier(VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage,
+    const VkBufferMemoryBarrier* buffer_barriers, uint32_t buffer_barriers_count,
+    const VkImageMemoryBarrier* image_barriers, uint32_t image_barriers_count)
+{
+    vkCmdPipelineBarrier(id_, src_stage, dst_stage, 0, 0, nullptr, buffer_barriers_count, buffer_barriers,
+        image_barriers_count, image_barriers);
+    return *this;
+}
+
+CommandBuffer& CommandBuffer::execute_commands(const CommandBuffer* command_buffers, uint32_t count)
+{
+    std::vector<VkCommandBuffer> ids(count);
+    for (uint32_t i = 0; i < count; ++i)
+        ids[i] = command_buffers[i];
+    vkCmdExecuteCommands(id_, count, &ids[0]);
+    return *this;
+}
+
 void GeometryLayout::vertex_input_info(VkPipelineVertexInputStateCreateInfo& info)
 {
     // vertex input
@@ -1493,21 +2559,190 @@ void GeometryLayout::vertex_input_info(VkPipelineVertexInputStateCreateInfo& inf
     info.vertexBindingDescriptionCount = 1;
 }
 
-void FullscreenLayout::vertex_input_info(VkPipelineVertexInputStateCreateInfo& info)
+namespace {
+
+bool vertex_formats_supported(const PhysicalDevice& physical_device, const VkFormat* formats, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(physical_device.id(), formats[i], &properties);
+        if (!(properties.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT))
+            return false;
+    }
+    return true;
+}
+
+}
+
+bool CompactGeometryLayout::supported(const PhysicalDevice& physical_device)
+{
+    // A2B10G10R10_SNORM isn't required to be supported for the vertex buffers
+    const VkFormat formats[] = { VK_FORMAT_A2B10G10R10_SNORM_PACK32, VK_FORMAT_R16G16_SFLOAT };
+    return vertex_formats_supported(physical_device, formats, array_size(formats));
+}
+
+void CompactGeometryLayout::vertex_input_info(VkPipelineVertexInputStateCreateInfo& info)
 {
     // vertex input
     static const VkVertexInputAttributeDescription vi_attr_desc[4] =
     {
-        { 0, 0, VK_FORMAT_R32G32B32A32_SFLOAT, 0 }, // pos
-        { 1, 0, VK_FORMAT_R32G32_SFLOAT, sizeof(vec4) } // tex
+        { 0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, pos) }, // pos
+        { 1, 0, VK_FORMAT_A2B10G10R10_SNORM_PACK32, offsetof(Vertex, nrm) }, // nrm
+        { 2, 0, VK_FORMAT_A2B10G10R10_SNORM_PACK32, offsetof(Vertex, tng) }, // tng
+        { 3, 0, VK_FORMAT_R16G16_SFLOAT, offsetof(Vertex, tex) } // tex
     };
 
-    static const VkVertexInputBindingDescription vi_binding_desc = { 0, sizeof(vk::FullscreenLayout::Vertex), VK_VERTEX_INPUT_RATE_VERTEX };
+    static const VkVertexInputBindingDescription vi_binding_desc = { 0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX };
 
     memset(&info, 0, sizeof(VkPipelineVertexInputStateCreateInfo));
     info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
     info.pVertexAttributeDescriptions = vi_attr_desc;
-    info.vertexAttributeDescriptionCount = 2;
+    info.vertexAttributeDescriptionCount = array_size(vi_attr_desc);
+    info.pVertexBindingDescriptions = &vi_binding_desc;
+    info.vertexBindingDescriptionCount = 1;
+}
+
+bool QuantizedGeometryLayout::supported(const PhysicalDevice& physical_device)
+{
+    const VkFormat formats[] = { VK_FORMAT_R16G16B16A16_UNORM };
+    return CompactGeometryLayout::supported(physical_device) && vertex_formats_supported(physical_device, formats, array_size(formats));
+}
+
+void QuantizedGeometryLayout::vertex_input_info(VkPipelineVertexInputStateCreateInfo& info)
+{
+    // vertex input
+    static const VkVertexInputAttributeDescription vi_attr_desc[4] =
+    {
+        { 0, 0, VK_FORMAT_R16G16B16A16_UNORM, offsetof(Vertex, pos) }, // pos
+        { 1, 0, VK_FORMAT_A2B10G10R10_SNORM_PACK32, offsetof(Vertex, nrm) }, // nrm
+        { 2, 0, VK_FORMAT_A2B10G10R10_SNORM_PACK32, offsetof(Vertex, tng) }, // tng
+        { 3, 0, VK_FORMAT_R16G16_SFLOAT, offsetof(Vertex, tex) } // tex
+    };
+
+    static const VkVertexInputBindingDescription vi_binding_desc = { 0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX };
+
+    memset(&info, 0, sizeof(VkPipelineVertexInputStateCreateInfo));
+    info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    info.pVertexAttributeDescriptions = vi_attr_desc;
+    info.vertexAttributeDescriptionCount = array_size(vi_attr_desc);
+    info.pVertexBindingDescriptions = &vi_binding_desc;
+    info.vertexBindingDescriptionCount = 1;
+}
+
+bool vertex_format_supported(const PhysicalDevice& physical_device, VertexFormat format)
+{
+    if (format == vertex_format_quantized)
+        return QuantizedGeometryLayout::supported(physical_device);
+    if (format == vertex_format_compact)
+        return CompactGeometryLayout::supported(physical_device);
+    return true;
+}
+
+uint32_t vertex_format_stride(VertexFormat format)
+{
+    if (format == vertex_format_quantized)
+        return QuantizedGeometryLayout::stride();
+    if (format == vertex_format_compact)
+        return CompactGeometryLayout::stride();
+    return GeometryLayout::stride();
+}
+
+void vertex_input_info(VertexFormat format, VkPipelineVertexInputStateCreateInfo& info)
+{
+    if (format == vertex_format_quantized)
+        QuantizedGeometryLayout::vertex_input_info(info);
+    else if (format == vertex_format_compact)
+        CompactGeometryLayout::vertex_input_info(info);
+    else
+        GeometryLayout::vertex_input_info(info);
+}
+
+// the pool copies the leading position of every vertex
+static_assert(offsetof(GeometryLayout::Vertex, pos) == 0 && offsetof(CompactGeometryLayout::Vertex, pos) == 0 &&
+    offsetof(QuantizedGeometryLayout::Vertex, pos) == 0, "The positions must start the vertices");
+
+uint32_t position_stride(VertexFormat format)
+{
+    return format == vertex_format_quantized ? sizeof(QuantizedGeometryLayout::Vertex::pos) : sizeof(vec3);
+}
+
+GeometryPool::Settings geometry_pool_settings(VertexFormat format)
+{
+    GeometryPool::Settings settings;
+    settings.vertex_size = vertex_format_stride(format);
+    settings.position_size = position_stride(format);
+    return settings;
+}
+
+void position_input_info(VertexFormat format, VkPipelineVertexInputStateCreateInfo& info)
+{
+    static const VkVertexInputAttributeDescription vi_attr_desc[2] =
+    {
+        { 0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0 },
+        { 0, 0, VK_FORMAT_R16G16B16A16_UNORM, 0 }
+    };
+
+    static const VkVertexInputBindingDescription vi_binding_desc[2] =
+    {
+        { 0, sizeof(vec3), VK_VERTEX_INPUT_RATE_VERTEX },
+        { 0, sizeof(QuantizedGeometryLayout::Vertex::pos), VK_VERTEX_INPUT_RATE_VERTEX }
+    };
+
+    const uint32_t index = format == vertex_format_quantized ? 1 : 0;
+    memset(&info, 0, sizeof(VkPipelineVertexInputStateCreateInfo));
+    info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    info.pVertexAttributeDescriptions = &vi_attr_desc[index];
+    info.vertexAttributeDescriptionCount = 1;
+    info.pVertexBindingDescriptions = &vi_binding_desc[index];
+    info.vertexBindingDescriptionCount = 1;
+}
+
+void InstancedGeometryLayout::vertex_input_info(VkPipelineVertexInputStateCreateInfo& info)
+{
+    // vertex input
+    static const VkVertexInputAttributeDescription vi_attr_desc[8] =
+    {
+        { 0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0 }, // pos
+        { 1, 0, VK_FORMAT_R32G32B32_SFLOAT, sizeof(vec3) }, // nrm
+        { 2, 0, VK_FORMAT_R32G32B32_SFLOAT, 2 * sizeof(vec3) }, //tng
+        { 3, 0, VK_FORMAT_R32G32_SFLOAT, 3 * sizeof(vec3) }, // tex
+        // a matrix takes one location per row
+        { 4, 1, VK_FORMAT_R32G32B32A32_SFLOAT, 0 }, // world
+        { 5, 1, VK_FORMAT_R32G32B32A32_SFLOAT, sizeof(vec4) },
+        { 6, 1, VK_FORMAT_R32G32B32A32_SFLOAT, 2 * sizeof(vec4) },
+        { 7, 1, VK_FORMAT_R32G32B32A32_SFLOAT, 3 * sizeof(vec4) }
+    };
+
+    static const VkVertexInputBindingDescription vi_binding_desc[2] =
+    {
+        { 0, sizeof(vk::InstancedGeometryLayout::Vertex), VK_VERTEX_INPUT_RATE_VERTEX },
+        { 1, sizeof(vk::InstancedGeometryLayout::Instance), VK_VERTEX_INPUT_RATE_INSTANCE }
+    };
+
+    memset(&info, 0, sizeof(VkPipelineVertexInputStateCreateInfo));
+    info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    info.pVertexAttributeDescriptions = vi_attr_desc;
+    info.vertexAttributeDescriptionCount = array_size(vi_attr_desc);
+    info.pVertexBindingDescriptions = vi_binding_desc;
+    info.vertexBindingDescriptionCount = array_size(vi_binding_desc);
+}
+
+void FullscreenLayout::vertex_input_info(VkPipelineVertexInputStateCreateInfo& info)
+{
+    // vertex input
+    static const VkVertexInputAttributeDescription vi_attr_desc[4] =
+    {
+        { 0, 0, VK_FORMAT_R32G32B32A32_SFLOAT, 0 }, // pos
+        { 1, 0, VK_FORMAT_R32G32_SFLOAT, sizeof(vec4) } // tex
+    };
+
+    static const VkVertexInputBindingDescription vi_binding_desc = { 0, sizeof(vk::FullscreenLayout::Vertex), VK_VERTEX_INPUT_RATE_VERTEX };
+
+    memset(&info, 0, sizeof(VkPipelineVertexInputStateCreateInfo));
+    info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    info.pVertexAttributeDescriptions = vi_attr_desc;
+    info.vertexAttributeDescriptionCount = 2;
     info.pVertexBindingDescriptions = &vi_binding_desc;
     info.vertexBindingDescriptionCount = 1;
 }
@@ -1557,6 +2792,853 @@ void Material::build_descriptor_set()
     vkUpdateDescriptorSets(*gpu_iface_.device, 1, &write_descriptor_set, 0, nullptr);
 }
 
+VkResult TransformBuffer::init(VulkanContext& context, const GPUInterface& gpu_iface, const Settings& settings)
+{
+    const uint32_t alignment = static_cast<uint32_t>(gpu_iface.device->physical_device()->properties().limits.minUniformBufferOffsetAlignment);
+    // the offsets are also used for the 16 bytes aligned SIMD stores
+    const uint32_t offset_alignment = std::max(alignment, 16u);
+    stride_ = (settings.object_size + offset_alignment - 1) / offset_alignment * offset_alignment;
+    frame_size_ = stride_ * settings.objects_count;
+
+    // the compute shaders read the whole buffer as a storage one
+    Buffer::Settings buffer_settings;
+    buffer_settings.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    buffer_settings.memory_properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    uint32_t queue_family_indices[2];
+    share_with_compute_queue(buffer_settings, queue_family_indices, *gpu_iface.device);
+    VK_CHECK(buffer_.init(context, gpu_iface, buffer_settings, nullptr, frame_size_ * settings.frames_count));
+
+    VkDescriptorSetAllocateInfo allocate_info = {};
+    allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocate_info.pSetLayouts = &context.descriptor_set_layouts.dynamic_mesh_layout;
+    allocate_info.descriptorSetCount = 1;
+    allocate_info.descriptorPool = context.descriptor_pools.main_descriptor_pool;
+    VK_CHECK(vkAllocateDescriptorSets(*gpu_iface.device, &allocate_info, &descriptor_set_));
+
+    // a shader sees one object, the offset is added when the set is bound
+    VkDescriptorBufferInfo buffer_info = {};
+    buffer_info.buffer = buffer_;
+    buffer_info.offset = 0;
+    buffer_info.range = settings.object_size;
+
+    VkWriteDescriptorSet write_descriptor_set = {};
+    write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_descriptor_set.descriptorCount = 1;
+    write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    write_descriptor_set.dstBinding = 0;
+    write_descriptor_set.dstSet = descriptor_set_;
+    write_descriptor_set.pBufferInfo = &buffer_info;
+    vkUpdateDescriptorSets(*gpu_iface.device, 1, &write_descriptor_set, 0, nullptr);
+
+    return VK_SUCCESS;
+}
+
+void TransformBuffer::destroy(VulkanContext& context)
+{
+    if (descriptor_set_ != VK_NULL_HANDLE)
+        VK_CHECK(vkFreeDescriptorSets(*context.main_device, context.descriptor_pools.main_descriptor_pool, 1, &descriptor_set_));
+    buffer_.destroy(context);
+}
+
+VkResult IndirectDrawBuffer::init(VulkanContext& context, const GPUInterface& gpu_iface, const Settings& settings)
+{
+    VERIFY(settings.max_commands_count > 0, "Invalid indirect commands count", VK_ERROR_INITIALIZATION_FAILED);
+    Device* device = gpu_iface.device;
+    max_draw_count_ = device->enabled_features().multiDrawIndirect ?
+        std::max(device->physical_device()->properties().limits.maxDrawIndirectCount, 1u) : 1;
+    max_commands_count_ = settings.max_commands_count;
+    commands_.reserve(max_commands_count_);
+
+    Buffer::Settings buffer_settings;
+    buffer_settings.usage = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+    buffer_settings.memory_properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    VK_CHECK(buffer_.init(context, gpu_iface, buffer_settings, nullptr,
+        max_commands_count_ * static_cast<uint32_t>(sizeof(VkDrawIndexedIndirectCommand))));
+
+    return VK_SUCCESS;
+}
+
+void IndirectDrawBuffer::destroy(VulkanContext& context)
+{
+    buffer_.destroy(context);
+    commands_.clear();
+    batches_.clear();
+    commands_count_ = 0;
+}
+
+VkResult IndirectDrawBuffer::build(VulkanContext& context, const Mesh* meshes, uint32_t meshes_count)
+{
+    commands_.clear();
+    batches_.clear();
+
+    std::vector<uint32_t> parts_order;
+    for (uint32_t object_index = 0; object_index < meshes_count; ++object_index)
+    {
+        const Mesh& mesh = meshes[object_index];
+        const std::vector<MeshPart>& parts = mesh.parts();
+
+        // parts with the same material become neighbours and share a batch
+        parts_order.resize(parts.size());
+        for (uint32_t i = 0, size = static_cast<uint32_t>(parts.size()); i < size; ++i)
+            parts_order[i] = i;
+        std::stable_sort(parts_order.begin(), parts_order.end(), [&parts](uint32_t a, uint32_t b)
+        {
+            return parts[a].material < parts[b].material;
+        });
+
+        for (size_t begin = 0, size = parts_order.size(); begin < size;)
+        {
+            const Material* material = parts[parts_order[begin]].material;
+            size_t end = begin + 1;
+            while (end < size && parts[parts_order[end]].material == material)
+                ++end;
+
+            Batch batch;
+            batch.mesh = &mesh;
+            batch.material = material;
+            batch.object_index = object_index;
+            batch.first_command = static_cast<uint32_t>(commands_.size());
+            batch.commands_count = static_cast<uint32_t>(end - begin);
+            batches_.push_back(batch);
+
+            // the levels of detail of the batch follow each other
+            for (uint32_t lod = 0; lod < mesh.lods_count(); ++lod)
+            {
+                for (size_t i = begin; i < end; ++i)
+                {
+                    const MeshPart& part = parts[parts_order[i]];
+                    VkDrawIndexedIndirectCommand command;
+                    command.indexCount = part.lods[lod].indices_count;
+                    command.instanceCount = 1;
+                    command.firstIndex = part.lods[lod].ibuffer_offset;
+                    command.vertexOffset = static_cast<int32_t>(part.vbuffer_offset);
+                    command.firstInstance = 0;
+                    commands_.push_back(command);
+                }
+            }
+            begin = end;
+        }
+    }
+
+    // nothing is drawn if the commands don't fit
+    if (commands_.size() > max_commands_count_)
+    {
+        batches_.clear();
+        commands_count_ = 0;
+        VERIFY_PRINT("Too many indirect draw commands");
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    commands_count_ = static_cast<uint32_t>(commands_.size());
+    if (commands_count_ == 0)
+        return VK_SUCCESS;
+    return buffer_.update(context, reinterpret_cast<const uint8_t*>(&commands_[0]),
+        commands_count_ * static_cast<uint32_t>(sizeof(VkDrawIndexedIndirectCommand)));
+}
+
+VkResult MeshletDrawBuffer::init(VulkanContext& /*context*/, const GPUInterface& gpu_iface, const Settings& settings)
+{
+    VERIFY(settings.frames_count > 0, "Invalid frames count", VK_ERROR_INITIALIZATION_FAILED);
+    Device* device = gpu_iface.device;
+    max_draw_count_ = device->enabled_features().multiDrawIndirect ?
+        std::max(device->physical_device()->properties().limits.maxDrawIndirectCount, 1u) : 1;
+    frames_count_ = settings.frames_count;
+    backface_culling_ = settings.backface_culling;
+    return VK_SUCCESS;
+}
+
+void MeshletDrawBuffer::destroy(VulkanContext& context)
+{
+    buffer_.destroy(context);
+    batches_.clear();
+    parts_.clear();
+    commands_counts_.clear();
+    max_commands_count_ = 0;
+}
+
+VkResult MeshletDrawBuffer::build(VulkanContext& context, const GPUInterface& gpu_iface, const IndirectDrawBuffer& draws)
+{
+    batches_.clear();
+    parts_.clear();
+
+    uint32_t commands_count = 0;
+    const std::vector<IndirectDrawBuffer::Batch>& draw_batches = draws.batches();
+    for (size_t i = 0, size = draw_batches.size(); i < size; ++i)
+    {
+        const IndirectDrawBuffer::Batch& draw_batch = draw_batches[i];
+        const std::vector<MeshPart>& parts = draw_batch.mesh->parts();
+
+        Batch batch;
+        batch.mesh = draw_batch.mesh;
+        batch.first_part = static_cast<uint32_t>(parts_.size());
+        batch.first_command = commands_count;
+        batch.meshlets_count = 0;
+        batch.max_commands_count = 0;
+        for (uint32_t j = 0, parts_count = static_cast<uint32_t>(parts.size()); j < parts_count; ++j)
+        {
+            if (parts[j].material != draw_batch.material)
+                continue;
+            parts_.push_back(j);
+            batch.meshlets_count += parts[j].meshlets_count;
+            batch.max_commands_count += std::max(parts[j].meshlets_count, 1u);
+        }
+        batch.parts_count = static_cast<uint32_t>(parts_.size()) - batch.first_part;
+        commands_count += batch.max_commands_count;
+        batches_.push_back(batch);
+    }
+    commands_counts_.assign(batches_.size() * frames_count_, 0);
+
+    // the buffer only grows, the commands are written every frame
+    if (commands_count <= max_commands_count_)
+        return VK_SUCCESS;
+    buffer_.destroy(context);
+    max_commands_count_ = commands_count;
+    Buffer::Settings buffer_settings;
+    buffer_settings.usage = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+    buffer_settings.memory_properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    return buffer_.init(context, gpu_iface, buffer_settings, nullptr,
+        frames_count_ * max_commands_count_ * static_cast<uint32_t>(sizeof(VkDrawIndexedIndirectCommand)));
+}
+
+uint32_t MeshletDrawBuffer::cull(uint32_t frame_index, size_t batch_index, uint32_t lod, const uint8_t* parts_visibility,
+    const Frustum& frustum, const vec3& camera)
+{
+    const Batch& batch = batches_[batch_index];
+    ASSERT(lod < batch.mesh->lods_count(), "Invalid level of detail");
+    const std::vector<MeshPart>& parts = batch.mesh->parts();
+    const std::vector<Meshlet>& meshlets = batch.mesh->meshlets();
+    VkDrawIndexedIndirectCommand* commands = reinterpret_cast<VkDrawIndexedIndirectCommand*>(buffer_.mapped() + frame_offset(frame_index)) +
+        batch.first_command;
+
+    // the mapping may be write-combined, the command being merged is kept aside and only written
+    uint32_t count = 0;
+    VkDrawIndexedIndirectCommand command = {};
+    for (uint32_t i = batch.first_part, end = batch.first_part + batch.parts_count; i < end; ++i)
+    {
+        if (parts_visibility != nullptr && parts_visibility[parts_[i]] == 0)
+            continue;
+        const MeshPart& part = parts[parts_[i]];
+        command.instanceCount = 1;
+        command.vertexOffset = static_cast<int32_t>(part.vbuffer_offset);
+        if (part.meshlets_count == 0 || lod != 0)
+        {
+            command.firstIndex = part.lods[lod].ibuffer_offset;
+            command.indexCount = part.lods[lod].indices_count;
+            commands[count++] = command;
+            continue;
+        }
+
+        command.indexCount = 0;
+        for (uint32_t j = part.first_meshlet, meshlets_end = part.first_meshlet + part.meshlets_count; j < meshlets_end; ++j)
+        {
+            const Meshlet& meshlet = meshlets[j];
+            const vec3 center(meshlet.center[0], meshlet.center[1], meshlet.center[2]);
+            const vec3 cone_axis(meshlet.cone_axis[0], meshlet.cone_axis[1], meshlet.cone_axis[2]);
+            if (!sphere_visible(frustum, center, meshlet.radius) ||
+                (backface_culling_ && cone_backfacing(center, meshlet.radius, cone_axis, meshlet.cone_cutoff, camera)))
+                continue;
+            if (command.indexCount != 0 && command.firstIndex + command.indexCount == meshlet.first_index)
+            {
+                command.indexCount += meshlet.indices_count;
+                continue;
+            }
+            if (command.indexCount != 0)
+                commands[count++] = command;
+            command.firstIndex = meshlet.first_index;
+            command.indexCount = meshlet.indices_count;
+        }
+        if (command.indexCount != 0)
+            commands[count++] = command;
+    }
+    commands_counts_[frame_index * batches_.size() + batch_index] = count;
+    return count;
+}
+
+namespace
+{
+// push constants of depth_reduce.comp
+struct ReduceConstants
+{
+    uint32_t src_size[2];
+    uint32_t dst_size[2];
+};
+
+uint32_t previous_power_of_2(uint32_t value)
+{
+    uint32_t result = 1;
+    while (result <= value / 2)
+        result *= 2;
+    return result;
+}
+}
+
+VkResult DepthPyramid::init(VulkanContext& context, const GPUInterface& gpu_iface, const Settings& settings)
+{
+    VERIFY(settings.depth != nullptr && settings.frames_count > 0, "Invalid depth pyramid settings", VK_ERROR_INITIALIZATION_FAILED);
+    gpu_iface_ = gpu_iface;
+    Device* device = gpu_iface.device;
+    async_compute_ = settings.async_compute && device->has_compute_queue();
+    built_ = false;
+    depth_image_ = settings.depth->image();
+    depth_width_ = settings.depth->width();
+    depth_height_ = settings.depth->height();
+    width_ = previous_power_of_2(depth_width_);
+    height_ = previous_power_of_2(depth_height_);
+    mip_levels_ = 1;
+    while ((std::max(width_, height_) >> mip_levels_) > 0)
+        ++mip_levels_;
+
+    ImageView::Settings image_settings;
+    image_settings.width = width_;
+    image_settings.height = height_;
+    image_settings.mip_levels = mip_levels_;
+    image_settings.format = VK_FORMAT_R32_SFLOAT;
+    image_settings.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    uint32_t queue_family_indices[2];
+    if (async_compute_)
+        share_with_compute_queue(image_settings, queue_family_indices, *device);
+    VK_CHECK(image_.init(context, gpu_iface, image_settings, VK_NULL_HANDLE, nullptr, 0));
+
+    // the shaders can't sample the depth and the stencil with one view
+    VkImageViewCreateInfo view_create_info = {};
+    view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_create_info.image = depth_image_;
+    view_create_info.format = settings.depth->format();
+    view_create_info.components = {VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A};
+    view_create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    view_create_info.subresourceRange.levelCount = 1;
+    view_create_info.subresourceRange.layerCount = 1;
+    VK_CHECK(vkCreateImageView(*device, &view_create_info, context.allocation_callbacks, &depth_view_));
+
+    view_create_info.image = image_.image();
+    view_create_info.format = VK_FORMAT_R32_SFLOAT;
+    view_create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    mip_views_.resize(mip_levels_, VK_NULL_HANDLE);
+    for (uint32_t i = 0; i < mip_levels_; ++i)
+    {
+        view_create_info.subresourceRange.baseMipLevel = i;
+        VK_CHECK(vkCreateImageView(*device, &view_create_info, context.allocation_callbacks, &mip_views_[i]));
+    }
+
+    // the filtering would mix the nearer depth in
+    VkSamplerCreateInfo sampler_create_info = SamplerCreateInfo(VK_FILTER_NEAREST, VK_FILTER_NEAREST, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+    sampler_create_info.maxLod = static_cast<float>(mip_levels_);
+    VK_CHECK(vkCreateSampler(*device, &sampler_create_info, context.allocation_callbacks, &sampler_));
+    descriptor_image_info_.sampler = sampler_;
+    descriptor_image_info_.imageView = image_.image_view_id();
+    descriptor_image_info_.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    // the source and the destination mip
+    VkDescriptorSetLayoutBinding bindings[2] =
+    {
+        { 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+        { 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,          1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr }
+    };
+    VkDescriptorSetLayoutCreateInfo layout_create_info = {};
+    layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_create_info.pBindings = bindings;
+    layout_create_info.bindingCount = array_size(bindings);
+    VK_CHECK(vkCreateDescriptorSetLayout(*device, &layout_create_info, context.allocation_callbacks, &descriptor_set_layout_));
+
+    const std::string shader = shaders_path() + "depth_reduce.comp.spv";
+    ComputePipeline::Settings pipeline_settings;
+    pipeline_settings.shader = shader.c_str();
+    pipeline_settings.descriptor_set_layouts = &descriptor_set_layout_;
+    pipeline_settings.descriptor_set_layouts_count = 1;
+    pipeline_settings.push_constants_size = sizeof(ReduceConstants);
+    VK_VERIFY(pipeline_.init(context, gpu_iface, pipeline_settings));
+
+    // mip 0 reads the depth, the next ones read the previous mip
+    std::vector<VkDescriptorSetLayout> layouts(mip_levels_, descriptor_set_layout_);
+    descriptor_sets_.resize(mip_levels_, VK_NULL_HANDLE);
+    VkDescriptorSetAllocateInfo allocate_info = DescriptorSetAllocateInfo(context.descriptor_pools.main_descriptor_pool,
+        &layouts[0], mip_levels_);
+    VK_VERIFY(vkAllocateDescriptorSets(*device, &allocate_info, &descriptor_sets_[0]));
+    for (uint32_t i = 0; i < mip_levels_; ++i)
+    {
+        VkDescriptorImageInfo image_infos[2];
+        image_infos[0].sampler = sampler_;
+        image_infos[0].imageView = i == 0 ? depth_view_ : mip_views_[i - 1];
+        image_infos[0].imageLayout = i == 0 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+        image_infos[1].sampler = VK_NULL_HANDLE;
+        image_infos[1].imageView = mip_views_[i];
+        image_infos[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        VkWriteDescriptorSet write_descriptor_sets[2] = { {}, {} };
+        for (uint32_t j = 0; j < array_size(write_descriptor_sets); ++j)
+        {
+            write_descriptor_sets[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write_descriptor_sets[j].dstSet = descriptor_sets_[i];
+            write_descriptor_sets[j].dstBinding = j;
+            write_descriptor_sets[j].descriptorCount = 1;
+            write_descriptor_sets[j].descriptorType = bindings[j].descriptorType;
+            write_descriptor_sets[j].pImageInfo = &image_infos[j];
+        }
+        vkUpdateDescriptorSets(*device, array_size(write_descriptor_sets), write_descriptor_sets, 0, nullptr);
+    }
+
+    semaphores_.resize(settings.frames_count, VK_NULL_HANDLE);
+    if (async_compute_)
+    {
+        VkSemaphoreCreateInfo semaphore_create_info = SemaphoreCreateInfo();
+        for (VkSemaphore& semaphore : semaphores_)
+            VK_CHECK(vkCreateSemaphore(*device, &semaphore_create_info, context.allocation_callbacks, &semaphore));
+    }
+
+    return VK_SUCCESS;
+}
+
+void DepthPyramid::destroy(VulkanContext& context)
+{
+    const VkDevice device = *gpu_iface_.device;
+    for (VkSemaphore semaphore : semaphores_)
+    {
+        if (semaphore != VK_NULL_HANDLE)
+            vkDestroySemaphore(device, semaphore, context.allocation_callbacks);
+    }
+    semaphores_.clear();
+    if (!descriptor_sets_.empty())
+        VK_CHECK(vkFreeDescriptorSets(device, context.descriptor_pools.main_descriptor_pool,
+            static_cast<uint32_t>(descriptor_sets_.size()), &descriptor_sets_[0]));
+    descriptor_sets_.clear();
+    pipeline_.destroy(context);
+    if (descriptor_set_layout_ != VK_NULL_HANDLE)
+        vkDestroyDescriptorSetLayout(device, descriptor_set_layout_, context.allocation_callbacks);
+    descriptor_set_layout_ = VK_NULL_HANDLE;
+    if (sampler_ != VK_NULL_HANDLE)
+        vkDestroySampler(device, sampler_, context.allocation_callbacks);
+    sampler_ = VK_NULL_HANDLE;
+    for (VkImageView view : mip_views_)
+        vkDestroyImageView(device, view, context.allocation_callbacks);
+    mip_views_.clear();
+    if (depth_view_ != VK_NULL_HANDLE)
+        vkDestroyImageView(device, depth_view_, context.allocation_callbacks);
+    depth_view_ = VK_NULL_HANDLE;
+    image_.destroy(context);
+    image_ = ImageView();
+    built_ = false;
+}
+
+void DepthPyramid::build(CommandBuffer& command_buffer, const mat4x4& view_projection)
+{
+    // the culling on this queue has read the previous pyramid, the first build discards the undefined contents
+    command_buffer
+        .image_barrier(depth_image_, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+            VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT)
+        .image_barrier(image_.image(), built_ ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+            VK_IMAGE_ASPECT_COLOR_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT)
+        .bind_pipeline(pipeline_, VK_PIPELINE_BIND_POINT_COMPUTE);
+
+    ReduceConstants constants;
+    constants.src_size[0] = depth_width_;
+    constants.src_size[1] = depth_height_;
+    for (uint32_t i = 0; i < mip_levels_; ++i)
+    {
+        constants.dst_size[0] = std::max(width_ >> i, 1u);
+        constants.dst_size[1] = std::max(height_ >> i, 1u);
+        command_buffer
+            .bind_descriptor_set(VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_.layout(), &descriptor_sets_[i], 1, 0)
+            .push_constants(pipeline_.layout(), VK_SHADER_STAGE_COMPUTE_BIT, &constants, sizeof(constants))
+            .dispatch((constants.dst_size[0] + group_size - 1) / group_size, (constants.dst_size[1] + group_size - 1) / group_size)
+            .memory_barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+        constants.src_size[0] = constants.dst_size[0];
+        constants.src_size[1] = constants.dst_size[1];
+    }
+
+    command_buffer.image_barrier(depth_image_, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+        VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+    view_projection_ = view_projection;
+    built_ = true;
+}
+
+namespace
+{
+// push constants of cull_parts.comp
+struct CullConstants
+{
+    vec4 planes[Frustum::planes_count];
+    uint32_t parts_count;
+    // in vec4 of the transforms buffer
+    uint32_t transforms_offset;
+    uint32_t transforms_stride;
+    uint32_t batches_count;
+};
+static_assert(sizeof(CullConstants) <= 128, "The push constants don't fit the guaranteed maxPushConstantsSize");
+
+// std140 uniform of cull_parts.comp, the pyramid is the one of the previous frame
+struct OcclusionData
+{
+    mat4x4 view_projection;
+    float pyramid_size[2];
+    uint32_t pyramid_levels;
+    // 0 until the pyramid is built
+    uint32_t enabled;
+};
+static_assert(sizeof(OcclusionData) == 80, "The size of the occlusion data does not match the std140 block of the shader");
+static_assert(sizeof(CulledDrawBuffer::Part) == 80, "The size of the part does not match the std430 struct of the shader");
+}
+
+VkResult CulledDrawBuffer::init(VulkanContext& context, const GPUInterface& gpu_iface, const Settings& settings)
+{
+    VERIFY(settings.frames_count > 0, "Invalid frames count", VK_ERROR_INITIALIZATION_FAILED);
+    gpu_iface_ = gpu_iface;
+    Device* device = gpu_iface.device;
+    max_draw_count_ = device->enabled_features().multiDrawIndirect ?
+        std::max(device->physical_device()->properties().limits.maxDrawIndirectCount, 1u) : 1;
+    async_compute_ = settings.async_compute && device->has_compute_queue();
+    frames_.resize(settings.frames_count);
+
+    // parts, transforms, levels of detail, commands and counts, then the occlusion data and the depth pyramid
+    VkDescriptorSetLayoutBinding bindings[7];
+    for (uint32_t i = 0; i < array_size(bindings); ++i)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        bindings[i].pImmutableSamplers = nullptr;
+    }
+    bindings[5].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    bindings[6].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    VkDescriptorSetLayoutCreateInfo layout_create_info = {};
+    layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_create_info.pBindings = bindings;
+    layout_create_info.bindingCount = array_size(bindings);
+    VK_CHECK(vkCreateDescriptorSetLayout(*device, &layout_create_info, context.allocation_callbacks, &descriptor_set_layout_));
+
+    const std::string shader = shaders_path() + "cull_parts.comp.spv";
+    ComputePipeline::Settings pipeline_settings;
+    pipeline_settings.shader = shader.c_str();
+    pipeline_settings.descriptor_set_layouts = &descriptor_set_layout_;
+    pipeline_settings.descriptor_set_layouts_count = 1;
+    pipeline_settings.push_constants_size = sizeof(CullConstants);
+    VK_VERIFY(pipeline_.init(context, gpu_iface, pipeline_settings));
+
+    return VK_SUCCESS;
+}
+
+void CulledDrawBuffer::destroy(VulkanContext& context)
+{
+    destroy_frames(context);
+    frames_.clear();
+    parts_.destroy(context);
+    parts_ = Buffer();
+    pipeline_.destroy(context);
+    if (descriptor_set_layout_ != VK_NULL_HANDLE)
+        vkDestroyDescriptorSetLayout(*gpu_iface_.device, descriptor_set_layout_, context.allocation_callbacks);
+    descriptor_set_layout_ = VK_NULL_HANDLE;
+    batches_.clear();
+    parts_count_ = 0;
+    objects_count_ = 0;
+}
+
+void CulledDrawBuffer::destroy_frames(VulkanContext& context)
+{
+    for (Frame& frame : frames_)
+    {
+        if (frame.descriptor_set != VK_NULL_HANDLE)
+            VK_CHECK(vkFreeDescriptorSets(*gpu_iface_.device, context.descriptor_pools.main_descriptor_pool, 1, &frame.descriptor_set));
+        frame.readback.destroy(context);
+        frame.counts.destroy(context);
+        frame.commands.destroy(context);
+        frame.occlusion.destroy(context);
+        frame.lods.destroy(context);
+        frame = Frame();
+    }
+}
+
+VkResult CulledDrawBuffer::build(VulkanContext& context, const GPUInterface& gpu_iface, const IndirectDrawBuffer& draws,
+    const TransformBuffer& transforms, const DepthPyramid* depth_pyramid)
+{
+    destroy_frames(context);
+    parts_.destroy(context);
+    parts_ = Buffer();
+    batches_.clear();
+    transforms_ = &transforms;
+    depth_pyramid_ = depth_pyramid;
+
+    // the parts of a batch are its commands, in the order of the mesh
+    std::vector<Part> parts;
+    objects_count_ = 0;
+    const std::vector<IndirectDrawBuffer::Batch>& draw_batches = draws.batches();
+    for (size_t i = 0, size = draw_batches.size(); i < size; ++i)
+    {
+        IndirectDrawBuffer::Batch batch = draw_batches[i];
+        batch.first_command = static_cast<uint32_t>(parts.size());
+        const std::vector<MeshPart>& mesh_parts = batch.mesh->parts();
+        for (size_t j = 0, parts_count = mesh_parts.size(); j < parts_count; ++j)
+        {
+            const MeshPart& mesh_part = mesh_parts[j];
+            if (mesh_part.material != batch.material)
+                continue;
+            Part part;
+            part.bounds_min[0] = mesh_part.bounds.min.x;
+            part.bounds_min[1] = mesh_part.bounds.min.y;
+            part.bounds_min[2] = mesh_part.bounds.min.z;
+            part.bounds_max[0] = mesh_part.bounds.max.x;
+            part.bounds_max[1] = mesh_part.bounds.max.y;
+            part.bounds_max[2] = mesh_part.bounds.max.z;
+            part.object_index = batch.object_index;
+            part.batch_index = static_cast<uint32_t>(i);
+            part.first_command = batch.first_command;
+            part.vertex_offset = static_cast<int32_t>(mesh_part.vbuffer_offset);
+            // the levels the mesh doesn't have repeat its coarsest one
+            for (uint32_t lod = 0; lod < max_mesh_lods; ++lod)
+            {
+                const MeshLod& mesh_lod = mesh_part.lods[std::min(lod, batch.mesh->lods_count() - 1)];
+                part.lods[lod][0] = mesh_lod.ibuffer_offset;
+                part.lods[lod][1] = mesh_lod.indices_count;
+            }
+            part.padding[0] = part.padding[1] = 0;
+            parts.push_back(part);
+        }
+        batch.commands_count = static_cast<uint32_t>(parts.size()) - batch.first_command;
+        batches_.push_back(batch);
+        objects_count_ = std::max(objects_count_, batch.object_index + 1);
+    }
+    parts_count_ = static_cast<uint32_t>(parts.size());
+    if (parts_count_ == 0)
+        return VK_SUCCESS;
+
+    Buffer::Settings parts_settings;
+    parts_settings.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    parts_settings.memory_properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    VK_CHECK(parts_.init(context, gpu_iface, parts_settings, reinterpret_cast<const uint8_t*>(&parts[0]),
+        parts_count_ * static_cast<uint32_t>(sizeof(Part))));
+
+    // only the commands are used by both queues
+    Buffer::Settings commands_settings;
+    commands_settings.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+    commands_settings.memory_properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    uint32_t queue_family_indices[2];
+    if (async_compute_)
+        share_with_compute_queue(commands_settings, queue_family_indices, *gpu_iface.device);
+
+    Buffer::Settings counts_settings;
+    counts_settings.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    counts_settings.memory_properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+    Buffer::Settings readback_settings;
+    readback_settings.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    readback_settings.memory_properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    Buffer::Settings occlusion_settings;
+    occlusion_settings.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+    occlusion_settings.memory_properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    // nothing is occluded by the white default texture until the pyramid is passed
+    const VkDescriptorImageInfo& pyramid_info = depth_pyramid != nullptr ?
+        depth_pyramid->descriptor_image_info() : context.default_texture.descriptor_image_info();
+    const uint32_t lods_size = objects_count_ * static_cast<uint32_t>(sizeof(uint32_t));
+    const uint32_t counts_size = static_cast<uint32_t>((batches_.size() + 1) * sizeof(uint32_t));
+    for (Frame& frame : frames_)
+    {
+        VK_CHECK(frame.lods.init(context, gpu_iface, parts_settings, nullptr, lods_size));
+        memset(frame.lods.mapped(), 0, lods_size);
+        VK_CHECK(frame.occlusion.init(context, gpu_iface, occlusion_settings, nullptr, sizeof(OcclusionData)));
+        memset(frame.occlusion.mapped(), 0, sizeof(OcclusionData));
+        VK_CHECK(frame.commands.init(context, gpu_iface, commands_settings, nullptr,
+            parts_count_ * static_cast<uint32_t>(sizeof(VkDrawIndexedIndirectCommand))));
+        VK_CHECK(frame.counts.init(context, gpu_iface, counts_settings, nullptr, counts_size));
+        VK_CHECK(frame.readback.init(context, gpu_iface, readback_settings, nullptr, counts_size));
+        memset(frame.readback.mapped(), 0, counts_size);
+
+        VkDescriptorSetAllocateInfo allocate_info = DescriptorSetAllocateInfo(context.descriptor_pools.main_descriptor_pool,
+            &descriptor_set_layout_, 1);
+        VK_VERIFY(vkAllocateDescriptorSets(*gpu_iface.device, &allocate_info, &frame.descriptor_set));
+
+        VkDescriptorBufferInfo buffer_infos[5] =
+        {
+            parts_.descriptor_buffer_info(),
+            transforms.buffer().descriptor_buffer_info(),
+            frame.lods.descriptor_buffer_info(),
+            frame.commands.descriptor_buffer_info(),
+            frame.counts.descriptor_buffer_info()
+        };
+        VkWriteDescriptorSet write_descriptor_sets[3] = { {}, {}, {} };
+        for (uint32_t i = 0; i < array_size(write_descriptor_sets); ++i)
+        {
+            write_descriptor_sets[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write_descriptor_sets[i].dstSet = frame.descriptor_set;
+            write_descriptor_sets[i].descriptorCount = 1;
+        }
+        write_descriptor_sets[0].dstBinding = 0;
+        write_descriptor_sets[0].descriptorCount = array_size(buffer_infos);
+        write_descriptor_sets[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        write_descriptor_sets[0].pBufferInfo = buffer_infos;
+        write_descriptor_sets[1].dstBinding = 5;
+        write_descriptor_sets[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        write_descriptor_sets[1].pBufferInfo = &frame.occlusion.descriptor_buffer_info();
+        write_descriptor_sets[2].dstBinding = 6;
+        write_descriptor_sets[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        write_descriptor_sets[2].pImageInfo = &pyramid_info;
+        vkUpdateDescriptorSets(*gpu_iface.device, array_size(write_descriptor_sets), write_descriptor_sets, 0, nullptr);
+    }
+
+    return VK_SUCCESS;
+}
+
+void CulledDrawBuffer::cull(CommandBuffer& command_buffer, uint32_t frame_index, const Frustum& frustum)
+{
+    if (parts_count_ == 0)
+        return;
+    const Frame& frame = frames_[frame_index];
+
+    CullConstants constants;
+    for (int i = 0; i < Frustum::planes_count; ++i)
+        constants.planes[i] = frustum.planes[i];
+    constants.parts_count = parts_count_;
+    constants.transforms_offset = transforms_->dynamic_offset(frame_index, 0) / static_cast<uint32_t>(sizeof(vec4));
+    constants.transforms_stride = transforms_->stride() / static_cast<uint32_t>(sizeof(vec4));
+    constants.batches_count = static_cast<uint32_t>(batches_.size());
+
+    // the frame's fence has been waited for, the GPU doesn't read the data
+    OcclusionData* occlusion = reinterpret_cast<OcclusionData*>(frame.occlusion.mapped());
+    occlusion->enabled = depth_pyramid_ != nullptr && depth_pyramid_->built() ? 1 : 0;
+    if (occlusion->enabled)
+    {
+        occlusion->view_projection = depth_pyramid_->view_projection();
+        occlusion->pyramid_size[0] = static_cast<float>(depth_pyramid_->width());
+        occlusion->pyramid_size[1] = static_cast<float>(depth_pyramid_->height());
+        occlusion->pyramid_levels = depth_pyramid_->mip_levels();
+    }
+
+    // the culled parts keep the zeroed commands
+    VkBufferCopy counts_region = {};
+    counts_region.size = (batches_.size() + 1) * sizeof(uint32_t);
+    command_buffer
+        .fill_buffer(frame.commands, 0, VK_WHOLE_SIZE, 0)
+        .fill_buffer(frame.counts, 0, VK_WHOLE_SIZE, 0)
+        .memory_barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT)
+        .bind_pipeline(pipeline_, VK_PIPELINE_BIND_POINT_COMPUTE)
+        .bind_descriptor_set(VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_.layout(), &frame.descriptor_set, 1, 0)
+        .push_constants(pipeline_.layout(), VK_SHADER_STAGE_COMPUTE_BIT, &constants, sizeof(constants))
+        .dispatch((parts_count_ + group_size - 1) / group_size)
+        .memory_barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT)
+        .copy_buffer(frame.counts, frame.readback, &counts_region, 1)
+        .memory_barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT);
+    // the semaphore orders the draws after the async compute
+    if (!async_compute_)
+    {
+        command_buffer.memory_barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+            VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+    }
+}
+
+uint32_t CulledDrawBuffer::visible_count(uint32_t frame_index) const
+{
+    if (parts_count_ == 0)
+        return 0;
+    const uint32_t* counts = reinterpret_cast<const uint32_t*>(frames_[frame_index].readback.mapped());
+    uint32_t count = 0;
+    for (size_t i = 0, size = batches_.size(); i < size; ++i)
+        count += counts[i];
+    return count;
+}
+
+uint32_t CulledDrawBuffer::frustum_visible_count(uint32_t frame_index) const
+{
+    if (parts_count_ == 0)
+        return 0;
+    const uint32_t* counts = reinterpret_cast<const uint32_t*>(frames_[frame_index].readback.mapped());
+    return counts[batches_.size()];
+}
+
+VkResult GeometryPool::init(VulkanContext& context, const GPUInterface& gpu_iface, const Settings& settings)
+{
+    VERIFY(settings.vertex_size > 0, "Invalid vertex size", VK_ERROR_INITIALIZATION_FAILED);
+    vertex_size_ = settings.vertex_size;
+    position_size_ = settings.position_size;
+    vertices_.init(settings.vertices_count, settings.min_range_size);
+    indices_.init(settings.indices_count, settings.min_range_size);
+
+    Buffer::Settings buffer_settings;
+    buffer_settings.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    buffer_settings.memory_properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    VK_CHECK(vbuffer_.init(context, gpu_iface, buffer_settings, nullptr, settings.vertices_count * vertex_size_));
+
+    buffer_settings.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+    VK_CHECK(ibuffer_.init(context, gpu_iface, buffer_settings, nullptr, settings.indices_count * static_cast<uint32_t>(sizeof(uint16_t))));
+
+    if (position_size_ != 0)
+    {
+        buffer_settings.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+        VK_CHECK(pbuffer_.init(context, gpu_iface, buffer_settings, nullptr, settings.vertices_count * position_size_));
+    }
+
+    return VK_SUCCESS;
+}
+
+void GeometryPool::destroy(VulkanContext& context)
+{
+    if (!initialized())
+        return;
+    ASSERT(vertices_.empty() && indices_.empty(), "Geometry pool is destroyed with the allocated ranges");
+    if (position_size_ != 0)
+        pbuffer_.destroy(context);
+    ibuffer_.destroy(context);
+    vbuffer_.destroy(context);
+    vertex_size_ = 0;
+    position_size_ = 0;
+}
+
+VkResult GeometryPool::allocate(Allocation& allocation, uint32_t vertices_count, uint32_t indices_count, VkIndexType index_type)
+{
+    const uint64_t vertices_offset = vertices_.allocate(vertices_count, 1);
+    VERIFY(vertices_offset != BuddyAllocator::invalid_offset, "Geometry pool is out of vertices", VK_ERROR_OUT_OF_DEVICE_MEMORY);
+    // the allocator works in 16 bit elements, the buddy nodes keep the 32 bit ranges aligned
+    const uint32_t elements_per_index = index_size(index_type) / sizeof(uint16_t);
+    const uint64_t indices_offset = indices_.allocate(static_cast<uint64_t>(indices_count) * elements_per_index, elements_per_index);
+    if (indices_offset == BuddyAllocator::invalid_offset)
+    {
+        vertices_.free(vertices_offset);
+        VERIFY_PRINT("Geometry pool is out of indices");
+        return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    }
+
+    allocation.vertices_offset = static_cast<uint32_t>(vertices_offset);
+    allocation.vertices_count = vertices_count;
+    allocation.indices_offset = static_cast<uint32_t>(indices_offset / elements_per_index);
+    allocation.indices_count = indices_count;
+    allocation.index_type = index_type;
+    return VK_SUCCESS;
+}
+
+void GeometryPool::free(Allocation& allocation)
+{
+    if (allocation.vertices_offset == invalid_index)
+        return;
+    vertices_.free(allocation.vertices_offset);
+    indices_.free(static_cast<uint64_t>(allocation.indices_offset) * (index_size(allocation.index_type) / sizeof(uint16_t)));
+    allocation = Allocation();
+}
+
+VkResult GeometryPool::upload(VulkanContext& context, const Allocation& allocation, const uint8_t* vertices, const uint8_t* indices)
+{
+    VK_CHECK(context.staging_ring.upload_buffer(context, vbuffer_, static_cast<VkDeviceSize>(allocation.vertices_offset) * vertex_size_,
+        vertices, static_cast<VkDeviceSize>(allocation.vertices_count) * vertex_size_));
+    if (position_size_ != 0)
+    {
+        std::vector<uint8_t> positions(static_cast<size_t>(allocation.vertices_count) * position_size_);
+        for (uint32_t i = 0; i < allocation.vertices_count; ++i)
+            memcpy(&positions[i * position_size_], vertices + static_cast<size_t>(i) * vertex_size_, position_size_);
+        VK_CHECK(context.staging_ring.upload_buffer(context, pbuffer_, static_cast<VkDeviceSize>(allocation.vertices_offset) * position_size_,
+            positions.empty() ? nullptr : &positions[0], positions.size()));
+    }
+    const VkDeviceSize size = index_size(allocation.index_type);
+    return context.staging_ring.upload_buffer(context, ibuffer_, allocation.indices_offset * size,
+        indices, allocation.indices_count * size);
+}
+
 VkResult Mesh::create_cube(vk::VulkanContext& context, const vk::GPUInterface& gpu_iface)
 {
     parts_.resize(1);
@@ -1600,10 +3682,13 @@ VkResult Mesh::create_cube(vk::VulkanContext& context, const vk::GPUInterface& g
     parts_[0].ibuffer_offset = 0;
     parts_[0].indices_count = array_size(cube_indices);
     parts_[0].material = nullptr;
+    parts_[0].bounds.min = vec3(-0.5f, -0.5f, -0.5f);
+    parts_[0].bounds.max = vec3(0.5f, 0.5f, 0.5f);
 
     VK_CHECK(init_descriptor_set(context, gpu_iface));
-    VK_CHECK(init_buffers(context, gpu_iface, reinterpret_cast<const uint8_t*>(cube_vertices), sizeof(cube_vertices),
-        reinterpret_cast<const uint8_t*>(cube_indices), sizeof(cube_indices)));
+    VK_CHECK(init_geometry(context, gpu_iface, context.geometry_pools.main_geometry_pool, geometry_pool_settings(vertex_format_float),
+        reinterpret_cast<const uint8_t*>(cube_vertices), array_size(cube_vertices),
+        reinterpret_cast<const uint8_t*>(cube_indices), array_size(cube_indices), VK_INDEX_TYPE_UINT16));
 
     return VK_SUCCESS;
 }
@@ -1620,7 +3705,8 @@ VkResult Mesh::init_descriptor_set(VulkanContext& context, const vk::GPUInterfac
     vk::Buffer::Settings buffer_settings;
     buffer_settings.memory_properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
     buffer_settings.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-    VK_CHECK(uniform_.init(context, gpu_iface, buffer_settings, reinterpret_cast<const uint8_t*>(&mat4x4::identity()), sizeof(mat4x4)));
+    mat4x4 world;
+    VK_CHECK(uniform_.init(context, gpu_iface, buffer_settings, reinterpret_cast<const uint8_t*>(world.data()), sizeof(mat4x4)));
 
     VkWriteDescriptorSet write_descriptor_set = {};
     write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
@@ -1634,21 +3720,50 @@ VkResult Mesh::init_descriptor_set(VulkanContext& context, const vk::GPUInterfac
     return VK_SUCCESS;
 }
 
-VkResult Mesh::init_buffers(VulkanContext& context, const vk::GPUInterface& gpu_iface,
-    const uint8_t* vertices, uint32_t vertices_data_size,
-    const uint8_t* indices, uint32_t indices_data_size)
+VkResult Mesh::init_geometry(VulkanContext& context, const vk::GPUInterface& gpu_iface, GeometryPool& geometry_pool,
+    const GeometryPool::Settings& pool_settings, const uint8_t* vertices, uint32_t vertices_count,
+    const uint8_t* indices, uint32_t indices_count, VkIndexType index_type)
 {
-    vk::Buffer::Settings buffer_settings;
-    buffer_settings.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-    buffer_settings.memory_properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-    VK_CHECK(vbuffer_.init(context, gpu_iface, buffer_settings, vertices, vertices_data_size));
+    if (!geometry_pool.initialized())
+        VK_VERIFY(geometry_pool.init(context, gpu_iface, pool_settings));
+    geometry_pool_ = &geometry_pool;
+    VK_VERIFY(geometry_pool.allocate(geometry_, vertices_count, indices_count, index_type));
+    VK_CHECK(geometry_pool.upload(context, geometry_, vertices, indices));
 
-    buffer_settings.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
-    VK_CHECK(ibuffer_.init(context, gpu_iface, buffer_settings, indices, indices_data_size));
+    for (size_t i = 0, size = parts_.size(); i < size; ++i)
+    {
+        MeshPart& part = parts_[i];
+        if (i == 0)
+            bounds_ = part.bounds;
+        bounds_.min = vec3(std::min(bounds_.min.x, part.bounds.min.x), std::min(bounds_.min.y, part.bounds.min.y),
+            std::min(bounds_.min.z, part.bounds.min.z));
+        bounds_.max = vec3(std::max(bounds_.max.x, part.bounds.max.x), std::max(bounds_.max.y, part.bounds.max.y),
+            std::max(bounds_.max.z, part.bounds.max.z));
+        part.vbuffer_offset += geometry_.vertices_offset;
+        part.ibuffer_offset += geometry_.indices_offset;
+        part.lods[0].ibuffer_offset = part.ibuffer_offset;
+        part.lods[0].indices_count = part.indices_count;
+        for (uint32_t lod = 1; lod < lods_count_; ++lod)
+            part.lods[lod].ibuffer_offset += geometry_.indices_offset;
+    }
+    for (size_t i = 0, size = meshlets_.size(); i < size; ++i)
+        meshlets_[i].first_index += geometry_.indices_offset;
 
     return VK_SUCCESS;
 }
 
+uint32_t Mesh::select_lod(float distance, float screen_scale, float max_error_pixels) const
+{
+    // the camera is inside of the object
+    if (distance <= 0.0f)
+        return 0;
+    const float max_error = max_error_pixels * distance / screen_scale;
+    uint32_t lod = 0;
+    while (lod + 1 < lods_count_ && lod_errors_[lod + 1] <= max_error)
+        ++lod;
+    return lod;
+}
+
 VkResult Mesh::create_quad(vk::VulkanContext& context, const vk::GPUInterface& gpu_iface)
 {
     parts_.resize(1);
@@ -1659,79 +3774,474 @@ VkResult Mesh::create_quad(vk::VulkanContext& context, const vk::GPUInterface& g
         { { 3.0f, -1.0f, 1.0f, 1.0f }, { 2.0f, 0.0f } },
     };
 
-    uint32_t graphics_queue_family_index = gpu_iface.device->physical_device()->graphics_queue_family_index();
-
-    vk::Buffer::Settings buffer_settings;
-    buffer_settings.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-    buffer_settings.memory_properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-    VK_CHECK(vbuffer_.init(context, gpu_iface, buffer_settings, reinterpret_cast<const uint8_t*>(vertices), sizeof(vertices)));
-
-    buffer_settings.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
-    VK_CHECK(ibuffer_.init(context, gpu_iface, buffer_settings, reinterpret_cast<const uint8_t*>(indices), sizeof(indices)));
-
     parts_[0].vbuffer_offset = 0;
     parts_[0].ibuffer_offset = 0;
     parts_[0].indices_count = array_size(indices);
     parts_[0].material = nullptr;
+    parts_[0].bounds.min = vec3(-1.0f, -1.0f, 1.0f);
+    parts_[0].bounds.max = vec3(3.0f, 3.0f, 1.0f);
+
+    // the fullscreen triangles are the only users of their pool
+    GeometryPool::Settings pool_settings;
+    pool_settings.vertex_size = FullscreenLayout::stride();
+    pool_settings.vertices_count = pool_settings.min_range_size;
+    pool_settings.indices_count = pool_settings.min_range_size;
+    return init_geometry(context, gpu_iface, context.geometry_pools.fullscreen_geometry_pool, pool_settings,
+        reinterpret_cast<const uint8_t*>(vertices), array_size(vertices),
+        reinterpret_cast<const uint8_t*>(indices), array_size(indices), VK_INDEX_TYPE_UINT16);
+}
 
-    return VK_SUCCESS;
+namespace {
+
+uint32_t pack_normal(const aiVector3D* normals, uint32_t index)
+{
+    if (normals == nullptr)
+        return pack_snorm_a2b10g10r10(0.0f, 0.0f, 1.0f, 0.0f);
+    const aiVector3D& n = normals[index];
+    return pack_snorm_a2b10g10r10(n.x, n.y, n.z, 0.0f);
 }
 
-VkResult Mesh::create(const char* filename, vk::VulkanContext& context, const vk::GPUInterface& gpu_iface)
+// w is the sign of the bitangent relative to cross(normal, tangent)
+uint32_t pack_tangent(const aiMesh* mesh, uint32_t index)
 {
-    Assimp::Importer importer;
-    const aiScene* assimp_scene = importer.ReadFile(filename, aiProcess_CalcTangentSpace | aiProcess_Triangulate |
-        aiProcess_GenNormals | aiProcess_GenUVCoords | aiProcess_TransformUVCoords);
-    VERIFY(assimp_scene, "Error occured during the scene parsing", VK_ERROR_INITIALIZATION_FAILED);
+    if (mesh->mTangents == nullptr)
+        return pack_snorm_a2b10g10r10(1.0f, 0.0f, 0.0f, 1.0f);
+    const aiVector3D& t = mesh->mTangents[index];
+    float w = 1.0f;
+    if (mesh->mNormals != nullptr && mesh->mBitangents != nullptr)
+    {
+        const aiVector3D& n = mesh->mNormals[index];
+        const aiVector3D& b = mesh->mBitangents[index];
+        const float cx = n.y * t.z - n.z * t.y;
+        const float cy = n.z * t.x - n.x * t.z;
+        const float cz = n.x * t.y - n.y * t.x;
+        w = cx * b.x + cy * b.y + cz * b.z < 0.0f ? -1.0f : 1.0f;
+    }
+    return pack_snorm_a2b10g10r10(t.x, t.y, t.z, w);
+}
 
-    std::vector<GeometryLayout::Vertex> vertices;
-    std::vector<uint16_t> indices;
-    parts_.resize(assimp_scene->mNumMeshes);
-    for (size_t i = 0, size = assimp_scene->mNumMeshes; i < size; ++i)
+void pack_texcoord(uint16_t* dst, const aiVector3D* texcoords, uint32_t index)
+{
+    dst[0] = float_to_half(texcoords != nullptr ? texcoords[index].x : 0.0f);
+    dst[1] = float_to_half(texcoords != nullptr ? texcoords[index].y : 0.0f);
+}
+
+void convert_vertex(GeometryLayout::Vertex& vertex, const aiMesh* mesh, uint32_t index, const PositionQuantization&)
+{
+    const aiVector3D& pos = mesh->mVertices[index];
+    vertex.pos = vec3(pos.x, pos.y, pos.z);
+    const aiVector3D* normals = mesh->mNormals;
+    vertex.nrm = normals != nullptr ? vec3(normals[index].x, normals[index].y, normals[index].z) : vec3();
+    const aiVector3D* tangents = mesh->mTangents;
+    vertex.tng = tangents != nullptr ? vec3(tangents[index].x, tangents[index].y, tangents[index].z) : vec3();
+    const aiVector3D* texcoords = mesh->mTextureCoords[0];
+    vertex.tex = texcoords != nullptr ? vec2(texcoords[index].x, texcoords[index].y) : vec2();
+}
+
+void convert_vertex(CompactGeometryLayout::Vertex& vertex, const aiMesh* mesh, uint32_t index, const PositionQuantization&)
+{
+    const aiVector3D& pos = mesh->mVertices[index];
+    vertex.pos = vec3(pos.x, pos.y, pos.z);
+    vertex.nrm = pack_normal(mesh->mNormals, index);
+    vertex.tng = pack_tangent(mesh, index);
+    pack_texcoord(vertex.tex, mesh->mTextureCoords[0], index);
+}
+
+void convert_vertex(QuantizedGeometryLayout::Vertex& vertex, const aiMesh* mesh, uint32_t index, const PositionQuantization& quantization)
+{
+    const aiVector3D& pos = mesh->mVertices[index];
+    const float inv_scale = 1.0f / quantization.scale;
+    vertex.pos[0] = quantize_unorm16((pos.x - quantization.offset[0]) * inv_scale);
+    vertex.pos[1] = quantize_unorm16((pos.y - quantization.offset[1]) * inv_scale);
+    vertex.pos[2] = quantize_unorm16((pos.z - quantization.offset[2]) * inv_scale);
+    vertex.pos[3] = 0;
+    vertex.nrm = pack_normal(mesh->mNormals, index);
+    vertex.tng = pack_tangent(mesh, index);
+    pack_texcoord(vertex.tex, mesh->mTextureCoords[0], index);
+}
+
+// cache behaviour of a part before and after the optimizations
+struct PartStatistics
+{
+    VertexCacheStatistics before;
+    VertexCacheStatistics after;
+};
+
+static_assert(max_mesh_lods == mesh_cache_max_lods, "The mesh cache must keep all the levels of detail");
+
+// the indices of all the levels of a part, the final offsets are known when all the parts are simplified
+struct PartIndices
+{
+    std::vector<uint32_t> indices;
+    // split the full detail, the indices are relative to the part
+    std::vector<Meshlet> meshlets;
+    // in the space of the stored vertices
+    Aabb bounds;
+    MeshCacheLod lods[max_mesh_lods];
+    float lod_errors[max_mesh_lods];
+    PartStatistics statistics;
+};
+
+// Writes the vertices of one aiMesh to their final place and produces the part relative indices of its levels
+// of detail. The triangles and the vertices are reordered according to the settings.
+template <class Vertex>
+void convert_mesh(const aiMesh* mesh, Vertex* vertices, const PositionQuantization& quantization,
+    const Mesh::ImportSettings& settings, uint32_t lods_count, PartIndices& part)
+{
+    const uint32_t vertices_count = mesh->mNumVertices;
+    const aiFace* faces = mesh->mFaces;
+    std::vector<uint32_t> indices(mesh->mNumFaces * 3);
+    for (uint32_t i = 0, size = mesh->mNumFaces; i < size; ++i)
     {
-        MeshPart& part = parts_[i];
-        part.vbuffer_offset = vertices.size();
-        part.ibuffer_offset = indices.size();
-        part.indices_count = assimp_scene->mMeshes[i]->mNumFaces * 3;
-        for (size_t j = 0, jsize = assimp_scene->mMeshes[i]->mNumFaces; j < jsize; ++j)
+        ASSERT(faces[i].mNumIndices == 3, "The mesh must be triangulated");
+        const unsigned int* face = faces[i].mIndices;
+        indices[i * 3 + 0] = face[0];
+        indices[i * 3 + 1] = face[1];
+        indices[i * 3 + 2] = face[2];
+    }
+
+    const size_t indices_count = indices.size();
+    uint32_t* indices_data = indices.empty() ? nullptr : &indices[0];
+    part.statistics.before = analyze_vertex_cache(indices_data, indices_count, vertices_count);
+    if (settings.optimize_vertex_cache && indices_count > 0)
+        optimize_vertex_cache(indices_data, indices_data, indices_count, vertices_count);
+    if (settings.optimize_overdraw && indices_count > 0)
+        optimize_overdraw(indices_data, indices_data, indices_count, &mesh->mVertices[0].x, sizeof(aiVector3D),
+            vertices_count, settings.overdraw_threshold);
+
+    const float inv_scale = 1.0f / quantization.scale;
+    if (vertices_count > 0)
+    {
+        vec3 min(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+        vec3 max(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+        for (uint32_t i = 0; i < vertices_count; ++i)
         {
-            ASSERT(assimp_scene->mMeshes[i]->mFaces[j].mNumIndices == 3, "The mesh must be triangulated");
-            indices.push_back(part.vbuffer_offset + assimp_scene->mMeshes[i]->mFaces[j].mIndices[0]);
-            indices.push_back(part.vbuffer_offset + assimp_scene->mMeshes[i]->mFaces[j].mIndices[1]);
-            indices.push_back(part.vbuffer_offset + assimp_scene->mMeshes[i]->mFaces[j].mIndices[2]);
+            const aiVector3D& pos = mesh->mVertices[i];
+            min = vec3(std::min(min.x, pos.x), std::min(min.y, pos.y), std::min(min.z, pos.z));
+            max = vec3(std::max(max.x, pos.x), std::max(max.y, pos.y), std::max(max.z, pos.z));
         }
+        part.bounds.min = vec3((min.x - quantization.offset[0]) * inv_scale, (min.y - quantization.offset[1]) * inv_scale,
+            (min.z - quantization.offset[2]) * inv_scale);
+        part.bounds.max = vec3((max.x - quantization.offset[0]) * inv_scale, (max.y - quantization.offset[1]) * inv_scale,
+            (max.z - quantization.offset[2]) * inv_scale);
+    }
 
-        for (size_t j = 0, jsize = assimp_scene->mMeshes[i]->mNumVertices; j < jsize; ++j)
+    // the clusters follow the final order of the triangles, the bounds are in the space of the stored vertices
+    if (settings.build_meshlets && indices_count > 0)
+    {
+        part.meshlets.resize(max_meshlets_count(indices_count, max_meshlet_vertices, max_meshlet_triangles));
+        part.meshlets.resize(build_meshlets(&part.meshlets[0], indices_data, indices_count, &mesh->mVertices[0].x,
+            sizeof(aiVector3D), vertices_count, max_meshlet_vertices, max_meshlet_triangles));
+        for (size_t i = 0, size = part.meshlets.size(); i < size; ++i)
         {
-            GeometryLayout::Vertex vertex;
+            Meshlet& meshlet = part.meshlets[i];
+            for (int j = 0; j < 3; ++j)
+                meshlet.center[j] = (meshlet.center[j] - quantization.offset[j]) * inv_scale;
+            meshlet.radius *= inv_scale;
+        }
+    }
 
-            const aiVector3D& pos = assimp_scene->mMeshes[i]->mVertices[j];
-            vertex.pos = vec3(pos.x, pos.y, pos.z);
-            const aiVector3D& nrm = assimp_scene->mMeshes[i]->mNormals[j];
-            vertex.nrm = vec3(nrm.x, nrm.y, nrm.z);
-            const aiVector3D& tex = assimp_scene->mMeshes[i]->mTextureCoords[0][j];
-            vertex.tex = vec2(tex.x, tex.y);
+    part.indices = indices;
+    part.lods[0].ibuffer_offset = 0;
+    part.lods[0].indices_count = static_cast<uint32_t>(indices_count);
+    part.lod_errors[0] = 0.0f;
 
-            vertices.push_back(vertex);
+    // every level is simplified from the full detail, so the errors don't accumulate
+    const float extent = indices_count > 0 ? position_extent(&mesh->mVertices[0].x, sizeof(aiVector3D), vertices_count) : 0.0f;
+    std::vector<uint32_t> lod_indices(indices_count);
+    float target_ratio = 1.0f;
+    for (uint32_t lod = 1; lod < lods_count; ++lod)
+    {
+        const MeshCacheLod& previous = part.lods[lod - 1];
+        target_ratio *= settings.lod_reduction;
+        size_t lod_indices_count = indices_count;
+        float error = 0.0f;
+        if (indices_count > 0)
+        {
+            const size_t target_indices_count = static_cast<size_t>(indices_count * target_ratio) / 3 * 3;
+            lod_indices_count = simplify(&lod_indices[0], indices_data, indices_count, &mesh->mVertices[0].x, sizeof(aiVector3D),
+                vertices_count, target_indices_count, settings.lod_max_error, &error);
         }
+        // the error limit is reached, the level repeats the previous one
+        if (lod_indices_count >= previous.indices_count)
+        {
+            part.lods[lod] = previous;
+            part.lod_errors[lod] = part.lod_errors[lod - 1];
+            continue;
+        }
+        if (settings.optimize_vertex_cache)
+            optimize_vertex_cache(&lod_indices[0], &lod_indices[0], lod_indices_count, vertices_count);
+        part.lods[lod].ibuffer_offset = static_cast<uint32_t>(part.indices.size());
+        part.lods[lod].indices_count = static_cast<uint32_t>(lod_indices_count);
+        part.lod_errors[lod] = std::max(part.lod_errors[lod - 1], error * extent);
+        part.indices.insert(part.indices.end(), lod_indices.begin(), lod_indices.begin() + lod_indices_count);
+    }
 
-        part.material = &context.default_material;
+    // the vertices are written right to their new places, the full detail uses all of them
+    std::vector<uint32_t> remap;
+    if (settings.optimize_vertex_fetch && indices_count > 0)
+    {
+        remap.resize(vertices_count);
+        optimize_vertex_fetch_remap(&remap[0], indices_data, indices_count, vertices_count);
+        remap_indices(&part.indices[0], part.indices.size(), &remap[0]);
     }
+    part.statistics.after = analyze_vertex_cache(part.indices.empty() ? nullptr : &part.indices[0], indices_count, vertices_count);
 
-    VK_CHECK(init_descriptor_set(context, gpu_iface));
-    VK_CHECK(init_buffers(context, gpu_iface, reinterpret_cast<const uint8_t*>(&vertices[0]), vertices.size() * sizeof(GeometryLayout::Vertex),
-        reinterpret_cast<const uint8_t*>(&indices[0]), indices.size() * sizeof(uint16_t)));
+    for (uint32_t i = 0; i < vertices_count; ++i)
+        convert_vertex(vertices[remap.empty() ? i : remap[i]], mesh, i, quantization);
+}
 
+// one task per aiMesh, the tasks write to disjoint ranges
+template <class Vertex>
+void convert_meshes(const aiScene* assimp_scene, const std::vector<MeshCachePart>& parts, uint8_t* vertices,
+    const PositionQuantization& quantization, const Mesh::ImportSettings& settings, uint32_t lods_count,
+    std::vector<PartIndices>& parts_indices, jobs::Scheduler* scheduler)
+{
+    auto convert = [&](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            Vertex* part_vertices = reinterpret_cast<Vertex*>(vertices) + parts[i].vbuffer_offset;
+            convert_mesh(assimp_scene->mMeshes[i], part_vertices, quantization, settings, lods_count, parts_indices[i]);
+        }
+    };
+    if (scheduler != nullptr)
+        scheduler->parallel_for(assimp_scene->mNumMeshes, 1, convert);
+    else
+        convert(0, assimp_scene->mNumMeshes);
+}
+
+template <class Index>
+void write_indices(Index* dst, const std::vector<uint32_t>& indices)
+{
+    for (size_t i = 0, size = indices.size(); i < size; ++i)
+        dst[i] = static_cast<Index>(indices[i]);
+}
+
+PositionQuantization scene_position_quantization(const aiScene* assimp_scene)
+{
+    float min[3] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+    float max[3] = { -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max() };
+    for (uint32_t i = 0; i < assimp_scene->mNumMeshes; ++i)
+    {
+        const aiMesh* mesh = assimp_scene->mMeshes[i];
+        for (uint32_t j = 0; j < mesh->mNumVertices; ++j)
+        {
+            const aiVector3D& pos = mesh->mVertices[j];
+            min[0] = std::min(min[0], pos.x);
+            min[1] = std::min(min[1], pos.y);
+            min[2] = std::min(min[2], pos.z);
+            max[0] = std::max(max[0], pos.x);
+            max[1] = std::max(max[1], pos.y);
+            max[2] = std::max(max[2], pos.z);
+        }
+    }
+    if (min[0] > max[0])
+        return PositionQuantization();
+    return compute_position_quantization(min, max);
+}
+
+}
+
+VkResult Mesh::create(const char* filename, vk::VulkanContext& context, const vk::GPUInterface& gpu_iface, jobs::Scheduler* scheduler,
+    const ImportSettings& settings)
+{
+    // the cooked mesh is next to the source asset, it's rebuilt when the asset or the import settings change
+    const VertexFormat vertex_format = settings.vertex_format;
+    const std::string cache_filename = std::string(filename) + ".mhemesh";
+    SourceFileInfo source;
+    get_source_file_info(source, filename);
+    const uint32_t stride = vertex_format_stride(vertex_format);
+
+    Timer timer;
+    MappedFile cache_file;
+    MeshCacheData data;
+    if (cache_file.open(cache_filename.c_str()) &&
+        read_mesh_cache(data, cache_file.data(), cache_file.size(), vertex_format, stride, settings.flags(), source))
+    {
+        const float map_time = timer.elapsed();
+        timer.start();
+        VK_VERIFY(create(data, context, gpu_iface));
+        printf("%s: map %.3f ms, upload %.3f ms\n", cache_filename.c_str(), map_time, timer.elapsed());
+        return VK_SUCCESS;
+    }
+    cache_file.close();
+
+    timer.start();
+    Assimp::Importer importer;
+    const aiScene* assimp_scene = importer.ReadFile(filename, aiProcess_CalcTangentSpace | aiProcess_Triangulate |
+        aiProcess_GenNormals | aiProcess_GenUVCoords | aiProcess_TransformUVCoords);
+    VERIFY(assimp_scene, "Error occured during the scene parsing", VK_ERROR_INITIALIZATION_FAILED);
+    const float parse_time = timer.elapsed();
+
+    // the vertex offsets of every part are known from the counts, so the vertices are sized once
+    // and the parts are converted independently
+    timer.start();
+    std::vector<MeshCachePart> parts(assimp_scene->mNumMeshes);
+    uint32_t vertices_count = 0;
+    uint32_t max_part_vertices_count = 0;
+    for (size_t i = 0, size = assimp_scene->mNumMeshes; i < size; ++i)
+    {
+        const aiMesh* assimp_mesh = assimp_scene->mMeshes[i];
+        parts[i].vbuffer_offset = vertices_count;
+        vertices_count += assimp_mesh->mNumVertices;
+        max_part_vertices_count = std::max(max_part_vertices_count, assimp_mesh->mNumVertices);
+    }
+    const uint32_t lods_count = std::max(std::min(settings.lods_count, max_mesh_lods), 1u);
+
+    // 16 bit indices halve the index fetch bandwidth, they're used when every part fits
+    const VkIndexType index_type = max_part_vertices_count <= std::numeric_limits<uint16_t>::max() + 1u ?
+        VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    PositionQuantization quantization;
+    if (vertex_format == vertex_format_quantized)
+        quantization = scene_position_quantization(assimp_scene);
+
+    std::vector<uint8_t> vertices(static_cast<size_t>(vertices_count) * stride);
+    std::vector<PartIndices> parts_indices(parts.size());
+    if (vertex_format == vertex_format_quantized)
+        convert_meshes<QuantizedGeometryLayout::Vertex>(assimp_scene, parts, &vertices[0], quantization, settings, lods_count,
+            parts_indices, scheduler);
+    else if (vertex_format == vertex_format_compact)
+        convert_meshes<CompactGeometryLayout::Vertex>(assimp_scene, parts, &vertices[0], quantization, settings, lods_count,
+            parts_indices, scheduler);
+    else
+        convert_meshes<GeometryLayout::Vertex>(assimp_scene, parts, &vertices[0], quantization, settings, lods_count,
+            parts_indices, scheduler);
+
+    // the levels of a part follow each other, a level of the mesh has the largest error of its parts
+    uint32_t indices_count = 0;
+    std::vector<Meshlet> meshlets;
+    PartStatistics total;
+    float lod_errors[max_mesh_lods] = {};
+    uint32_t lod_indices_counts[max_mesh_lods] = {};
+    for (size_t i = 0, size = parts.size(); i < size; ++i)
+    {
+        const PartIndices& part_indices = parts_indices[i];
+        MeshCachePart& part = parts[i];
+        part.ibuffer_offset = indices_count;
+        part.indices_count = part_indices.lods[0].indices_count;
+        part.first_meshlet = static_cast<uint32_t>(meshlets.size());
+        part.meshlets_count = static_cast<uint32_t>(part_indices.meshlets.size());
+        part.bounds_min[0] = part_indices.bounds.min.x;
+        part.bounds_min[1] = part_indices.bounds.min.y;
+        part.bounds_min[2] = part_indices.bounds.min.z;
+        part.bounds_max[0] = part_indices.bounds.max.x;
+        part.bounds_max[1] = part_indices.bounds.max.y;
+        part.bounds_max[2] = part_indices.bounds.max.z;
+        for (size_t j = 0, size = part_indices.meshlets.size(); j < size; ++j)
+        {
+            meshlets.push_back(part_indices.meshlets[j]);
+            meshlets.back().first_index += indices_count;
+        }
+        for (uint32_t lod = 0; lod < mesh_cache_max_lods; ++lod)
+        {
+            part.lods[lod] = part_indices.lods[lod < lods_count ? lod : 0];
+            part.lods[lod].ibuffer_offset += indices_count;
+        }
+        for (uint32_t lod = 0; lod < lods_count; ++lod)
+        {
+            lod_errors[lod] = std::max(lod_errors[lod], part_indices.lod_errors[lod]);
+            lod_indices_counts[lod] += part_indices.lods[lod].indices_count;
+        }
+        indices_count += static_cast<uint32_t>(part_indices.indices.size());
+        total.before += part_indices.statistics.before;
+        total.after += part_indices.statistics.after;
+    }
+    std::vector<uint8_t> indices(static_cast<size_t>(indices_count) * index_size(index_type));
+    for (size_t i = 0, size = parts.size(); i < size; ++i)
+    {
+        if (parts_indices[i].indices.empty())
+            continue;
+        uint8_t* dst = &indices[0] + parts[i].ibuffer_offset * index_size(index_type);
+        if (index_type == VK_INDEX_TYPE_UINT16)
+            write_indices(reinterpret_cast<uint16_t*>(dst), parts_indices[i].indices);
+        else
+            write_indices(reinterpret_cast<uint32_t*>(dst), parts_indices[i].indices);
+    }
+    const float convert_time = timer.elapsed();
+
+    printf("%s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", filename, total.before.acmr(), total.after.acmr(),
+        total.before.atvr(), total.after.atvr());
+    for (uint32_t lod = 0; lod < lods_count; ++lod)
+        printf("%s: LOD %u %u triangles, error %f\n", filename, lod, lod_indices_counts[lod] / 3, lod_errors[lod]);
+    printf("%s: %u meshlets\n", filename, static_cast<uint32_t>(meshlets.size()));
+
+    data.parts = &parts[0];
+    data.parts_count = static_cast<uint32_t>(parts.size());
+    data.vertices = &vertices[0];
+    data.vertices_count = vertices_count;
+    data.vertex_size = stride;
+    data.indices = &indices[0];
+    data.indices_count = indices_count;
+    data.index_size = index_size(index_type);
+    data.meshlets = meshlets.empty() ? nullptr : &meshlets[0];
+    data.meshlets_count = static_cast<uint32_t>(meshlets.size());
+    data.vertex_format = vertex_format;
+    data.import_flags = settings.flags();
+    for (int i = 0; i < 3; ++i)
+        data.position_offset[i] = quantization.offset[i];
+    data.position_scale = quantization.scale;
+    data.lods_count = lods_count;
+    for (uint32_t lod = 0; lod < max_mesh_lods; ++lod)
+        data.lod_errors[lod] = lod_errors[lod];
+
+    timer.start();
+    if (!write_mesh_cache(cache_filename.c_str(), data, source))
+        printf("Can't write the mesh cache %s\n", cache_filename.c_str());
+    const float cook_time = timer.elapsed();
+
+    timer.start();
+    VK_VERIFY(create(data, context, gpu_iface));
+    printf("%s: parse %.3f ms, convert %.3f ms, cook %.3f ms, upload %.3f ms\n", filename,
+        parse_time, convert_time, cook_time, timer.elapsed());
     return VK_SUCCESS;
 }
 
+VkResult Mesh::create(const MeshCacheData& data, vk::VulkanContext& context, const vk::GPUInterface& gpu_iface)
+{
+    VERIFY(data.vertex_format < vertex_formats_count, "Invalid vertex format", VK_ERROR_INITIALIZATION_FAILED);
+    vertex_format_ = static_cast<VertexFormat>(data.vertex_format);
+    position_offset_ = vec3(data.position_offset[0], data.position_offset[1], data.position_offset[2]);
+    position_scale_ = data.position_scale;
+    VERIFY(data.lods_count > 0 && data.lods_count <= max_mesh_lods, "Invalid levels of detail count", VK_ERROR_INITIALIZATION_FAILED);
+    lods_count_ = data.lods_count;
+    for (uint32_t lod = 0; lod < max_mesh_lods; ++lod)
+        lod_errors_[lod] = data.lod_errors[lod];
+
+    parts_.resize(data.parts_count);
+    for (uint32_t i = 0; i < data.parts_count; ++i)
+    {
+        parts_[i].vbuffer_offset = data.parts[i].vbuffer_offset;
+        parts_[i].ibuffer_offset = data.parts[i].ibuffer_offset;
+        parts_[i].indices_count = data.parts[i].indices_count;
+        parts_[i].material = &context.default_material;
+        for (uint32_t lod = 0; lod < max_mesh_lods; ++lod)
+        {
+            parts_[i].lods[lod].ibuffer_offset = data.parts[i].lods[lod].ibuffer_offset;
+            parts_[i].lods[lod].indices_count = data.parts[i].lods[lod].indices_count;
+        }
+        parts_[i].first_meshlet = data.parts[i].first_meshlet;
+        parts_[i].meshlets_count = data.parts[i].meshlets_count;
+        parts_[i].bounds.min = vec3(data.parts[i].bounds_min[0], data.parts[i].bounds_min[1], data.parts[i].bounds_min[2]);
+        parts_[i].bounds.max = vec3(data.parts[i].bounds_max[0], data.parts[i].bounds_max[1], data.parts[i].bounds_max[2]);
+        VERIFY(static_cast<uint64_t>(parts_[i].first_meshlet) + parts_[i].meshlets_count <= data.meshlets_count,
+            "Invalid meshlets range", VK_ERROR_INITIALIZATION_FAILED);
+    }
+    meshlets_.assign(data.meshlets, data.meshlets + data.meshlets_count);
+
+    VK_CHECK(init_descriptor_set(context, gpu_iface));
+    // the staging ring copies the data, it may point into a mapped file
+    return init_geometry(context, gpu_iface, context.geometry_pools.pool(vertex_format_), geometry_pool_settings(vertex_format_),
+        data.vertices, data.vertices_count, data.indices, data.indices_count, data.index_size == sizeof(uint32_t) ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16);
+}
+
 void Mesh::destroy(vk::VulkanContext& context)
 {
     uniform_.destroy(context);
     if (descriptor_set_ != VK_NULL_HANDLE)
         VK_CHECK(vkFreeDescriptorSets(*context.main_device, context.descriptor_pools.main_descriptor_pool, 1, &descriptor_set_));
-    ibuffer_.destroy(context);
-    vbuffer_.destroy(context);
+    if (geometry_pool_ != nullptr)
+        geometry_pool_->free(geometry_);
 }
 
 std::string shaders_path()
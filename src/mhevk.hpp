@@ -12,12 +12,20 @@
 #include <vulkan/vk_sdk_platform.h>
 
 #include <vector>
+#include <set>
+#include <unordered_map>
 #include <limits>
 #include <string>
 #include <cstdio>
 #include <cassert>
 #include <cmath>
 #include <cstring>
+#include <chrono>
+#include <algorithm>
+
+#include "mhemath.hpp"
+#include "meshopt.hpp"
+#include "culling.hpp"
 
 #ifdef _DEBUG
 #define VERIFY_PRINT(text) {printf("%s %d %s\n", __FUNCTION__, __LINE__, text); assert(0);}
@@ -43,409 +51,133 @@ constexpr uint32_t array_size(T(&)[N])
 
 namespace mhe {
 
-const float pi = 3.14f;
+struct MeshCacheData;
 
-template <class T>
-T deg_to_rad(T d)
-{
-    return d * (T)180 / (T)pi;
+namespace jobs {
+class Scheduler;
 }
 
-template <class T>
-class vector2
-{
-public:
-    T x;
-    T y;
-
-    vector2() : x(0), y(0) {}
-    vector2(T newx, T newy) : x(newx), y(newy) {}
-};
-
-template <class T>
-class vector3
-{
-public:
-    T x;
-    T y;
-    T z;
-
-    vector3() : x(0), y(0), z(0) {}
-    vector3(T newx, T newy, T newz) : x(newx), y(newy), z(newz) {}
-
-    void normalize()
-    {
-        T m = magnitude();
-        x /= m;
-        y /= m;
-        z /= m;
-    }
-
-    T magnitude() const
-    {
-        return sqrt(x * x + y * y + z * z);
-    }
-
-    vector3 operator- (const vector3& other) const
-    {
-        return vector3(x - other.x, y - other.y, z - other.z);
-    }
-
-    static vector3 up()
-    {
-        static vector3 v(0, 1, 0);
-        return v;
-    }
-};
-
-template <class T>
-T dot(const vector3<T>& v1, const vector3<T>& v2)
+inline bool read_entire_file(std::vector<uint8_t>& data, const char* filename, const char* mode)
 {
-    return v1.x * v2.x + v1.y * v2.y + v1.z * v2.z;
-}
+    FILE* f = fopen(filename, mode);
+    if (!f)
+        return false;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
 
-template <class T>
-vector3<T> cross(const vector3<T>& v1, const vector3<T>& v2)
-{
-    return vector3<T>(v1.y * v2.z - v2.y * v1.z,
-        v2.x * v1.z - v1.x * v2.z,
-        v1.x * v2.y - v2.x * v1.y);
+    data.resize(size);
+    size_t res = fread(&data[0], 1, size, f);
+    fclose(f);
+    return res == size;
 }
 
-template <class T>
-vector3<T> operator- (const vector3<T>& v)
+inline bool read_entire_file(std::vector<uint8_t>& data, const std::string& filename, const char* mode)
 {
-    return vector3<T>(-v.x, -v.y, -v.z);
+    return read_entire_file(data, filename.c_str(), mode);
 }
 
-template <class T>
-class vector4
+class Timer
 {
 public:
-    union
+    Timer()
     {
-        struct
-        {
-            T x, y, z, w;
-        };
-
-        struct
-        {
-            T c[4];
-        };
-    };
-
-    vector4() : x(0), y(0), z(0), w(0) {}
-    vector4(T newx, T newy, T newz, T neww) : x(newx), y(newy), z(newz), w(neww) {}
+        start();
+    }
 
-    void set(T newx, T newy, T newz, T neww)
+    void start()
     {
-        x = newx;
-        y = newy;
-        z = newz;
-        w = neww;
+        start_ = std::chrono::high_resolution_clock::now();
     }
 
-    static vector4 zero()
+    // milliseconds since the last start()
+    float elapsed() const
     {
-        static vector4 v;
-        return v;
+        return std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start_).count();
     }
+private:
+    std::chrono::high_resolution_clock::time_point start_;
 };
 
-template <class T>
-T dot(const vector4<T>& v1, const vector4<T>& v2)
+inline uint64_t align_up(uint64_t value, uint64_t alignment)
 {
-    return v1.x * v2.x + v1.y * v2.y + v1.z * v2.z + v1.w * v2.w;
+    return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
 }
 
-template <class T>
-class matrix4x4
+inline uint64_t next_pow2(uint64_t value)
 {
-public:
-    matrix4x4()
-    {
-        load_identity();
-    }
-
-    void load_identity()
-    {
-        set(1, 0, 0, 0,
-            0, 1, 0, 0,
-            0, 0, 1, 0,
-            0, 0, 0, 1);
-    }
-
-    void set(T a00, T a01, T a02, T a03,
-        T a10, T a11, T a12, T a13,
-        T a20, T a21, T a22, T a23,
-        T a30, T a31, T a32, T a33)
-    {
-        m_[0][0] = a00; m_[0][1] = a01; m_[0][2] = a02, m_[0][3] = a03;
-        m_[1][0] = a10; m_[1][1] = a11; m_[1][2] = a12, m_[1][3] = a13;
-        m_[2][0] = a20; m_[2][1] = a21; m_[2][2] = a22, m_[2][3] = a23;
-        m_[3][0] = a30; m_[3][1] = a31; m_[3][2] = a32, m_[3][3] = a33;
-    }
-
-    void set(const T* data)
-    {
-        memcpy(&m_, data, 16 * sizeof(T));
-    }
+    uint64_t res = 1;
+    while (res < value)
+        res <<= 1;
+    return res;
+}
 
-    T* data()
-    {
-        return reinterpret_cast<T*>(m_);
-    }
+// Offset-only buddy allocator. Every node is aligned to its own size, so an alignment request
+// is satisfied by rounding the allocation size up to it.
+class BuddyAllocator
+{
+public:
+    static const uint64_t invalid_offset = ~0ULL;
 
-    const T* data() const
-    {
-        return reinterpret_cast<const T*>(m_);
-    }
+    BuddyAllocator() :
+        size_(0), min_size_(0), used_(0), requested_(0)
+    {}
 
-    T operator() (size_t i, size_t j) const
-    {
-        ASSERT(i < 4 && j < 4, "Invalid index");
-        return m_[i][j];
-    }
+    void init(uint64_t size, uint64_t min_size);
 
-    matrix4x4& operator= (const matrix4x4& other)
-    {
-        if (this == &other)
-            return *this;
-        memcpy(m_, other.data(), sizeof(T) * 16);
-        return *this;
-    }
+    uint64_t allocate(uint64_t size, uint64_t alignment);
+    void free(uint64_t offset);
 
-    matrix4x4 operator* (const matrix4x4& other) const
+    uint64_t size() const
     {
-#define MUL(i, j) (m_[i][0] * other(0, j) + m_[i][1] * other(1, j) + m_[i][2] * other(2, j) + m_[i][3] * other(3, j))
-        matrix4x4 res;
-        res.set(MUL(0, 0), MUL(0, 1), MUL(0, 2), MUL(0, 3),
-            MUL(1, 0), MUL(1, 1), MUL(1, 2), MUL(1, 3),
-            MUL(2, 0), MUL(2, 1), MUL(2, 2), MUL(2, 3),
-            MUL(3, 0), MUL(3, 1), MUL(3, 2), MUL(3, 3));
-        return res;
+        return size_;
     }
 
-    matrix4x4& operator*= (T v)
+    // bytes taken by the allocated nodes
+    uint64_t used() const
     {
-        for (int i = 0; i < 4; ++i)
-        {
-            for (int j = 0; j < 4; ++j)
-                m_[i][j] *= v;
-        }
-        return *this;
-    }
-
-    vector4<T> row(size_t index) const
-    {
-        ASSERT(index < 4, "Invalid index");
-        return vector4<T>(m_[index][0], m_[index][1], m_[index][2], m_[index][3]);
-    }
-
-    void transpose()
-    {
-        T t = m_[0][1];
-        m_[0][1] = m_[1][0];
-        m_[1][0] = t;
-
-        t = m_[0][2];
-        m_[0][2] = m_[2][0];
-        m_[2][0] = t;
-
-        t = m_[0][3];
-        m_[0][3] = m_[3][0];
-        m_[3][0] = t;
-
-        t = m_[1][2];
-        m_[1][2] = m_[2][1];
-        m_[2][1] = t;
-
-        t = m_[1][3];
-        m_[1][3] = m_[3][1];
-        m_[3][1] = t;
-
-        t = m_[2][3];
-        m_[2][3] = m_[3][2];
-        m_[3][2] = t;
-    }
-
-    matrix4x4 transposed() const
-    {
-        matrix4x4 res = *this;
-        res.transpose();
-        return res;
-    }
-
-    void invert()
-    {
-        T res[4][4];
-        T m2233 = m_[2][2] * m_[3][3] - m_[2][3] * m_[3][2];
-        T m2133 = m_[2][1] * m_[3][3] - m_[2][3] * m_[3][1];
-        T m2132 = m_[2][1] * m_[3][2] - m_[2][2] * m_[3][1];
-        T m1033 = m_[1][0] * m_[3][3] - m_[1][3] * m_[3][0];
-        T m1032 = m_[1][0] * m_[3][2] - m_[1][2] * m_[3][0];
-        T m2032 = m_[2][0] * m_[3][2] - m_[2][2] * m_[3][0];
-        T m2031 = m_[2][0] * m_[3][1] - m_[2][1] * m_[3][0];
-        T m2033 = m_[2][0] * m_[3][3] - m_[2][3] * m_[3][0];
-        T m1233 = m_[1][2] * m_[3][3] - m_[1][3] * m_[3][2];
-        T m1133 = m_[1][1] * m_[3][3] - m_[1][3] * m_[3][1];
-        T m1132 = m_[1][1] * m_[3][2] - m_[1][2] * m_[3][1];
-        T m1031 = m_[1][0] * m_[3][1] - m_[1][1] * m_[3][0];
-        T m1223 = m_[1][2] * m_[2][3] - m_[1][3] * m_[2][2];
-        T m1123 = m_[1][1] * m_[2][3] - m_[1][3] * m_[2][1];
-        T m1122 = m_[1][1] * m_[2][2] - m_[1][2] * m_[2][1];
-        T m1023 = m_[1][0] * m_[2][3] - m_[1][3] * m_[2][0];
-        T m1022 = m_[1][0] * m_[2][2] - m_[1][2] * m_[2][0];
-        T m1021 = m_[1][0] * m_[2][1] - m_[1][1] * m_[2][0];
-
-        res[0][0] = m_[1][1] * m2233 - m_[1][2] * m2133 + m_[1][3] * m2132;
-        res[1][0] = -(m_[1][0] * m2233 - m_[1][2] * m2033 + m_[1][3] * m2032);
-        res[2][0] = m_[1][0] * m2133 - m_[1][1] * m2033 + m_[1][3] * m2031;
-        res[3][0] = -(m_[1][0] * m2132 - m_[1][1] * m2032 + m_[1][2] * m2031);
-        res[0][1] = -(m_[0][1] * m2233 - m_[0][2] * m2133 + m_[0][3] * m2132);
-        res[1][1] = m_[0][0] * m2233 - m_[0][2] * m2033 + m_[0][3] * m2032;
-        res[2][1] = -(m_[0][0] * m2133 - m_[0][1] * m2033 + m_[0][3] * m2031);
-        res[3][1] = m_[0][0] * m2132 - m_[0][1] * m2032 + m_[0][2] * m2031;
-        res[0][2] = m_[0][1] * m1233 - m_[0][2] * m1133 + m_[0][3] * m1132;
-        res[1][2] = -(m_[0][0] * m1233 - m_[0][2] * m1033 + m_[0][3] * m1032);
-        res[2][2] = m_[0][0] * m1133 - m_[0][1] * m1033 + m_[0][3] * m1031;
-        res[3][2] = -(m_[0][0] * m1132 - m_[0][1] * m1032 + m_[0][2] * m1031);
-        res[0][3] = -(m_[0][1] * m1223 - m_[0][2] * m1123 + m_[0][3] * m1122);
-        res[1][3] = m_[0][0] * m1223 - m_[0][2] * m1023 + m_[0][3] * m1022;
-        res[2][3] = -(m_[0][0] * m1123 - m_[0][1] * m1023 + m_[0][3] * m1021);
-        res[3][3] = m_[0][0] * m1122 - m_[0][1] * m1022 + m_[0][2] * m1021;
-
-        T det = m_[0][0] * res[0][0] + m_[0][1] * res[1][0] + m_[0][2] * res[2][0] + m_[0][3] * res[3][0];
-        if (det == 0)
-        {
-            assert(0);
-            load_identity();
-            return;
-        }
-        float inv_det = 1.0f / det;
-        set(reinterpret_cast<const T*>(res));
-        *this *= inv_det;
+        return used_;
     }
 
-    static matrix4x4& identity()
+    // bytes actually requested by the clients, used - requested is the internal fragmentation
+    uint64_t requested() const
     {
-        static matrix4x4 m;
-        return m;
+        return requested_;
     }
 
-    static matrix4x4 scaling(T s)
+    uint32_t allocations_count() const
     {
-        static matrix4x4 m;
-        m.set(s, 0, 0, 0,
-            0, s, 0, 0,
-            0, 0, s, 0,
-            0, 0, 0, 1);
-        return m;
+        return static_cast<uint32_t>(allocated_.size());
     }
 
-    static matrix4x4 translation(const vector3<T>& v)
+    bool empty() const
     {
-        static matrix4x4 m;
-        m.set(0, 0, 0, 0,
-            0, 0, 0, 0,
-            0, 0, 0, 0,
-            v.x, v.y, v.z, 1);
-        return m;
+        return allocated_.empty();
     }
 
-    static matrix4x4 rotation_around_y(T angle)
+    uint64_t largest_free() const;
+private:
+    struct AllocatedNode
     {
-        T s = sin(angle);
-        T c = cos(angle);
-
-        static matrix4x4 m;
-        m.set(c, 0, s, 0,
-            0, 1, 0, 0,
-            -s, 0, c, 0,
-            0, 0, 0, 1);
-        return m;
-    }
+        uint32_t order;
+        uint64_t requested;
+    };
 
-    static matrix4x4 look_at(const vector3<T>& pos, const vector3<T>& dir, const vector3<T>& up)
-    {
-        static matrix4x4 m;
-        vector3<T> f = dir - pos;
-        f.normalize();
-        vector3<T> s = cross(f, up);
-        s.normalize();
-        vector3<T> u = cross(s, f);
-        u.normalize();
-        m.set(s.x, -u.x, f.x, 0,
-            s.y, -u.y, f.y, 0,
-            s.z, -u.z, f.z, 0,
-            -dot(pos, s), -dot(pos, u), -dot(pos, f), 1);
-        return m;
-    }
+    uint32_t order_for(uint64_t size) const;
 
-    static matrix4x4 frustum(T l, T r, T t, T b, T n, T f)
+    uint64_t node_size(uint32_t order) const
     {
-        static matrix4x4 m;
-        // suppose that we have depth mapped to [0..1] interval
-        m.set((T)2 / (r - l), 0, 0, 0,
-            0, (T)2 / (t - b), 0, 0,
-            -(r + l) / (r - l), -(t + b) / (t - b), -f / (n - f), 1,
-            0, 0, n * f / (n - f), 0);
-        return m;
+        return min_size_ << order;
     }
 
-    static matrix4x4 perspective(T fov, T aspect, T znear, T zfar)
-    {
-        T fov_tan = (T)tan(fov * 0.5f);
-        T right = fov_tan * aspect * znear;
-        T left = -right;
-        T top = fov_tan * znear;
-        T bottom = -top;
-        return frustum(left, right, top, bottom, znear, zfar);
-    }
-private:
-    T m_[4][4];
+    uint64_t size_;
+    uint64_t min_size_;
+    uint64_t used_;
+    uint64_t requested_;
+    std::vector<std::set<uint64_t>> free_lists_;
+    std::unordered_map<uint64_t, AllocatedNode> allocated_;
 };
 
-template <class T>
-matrix4x4<T> transpose(const matrix4x4<T>& m)
-{
-    return m.transposed();
-}
-
-template <class T>
-matrix4x4<T> inverse(const matrix4x4<T>& m)
-{
-    matrix4x4<T> copy = m;
-    copy.invert();
-    return copy;
-}
-
-typedef vector2<float> vec2;
-typedef vector3<float> vec3;
-typedef vector4<float> vec4;
-typedef matrix4x4<float> mat4x4;
-
-inline bool read_entire_file(std::vector<uint8_t>& data, const char* filename, const char* mode)
-{
-    FILE* f = fopen(filename, mode);
-    if (!f)
-        return false;
-    fseek(f, 0, SEEK_END);
-    long size = ftell(f);
-    fseek(f, 0, SEEK_SET);
-
-    data.resize(size);
-    size_t res = fread(&data[0], 1, size, f);
-    fclose(f);
-    return res == size;
-}
-
-inline bool read_entire_file(std::vector<uint8_t>& data, const std::string& filename, const char* mode)
-{
-    return read_entire_file(data, filename.c_str(), mode);
-}
-
 namespace vk {
 
 struct VulkanContext;
@@ -453,6 +185,12 @@ class Swapchain;
 class CommandBuffer;
 class Device;
 class Mesh;
+class GeometryPool;
+class IndirectDrawBuffer;
+class MeshletDrawBuffer;
+class CulledDrawBuffer;
+class DepthPyramid;
+class FrameContext;
 
 #ifdef _WIN32
 struct PlatformData
@@ -473,11 +211,30 @@ const VkResult VK_MHE_ERROR_DATA_PROCESSING = static_cast<VkResult>(-20000001);
 const VkFlags vk_all_color_components = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
 
 static const uint32_t max_attachments = 4;
+// the full detail geometry and the simplified levels
+static const uint32_t max_mesh_lods = 4;
 
 const uint32_t invalid_index = std::numeric_limits<uint32_t>::max();
 
 uint32_t get_memory_type_index(const VkMemoryRequirements& requirements, VkFlags properties, const VkPhysicalDeviceMemoryProperties& memory_properties);
 
+// vertex layouts of the meshes, the same attribute locations in all of them
+enum VertexFormat
+{
+    // GeometryLayout, fp32 everywhere
+    vertex_format_float,
+    // CompactGeometryLayout, fp32 positions, 10 bit normals and tangents, half float uvs
+    vertex_format_compact,
+    // QuantizedGeometryLayout, CompactGeometryLayout with 16 bit positions dequantized by the world matrix
+    vertex_format_quantized,
+    vertex_formats_count
+};
+
+inline uint32_t index_size(VkIndexType index_type)
+{
+    return index_type == VK_INDEX_TYPE_UINT32 ? sizeof(uint32_t) : sizeof(uint16_t);
+}
+
 struct GPUInterface
 {
     Device* device;
@@ -676,7 +433,9 @@ public:
     PhysicalDevice() :
         id_(VK_NULL_HANDLE),
         graphics_queue_family_index_(invalid_index),
-        present_queue_family_index_(invalid_index)
+        present_queue_family_index_(invalid_index),
+        compute_queue_family_index_(invalid_index),
+        transfer_queue_family_index_(invalid_index)
     {}
 
     VkResult init(VulkanContext& context, VkPhysicalDevice id);
@@ -697,6 +456,17 @@ public:
         return graphics_queue_family_index_;
     }
 
+    uint32_t compute_queue_family_index() const
+    {
+        return compute_queue_family_index_;
+    }
+
+    // invalid_index when the device doesn't expose a transfer-only queue family
+    uint32_t transfer_queue_family_index() const
+    {
+        return transfer_queue_family_index_;
+    }
+
     const std::vector<VkPresentModeKHR>& present_modes() const
     {
         return present_modes_;
@@ -714,6 +484,21 @@ public:
 
     uint32_t get_memory_type_index(const VkMemoryRequirements& memory_requirements, VkMemoryPropertyFlags flags) const;
 
+    const VkPhysicalDeviceProperties& properties() const
+    {
+        return properties_;
+    }
+
+    const VkPhysicalDeviceMemoryProperties& memory_properties() const
+    {
+        return memory_properties_;
+    }
+
+    const VkPhysicalDeviceFeatures& features() const
+    {
+        return features_;
+    }
+
     const std::vector<const char*>& enabled_debug_layers() const
     {
         return enabled_device_debug_layers_extensions_;
@@ -724,10 +509,13 @@ private:
     VkPhysicalDevice id_;
     VkPhysicalDeviceProperties properties_;
     VkPhysicalDeviceMemoryProperties memory_properties_;
+    VkPhysicalDeviceFeatures features_;
     std::vector<VkQueueFamilyProperties> queue_properties_;
     std::vector<const char*> enabled_device_debug_layers_extensions_;
     uint32_t graphics_queue_family_index_;
     uint32_t present_queue_family_index_;
+    uint32_t compute_queue_family_index_;
+    uint32_t transfer_queue_family_index_;
     std::vector<VkPresentModeKHR> present_modes_;
     VkSurfaceCapabilitiesKHR surface_capabilities_;
     std::vector<VkSurfaceFormatKHR> surface_formats_;
@@ -746,18 +534,19 @@ public:
 
     VkResult submit(const CommandBuffer* command_buffers, uint32_t count,
         const VkSemaphore* wait_semaphores = nullptr, uint32_t wait_semaphores_count = 0,
-        const VkSemaphore* signal_semaphores = nullptr, uint32_t signal_semaphores_count = 0);
-    VkResult present(const Swapchain* swapchain);
+        const VkSemaphore* signal_semaphores = nullptr, uint32_t signal_semaphores_count = 0,
+        VkFence fence = VK_NULL_HANDLE, VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+    // waits for the frame's swapchain image, signals the frame's render semaphore and fence
+    VkResult submit(const FrameContext& frame, const CommandBuffer* command_buffers, uint32_t count);
+    // also waits for wait_semaphore at wait_stage, e.g. for the frame's compute_finished_semaphore() at the indirect draws,
+    // and signals signal_semaphore, the null handles are skipped
+    VkResult submit(const FrameContext& frame, const CommandBuffer* command_buffers, uint32_t count,
+        VkSemaphore wait_semaphore, VkPipelineStageFlags wait_stage, VkSemaphore signal_semaphore = VK_NULL_HANDLE);
+    VkResult present(const Swapchain* swapchain, VkSemaphore wait_semaphore);
+    VkResult present(const Swapchain* swapchain, const FrameContext& frame);
     VkResult wait_idle();
-
-    VkSemaphore present_semaphore() const
-    {
-        return present_semaphore_;
-    }
 private:
     VkQueue id_;
-    VkSemaphore present_semaphore_;
-    VkFence submit_fence_;
     GPUInterface gpu_iface_;
 };
 
@@ -765,7 +554,10 @@ class Device
 {
 public:
     Device() :
-        id_(VK_NULL_HANDLE)
+        id_(VK_NULL_HANDLE),
+        has_transfer_queue_(false),
+        has_compute_queue_(false),
+        enabled_features_()
     {}
 
     VkResult init(VulkanContext& context, PhysicalDevice* physical_device);
@@ -792,13 +584,171 @@ public:
     {
         return graphics_queue_;
     }
+
+    bool has_transfer_queue() const
+    {
+        return has_transfer_queue_;
+    }
+
+    // falls back to the graphics queue on devices with a single queue family
+    Queue& transfer_queue()
+    {
+        return has_transfer_queue_ ? transfer_queue_ : graphics_queue_;
+    }
+
+    uint32_t transfer_queue_family_index() const
+    {
+        return has_transfer_queue_ ? physical_device_->transfer_queue_family_index() : physical_device_->graphics_queue_family_index();
+    }
+
+    // a compute family without graphics, its work may overlap the rendering
+    bool has_compute_queue() const
+    {
+        return has_compute_queue_;
+    }
+
+    // falls back to the graphics queue, which always supports compute
+    Queue& compute_queue()
+    {
+        return has_compute_queue_ ? compute_queue_ : graphics_queue_;
+    }
+
+    uint32_t compute_queue_family_index() const
+    {
+        return has_compute_queue_ ? physical_device_->compute_queue_family_index() : physical_device_->graphics_queue_family_index();
+    }
+
+    // subset of the physical device features the device has been created with
+    const VkPhysicalDeviceFeatures& enabled_features() const
+    {
+        return enabled_features_;
+    }
 private:
     PhysicalDevice* physical_device_;
     VkDevice id_;
     Queue graphics_queue_;
+    Queue transfer_queue_;
+    Queue compute_queue_;
+    bool has_transfer_queue_;
+    bool has_compute_queue_;
+    VkPhysicalDeviceFeatures enabled_features_;
     std::vector<const char*> device_enabled_extensions_;
 };
 
+struct MemoryAllocation
+{
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    uint8_t* mapped;
+    uint32_t pool;
+    uint32_t block;
+
+    MemoryAllocation() :
+        memory(VK_NULL_HANDLE), offset(0), size(0), mapped(nullptr),
+        pool(invalid_index), block(invalid_index)
+    {}
+};
+
+struct MemoryStats
+{
+    uint32_t blocks_count;
+    uint32_t dedicated_blocks_count;
+    uint32_t allocations_count;
+    VkDeviceSize allocated_bytes;
+    VkDeviceSize used_bytes;
+    VkDeviceSize requested_bytes;
+    VkDeviceSize largest_free_range;
+    // 0 - all free memory is one range, 1 - free memory is scattered over tiny ranges
+    float fragmentation;
+};
+
+// Sub-allocates resources out of large VkDeviceMemory blocks.
+// Long-lived resources go to buddy-managed blocks, transient ones (staging copies) to linear pages
+// that are reset once all their allocations are freed. Linear and optimal resources never share
+// a block, so bufferImageGranularity can't be violated.
+class MemoryAllocator
+{
+public:
+    enum Usage
+    {
+        usage_persistent = 0,
+        usage_transient = 1
+    };
+
+    enum ResourceType
+    {
+        resource_linear = 0,
+        resource_optimal = 1
+    };
+
+    struct Settings
+    {
+        VkDeviceSize block_size;
+        VkDeviceSize transient_page_size;
+        VkDeviceSize min_allocation_size;
+
+        Settings() :
+            block_size(64 * 1024 * 1024),
+            transient_page_size(16 * 1024 * 1024),
+            min_allocation_size(256)
+        {}
+    };
+
+    VkResult init(VulkanContext& context, const GPUInterface& gpu_iface, const Settings& settings);
+    void destroy(VulkanContext& context);
+
+    VkResult allocate(VulkanContext& context, const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties,
+        ResourceType resource_type, Usage usage, MemoryAllocation& allocation);
+    void free(VulkanContext& context, MemoryAllocation& allocation);
+
+    // makes host writes visible to the device, does nothing for coherent memory
+    VkResult flush(const MemoryAllocation& allocation, VkDeviceSize offset, VkDeviceSize size);
+
+    void stats(MemoryStats& stats) const;
+    void print_stats() const;
+private:
+    struct Block
+    {
+        VkDeviceMemory memory;
+        uint8_t* mapped;
+        VkDeviceSize size;
+        BuddyAllocator buddy;
+        VkDeviceSize linear_head;
+        uint32_t linear_allocations;
+        bool dedicated;
+    };
+
+    struct Pool
+    {
+        std::vector<Block> blocks;
+    };
+
+    static uint32_t pool_index(uint32_t memory_type_index, ResourceType resource_type, Usage usage)
+    {
+        return memory_type_index * 4 + usage * 2 + resource_type;
+    }
+
+    static uint32_t pool_memory_type(uint32_t pool)
+    {
+        return pool / 4;
+    }
+
+    static Usage pool_usage(uint32_t pool)
+    {
+        return static_cast<Usage>((pool / 2) & 1);
+    }
+
+    VkResult create_block(VulkanContext& context, uint32_t pool, VkDeviceSize size, bool dedicated, uint32_t& block_index);
+    void destroy_block(VulkanContext& context, Block& block);
+    bool allocate_from_block(Block& block, Usage usage, const VkMemoryRequirements& requirements, VkDeviceSize& offset);
+
+    GPUInterface gpu_iface_;
+    Settings settings_;
+    std::vector<Pool> pools_;
+    uint32_t device_allocations_count_;
+};
+
 struct ImageData
 {
     uint32_t width;
@@ -826,19 +776,24 @@ public:
         VkFormat format;
         VkImageUsageFlags usage;
         VkImageAspectFlags aspect_mask;
+        uint32_t* queue_family_indices;
+        uint32_t queue_family_indices_count;
+        VkSharingMode sharing_mode;
 
         Settings() :
             depth(1),
             mip_levels(1), array_layers(1), format(VK_FORMAT_R8G8B8A8_UNORM),
             usage(VK_IMAGE_USAGE_SAMPLED_BIT),
-            aspect_mask(VK_IMAGE_ASPECT_COLOR_BIT)
+            aspect_mask(VK_IMAGE_ASPECT_COLOR_BIT),
+            queue_family_indices(nullptr),
+            queue_family_indices_count(0),
+            sharing_mode(VK_SHARING_MODE_EXCLUSIVE)
         {}
     };
 
     ImageView() :
         image_(VK_NULL_HANDLE),
-        imageview_(VK_NULL_HANDLE),
-        memory_(VK_NULL_HANDLE)
+        imageview_(VK_NULL_HANDLE)
     {}
 
     VkResult init(VulkanContext& context, const GPUInterface& gpu_iface, const Settings& settings, VkImage image, const uint8_t* data, uint32_t size);
@@ -863,10 +818,20 @@ public:
     {
         return settings_.format;
     }
+
+    uint32_t width() const
+    {
+        return settings_.width;
+    }
+
+    uint32_t height() const
+    {
+        return settings_.height;
+    }
 private:
     VkImage image_;
     VkImageView imageview_;
-    VkDeviceMemory memory_;
+    MemoryAllocation allocation_;
     Settings settings_;
     GPUInterface gpu_iface_;
 };
@@ -891,8 +856,7 @@ public:
     };
 
     Buffer() :
-        buffer_(VK_NULL_HANDLE),
-        memory_(VK_NULL_HANDLE)
+        buffer_(VK_NULL_HANDLE)
     {}
 
     VkResult init(VulkanContext& context, const GPUInterface& gpu_iface, const Settings& settings, const uint8_t* data, uint32_t size);
@@ -908,10 +872,16 @@ public:
     {
         return buffer_;
     }
+
+    // valid for the host visible buffers only
+    uint8_t* mapped() const
+    {
+        return allocation_.mapped;
+    }
 private:
     VkBuffer buffer_;
     VkDescriptorBufferInfo desc_buffer_info_;
-    VkDeviceMemory memory_;
+    MemoryAllocation allocation_;
     GPUInterface gpu_iface_;
     Settings settings_;
 };
@@ -925,6 +895,15 @@ public:
         {
             VkFormat format;
             VkImageLayout layout;
+            // VK_ATTACHMENT_LOAD_OP_LOAD keeps the contents of a previous pass, e.g. of the depth pre-pass
+            VkAttachmentLoadOp load_op;
+            // the layout after the pass, by default the presentable one for the colors and layout for the depth
+            VkImageLayout final_layout;
+
+            AttachmentDesc() :
+                load_op(VK_ATTACHMENT_LOAD_OP_CLEAR),
+                final_layout(VK_IMAGE_LAYOUT_UNDEFINED)
+            {}
         };
 
         struct DependencyDesc
@@ -1025,7 +1004,8 @@ public:
         return color_images_;
     }
 
-    VkResult acquire_next_image();
+    // signals the semaphore when the image is ready, next_image_semaphore() is used by default
+    VkResult acquire_next_image(VkSemaphore semaphore = VK_NULL_HANDLE);
     uint32_t current_buffer() const
     {
         return current_buffer_;
@@ -1107,6 +1087,50 @@ private:
     VkDescriptorImageInfo descriptor_image_info_;
 };
 
+// Compute shader with its pipeline layout. The descriptor set layouts are owned by the caller,
+// the push constants are visible to the compute stage.
+class ComputePipeline
+{
+public:
+    struct Settings
+    {
+        // SPIR-V file
+        const char* shader;
+        const VkDescriptorSetLayout* descriptor_set_layouts;
+        uint32_t descriptor_set_layouts_count;
+        uint32_t push_constants_size;
+
+        Settings() :
+            shader(nullptr),
+            descriptor_set_layouts(nullptr),
+            descriptor_set_layouts_count(0),
+            push_constants_size(0)
+        {}
+    };
+
+    ComputePipeline() :
+        pipeline_(VK_NULL_HANDLE),
+        layout_(VK_NULL_HANDLE)
+    {}
+
+    VkResult init(VulkanContext& context, const GPUInterface& gpu_iface, const Settings& settings);
+    void destroy(VulkanContext& context);
+
+    operator VkPipeline() const
+    {
+        return pipeline_;
+    }
+
+    VkPipelineLayout layout() const
+    {
+        return layout_;
+    }
+private:
+    VkPipeline pipeline_;
+    VkPipelineLayout layout_;
+    GPUInterface gpu_iface_;
+};
+
 class Command
 {
 public:
@@ -1125,22 +1149,55 @@ public:
     }
 
     CommandBuffer& begin();
+    // secondary command buffers continue the subpass of the framebuffer's render pass
+    CommandBuffer& begin_secondary(const Framebuffer* framebuffer, uint32_t subpass = 0);
     void end();
 
     CommandBuffer& begin_render_pass_command(const Framebuffer* framebuffer, const vec4& color, float depth, uint32_t stencil,
-        uint32_t clear_color, bool clear_depth, bool clear_stencil);
+        uint32_t clear_color, bool clear_depth, bool clear_stencil, VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE);
     CommandBuffer& end_render_pass_command();
     CommandBuffer& set_viewport_command(const VkRect2D& rect);
     CommandBuffer& set_scissor_command(const VkRect2D& rect);
     CommandBuffer& copy_image_command(VkImage src, VkImage dst, VkImageLayout src_layout, VkImageLayout dst_layout,
         const VkImageCopy* regions, uint32_t regions_count);
     CommandBuffer& copy_buffer(VkBuffer src, VkBuffer dst, const VkBufferCopy* regions, uint32_t regions_count);
+    CommandBuffer& copy_buffer_to_image(VkBuffer src, VkImage dst, VkImageLayout dst_layout,
+        const VkBufferImageCopy* regions, uint32_t regions_count);
     CommandBuffer& bind_pipeline(VkPipeline pipeline, VkPipelineBindPoint bind_point);
     CommandBuffer& bind_descriptor_set(VkPipelineBindPoint bind_point, VkPipelineLayout pipeline_layout,
-        const VkDescriptorSet* descriptor_sets, uint32_t descriptor_sets_count, uint32_t first);
+        const VkDescriptorSet* descriptor_sets, uint32_t descriptor_sets_count, uint32_t first,
+        const uint32_t* dynamic_offsets = nullptr, uint32_t dynamic_offsets_count = 0);
+    CommandBuffer& push_constants(VkPipelineLayout pipeline_layout, VkShaderStageFlags stages, const void* data, uint32_t size,
+        uint32_t offset = 0);
+    CommandBuffer& dispatch(uint32_t groups_count_x, uint32_t groups_count_y = 1, uint32_t groups_count_z = 1);
+    // size and offset are multiples of 4, VK_WHOLE_SIZE fills the rest of the buffer
+    CommandBuffer& fill_buffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, uint32_t value);
     CommandBuffer& draw(const Mesh& mesh, size_t part_index);
+    // binds the buffers of the pool for the draws of all its meshes with index_type, instance_buffer goes to the binding 1
+    CommandBuffer& bind_geometry(const GeometryPool& geometry_pool, VkIndexType index_type, const Buffer* instance_buffer = nullptr);
+    // the position stream of the pool for the depth-only passes, the draws are the same as with bind_geometry()
+    CommandBuffer& bind_positions(const GeometryPool& geometry_pool, VkIndexType index_type);
+    // binds the geometry pool of the mesh for the following draw_instanced() calls
+    CommandBuffer& bind_mesh(const Mesh& mesh, const Buffer* instance_buffer = nullptr);
+    // the buffers must be bound by bind_mesh()
+    CommandBuffer& draw_instanced(const Mesh& mesh, size_t part_index, uint32_t instances_count, uint32_t first_instance = 0);
+    CommandBuffer& draw_indexed_indirect(VkBuffer buffer, VkDeviceSize offset, uint32_t draw_count, uint32_t stride);
+    // all the commands of the batch, the geometry pool of the batch's mesh must be bound
+    CommandBuffer& draw_indirect(const IndirectDrawBuffer& draws, size_t batch_index, uint32_t lod = 0);
+    // the commands written by the last MeshletDrawBuffer::cull() of the batch in the frame
+    CommandBuffer& draw_meshlets(const MeshletDrawBuffer& draws, uint32_t frame_index, size_t batch_index);
+    // all the commands of the batch written by the last CulledDrawBuffer::cull() of the frame, the culled ones draw nothing
+    CommandBuffer& draw_culled(const CulledDrawBuffer& draws, uint32_t frame_index, size_t batch_index);
     CommandBuffer& transfer_image_layout(VkImage image, VkImageLayout src_layout, VkImageLayout dst_layout, VkImageAspectFlags aspect_flags);
     CommandBuffer& render_target_barrier(VkImage image, VkImageLayout layout, VkImageAspectFlags aspect_flags);
+    CommandBuffer& memory_barrier(VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage,
+        VkAccessFlags src_access, VkAccessFlags dst_access);
+    CommandBuffer& image_barrier(VkImage image, VkImageLayout src_layout, VkImageLayout dst_layout, VkImageAspectFlags aspect_flags,
+        VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage, VkAccessFlags src_access, VkAccessFlags dst_access);
+    CommandBuffer& pipeline_barrier(VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage,
+        const VkBufferMemoryBarrier* buffer_barriers, uint32_t buffer_barriers_count,
+        const VkImageMemoryBarrier* image_barriers, uint32_t image_barriers_count);
+    CommandBuffer& execute_commands(const CommandBuffer* command_buffers, uint32_t count);
 private:
     VkCommandBuffer id_;
 };
@@ -1148,7 +1205,9 @@ private:
 class CommandPool
 {
 public:
-    VkResult init(VulkanContext& context, const GPUInterface& gpu_iface);
+    // the graphics queue family is used by default
+    VkResult init(VulkanContext& context, const GPUInterface& gpu_iface, VkCommandPoolCreateFlags flags = 0,
+        uint32_t queue_family_index = invalid_index);
     void destroy(VulkanContext& context);
 
     operator VkCommandPool()
@@ -1156,22 +1215,394 @@ public:
         return id_;
     }
 
-    VkResult create_command_buffers(VulkanContext& context, CommandBuffer* buffers, uint32_t count);
+    VkResult create_command_buffers(VulkanContext& context, CommandBuffer* buffers, uint32_t count,
+        VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
     void destroy_command_buffers(VulkanContext& context, CommandBuffer* buffers, uint32_t count);
+    // recycles all command buffers allocated from the pool
+    VkResult reset(VulkanContext& context);
 private:
     VkCommandPool id_;
     GPUInterface gpu_iface_;
 };
 
-struct RenderPasses
+// Resources owned by one frame in flight. They can be reused only after the fence is signaled.
+class FrameContext
 {
-    RenderPass main_render_pass;
-};
+public:
+    FrameContext() :
+        fence_(VK_NULL_HANDLE),
+        image_acquired_semaphore_(VK_NULL_HANDLE),
+        render_finished_semaphore_(VK_NULL_HANDLE),
+        compute_finished_semaphore_(VK_NULL_HANDLE)
+    {}
 
-struct CommandPools
-{
-    CommandPool main_graphics_command_pool;
-    CommandPool resource_uploading_command_pool;
+    // every recording thread gets its own command pool with secondary_command_buffers_count secondary buffers,
+    // the compute command buffers are allocated for the compute queue family
+    VkResult init(VulkanContext& context, const GPUInterface& gpu_iface, uint32_t command_buffers_count, uint32_t uniform_size,
+        uint32_t recording_threads_count = 0, uint32_t secondary_command_buffers_count = 0, uint32_t compute_command_buffers_count = 0);
+    void destroy(VulkanContext& context);
+
+    // blocks until the GPU is done with the previous use of the frame and recycles its command buffers
+    VkResult wait(VulkanContext& context);
+
+    CommandPool& command_pool()
+    {
+        return command_pool_;
+    }
+
+    CommandBuffer& command_buffer(size_t index)
+    {
+        return command_buffers_[index];
+    }
+
+    CommandBuffer* command_buffers()
+    {
+        return &command_buffers_[0];
+    }
+
+    uint32_t recording_threads_count() const
+    {
+        return static_cast<uint32_t>(thread_commands_.size());
+    }
+
+    // must be used only by the thread with thread_index
+    CommandBuffer& secondary_command_buffer(uint32_t thread_index, uint32_t index)
+    {
+        return thread_commands_[thread_index].secondary_command_buffers[index];
+    }
+
+    // submitted to Device::compute_queue()
+    CommandBuffer& compute_command_buffer(size_t index)
+    {
+        return compute_command_buffers_[index];
+    }
+
+    // host visible storage for the data changing every frame
+    Buffer& uniform()
+    {
+        return uniform_;
+    }
+
+    VkFence fence() const
+    {
+        return fence_;
+    }
+
+    VkSemaphore image_acquired_semaphore() const
+    {
+        return image_acquired_semaphore_;
+    }
+
+    VkSemaphore render_finished_semaphore() const
+    {
+        return render_finished_semaphore_;
+    }
+
+    // signaled by the compute submit of the frame, the rendering waits for it
+    VkSemaphore compute_finished_semaphore() const
+    {
+        return compute_finished_semaphore_;
+    }
+private:
+    struct ThreadCommands
+    {
+        CommandPool command_pool;
+        std::vector<CommandBuffer> secondary_command_buffers;
+    };
+
+    CommandPool command_pool_;
+    std::vector<CommandBuffer> command_buffers_;
+    std::vector<ThreadCommands> thread_commands_;
+    CommandPool compute_command_pool_;
+    std::vector<CommandBuffer> compute_command_buffers_;
+    Buffer uniform_;
+    VkFence fence_;
+    VkSemaphore image_acquired_semaphore_;
+    VkSemaphore render_finished_semaphore_;
+    VkSemaphore compute_finished_semaphore_;
+    GPUInterface gpu_iface_;
+};
+
+// N frames in flight: the CPU records frame N + 1 while the GPU executes frame N
+class FrameContextRing
+{
+public:
+    struct Settings
+    {
+        uint32_t frames_count;
+        uint32_t command_buffers_count;
+        uint32_t uniform_size;
+        uint32_t recording_threads_count;
+        uint32_t secondary_command_buffers_count;
+        uint32_t compute_command_buffers_count;
+
+        Settings() :
+            frames_count(2),
+            command_buffers_count(1),
+            uniform_size(0),
+            recording_threads_count(0),
+            secondary_command_buffers_count(1),
+            compute_command_buffers_count(0)
+        {}
+    };
+
+    FrameContextRing() :
+        current_(0), frame_time_(0.0f)
+    {}
+
+    VkResult init(VulkanContext& context, const GPUInterface& gpu_iface, const Settings& settings);
+    void destroy(VulkanContext& context);
+
+    // waits for the oldest frame in flight and acquires the next swapchain image
+    FrameContext& begin_frame(VulkanContext& context);
+
+    FrameContext& current()
+    {
+        return frames_[current_];
+    }
+
+    uint32_t current_index() const
+    {
+        return current_;
+    }
+
+    uint32_t frames_count() const
+    {
+        return static_cast<uint32_t>(frames_.size());
+    }
+
+    // smoothed CPU time between two begin_frame() calls in milliseconds
+    float frame_time() const
+    {
+        return frame_time_;
+    }
+private:
+    std::vector<FrameContext> frames_;
+    uint32_t current_;
+    Timer timer_;
+    float frame_time_;
+};
+
+// Persistently mapped upload buffer. Copies are recorded into a batch command buffer that is
+// submitted by flush(), the space of a batch is reused after its fence is signaled.
+// Copies are recorded for the transfer queue. When it belongs to a separate family, the batch also gets
+// a small graphics command buffer that acquires the ownership of the uploaded resources.
+class StagingRing
+{
+public:
+    struct Settings
+    {
+        VkDeviceSize size;
+        uint32_t batches_count;
+
+        Settings() :
+            size(32 * 1024 * 1024),
+            batches_count(4)
+        {}
+    };
+
+    StagingRing() :
+        head_(0), tail_(0), first_submitted_(0), submitted_count_(0),
+        uploads_count_(0), submits_count_(0), dedicated_transfer_queue_(false)
+    {}
+
+    VkResult init(VulkanContext& context, const GPUInterface& gpu_iface, const Settings& settings);
+    void destroy(VulkanContext& context);
+
+    VkResult upload_buffer(VulkanContext& context, VkBuffer dst, VkDeviceSize dst_offset, const uint8_t* data, VkDeviceSize size);
+    // the whole subresource is overwritten, the image ends up in final_layout
+    VkResult upload_image(VulkanContext& context, VkImage dst, const VkImageSubresourceLayers& subresource, const VkExtent3D& extent,
+        VkImageLayout final_layout, const uint8_t* data, VkDeviceSize size);
+
+    // submits the recorded copies without waiting for them
+    VkResult flush(VulkanContext& context);
+    VkResult wait_idle(VulkanContext& context);
+
+    uint32_t uploads_count() const
+    {
+        return uploads_count_;
+    }
+
+    uint32_t submits_count() const
+    {
+        return submits_count_;
+    }
+
+    bool dedicated_transfer_queue() const
+    {
+        return dedicated_transfer_queue_;
+    }
+private:
+    struct Batch
+    {
+        CommandBuffer command_buffer;
+        // executed on the graphics queue after command_buffer
+        CommandBuffer acquire_command_buffer;
+        VkSemaphore transfer_finished_semaphore;
+        std::vector<VkBufferMemoryBarrier> buffer_ownership_barriers;
+        std::vector<VkImageMemoryBarrier> image_ownership_barriers;
+        VkFence fence;
+        // virtual ring offset the batch's data ends at
+        uint64_t end;
+        bool recording;
+        // uploads that don't fit into the ring
+        std::vector<Buffer> temporary_buffers;
+    };
+
+    VkResult current_batch(VulkanContext& context, Batch*& batch);
+    VkResult reserve(VulkanContext& context, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+    VkResult retire(VulkanContext& context, bool wait);
+
+    GPUInterface gpu_iface_;
+    Settings settings_;
+    Buffer buffer_;
+    std::vector<Batch> batches_;
+    // offsets grow monotonically, the physical offset is offset % size
+    uint64_t head_;
+    uint64_t tail_;
+    uint32_t first_submitted_;
+    uint32_t submitted_count_;
+    uint32_t uploads_count_;
+    uint32_t submits_count_;
+    bool dedicated_transfer_queue_;
+};
+
+// Vertices and indices of many meshes in one device local vertex buffer and one index buffer.
+// The ranges are sub-allocated in elements by a buddy allocator, all the meshes of a pool share
+// the vertex layout and the pool's buffers are bound once for all of them.
+// 16 and 32 bit index ranges share the index buffer, it's rebound only when the index type changes.
+class GeometryPool
+{
+public:
+    struct Settings
+    {
+        uint32_t vertex_size;
+        // Size of the position at the start of every vertex. When it's not 0 the positions are also copied
+        // into a tightly packed stream for the depth-only passes, see position_input_info().
+        uint32_t position_size;
+        // capacities and the smallest range in elements, powers of 2, a 32 bit index takes 2 elements of indices_count
+        uint32_t vertices_count;
+        uint32_t indices_count;
+        uint32_t min_range_size;
+
+        Settings() :
+            vertex_size(0),
+            position_size(0),
+            vertices_count(1 << 19),
+            indices_count(1 << 22),
+            min_range_size(64)
+        {}
+    };
+
+    // offsets and counts in elements, indices_offset is in indices of index_type
+    struct Allocation
+    {
+        uint32_t vertices_offset;
+        uint32_t vertices_count;
+        uint32_t indices_offset;
+        uint32_t indices_count;
+        VkIndexType index_type;
+
+        Allocation() :
+            vertices_offset(invalid_index), vertices_count(0),
+            indices_offset(invalid_index), indices_count(0),
+            index_type(VK_INDEX_TYPE_UINT16)
+        {}
+    };
+
+    GeometryPool() :
+        vertex_size_(0),
+        position_size_(0)
+    {}
+
+    VkResult init(VulkanContext& context, const GPUInterface& gpu_iface, const Settings& settings);
+    void destroy(VulkanContext& context);
+
+    VkResult allocate(Allocation& allocation, uint32_t vertices_count, uint32_t indices_count, VkIndexType index_type = VK_INDEX_TYPE_UINT16);
+    void free(Allocation& allocation);
+    // the data goes through the staging ring, indices are of the allocation's index_type
+    VkResult upload(VulkanContext& context, const Allocation& allocation, const uint8_t* vertices, const uint8_t* indices);
+
+    const Buffer& vbuffer() const
+    {
+        return vbuffer_;
+    }
+
+    const Buffer& ibuffer() const
+    {
+        return ibuffer_;
+    }
+
+    // the positions at the same vertex offsets as vbuffer(), valid when has_positions()
+    const Buffer& pbuffer() const
+    {
+        return pbuffer_;
+    }
+
+    bool has_positions() const
+    {
+        return position_size_ != 0;
+    }
+
+    uint32_t vertex_size() const
+    {
+        return vertex_size_;
+    }
+
+    const BuddyAllocator& vertices_allocator() const
+    {
+        return vertices_;
+    }
+
+    const BuddyAllocator& indices_allocator() const
+    {
+        return indices_;
+    }
+
+    bool initialized() const
+    {
+        return vertex_size_ != 0;
+    }
+private:
+    Buffer vbuffer_;
+    Buffer ibuffer_;
+    Buffer pbuffer_;
+    BuddyAllocator vertices_;
+    BuddyAllocator indices_;
+    uint32_t vertex_size_;
+    uint32_t position_size_;
+};
+
+struct RenderPasses
+{
+    RenderPass main_render_pass;
+};
+
+struct CommandPools
+{
+    CommandPool main_graphics_command_pool;
+    CommandPool resource_uploading_command_pool;
+    CommandPool transfer_command_pool;
+};
+
+// The pools are created by the first mesh using them, see geometry_pool_settings(), the ones of the unused
+// vertex formats take no memory.
+struct GeometryPools
+{
+    // GeometryLayout vertices
+    GeometryPool main_geometry_pool;
+    // CompactGeometryLayout vertices
+    GeometryPool compact_geometry_pool;
+    // QuantizedGeometryLayout vertices
+    GeometryPool quantized_geometry_pool;
+    // FullscreenLayout vertices
+    GeometryPool fullscreen_geometry_pool;
+
+    GeometryPool& pool(VertexFormat format)
+    {
+        return format == vertex_format_quantized ? quantized_geometry_pool :
+            (format == vertex_format_compact ? compact_geometry_pool : main_geometry_pool);
+    }
 };
 
 struct DescriptorPools
@@ -1183,6 +1614,7 @@ struct DesciptorSetLayouts
 {
     VkDescriptorSetLayout camera_layout;
     VkDescriptorSetLayout mesh_layout;
+    VkDescriptorSetLayout dynamic_mesh_layout;
     VkDescriptorSetLayout material_layout;
     VkDescriptorSetLayout gbuffer_layout;
 };
@@ -1254,10 +1686,14 @@ struct VulkanContext
 
     GPUInterface default_gpu_interface;
 
+    MemoryAllocator memory_allocator;
+
     ImageView main_depth_stencil_image_view;
 
     RenderPasses render_passes;
     CommandPools command_pools;
+    StagingRing staging_ring;
+    GeometryPools geometry_pools;
     DescriptorPools descriptor_pools;
 
     DesciptorSetLayouts descriptor_set_layouts;
@@ -1292,6 +1728,86 @@ public:
     static void vertex_input_info(VkPipelineVertexInputStateCreateInfo& info);
 };
 
+// GeometryLayout in about a half of the memory. Normals and tangents are in VK_FORMAT_A2B10G10R10_SNORM_PACK32,
+// the tangent's w is the bitangent sign, uvs are half floats. The shaders see the same inputs as with GeometryLayout.
+class CompactGeometryLayout
+{
+public:
+    struct Vertex
+    {
+        vec3 pos;
+        uint32_t nrm;
+        uint32_t tng;
+        uint16_t tex[2];
+    };
+
+    static uint32_t stride()
+    {
+        return sizeof(Vertex);
+    }
+
+    static bool supported(const PhysicalDevice& physical_device);
+    static void vertex_input_info(VkPipelineVertexInputStateCreateInfo& info);
+};
+
+// CompactGeometryLayout with VK_FORMAT_R16G16B16A16_UNORM positions relative to the mesh bounds,
+// Mesh::dequantization() maps them back, it goes to the world matrix with TransformArray::set_local()
+class QuantizedGeometryLayout
+{
+public:
+    struct Vertex
+    {
+        uint16_t pos[4];
+        uint32_t nrm;
+        uint32_t tng;
+        uint16_t tex[2];
+    };
+
+    static uint32_t stride()
+    {
+        return sizeof(Vertex);
+    }
+
+    static bool supported(const PhysicalDevice& physical_device);
+    static void vertex_input_info(VkPipelineVertexInputStateCreateInfo& info);
+};
+
+static_assert(sizeof(CompactGeometryLayout::Vertex) == 24, "The compact vertex must be tightly packed");
+static_assert(sizeof(QuantizedGeometryLayout::Vertex) == 20, "The quantized vertex must be tightly packed");
+
+bool vertex_format_supported(const PhysicalDevice& physical_device, VertexFormat format);
+uint32_t vertex_format_stride(VertexFormat format);
+void vertex_input_info(VertexFormat format, VkPipelineVertexInputStateCreateInfo& info);
+// the position stream of GeometryPool::pbuffer(), the location 0 only
+uint32_t position_stride(VertexFormat format);
+void position_input_info(VertexFormat format, VkPipelineVertexInputStateCreateInfo& info);
+// of GeometryPools::pool(format)
+GeometryPool::Settings geometry_pool_settings(VertexFormat format);
+
+// GeometryLayout with the world matrix of every instance in the binding 1
+class InstancedGeometryLayout
+{
+public:
+    typedef GeometryLayout::Vertex Vertex;
+
+    struct Instance
+    {
+        mat4x4 world;
+    };
+
+    static uint32_t stride()
+    {
+        return sizeof(Vertex);
+    }
+
+    static uint32_t instance_stride()
+    {
+        return sizeof(Instance);
+    }
+
+    static void vertex_input_info(VkPipelineVertexInputStateCreateInfo& info);
+};
+
 class FullscreenLayout
 {
 public:
@@ -1309,24 +1825,91 @@ public:
     static void vertex_input_info(VkPipelineVertexInputStateCreateInfo& info);
 };
 
+// index range of a level of detail, the levels share the vertices of the part
+struct MeshLod
+{
+    uint32_t ibuffer_offset;
+    uint32_t indices_count;
+};
+
 struct MeshPart
 {
+    // in indices of the mesh's index type
     uint32_t ibuffer_offset;
     uint32_t vbuffer_offset;
     uint32_t indices_count;
     Material* material;
+    // lods[0] is the range above, Mesh::lods_count() of them are valid
+    MeshLod lods[max_mesh_lods];
+    // the range of Mesh::meshlets() splitting lods[0], empty for the meshes not imported from assets
+    uint32_t first_meshlet;
+    uint32_t meshlets_count;
+    // in the space of the vertices like the meshlets
+    Aabb bounds;
 };
 
+// MeshPart offsets are absolute in the buffers of the mesh's geometry pool
 class Mesh
 {
 public:
+    struct ImportSettings
+    {
+        VertexFormat vertex_format;
+        // triangles order for the post-transform cache
+        bool optimize_vertex_cache;
+        // clusters order for less overdraw, the ACMR may get worse by overdraw_threshold times at most
+        bool optimize_overdraw;
+        float overdraw_threshold;
+        // vertices order for the vertex fetch
+        bool optimize_vertex_fetch;
+        // up to max_mesh_lods levels, every one has lod_reduction of the triangles of the previous one
+        // unless the error relative to the size of the part would exceed lod_max_error
+        uint32_t lods_count;
+        float lod_reduction;
+        float lod_max_error;
+        // clusters of the full detail triangles for the finer culling
+        bool build_meshlets;
+
+        ImportSettings() :
+            vertex_format(vertex_format_float),
+            optimize_vertex_cache(true),
+            optimize_overdraw(true),
+            overdraw_threshold(1.05f),
+            optimize_vertex_fetch(true),
+            lods_count(max_mesh_lods),
+            lod_reduction(0.5f),
+            lod_max_error(0.05f),
+            build_meshlets(true)
+        {}
+
+        // stored in the mesh cache, the overdraw threshold goes to the high bits in the thousandths
+        uint32_t flags() const
+        {
+            const uint32_t threshold = optimize_overdraw ?
+                static_cast<uint32_t>(std::min(std::max(overdraw_threshold, 0.0f) * 1000.0f + 0.5f, 65535.0f)) : 0;
+            return (optimize_vertex_cache ? 1 : 0) | (optimize_overdraw ? 2 : 0) | (optimize_vertex_fetch ? 4 : 0) |
+                (build_meshlets ? 8 : 0) | (lods_count << 8) | (threshold << 16);
+        }
+    };
+
     Mesh() :
+        geometry_pool_(nullptr),
+        vertex_format_(vertex_format_float),
+        position_scale_(1.0f),
+        lods_count_(1),
         descriptor_set_(VK_NULL_HANDLE)
-    {}
+    {
+        for (uint32_t i = 0; i < max_mesh_lods; ++i)
+            lod_errors_[i] = 0.0f;
+    }
 
     VkResult create_cube(vk::VulkanContext& context, const vk::GPUInterface& gpu_iface);
     VkResult create_quad(vk::VulkanContext& context, const vk::GPUInterface& gpu_iface);
-    VkResult create(const char* filename, vk::VulkanContext& context, const vk::GPUInterface& gpu_iface);
+    // Imports the asset with Assimp and cooks filename.mhemesh, the next runs load the cooked file.
+    // The parts are converted and optimized by the scheduler's threads when it's passed.
+    VkResult create(const char* filename, vk::VulkanContext& context, const vk::GPUInterface& gpu_iface,
+        jobs::Scheduler* scheduler = nullptr, const ImportSettings& settings = ImportSettings());
+    VkResult create(const MeshCacheData& data, vk::VulkanContext& context, const vk::GPUInterface& gpu_iface);
     void destroy(vk::VulkanContext& context);
 
     const std::vector<MeshPart>& parts() const
@@ -1334,14 +1917,80 @@ public:
         return parts_;
     }
 
+    const GeometryPool* geometry_pool() const
+    {
+        return geometry_pool_;
+    }
+
+    const GeometryPool::Allocation& geometry() const
+    {
+        return geometry_;
+    }
+
+    // 16 bit when every part has at most 65536 vertices
+    VkIndexType index_type() const
+    {
+        return geometry_.index_type;
+    }
+
+    VertexFormat vertex_format() const
+    {
+        return vertex_format_;
+    }
+
+    // vertex_format_quantized positions are position_offset() + position * position_scale()
+    const vec3& position_offset() const
+    {
+        return position_offset_;
+    }
+
+    float position_scale() const
+    {
+        return position_scale_;
+    }
+
+    // identity for the other formats
+    mat4x4 dequantization() const
+    {
+        return mat4x4::scaling(position_scale_) * mat4x4::translation(position_offset_);
+    }
+
+    uint32_t lods_count() const
+    {
+        return lods_count_;
+    }
+
+    // the geometric error of the level in the units of the source asset, 0 for the full detail
+    float lod_error(uint32_t lod) const
+    {
+        return lod_errors_[lod];
+    }
+
+    // The coarsest level whose error projected to the screen is below max_error_pixels.
+    // distance is in the units of the source asset, screen_scale = viewport height / (2 * tan(fov_y / 2)).
+    uint32_t select_lod(float distance, float screen_scale, float max_error_pixels) const;
+
+    // First indices are absolute in the index buffer of the pool. The bounds are in the space of the vertices,
+    // for vertex_format_quantized it's the one before dequantization().
+    const std::vector<Meshlet>& meshlets() const
+    {
+        return meshlets_;
+    }
+
+    // of all the parts
+    const Aabb& bounds() const
+    {
+        return bounds_;
+    }
+
     const vk::Buffer& vbuffer() const
     {
-        return vbuffer_;
+        return geometry_pool_->vbuffer();
     }
 
     const vk::Buffer& ibuffer() const
     {
-        return ibuffer_;
+        return geometry_pool_->ibuffer();
     }
 
     VkDescriptorSet descriptor_set() const
@@ -1355,20 +2004,489 @@ public:
     }
 private:
     VkResult init_descriptor_set(VulkanContext& context, const vk::GPUInterface& gpu_iface);
-    VkResult init_buffers(VulkanContext& context, const vk::GPUInterface& gpu_iface,
-        const uint8_t* vertices, uint32_t vertices_data_size,
-        const uint8_t* indices, uint32_t indices_data_size);
+    // part offsets are relative to the mesh data and become absolute in the pool,
+    // the pool is created with pool_settings if it's the first mesh using it
+    VkResult init_geometry(VulkanContext& context, const vk::GPUInterface& gpu_iface, GeometryPool& geometry_pool,
+        const GeometryPool::Settings& pool_settings, const uint8_t* vertices, uint32_t vertices_count,
+        const uint8_t* indices, uint32_t indices_count, VkIndexType index_type);
 
     std::vector<MeshPart> parts_;
-    vk::Buffer vbuffer_;
-    vk::Buffer ibuffer_;
+    GeometryPool* geometry_pool_;
+    GeometryPool::Allocation geometry_;
+    VertexFormat vertex_format_;
+    vec3 position_offset_;
+    float position_scale_;
+    uint32_t lods_count_;
+    float lod_errors_[max_mesh_lods];
+    std::vector<Meshlet> meshlets_;
+    Aabb bounds_;
     vk::Buffer uniform_;
     VkDescriptorSet descriptor_set_;
 };
 
+// Per-object uniform data of all the frames in flight in one persistently mapped buffer.
+// The CPU writes the whole frame at once, the draws pick their object with a dynamic offset.
+class TransformBuffer
+{
+public:
+    struct Settings
+    {
+        uint32_t objects_count;
+        uint32_t frames_count;
+        // bytes of data per object
+        uint32_t object_size;
+
+        Settings() :
+            objects_count(0),
+            frames_count(2),
+            object_size(sizeof(mat4x4))
+        {}
+    };
+
+    TransformBuffer() :
+        descriptor_set_(VK_NULL_HANDLE),
+        stride_(0),
+        frame_size_(0)
+    {}
+
+    VkResult init(VulkanContext& context, const GPUInterface& gpu_iface, const Settings& settings);
+    void destroy(VulkanContext& context);
+
+    // data of the object i is at frame_data(frame_index) + i * stride()
+    uint8_t* frame_data(uint32_t frame_index) const
+    {
+        return buffer_.mapped() + frame_index * frame_size_;
+    }
+
+    // object size rounded up to minUniformBufferOffsetAlignment
+    uint32_t stride() const
+    {
+        return stride_;
+    }
+
+    uint32_t dynamic_offset(uint32_t frame_index, uint32_t object_index) const
+    {
+        return frame_index * frame_size_ + object_index * stride_;
+    }
+
+    // uses dynamic_mesh_layout
+    VkDescriptorSet descriptor_set() const
+    {
+        return descriptor_set_;
+    }
+
+    // all the frames, for the storage buffer bindings
+    const Buffer& buffer() const
+    {
+        return buffer_;
+    }
+private:
+    Buffer buffer_;
+    VkDescriptorSet descriptor_set_;
+    uint32_t stride_;
+    uint32_t frame_size_;
+};
+
+// VkDrawIndexedIndirectCommand for every part of a set of meshes. The parts of a mesh are grouped by material,
+// every group is a batch drawn by a single vkCmdDrawIndexedIndirect when the device supports multiDrawIndirect.
+class IndirectDrawBuffer
+{
+public:
+    struct Settings
+    {
+        uint32_t max_commands_count;
+
+        Settings() :
+            max_commands_count(0)
+        {}
+    };
+
+    // Commands [first_command, first_command + commands_count) share the mesh and the material,
+    // the commands of the level of detail lod start at first_command + lod * commands_count.
+    struct Batch
+    {
+        const Mesh* mesh;
+        const Material* material;
+        // index of the mesh in the array passed to build()
+        uint32_t object_index;
+        uint32_t first_command;
+        uint32_t commands_count;
+    };
+
+    IndirectDrawBuffer() :
+        commands_count_(0),
+        max_commands_count_(0),
+        max_draw_count_(1)
+    {}
+
+    VkResult init(VulkanContext& context, const GPUInterface& gpu_iface, const Settings& settings);
+    void destroy(VulkanContext& context);
+
+    // the buffer is written by the CPU, don't rebuild it while the GPU may still read it
+    VkResult build(VulkanContext& context, const Mesh* meshes, uint32_t meshes_count);
+
+    const std::vector<Batch>& batches() const
+    {
+        return batches_;
+    }
+
+    uint32_t commands_count() const
+    {
+        return commands_count_;
+    }
+
+    // 1 without multiDrawIndirect
+    uint32_t max_draw_count() const
+    {
+        return max_draw_count_;
+    }
+
+    const Buffer& buffer() const
+    {
+        return buffer_;
+    }
+private:
+    Buffer buffer_;
+    std::vector<VkDrawIndexedIndirectCommand> commands_;
+    std::vector<Batch> batches_;
+    uint32_t commands_count_;
+    uint32_t max_commands_count_;
+    uint32_t max_draw_count_;
+};
+
+// Draws of the visible parts and meshlets of the batches of an IndirectDrawBuffer. The CPU culls the meshlets
+// of a batch against the frustum and, with the back faces culled, their normal cones and writes the compacted commands for the frame,
+// the neighbouring visible meshlets share a command. The parts without meshlets and the coarser levels of detail
+// are drawn by whole parts.
+class MeshletDrawBuffer
+{
+public:
+    struct Settings
+    {
+        uint32_t frames_count;
+        // the cone test is only valid when the pipelines drawing the commands cull the back faces
+        bool backface_culling;
+
+        Settings() :
+            frames_count(2),
+            backface_culling(true)
+        {}
+    };
+
+    // every meshlet of the batch may get its own command, they start at first_command of the frame
+    struct Batch
+    {
+        const Mesh* mesh;
+        uint32_t first_part;
+        uint32_t parts_count;
+        uint32_t first_command;
+        uint32_t max_commands_count;
+        uint32_t meshlets_count;
+    };
+
+    MeshletDrawBuffer() :
+        frames_count_(0),
+        max_commands_count_(0),
+        max_draw_count_(1),
+        backface_culling_(true)
+    {}
+
+    VkResult init(VulkanContext& context, const GPUInterface& gpu_iface, const Settings& settings);
+    void destroy(VulkanContext& context);
+
+    // the batches follow the ones of draws, it has to be rebuilt when draws is
+    VkResult build(VulkanContext& context, const GPUInterface& gpu_iface, const IndirectDrawBuffer& draws);
+
+    // Frustum and camera are in the space of the mesh's vertices. parts_visibility is indexed by the parts of the mesh,
+    // the parts with 0 are skipped, nullptr when all of them are visible. The batches may be culled by different threads,
+    // a frame must not be culled while the GPU may still read its commands. Returns the commands count.
+    uint32_t cull(uint32_t frame_index, size_t batch_index, uint32_t lod, const uint8_t* parts_visibility,
+        const Frustum& frustum, const vec3& camera);
+
+    const std::vector<Batch>& batches() const
+    {
+        return batches_;
+    }
+
+    uint32_t commands_count(uint32_t frame_index, size_t batch_index) const
+    {
+        return commands_counts_[frame_index * batches_.size() + batch_index];
+    }
+
+    VkDeviceSize frame_offset(uint32_t frame_index) const
+    {
+        return static_cast<VkDeviceSize>(frame_index) * max_commands_count_ * sizeof(VkDrawIndexedIndirectCommand);
+    }
+
+    uint32_t max_draw_count() const
+    {
+        return max_draw_count_;
+    }
+
+    const Buffer& buffer() const
+    {
+        return buffer_;
+    }
+private:
+    Buffer buffer_;
+    std::vector<Batch> batches_;
+    // the parts of the batches in their order
+    std::vector<uint32_t> parts_;
+    std::vector<uint32_t> commands_counts_;
+    uint32_t frames_count_;
+    uint32_t max_commands_count_;
+    uint32_t max_draw_count_;
+    bool backface_culling_;
+};
+
+// Draws of the parts of the batches of an IndirectDrawBuffer culled by a compute shader. The shader transforms the part's
+// bounds by the object's world matrix from a TransformBuffer, tests them against the frustum and appends the visible parts
+// to the batch's range of the frame's commands, the batch's count is incremented. The headers lack the indirect count
+// draws, so the commands are zeroed first and the whole ranges are drawn, the culled commands draw nothing.
+// The counts are copied to a host visible buffer for the statistics.
+// Hierarchical depth of the last rendered frame for the occlusion culling. Mip 0 is the depth buffer reduced to
+// the power of 2 below its size, every texel of the next mips keeps the farthest depth of the 2x2 texels under it.
+class DepthPyramid
+{
+public:
+    struct Settings
+    {
+        // created with VK_IMAGE_USAGE_SAMPLED_BIT
+        const ImageView* depth;
+        uint32_t frames_count;
+        // the pyramid is read by Device::compute_queue() too, the frames get the semaphores of the builds
+        bool async_compute;
+
+        Settings() :
+            depth(nullptr),
+            frames_count(2),
+            async_compute(true)
+        {}
+    };
+
+    // the local size of depth_reduce.comp in both dimensions
+    static const uint32_t group_size = 8;
+
+    DepthPyramid() :
+        descriptor_set_layout_(VK_NULL_HANDLE),
+        depth_view_(VK_NULL_HANDLE),
+        sampler_(VK_NULL_HANDLE),
+        depth_image_(VK_NULL_HANDLE),
+        depth_width_(0),
+        depth_height_(0),
+        width_(0),
+        height_(0),
+        mip_levels_(0),
+        async_compute_(false),
+        built_(false)
+    {}
+
+    VkResult init(VulkanContext& context, const GPUInterface& gpu_iface, const Settings& settings);
+    void destroy(VulkanContext& context);
+
+    // Records the reduction of the depth rendered with view_projection after the render pass that wrote it,
+    // the depth is in VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL before and after.
+    void build(CommandBuffer& command_buffer, const mat4x4& view_projection);
+
+    // The graphics submit of the frame that builds the pyramid signals it when async_compute(),
+    // the culling of the next frame on the compute queue waits for it.
+    VkSemaphore built_semaphore(uint32_t frame_index) const
+    {
+        return semaphores_[frame_index];
+    }
+
+    // false until the first build()
+    bool built() const
+    {
+        return built_;
+    }
+
+    bool async_compute() const
+    {
+        return async_compute_;
+    }
+
+    // the one of the last build()
+    const mat4x4& view_projection() const
+    {
+        return view_projection_;
+    }
+
+    uint32_t width() const
+    {
+        return width_;
+    }
+
+    uint32_t height() const
+    {
+        return height_;
+    }
+
+    uint32_t mip_levels() const
+    {
+        return mip_levels_;
+    }
+
+    // all the mips with a nearest clamped sampler, in VK_IMAGE_LAYOUT_GENERAL
+    const VkDescriptorImageInfo& descriptor_image_info() const
+    {
+        return descriptor_image_info_;
+    }
+private:
+    ComputePipeline pipeline_;
+    VkDescriptorSetLayout descriptor_set_layout_;
+    ImageView image_;
+    // the depth aspect of the depth buffer
+    VkImageView depth_view_;
+    std::vector<VkImageView> mip_views_;
+    // reduce the previous mip into the next one
+    std::vector<VkDescriptorSet> descriptor_sets_;
+    std::vector<VkSemaphore> semaphores_;
+    VkSampler sampler_;
+    VkDescriptorImageInfo descriptor_image_info_;
+    mat4x4 view_projection_;
+    VkImage depth_image_;
+    uint32_t depth_width_;
+    uint32_t depth_height_;
+    uint32_t width_;
+    uint32_t height_;
+    uint32_t mip_levels_;
+    bool async_compute_;
+    bool built_;
+    GPUInterface gpu_iface_;
+};
+
+class CulledDrawBuffer
+{
+public:
+    struct Settings
+    {
+        uint32_t frames_count;
+        // the work goes to the graphics queue when it's false or the device has no separate compute family
+        bool async_compute;
+
+        Settings() :
+            frames_count(2),
+            async_compute(true)
+        {}
+    };
+
+    // the part's data read by cull_parts.comp, std430 layout
+    struct Part
+    {
+        float bounds_min[3];
+        uint32_t object_index;
+        float bounds_max[3];
+        uint32_t batch_index;
+        // of the batch, the visible parts are appended to it
+        uint32_t first_command;
+        int32_t vertex_offset;
+        // first index and indices count of every level of detail
+        uint32_t lods[max_mesh_lods][2];
+        uint32_t padding[2];
+    };
+
+    // the local size of cull_parts.comp
+    static const uint32_t group_size = 64;
+
+    CulledDrawBuffer() :
+        descriptor_set_layout_(VK_NULL_HANDLE),
+        transforms_(nullptr),
+        depth_pyramid_(nullptr),
+        parts_count_(0),
+        objects_count_(0),
+        max_draw_count_(1),
+        async_compute_(false)
+    {}
+
+    VkResult init(VulkanContext& context, const GPUInterface& gpu_iface, const Settings& settings);
+    void destroy(VulkanContext& context);
+
+    // The batches are the ones of draws without the coarser levels of detail, the transforms are read from transforms.
+    // The parts passing the frustum are tested against depth_pyramid once it's built, when it's passed.
+    VkResult build(VulkanContext& context, const GPUInterface& gpu_iface, const IndirectDrawBuffer& draws,
+        const TransformBuffer& transforms, const DepthPyramid* depth_pyramid = nullptr);
+
+    // The levels of detail of the objects for the frame, indexed by the object_index of the batches.
+    // Write them before cull(), the GPU reads them until the frame's fence is signaled.
+    uint32_t* object_lods(uint32_t frame_index) const
+    {
+        return reinterpret_cast<uint32_t*>(frames_[frame_index].lods.mapped());
+    }
+
+    // Records the culling of all the parts for the frame into command_buffer, which goes to Device::compute_queue()
+    // when async_compute() and to the graphics queue otherwise. The frustum is in the world space.
+    // The graphics queue then waits for the frame's compute_finished_semaphore() at VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+    // without the async compute the command buffer gets the barrier for the draws.
+    void cull(CommandBuffer& command_buffer, uint32_t frame_index, const Frustum& frustum);
+
+    // the parts found visible by the last cull() of the frame, valid after the frame's fence is signaled
+    uint32_t visible_count(uint32_t frame_index) const;
+    // the parts inside the frustum, visible_count() of them aren't occluded either
+    uint32_t frustum_visible_count(uint32_t frame_index) const;
+
+    bool async_compute() const
+    {
+        return async_compute_;
+    }
+
+    const std::vector<IndirectDrawBuffer::Batch>& batches() const
+    {
+        return batches_;
+    }
+
+    uint32_t parts_count() const
+    {
+        return parts_count_;
+    }
+
+    uint32_t max_draw_count() const
+    {
+        return max_draw_count_;
+    }
+
+    const Buffer& commands_buffer(uint32_t frame_index) const
+    {
+        return frames_[frame_index].commands;
+    }
+private:
+    struct Frame
+    {
+        Buffer lods;
+        Buffer occlusion;
+        Buffer commands;
+        // of the batches followed by the frustum visible parts
+        Buffer counts;
+        Buffer readback;
+        VkDescriptorSet descriptor_set;
+
+        Frame() :
+            descriptor_set(VK_NULL_HANDLE)
+        {}
+    };
+
+    void destroy_frames(VulkanContext& context);
+
+    ComputePipeline pipeline_;
+    VkDescriptorSetLayout descriptor_set_layout_;
+    Buffer parts_;
+    std::vector<Frame> frames_;
+    std::vector<IndirectDrawBuffer::Batch> batches_;
+    const TransformBuffer* transforms_;
+    const DepthPyramid* depth_pyramid_;
+    uint32_t parts_count_;
+    uint32_t objects_count_;
+    uint32_t max_draw_count_;
+    bool async_compute_;
+    GPUInterface gpu_iface_;
+};
+
 VkResult init_vulkan_context(VulkanContext& context, const char* appname, uint32_t width, uint32_t height, bool enable_default_debug_layers);
 void destroy_vulkan_context(VulkanContext& context);
 
+// submits the pending Buffer/ImageView uploads, call it once per frame before the rendering submit
+VkResult flush_uploads(VulkanContext& context);
+
 bool app_message_loop(VulkanContext& context);
 
 void init_fullscreen_viewport(VkViewport& viewport, const VulkanContext& context);
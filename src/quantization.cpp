@@ -0,0 +1,130 @@
+#include "quantization.hpp"
+
+#include <cstring>
+#include <cmath>
+
+namespace mhe {
+
+uint16_t float_to_half(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(float));
+
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const uint32_t exponent = (bits >> 23) & 0xff;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    // NaN stays NaN, infinity stays infinity
+    if (exponent == 0xff)
+        return static_cast<uint16_t>(sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0));
+
+    const int32_t half_exponent = static_cast<int32_t>(exponent) - 127 + 15;
+    if (half_exponent >= 31)
+        return static_cast<uint16_t>(sign | 0x7c00);
+
+    if (half_exponent <= 0)
+    {
+        // denormals, anything below the half of the smallest one is zero
+        if (half_exponent < -10)
+            return static_cast<uint16_t>(sign);
+        mantissa |= 0x800000;
+        const uint32_t shift = static_cast<uint32_t>(14 - half_exponent);
+        uint32_t half_mantissa = mantissa >> shift;
+        const uint32_t remainder = mantissa & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half_mantissa & 1)))
+            ++half_mantissa;
+        return static_cast<uint16_t>(sign | half_mantissa);
+    }
+
+    uint32_t half = sign | (static_cast<uint32_t>(half_exponent) << 10) | (mantissa >> 13);
+    const uint32_t remainder = mantissa & 0x1fff;
+    // a carry from the mantissa correctly increments the exponent, up to infinity
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+        ++half;
+    return static_cast<uint16_t>(half);
+}
+
+float half_to_float(uint16_t value)
+{
+    const uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+    const uint32_t exponent = (value >> 10) & 0x1f;
+    uint32_t mantissa = value & 0x3ff;
+
+    uint32_t bits;
+    if (exponent == 0x1f)
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    else if (exponent != 0)
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    else if (mantissa == 0)
+        bits = sign;
+    else
+    {
+        // normalize the denormal
+        uint32_t e = 127 - 15 + 1;
+        while ((mantissa & 0x400) == 0)
+        {
+            mantissa <<= 1;
+            --e;
+        }
+        bits = sign | (e << 23) | ((mantissa & 0x3ff) << 13);
+    }
+
+    float res;
+    memcpy(&res, &bits, sizeof(float));
+    return res;
+}
+
+namespace {
+
+int32_t quantize_snorm(float value, float max)
+{
+    value = value < -1.0f ? -1.0f : (value > 1.0f ? 1.0f : value);
+    return static_cast<int32_t>(std::floor(value * max + 0.5f));
+}
+
+float dequantize_snorm(int32_t value, float max)
+{
+    const float res = static_cast<float>(value) / max;
+    return res < -1.0f ? -1.0f : res;
+}
+
+int32_t sign_extend(uint32_t value, uint32_t bits)
+{
+    const uint32_t shift = 32 - bits;
+    return static_cast<int32_t>(value << shift) >> shift;
+}
+
+}
+
+uint32_t pack_snorm_a2b10g10r10(float x, float y, float z, float w)
+{
+    return (static_cast<uint32_t>(quantize_snorm(x, 511.0f)) & 0x3ff) |
+        ((static_cast<uint32_t>(quantize_snorm(y, 511.0f)) & 0x3ff) << 10) |
+        ((static_cast<uint32_t>(quantize_snorm(z, 511.0f)) & 0x3ff) << 20) |
+        ((static_cast<uint32_t>(quantize_snorm(w, 1.0f)) & 0x3) << 30);
+}
+
+void unpack_snorm_a2b10g10r10(uint32_t value, float& x, float& y, float& z, float& w)
+{
+    x = dequantize_snorm(sign_extend(value & 0x3ff, 10), 511.0f);
+    y = dequantize_snorm(sign_extend((value >> 10) & 0x3ff, 10), 511.0f);
+    z = dequantize_snorm(sign_extend((value >> 20) & 0x3ff, 10), 511.0f);
+    w = dequantize_snorm(sign_extend(value >> 30, 2), 1.0f);
+}
+
+PositionQuantization compute_position_quantization(const float* min, const float* max)
+{
+    PositionQuantization res;
+    float extent = 0.0f;
+    for (int i = 0; i < 3; ++i)
+    {
+        res.offset[i] = min[i];
+        extent = max[i] - min[i] > extent ? max[i] - min[i] : extent;
+    }
+    // a degenerate mesh still gets a valid scale
+    res.scale = extent > 0.0f ? extent : 1.0f;
+    return res;
+}
+
+}
@@ -0,0 +1,41 @@
+#ifndef __QUANTIZATION_HPP__
+#define __QUANTIZATION_HPP__
+
+#include <cstdint>
+
+namespace mhe {
+
+// IEEE 754 binary16, round to nearest even, overflow goes to infinity
+uint16_t float_to_half(float value);
+float half_to_float(uint16_t value);
+
+// [0, 1] to VK_FORMAT_*_UNORM
+inline uint16_t quantize_unorm16(float value)
+{
+    value = value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+    return static_cast<uint16_t>(value * 65535.0f + 0.5f);
+}
+
+// [-1, 1] to VK_FORMAT_A2B10G10R10_SNORM_PACK32, x goes to the lowest bits
+uint32_t pack_snorm_a2b10g10r10(float x, float y, float z, float w);
+void unpack_snorm_a2b10g10r10(uint32_t value, float& x, float& y, float& z, float& w);
+
+// Maps positions into [0, 1]^3 as (p - offset) / scale. The scale is the same for all the axes,
+// so the dequantization matrix keeps the normals' directions.
+struct PositionQuantization
+{
+    float offset[3];
+    float scale;
+
+    PositionQuantization()
+    {
+        offset[0] = offset[1] = offset[2] = 0.0f;
+        scale = 1.0f;
+    }
+};
+
+PositionQuantization compute_position_quantization(const float* min, const float* max);
+
+}
+
+#endif
@@ -0,0 +1,525 @@
+#include "rendergraph.hpp"
+
+#include <algorithm>
+
+namespace mhe {
+namespace vk {
+
+namespace {
+
+struct UsageInfo
+{
+    VkPipelineStageFlags stages;
+    VkAccessFlags access;
+    VkImageLayout layout;
+};
+
+const UsageInfo usage_infos[RenderGraph::usages_count] =
+{
+    // color attachment
+    { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL },
+    // depth attachment
+    { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL },
+    // depth read, the render passes use the attachment layout for the depth
+    { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL },
+    // sampled
+    { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
+    // depth sampled
+    { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL },
+    // compute sampled
+    { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
+    // storage read
+    { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL },
+    // storage write
+    { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL },
+    // indirect
+    { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED },
+    // vertex input
+    { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED },
+    // transfer source
+    { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL },
+    // transfer destination
+    { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL },
+    // present, the semaphore signaled by the submit makes the writes available to the presentation engine
+    { VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR }
+};
+
+const VkAccessFlags write_access_mask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT |
+    VK_ACCESS_MEMORY_WRITE_BIT;
+
+bool has_lazy_memory(const VkPhysicalDeviceMemoryProperties& memory_properties, uint32_t memory_type_bits)
+{
+    for (uint32_t i = 0; i < memory_properties.memoryTypeCount; ++i)
+    {
+        if ((memory_type_bits & (1 << i)) &&
+            (memory_properties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT))
+            return true;
+    }
+    return false;
+}
+
+bool overlap(VkDeviceSize begin0, VkDeviceSize end0, VkDeviceSize begin1, VkDeviceSize end1)
+{
+    return begin0 < end1 && begin1 < end0;
+}
+
+}
+
+RenderGraph::Resource RenderGraph::import_image(const char* name, VkImage image, VkImageAspectFlags aspect,
+    VkImageLayout layout, bool transient)
+{
+    ResourceData resource = {};
+    resource.name = name;
+    resource.image = image;
+    resource.buffer = VK_NULL_HANDLE;
+    resource.aspect = aspect;
+    resource.layout = layout;
+    resource.first_pass = invalid;
+    resource.last_pass = invalid;
+    resource.transient = transient;
+    resource.is_image = true;
+    resources_.push_back(resource);
+    return static_cast<Resource>(resources_.size() - 1);
+}
+
+RenderGraph::Resource RenderGraph::import_buffer(const char* name, VkBuffer buffer)
+{
+    ResourceData resource = {};
+    resource.name = name;
+    resource.image = VK_NULL_HANDLE;
+    resource.buffer = buffer;
+    resource.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    resource.first_pass = invalid;
+    resource.last_pass = invalid;
+    resources_.push_back(resource);
+    return static_cast<Resource>(resources_.size() - 1);
+}
+
+RenderGraph::Resource RenderGraph::create_image(const char* name, const ImageView::Settings& settings)
+{
+    const Resource resource = import_image(name, VK_NULL_HANDLE, settings.aspect_mask, VK_IMAGE_LAYOUT_UNDEFINED, true);
+    resources_[resource].created = true;
+    resources_[resource].image_settings = settings;
+    return resource;
+}
+
+RenderGraph::Resource RenderGraph::create_buffer(const char* name, VkDeviceSize size, VkBufferUsageFlags usage)
+{
+    const Resource resource = import_buffer(name, VK_NULL_HANDLE);
+    resources_[resource].created = true;
+    resources_[resource].transient = true;
+    resources_[resource].buffer_size = size;
+    resources_[resource].buffer_usage = usage;
+    return resource;
+}
+
+void RenderGraph::set_image(Resource resource, VkImage image, VkImageLayout layout, VkPipelineStageFlags stages)
+{
+    ResourceData& data = resources_[resource];
+    data.image = image;
+    data.layout = layout;
+    // the image is ready in these stages, there is nothing to make visible
+    data.write_stages = stages;
+    data.write_access = 0;
+    data.read_stages = 0;
+    data.visible_stages = 0;
+    data.visible_access = 0;
+}
+
+void RenderGraph::set_output(Resource resource)
+{
+    resources_[resource].output = true;
+}
+
+RenderGraph::Pass RenderGraph::add_pass(const char* name, const RecordFunction& record)
+{
+    PassData pass;
+    pass.name = name;
+    pass.record = record;
+    pass.culled = false;
+    passes_.push_back(pass);
+    return static_cast<Pass>(passes_.size() - 1);
+}
+
+void RenderGraph::read(Pass pass, Resource resource, Usage usage)
+{
+    add_access(pass, resource, usage, VK_IMAGE_LAYOUT_UNDEFINED, false);
+}
+
+void RenderGraph::write(Pass pass, Resource resource, Usage usage, VkImageLayout final_layout)
+{
+    add_access(pass, resource, usage, final_layout, true);
+}
+
+void RenderGraph::add_access(Pass pass, Resource resource, Usage usage, VkImageLayout final_layout, bool write)
+{
+    std::vector<Access>& accesses = passes_[pass].accesses;
+    for (const Access& access : accesses)
+    {
+        ASSERT(access.resource != resource, "A pass can use a resource only once");
+    }
+
+    Access access;
+    access.resource = resource;
+    access.usage = usage;
+    access.final_layout = final_layout;
+    access.write = write;
+    accesses.push_back(access);
+}
+
+void RenderGraph::compile()
+{
+    // walk back from the outputs, a pass is needed when it writes something read by a needed pass
+    std::vector<bool> needed(resources_.size(), false);
+    for (size_t i = 0, size = resources_.size(); i < size; ++i)
+        needed[i] = resources_[i].output;
+
+    for (size_t i = passes_.size(); i > 0; --i)
+    {
+        PassData& pass = passes_[i - 1];
+        pass.culled = true;
+        for (const Access& access : pass.accesses)
+        {
+            // the passes reading the outputs, e.g. to present them, have side effects too
+            if (needed[access.resource] && (access.write || resources_[access.resource].output))
+                pass.culled = false;
+        }
+        if (pass.culled)
+            continue;
+        for (const Access& access : pass.accesses)
+        {
+            if (!access.write)
+                needed[access.resource] = true;
+        }
+    }
+
+    for (ResourceData& resource : resources_)
+    {
+        resource.first_pass = invalid;
+        resource.last_pass = invalid;
+    }
+    for (size_t i = 0, size = passes_.size(); i < size; ++i)
+    {
+        if (passes_[i].culled)
+            continue;
+        for (const Access& access : passes_[i].accesses)
+        {
+            ResourceData& resource = resources_[access.resource];
+            if (resource.first_pass == invalid)
+                resource.first_pass = static_cast<Pass>(i);
+            resource.last_pass = static_cast<Pass>(i);
+        }
+    }
+}
+
+bool RenderGraph::lazy_candidate(Resource resource) const
+{
+    const ResourceData& data = resources_[resource];
+    if (!data.is_image || data.first_pass == invalid || data.first_pass != data.last_pass)
+        return false;
+    // transient images may only have the attachment usages
+    const VkImageUsageFlags attachment_usages = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+        VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+    if ((data.image_settings.usage & ~attachment_usages) != 0)
+        return false;
+    // the contents of the attachments used by one pass never have to leave the tile memory
+    for (const Access& access : passes_[data.first_pass].accesses)
+    {
+        if (access.resource == resource && access.usage != usage_color_attachment && access.usage != usage_depth_attachment &&
+            access.usage != usage_depth_read)
+            return false;
+    }
+    return true;
+}
+
+void RenderGraph::place(Heap heap)
+{
+    std::vector<Resource> order;
+    for (size_t i = 0, size = resources_.size(); i < size; ++i)
+    {
+        if (resources_[i].created && resources_[i].first_pass != invalid && resources_[i].heap == heap)
+            order.push_back(static_cast<Resource>(i));
+    }
+    // the largest first, the smaller ones fill the gaps
+    std::sort(order.begin(), order.end(), [this](Resource a, Resource b)
+    {
+        return resources_[a].requirements.size > resources_[b].requirements.size;
+    });
+
+    VkMemoryRequirements& requirements = heap_requirements_[heap];
+    requirements.size = 0;
+    requirements.alignment = 1;
+    requirements.memoryTypeBits = ~0u;
+    for (size_t i = 0, size = order.size(); i < size; ++i)
+    {
+        ResourceData& resource = resources_[order[i]];
+        // the lowest offset free of the placed resources alive at the same time
+        VkDeviceSize offset = 0;
+        for (bool moved = true; moved;)
+        {
+            moved = false;
+            for (size_t j = 0; j < i; ++j)
+            {
+                const ResourceData& placed = resources_[order[j]];
+                if (resource.first_pass <= placed.last_pass && placed.first_pass <= resource.last_pass &&
+                    overlap(offset, offset + resource.requirements.size, placed.offset, placed.offset + placed.requirements.size))
+                {
+                    offset = align_up(placed.offset + placed.requirements.size, resource.requirements.alignment);
+                    moved = true;
+                }
+            }
+        }
+        resource.offset = offset;
+        requirements.size = std::max(requirements.size, offset + resource.requirements.size);
+        requirements.alignment = std::max(requirements.alignment, resource.requirements.alignment);
+        requirements.memoryTypeBits &= resource.requirements.memoryTypeBits;
+
+        for (size_t j = 0; j < i; ++j)
+        {
+            ResourceData& placed = resources_[order[j]];
+            if (overlap(offset, offset + resource.requirements.size, placed.offset, placed.offset + placed.requirements.size))
+            {
+                resource.aliases.push_back(order[j]);
+                placed.aliases.push_back(order[i]);
+            }
+        }
+    }
+}
+
+VkResult RenderGraph::allocate(VulkanContext& context, const GPUInterface& gpu_iface)
+{
+    gpu_iface_ = gpu_iface;
+    const VkDevice device = gpu_iface.device->id();
+    const VkPhysicalDeviceMemoryProperties& memory_properties = gpu_iface.device->physical_device()->memory_properties();
+
+    unaliased_memory_size_ = 0;
+    for (size_t i = 0, size = resources_.size(); i < size; ++i)
+    {
+        ResourceData& resource = resources_[i];
+        if (!resource.created || resource.first_pass == invalid)
+            continue;
+        resource.aliases.clear();
+
+        if (resource.is_image)
+        {
+            const ImageView::Settings& settings = resource.image_settings;
+            VkExtent3D extent = {settings.width, settings.height, settings.depth};
+            ImageCreateInfo create_info(VK_IMAGE_TYPE_2D, settings.format, extent, settings.mip_levels, settings.array_layers,
+                VK_SAMPLE_COUNT_1_BIT, settings.usage, settings.sharing_mode);
+            create_info.queueFamilyIndexCount = settings.queue_family_indices_count;
+            create_info.pQueueFamilyIndices = settings.queue_family_indices;
+            if (lazy_candidate(static_cast<Resource>(i)) && has_lazy_memory(memory_properties, ~0u))
+                create_info.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+            VK_VERIFY(vkCreateImage(device, create_info.c_struct(), context.allocation_callbacks, &resource.image));
+            vkGetImageMemoryRequirements(device, resource.image, &resource.requirements);
+            resource.heap = (create_info.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) &&
+                has_lazy_memory(memory_properties, resource.requirements.memoryTypeBits) ? heap_lazy_images : heap_images;
+        }
+        else
+        {
+            VkBufferCreateInfo create_info = {};
+            create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            create_info.size = resource.buffer_size;
+            create_info.usage = resource.buffer_usage;
+            create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            VK_VERIFY(vkCreateBuffer(device, &create_info, context.allocation_callbacks, &resource.buffer));
+            vkGetBufferMemoryRequirements(device, resource.buffer, &resource.requirements);
+            resource.heap = heap_buffers;
+        }
+        unaliased_memory_size_ += resource.requirements.size;
+    }
+
+    for (uint32_t i = 0; i < heaps_count; ++i)
+    {
+        const Heap heap = static_cast<Heap>(i);
+        place(heap);
+        const VkMemoryRequirements& requirements = heap_requirements_[heap];
+        if (requirements.size == 0)
+            continue;
+        VERIFY(requirements.memoryTypeBits != 0, "The transient resources don't have a common memory type", VK_ERROR_FEATURE_NOT_PRESENT);
+        const VkMemoryPropertyFlags properties = heap == heap_lazy_images ?
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        VK_VERIFY(context.memory_allocator.allocate(context, requirements, properties,
+            heap == heap_buffers ? MemoryAllocator::resource_linear : MemoryAllocator::resource_optimal,
+            MemoryAllocator::usage_persistent, heaps_[heap]));
+    }
+
+    for (ResourceData& resource : resources_)
+    {
+        if (!resource.created || resource.first_pass == invalid)
+            continue;
+        const MemoryAllocation& allocation = heaps_[resource.heap];
+        if (resource.is_image)
+        {
+            VK_VERIFY(vkBindImageMemory(device, resource.image, allocation.memory, allocation.offset + resource.offset));
+            VK_VERIFY(resource.view.init(context, gpu_iface, resource.image_settings, resource.image, nullptr, 0));
+        }
+        else
+            VK_VERIFY(vkBindBufferMemory(device, resource.buffer, allocation.memory, allocation.offset + resource.offset));
+    }
+
+    return VK_SUCCESS;
+}
+
+void RenderGraph::destroy(VulkanContext& context)
+{
+    for (ResourceData& resource : resources_)
+    {
+        if (!resource.created || resource.first_pass == invalid)
+            continue;
+        if (resource.is_image)
+        {
+            // the view doesn't own the image
+            resource.view.destroy(context);
+            vkDestroyImage(gpu_iface_.device->id(), resource.image, context.allocation_callbacks);
+            resource.image = VK_NULL_HANDLE;
+        }
+        else
+        {
+            vkDestroyBuffer(gpu_iface_.device->id(), resource.buffer, context.allocation_callbacks);
+            resource.buffer = VK_NULL_HANDLE;
+        }
+    }
+    for (uint32_t i = 0; i < heaps_count; ++i)
+    {
+        context.memory_allocator.free(context, heaps_[i]);
+        heaps_[i] = MemoryAllocation();
+    }
+}
+
+void RenderGraph::execute(CommandBuffer& command_buffer)
+{
+    barriers_count_ = 0;
+    image_barriers_count_ = 0;
+    for (ResourceData& resource : resources_)
+        resource.used = false;
+
+    for (PassData& pass : passes_)
+    {
+        if (pass.culled)
+            continue;
+
+        // all the barriers of the pass go into one vkCmdPipelineBarrier
+        VkPipelineStageFlags src_stages = 0;
+        VkPipelineStageFlags dst_stages = 0;
+        image_barriers_.clear();
+        buffer_barriers_.clear();
+        for (const Access& access : pass.accesses)
+        {
+            ResourceData& resource = resources_[access.resource];
+            const UsageInfo& info = usage_infos[access.usage];
+            const bool image = resource.is_image;
+            const VkImageLayout layout = image && info.layout != VK_IMAGE_LAYOUT_UNDEFINED ? info.layout : resource.layout;
+            const bool discard = resource.transient && !resource.used && access.write;
+            const bool layout_change = image && layout != resource.layout;
+            resource.used = true;
+
+            VkPipelineStageFlags barrier_src_stages = 0;
+            VkAccessFlags src_access = 0;
+            if (access.write || layout_change)
+            {
+                // after the previous write and the reads of it, the reads need only the execution dependency
+                barrier_src_stages = resource.write_stages | resource.read_stages;
+                src_access = resource.write_access;
+                // and after the last use of the resources sharing the memory
+                if (discard)
+                {
+                    for (Resource alias : resource.aliases)
+                    {
+                        barrier_src_stages |= resources_[alias].write_stages | resources_[alias].read_stages;
+                        src_access |= resources_[alias].write_access;
+                    }
+                }
+            }
+            else if ((info.stages & ~resource.visible_stages) != 0 || (info.access & ~resource.visible_access) != 0)
+            {
+                // a read of the last write, the reads of the same stages after a barrier don't need another one
+                barrier_src_stages = resource.write_stages;
+                src_access = resource.write_access;
+            }
+
+            const bool barrier = layout_change || barrier_src_stages != 0;
+            if (barrier)
+            {
+                src_stages |= barrier_src_stages;
+                dst_stages |= info.stages;
+                if (image)
+                {
+                    VkImageMemoryBarrier image_barrier = {};
+                    image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+                    image_barrier.srcAccessMask = src_access;
+                    image_barrier.dstAccessMask = info.access;
+                    image_barrier.oldLayout = discard ? VK_IMAGE_LAYOUT_UNDEFINED : resource.layout;
+                    image_barrier.newLayout = layout;
+                    image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                    image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                    image_barrier.image = resource.image;
+                    image_barrier.subresourceRange.aspectMask = resource.aspect;
+                    image_barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+                    image_barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+                    image_barriers_.push_back(image_barrier);
+                }
+                else
+                {
+                    VkBufferMemoryBarrier buffer_barrier = {};
+                    buffer_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+                    buffer_barrier.srcAccessMask = src_access;
+                    buffer_barrier.dstAccessMask = info.access;
+                    buffer_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                    buffer_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                    buffer_barrier.buffer = resource.buffer;
+                    buffer_barrier.size = VK_WHOLE_SIZE;
+                    buffer_barriers_.push_back(buffer_barrier);
+                }
+            }
+
+            if (access.write || layout_change)
+            {
+                // a layout transition is a write too, it's visible only to the stages of this pass
+                resource.write_stages = info.stages;
+                resource.write_access = access.write ? info.access & write_access_mask : 0;
+                resource.read_stages = access.write ? 0 : info.stages;
+                resource.visible_stages = info.stages;
+                resource.visible_access = info.access;
+            }
+            else
+            {
+                resource.read_stages |= info.stages;
+                if (barrier)
+                {
+                    resource.visible_stages |= info.stages;
+                    resource.visible_access |= info.access;
+                }
+            }
+            resource.layout = image && access.final_layout != VK_IMAGE_LAYOUT_UNDEFINED ? access.final_layout : layout;
+        }
+
+        if (!image_barriers_.empty() || !buffer_barriers_.empty())
+        {
+            command_buffer.pipeline_barrier(
+                src_stages != 0 ? src_stages : static_cast<VkPipelineStageFlags>(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT), dst_stages,
+                buffer_barriers_.empty() ? nullptr : &buffer_barriers_[0], static_cast<uint32_t>(buffer_barriers_.size()),
+                image_barriers_.empty() ? nullptr : &image_barriers_[0], static_cast<uint32_t>(image_barriers_.size()));
+            ++barriers_count_;
+            image_barriers_count_ += static_cast<uint32_t>(image_barriers_.size());
+        }
+
+        if (pass.record)
+            pass.record(command_buffer);
+    }
+}
+
+void RenderGraph::clear()
+{
+    passes_.clear();
+    resources_.clear();
+}
+
+}
+}
@@ -0,0 +1,224 @@
+#ifndef __RENDERGRAPH_HPP__
+#define __RENDERGRAPH_HPP__
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <limits>
+#include <cstdint>
+
+#include "mhevk.hpp"
+
+namespace mhe {
+namespace vk {
+
+// Passes declare how they use the images and buffers of the frame, the graph culls the passes whose results aren't
+// used and records the others with the barriers they need. The states of the resources persist between
+// the executions, so the accesses of the consecutive frames are ordered too.
+// The transient resources created by the graph share the memory with the ones that aren't alive at the same time.
+class RenderGraph
+{
+public:
+    typedef uint32_t Resource;
+    typedef uint32_t Pass;
+    typedef std::function<void(CommandBuffer&)> RecordFunction;
+
+    enum Usage
+    {
+        usage_color_attachment,
+        usage_depth_attachment,
+        // the depth test without writes
+        usage_depth_read,
+        usage_sampled,
+        usage_depth_sampled,
+        usage_compute_sampled,
+        usage_storage_read,
+        usage_storage_write,
+        usage_indirect,
+        usage_vertex_input,
+        usage_transfer_src,
+        usage_transfer_dst,
+        usage_present,
+        usages_count
+    };
+
+    static const uint32_t invalid = std::numeric_limits<uint32_t>::max();
+
+    RenderGraph() :
+        barriers_count_(0),
+        image_barriers_count_(0),
+        unaliased_memory_size_(0)
+    {}
+
+    // The contents of the transient images don't survive between the executions, their first writer in a frame
+    // transitions them from the undefined layout.
+    Resource import_image(const char* name, VkImage image, VkImageAspectFlags aspect,
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED, bool transient = false);
+    Resource import_buffer(const char* name, VkBuffer buffer);
+    // Transient resources owned by the graph, they are created by allocate(). Their contents don't survive between
+    // the executions, the images used only as the attachments of one pass get the lazily allocated memory if there is one.
+    Resource create_image(const char* name, const ImageView::Settings& settings);
+    Resource create_buffer(const char* name, VkDeviceSize size, VkBufferUsageFlags usage);
+    // Resets the state for the next execution, e.g. of a swapchain image after acquiring it. The stages are the ones
+    // the image is available in, the wait stage of the semaphore.
+    void set_image(Resource resource, VkImage image, VkImageLayout layout, VkPipelineStageFlags stages);
+    // the passes contributing to the outputs are never culled
+    void set_output(Resource resource);
+
+    // the record function is called between the barriers, it begins and ends its render pass itself
+    Pass add_pass(const char* name, const RecordFunction& record);
+    void read(Pass pass, Resource resource, Usage usage);
+    // final_layout is the one the pass leaves the image in, the final layout of its render pass
+    void write(Pass pass, Resource resource, Usage usage, VkImageLayout final_layout = VK_IMAGE_LAYOUT_UNDEFINED);
+
+    // culls the passes and finds the lifetimes of the resources
+    void compile();
+    // after compile(), places the created resources with the disjoint lifetimes at the same memory
+    VkResult allocate(VulkanContext& context, const GPUInterface& gpu_iface);
+    void destroy(VulkanContext& context);
+    void execute(CommandBuffer& command_buffer);
+    void clear();
+
+    bool culled(Pass pass) const
+    {
+        return passes_[pass].culled;
+    }
+
+    const char* name(Pass pass) const
+    {
+        return passes_[pass].name.c_str();
+    }
+
+    // the first and the last pass using the resource, invalid if it isn't used
+    Pass first_pass(Resource resource) const
+    {
+        return resources_[resource].first_pass;
+    }
+
+    Pass last_pass(Resource resource) const
+    {
+        return resources_[resource].last_pass;
+    }
+
+    // of the created resources, the unused ones have none
+    const ImageView& image_view(Resource resource) const
+    {
+        return resources_[resource].view;
+    }
+
+    VkBuffer buffer(Resource resource) const
+    {
+        return resources_[resource].buffer;
+    }
+
+    // the memory of the created resources with and without the aliasing, the lazily allocated one included
+    VkDeviceSize transient_memory_size() const
+    {
+        VkDeviceSize size = 0;
+        for (uint32_t i = 0; i < heaps_count; ++i)
+            size += heaps_[i].size;
+        return size;
+    }
+
+    VkDeviceSize unaliased_memory_size() const
+    {
+        return unaliased_memory_size_;
+    }
+
+    VkDeviceSize lazy_memory_size() const
+    {
+        return heaps_[heap_lazy_images].size;
+    }
+
+    // of the last execution
+    uint32_t barriers_count() const
+    {
+        return barriers_count_;
+    }
+
+    uint32_t image_barriers_count() const
+    {
+        return image_barriers_count_;
+    }
+private:
+    // the images and the buffers don't share the memory because of bufferImageGranularity
+    enum Heap
+    {
+        heap_images,
+        heap_lazy_images,
+        heap_buffers,
+        heaps_count
+    };
+
+    struct Access
+    {
+        Resource resource;
+        Usage usage;
+        VkImageLayout final_layout;
+        bool write;
+    };
+
+    struct PassData
+    {
+        std::string name;
+        RecordFunction record;
+        std::vector<Access> accesses;
+        bool culled;
+    };
+
+    struct ResourceData
+    {
+        std::string name;
+        VkImage image;
+        VkBuffer buffer;
+        VkImageAspectFlags aspect;
+        VkImageLayout layout;
+        // of the last write, the previous writes are complete
+        VkPipelineStageFlags write_stages;
+        VkAccessFlags write_access;
+        // since the last write
+        VkPipelineStageFlags read_stages;
+        // the last write is visible to these stages and accesses
+        VkPipelineStageFlags visible_stages;
+        VkAccessFlags visible_access;
+        Pass first_pass;
+        Pass last_pass;
+        bool transient;
+        bool output;
+        // in the current execution
+        bool used;
+
+        // the created ones
+        bool created;
+        bool is_image;
+        ImageView::Settings image_settings;
+        ImageView view;
+        VkDeviceSize buffer_size;
+        VkBufferUsageFlags buffer_usage;
+        VkMemoryRequirements requirements;
+        Heap heap;
+        VkDeviceSize offset;
+        // the created resources sharing the memory, the first use waits for their last one
+        std::vector<Resource> aliases;
+    };
+
+    void add_access(Pass pass, Resource resource, Usage usage, VkImageLayout final_layout, bool write);
+    bool lazy_candidate(Resource resource) const;
+    void place(Heap heap);
+
+    std::vector<PassData> passes_;
+    std::vector<ResourceData> resources_;
+    std::vector<VkImageMemoryBarrier> image_barriers_;
+    std::vector<VkBufferMemoryBarrier> buffer_barriers_;
+    uint32_t barriers_count_;
+    uint32_t image_barriers_count_;
+    MemoryAllocation heaps_[heaps_count];
+    VkMemoryRequirements heap_requirements_[heaps_count];
+    GPUInterface gpu_iface_;
+    VkDeviceSize unaliased_memory_size_;
+};
+
+}
+}
+
+#endif
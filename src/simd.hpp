@@ -0,0 +1,294 @@
+#ifndef __SIMD_HPP__
+#define __SIMD_HPP__
+
+// Minimal 4-wide float abstraction used by the math code. SSE2 is the baseline on x86,
+// AVX is used where it helps when the compiler targets it, NEON is used on AArch64.
+// Define MHE_NO_SIMD to force the scalar fallback.
+#if defined(MHE_NO_SIMD)
+#define MHE_SIMD_SCALAR
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MHE_SIMD_SSE
+#include <emmintrin.h>
+#if defined(__AVX__)
+#define MHE_SIMD_AVX
+#include <immintrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define MHE_SIMD_NEON
+#include <arm_neon.h>
+#else
+#define MHE_SIMD_SCALAR
+#endif
+
+#if defined(MHE_SIMD_SCALAR)
+#include <cmath>
+#endif
+
+namespace mhe {
+namespace simd {
+
+#if defined(MHE_SIMD_SSE)
+
+typedef __m128 float4;
+
+// pointers must be 16 bytes aligned
+inline float4 load(const float* p)
+{
+    return _mm_load_ps(p);
+}
+
+inline void store(float* p, float4 v)
+{
+    _mm_store_ps(p, v);
+}
+
+inline float4 set(float x, float y, float z, float w)
+{
+    return _mm_setr_ps(x, y, z, w);
+}
+
+inline float4 splat(float v)
+{
+    return _mm_set1_ps(v);
+}
+
+inline float4 add(float4 a, float4 b)
+{
+    return _mm_add_ps(a, b);
+}
+
+inline float4 sub(float4 a, float4 b)
+{
+    return _mm_sub_ps(a, b);
+}
+
+inline float4 mul(float4 a, float4 b)
+{
+    return _mm_mul_ps(a, b);
+}
+
+inline float4 div(float4 a, float4 b)
+{
+    return _mm_div_ps(a, b);
+}
+
+inline float4 min(float4 a, float4 b)
+{
+    return _mm_min_ps(a, b);
+}
+
+inline float x(float4 v)
+{
+    return _mm_cvtss_f32(v);
+}
+
+// bit i is the sign bit of the lane i
+inline int sign_mask(float4 v)
+{
+    return _mm_movemask_ps(v);
+}
+
+// (a[i0], a[i1], b[i2], b[i3])
+template <int i0, int i1, int i2, int i3>
+inline float4 shuffle(float4 a, float4 b)
+{
+    return _mm_shuffle_ps(a, b, _MM_SHUFFLE(i3, i2, i1, i0));
+}
+
+#elif defined(MHE_SIMD_NEON)
+
+typedef float32x4_t float4;
+
+inline float4 load(const float* p)
+{
+    return vld1q_f32(p);
+}
+
+inline void store(float* p, float4 v)
+{
+    vst1q_f32(p, v);
+}
+
+inline float4 set(float x, float y, float z, float w)
+{
+    const float v[4] = { x, y, z, w };
+    return vld1q_f32(v);
+}
+
+inline float4 splat(float v)
+{
+    return vdupq_n_f32(v);
+}
+
+inline float4 add(float4 a, float4 b)
+{
+    return vaddq_f32(a, b);
+}
+
+inline float4 sub(float4 a, float4 b)
+{
+    return vsubq_f32(a, b);
+}
+
+inline float4 mul(float4 a, float4 b)
+{
+    return vmulq_f32(a, b);
+}
+
+inline float4 div(float4 a, float4 b)
+{
+    return vdivq_f32(a, b);
+}
+
+inline float4 min(float4 a, float4 b)
+{
+    return vminq_f32(a, b);
+}
+
+inline float x(float4 v)
+{
+    return vgetq_lane_f32(v, 0);
+}
+
+inline int sign_mask(float4 v)
+{
+    const uint32x4_t sign = vshrq_n_u32(vreinterpretq_u32_f32(v), 31);
+    return static_cast<int>(vgetq_lane_u32(sign, 0) | (vgetq_lane_u32(sign, 1) << 1) |
+        (vgetq_lane_u32(sign, 2) << 2) | (vgetq_lane_u32(sign, 3) << 3));
+}
+
+template <int i0, int i1, int i2, int i3>
+inline float4 shuffle(float4 a, float4 b)
+{
+    float4 res = vdupq_n_f32(vgetq_lane_f32(a, i0));
+    res = vsetq_lane_f32(vgetq_lane_f32(a, i1), res, 1);
+    res = vsetq_lane_f32(vgetq_lane_f32(b, i2), res, 2);
+    return vsetq_lane_f32(vgetq_lane_f32(b, i3), res, 3);
+}
+
+#else
+
+struct float4
+{
+    float v[4];
+};
+
+inline float4 load(const float* p)
+{
+    float4 res = {{ p[0], p[1], p[2], p[3] }};
+    return res;
+}
+
+inline void store(float* p, float4 v)
+{
+    p[0] = v.v[0]; p[1] = v.v[1]; p[2] = v.v[2]; p[3] = v.v[3];
+}
+
+inline float4 set(float x, float y, float z, float w)
+{
+    float4 res = {{ x, y, z, w }};
+    return res;
+}
+
+inline float4 splat(float v)
+{
+    return set(v, v, v, v);
+}
+
+inline float4 add(float4 a, float4 b)
+{
+    return set(a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]);
+}
+
+inline float4 sub(float4 a, float4 b)
+{
+    return set(a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]);
+}
+
+inline float4 mul(float4 a, float4 b)
+{
+    return set(a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]);
+}
+
+inline float4 div(float4 a, float4 b)
+{
+    return set(a.v[0] / b.v[0], a.v[1] / b.v[1], a.v[2] / b.v[2], a.v[3] / b.v[3]);
+}
+
+inline float4 min(float4 a, float4 b)
+{
+    return set(a.v[0] < b.v[0] ? a.v[0] : b.v[0], a.v[1] < b.v[1] ? a.v[1] : b.v[1],
+        a.v[2] < b.v[2] ? a.v[2] : b.v[2], a.v[3] < b.v[3] ? a.v[3] : b.v[3]);
+}
+
+inline float x(float4 v)
+{
+    return v.v[0];
+}
+
+inline int sign_mask(float4 v)
+{
+    return (std::signbit(v.v[0]) ? 1 : 0) | (std::signbit(v.v[1]) ? 2 : 0) | (std::signbit(v.v[2]) ? 4 : 0) |
+        (std::signbit(v.v[3]) ? 8 : 0);
+}
+
+template <int i0, int i1, int i2, int i3>
+inline float4 shuffle(float4 a, float4 b)
+{
+    return set(a.v[i0], a.v[i1], b.v[i2], b.v[i3]);
+}
+
+#endif
+
+// helpers built on top of the backend primitives
+
+template <int i0, int i1, int i2, int i3>
+inline float4 swizzle(float4 v)
+{
+    return shuffle<i0, i1, i2, i3>(v, v);
+}
+
+template <int i>
+inline float4 broadcast(float4 v)
+{
+    return shuffle<i, i, i, i>(v, v);
+}
+
+// a * b + c
+inline float4 madd(float4 a, float4 b, float4 c)
+{
+#if defined(MHE_SIMD_NEON)
+    return vfmaq_f32(c, a, b);
+#else
+    return add(mul(a, b), c);
+#endif
+}
+
+// sum of all lanes in every lane
+inline float4 hsum(float4 v)
+{
+    float4 t = add(v, swizzle<1, 0, 3, 2>(v));
+    return add(t, swizzle<2, 3, 0, 1>(t));
+}
+
+inline float dot(float4 a, float4 b)
+{
+    return x(hsum(mul(a, b)));
+}
+
+inline void transpose(float4& r0, float4& r1, float4& r2, float4& r3)
+{
+    float4 t0 = shuffle<0, 1, 0, 1>(r0, r1);
+    float4 t1 = shuffle<2, 3, 2, 3>(r0, r1);
+    float4 t2 = shuffle<0, 1, 0, 1>(r2, r3);
+    float4 t3 = shuffle<2, 3, 2, 3>(r2, r3);
+    r0 = shuffle<0, 2, 0, 2>(t0, t2);
+    r1 = shuffle<1, 3, 1, 3>(t0, t2);
+    r2 = shuffle<0, 2, 0, 2>(t1, t3);
+    r3 = shuffle<1, 3, 1, 3>(t1, t3);
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,237 @@
+#include "transforms.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace mhe {
+
+void TransformArray::resize(uint32_t size)
+{
+    const uint32_t old_size = std::min(size_, size);
+    const uint32_t capacity = (size + 3) & ~3u;
+    if (capacity != capacity_)
+    {
+        std::vector<vec4> storage(components_count * capacity / 4);
+        for (uint32_t c = 0; c < components_count; ++c)
+        {
+            if (old_size > 0)
+                memcpy(&storage[c * capacity / 4], &storage_[c * capacity_ / 4], old_size * sizeof(float));
+        }
+        storage_.swap(storage);
+        capacity_ = capacity;
+    }
+    size_ = size;
+
+    // the padding is initialized too, the SIMD code processes it along with the real objects
+    for (uint32_t i = old_size; i < capacity_; ++i)
+    {
+        set(i, vec3(), vec4(0.0f, 0.0f, 0.0f, 1.0f), vec3(1.0f, 1.0f, 1.0f));
+        set_local(i, vec3(), 1.0f);
+    }
+}
+
+void TransformArray::set(uint32_t index, const vec3& position, const vec4& rotation, const vec3& scale)
+{
+    set_position(index, position);
+    set_rotation(index, rotation);
+    set_component(scale_x, index, scale.x);
+    set_component(scale_y, index, scale.y);
+    set_component(scale_z, index, scale.z);
+}
+
+void TransformArray::set_position(uint32_t index, const vec3& position)
+{
+    set_component(position_x, index, position.x);
+    set_component(position_y, index, position.y);
+    set_component(position_z, index, position.z);
+}
+
+void TransformArray::set_rotation(uint32_t index, const vec4& rotation)
+{
+    set_component(rotation_x, index, rotation.x);
+    set_component(rotation_y, index, rotation.y);
+    set_component(rotation_z, index, rotation.z);
+    set_component(rotation_w, index, rotation.w);
+}
+
+void TransformArray::set_local(uint32_t index, const vec3& offset, float scale)
+{
+    set_component(local_offset_x, index, offset.x);
+    set_component(local_offset_y, index, offset.y);
+    set_component(local_offset_z, index, offset.z);
+    set_component(local_scale, index, scale);
+}
+
+mat4x4 TransformArray::world(uint32_t index) const
+{
+    const float x = component(rotation_x)[index];
+    const float y = component(rotation_y)[index];
+    const float z = component(rotation_z)[index];
+    const float w = component(rotation_w)[index];
+    const float sx = component(scale_x)[index];
+    const float sy = component(scale_y)[index];
+    const float sz = component(scale_z)[index];
+
+    const float ox = component(local_offset_x)[index];
+    const float oy = component(local_offset_y)[index];
+    const float oz = component(local_offset_z)[index];
+    const float ls = component(local_scale)[index];
+
+    // scale * rotation
+    const float r[3][3] =
+    {
+        { sx * (1.0f - 2.0f * (y * y + z * z)), sx * 2.0f * (x * y + z * w), sx * 2.0f * (x * z - y * w) },
+        { sy * 2.0f * (x * y - z * w), sy * (1.0f - 2.0f * (x * x + z * z)), sy * 2.0f * (y * z + x * w) },
+        { sz * 2.0f * (x * z + y * w), sz * 2.0f * (y * z - x * w), sz * (1.0f - 2.0f * (x * x + y * y)) }
+    };
+    float t[3] = { component(position_x)[index], component(position_y)[index], component(position_z)[index] };
+    for (int j = 0; j < 3; ++j)
+        t[j] += ox * r[0][j] + oy * r[1][j] + oz * r[2][j];
+
+    // local * scale * rotation * translation for the row vectors
+    mat4x4 m;
+    m.set(ls * r[0][0], ls * r[0][1], ls * r[0][2], 0.0f,
+        ls * r[1][0], ls * r[1][1], ls * r[1][2], 0.0f,
+        ls * r[2][0], ls * r[2][1], ls * r[2][2], 0.0f,
+        t[0], t[1], t[2], 1.0f);
+    return m;
+}
+
+namespace {
+
+// columns of 4 objects to the rows of every object
+void transpose_rows(simd::float4 rows[4][4], uint32_t row, simd::float4 c0, simd::float4 c1, simd::float4 c2, simd::float4 c3)
+{
+    simd::transpose(c0, c1, c2, c3);
+    rows[0][row] = c0;
+    rows[1][row] = c1;
+    rows[2][row] = c2;
+    rows[3][row] = c3;
+}
+
+}
+
+void compute_transforms(uint8_t* dst, uint32_t stride, const TransformArray& transforms, const mat4x4& vp,
+    uint32_t begin, uint32_t end)
+{
+    assert(end <= transforms.size());
+    assert((reinterpret_cast<uintptr_t>(dst) & 15) == 0 && (stride & 15) == 0);
+
+    const float* px = transforms.component(TransformArray::position_x);
+    const float* py = transforms.component(TransformArray::position_y);
+    const float* pz = transforms.component(TransformArray::position_z);
+    const float* qx = transforms.component(TransformArray::rotation_x);
+    const float* qy = transforms.component(TransformArray::rotation_y);
+    const float* qz = transforms.component(TransformArray::rotation_z);
+    const float* qw = transforms.component(TransformArray::rotation_w);
+    const float* sx = transforms.component(TransformArray::scale_x);
+    const float* sy = transforms.component(TransformArray::scale_y);
+    const float* sz = transforms.component(TransformArray::scale_z);
+    const float* ox = transforms.component(TransformArray::local_offset_x);
+    const float* oy = transforms.component(TransformArray::local_offset_y);
+    const float* oz = transforms.component(TransformArray::local_offset_z);
+    const float* ls = transforms.component(TransformArray::local_scale);
+
+    // vp elements are the same for all the objects
+    simd::float4 v[4][4];
+    for (int i = 0; i < 4; ++i)
+    {
+        for (int j = 0; j < 4; ++j)
+            v[i][j] = simd::splat(vp(i, j));
+    }
+
+    const simd::float4 zero = simd::splat(0.0f);
+    const simd::float4 one = simd::splat(1.0f);
+    const simd::float4 two = simd::splat(2.0f);
+
+    // every lane of a register belongs to a different object, 4 objects per iteration
+    for (uint32_t first = begin & ~3u; first < end; first += 4)
+    {
+        const simd::float4 x = simd::load(qx + first);
+        const simd::float4 y = simd::load(qy + first);
+        const simd::float4 z = simd::load(qz + first);
+        const simd::float4 w = simd::load(qw + first);
+        const simd::float4 x2 = simd::mul(x, two);
+        const simd::float4 y2 = simd::mul(y, two);
+        const simd::float4 z2 = simd::mul(z, two);
+        const simd::float4 xx = simd::mul(x, x2);
+        const simd::float4 yy = simd::mul(y, y2);
+        const simd::float4 zz = simd::mul(z, z2);
+        const simd::float4 xy = simd::mul(x, y2);
+        const simd::float4 xz = simd::mul(x, z2);
+        const simd::float4 yz = simd::mul(y, z2);
+        const simd::float4 xw = simd::mul(w, x2);
+        const simd::float4 yw = simd::mul(w, y2);
+        const simd::float4 zw = simd::mul(w, z2);
+
+        // upper 3x3 part of the world matrix, the last column is (0, 0, 0, 1)
+        simd::float4 m[4][3];
+        // the local transform is folded into the scales: row i is local_scale * scale_i * rotation_i,
+        // the translation gets local_offset * scale * rotation
+        const simd::float4 local_scale = simd::load(ls + first);
+        const simd::float4 scale_x = simd::load(sx + first);
+        const simd::float4 scale_y = simd::load(sy + first);
+        const simd::float4 scale_z = simd::load(sz + first);
+        const simd::float4 offset_x = simd::mul(scale_x, simd::load(ox + first));
+        const simd::float4 offset_y = simd::mul(scale_y, simd::load(oy + first));
+        const simd::float4 offset_z = simd::mul(scale_z, simd::load(oz + first));
+        simd::float4 rot[3][3];
+        rot[0][0] = simd::sub(one, simd::add(yy, zz));
+        rot[0][1] = simd::add(xy, zw);
+        rot[0][2] = simd::sub(xz, yw);
+        rot[1][0] = simd::sub(xy, zw);
+        rot[1][1] = simd::sub(one, simd::add(xx, zz));
+        rot[1][2] = simd::add(yz, xw);
+        rot[2][0] = simd::add(xz, yw);
+        rot[2][1] = simd::sub(yz, xw);
+        rot[2][2] = simd::sub(one, simd::add(xx, yy));
+        const simd::float4 row_scale[3] = { simd::mul(local_scale, scale_x), simd::mul(local_scale, scale_y),
+            simd::mul(local_scale, scale_z) };
+        for (uint32_t j = 0; j < 3; ++j)
+        {
+            for (uint32_t i = 0; i < 3; ++i)
+                m[i][j] = simd::mul(row_scale[i], rot[i][j]);
+        }
+        m[3][0] = simd::load(px + first);
+        m[3][1] = simd::load(py + first);
+        m[3][2] = simd::load(pz + first);
+        for (uint32_t j = 0; j < 3; ++j)
+        {
+            m[3][j] = simd::madd(offset_x, rot[0][j], m[3][j]);
+            m[3][j] = simd::madd(offset_y, rot[1][j], m[3][j]);
+            m[3][j] = simd::madd(offset_z, rot[2][j], m[3][j]);
+        }
+
+        simd::float4 world[4][4];
+        simd::float4 wvp[4][4];
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            transpose_rows(world, i, m[i][0], m[i][1], m[i][2], i == 3 ? one : zero);
+
+            simd::float4 r[4];
+            for (uint32_t j = 0; j < 4; ++j)
+            {
+                r[j] = i == 3 ? v[3][j] : zero;
+                r[j] = simd::madd(m[i][0], v[0][j], r[j]);
+                r[j] = simd::madd(m[i][1], v[1][j], r[j]);
+                r[j] = simd::madd(m[i][2], v[2][j], r[j]);
+            }
+            transpose_rows(wvp, i, r[0], r[1], r[2], r[3]);
+        }
+
+        // whole objects are written sequentially, write-combined memory gets full cache lines
+        for (uint32_t k = 0; k < 4; ++k)
+        {
+            const uint32_t index = first + k;
+            if (index < begin || index >= end)
+                continue;
+            float* object = reinterpret_cast<float*>(dst + index * stride);
+            for (uint32_t i = 0; i < 4; ++i)
+                simd::store(object + i * 4, world[k][i]);
+            for (uint32_t i = 0; i < 4; ++i)
+                simd::store(object + 16 + i * 4, wvp[k][i]);
+        }
+    }
+}
+
+}
@@ -0,0 +1,94 @@
+#ifndef __TRANSFORMS_HPP__
+#define __TRANSFORMS_HPP__
+
+#include <vector>
+#include <cstdint>
+
+#include "mhemath.hpp"
+
+namespace mhe {
+
+// Positions, rotations and scales of many objects in structure of arrays layout, every component
+// is a separate array padded to a multiple of 4, so 4 objects fit into one SIMD register.
+class TransformArray
+{
+public:
+    enum Component
+    {
+        position_x,
+        position_y,
+        position_z,
+        // rotation quaternion
+        rotation_x,
+        rotation_y,
+        rotation_z,
+        rotation_w,
+        scale_x,
+        scale_y,
+        scale_z,
+        // object space transform applied before the scale, e.g. dequantization of the vertex positions
+        local_offset_x,
+        local_offset_y,
+        local_offset_z,
+        local_scale,
+        components_count
+    };
+
+    TransformArray() :
+        size_(0), capacity_(0)
+    {}
+
+    // new objects get the identity transform
+    void resize(uint32_t size);
+
+    uint32_t size() const
+    {
+        return size_;
+    }
+
+    // 16 bytes aligned array of size() elements
+    float* component(Component c)
+    {
+        return &storage_[c * capacity_ / 4].x;
+    }
+
+    const float* component(Component c) const
+    {
+        return &storage_[c * capacity_ / 4].x;
+    }
+
+    void set(uint32_t index, const vec3& position, const vec4& rotation, const vec3& scale);
+    void set_position(uint32_t index, const vec3& position);
+    void set_rotation(uint32_t index, const vec4& rotation);
+    // p * local_scale + local_offset
+    void set_local(uint32_t index, const vec3& offset, float scale);
+
+    // scalar version of the world matrix computed by compute_transforms()
+    mat4x4 world(uint32_t index) const;
+private:
+    void set_component(Component c, uint32_t index, float value)
+    {
+        component(c)[index] = value;
+    }
+
+    std::vector<vec4> storage_;
+    uint32_t size_;
+    uint32_t capacity_;
+};
+
+// per-object data written by compute_transforms()
+struct ObjectTransform
+{
+    mat4x4 world;
+    mat4x4 wvp;
+};
+
+// Computes world and world * vp matrices for the objects in [begin, end) and writes them as ObjectTransform
+// to dst + index * stride, dst is usually a mapped GPU buffer. dst must be 16 bytes aligned and stride a multiple of 16.
+// Different ranges can be computed by different threads.
+void compute_transforms(uint8_t* dst, uint32_t stride, const TransformArray& transforms, const mat4x4& vp,
+    uint32_t begin, uint32_t end);
+
+}
+
+#endif